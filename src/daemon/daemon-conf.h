@@ -75,7 +75,8 @@ typedef struct pa_daemon_conf {
         log_time,
         flat_volumes,
         lock_memory,
-        deferred_volume;
+        deferred_volume,
+        scache_mmap;
     pa_server_type_t local_server_type;
     int exit_idle_time,
         scache_idle_time,
@@ -0,0 +1,73 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "adrian-aec-nlms.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <immintrin.h>
+
+static float dotp_avx(const float *w, const float *x, unsigned n) {
+    unsigned j;
+    float sum;
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m128 acc;
+
+    /* Two accumulators to hide the latency of the additions */
+    for (j = 0; j < n; j += 16) {
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_load_ps(w + j), _mm256_loadu_ps(x + j)));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_load_ps(w + j + 8), _mm256_loadu_ps(x + j + 8)));
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+
+    acc = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+    _mm_store_ss(&sum, acc);
+
+    return sum;
+}
+
+static void update_avx(float *w, const float *x, float mikro_ef, unsigned n) {
+    unsigned j;
+    __m256 m = _mm256_set1_ps(mikro_ef);
+
+    for (j = 0; j < n; j += 16) {
+        _mm256_store_ps(w + j, _mm256_add_ps(_mm256_load_ps(w + j), _mm256_mul_ps(m, _mm256_loadu_ps(x + j))));
+        _mm256_store_ps(w + j + 8, _mm256_add_ps(_mm256_load_ps(w + j + 8), _mm256_mul_ps(m, _mm256_loadu_ps(x + j + 8))));
+    }
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void AEC_nlms_init_avx(pa_cpu_x86_flag_t flags, AEC_dotp_func_t *dotp, AEC_update_func_t *update) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized NLMS functions.");
+
+        *dotp = dotp_avx;
+        *update = update_avx;
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
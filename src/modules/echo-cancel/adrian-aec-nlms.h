@@ -0,0 +1,46 @@
+#ifndef fooadrianaecnlmshfoo
+#define fooadrianaecnlmshfoo
+
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulsecore/cpu-x86.h>
+
+/* The inner loops of the NLMS filter in adrian-aec.c, of which there are
+ * vector implementations for several instruction sets.
+ *
+ * The tap weights w are 32 byte aligned, the (pre-whitened) tap delayed
+ * loudspeaker signal x is not, as the filter slides over it. n is always a
+ * multiple of 16. */
+
+/* Return the dot product of w and x */
+typedef float (*AEC_dotp_func_t) (const float *w, const float *x, unsigned n);
+
+/* w += mikro_ef * x, i.e. the filter learning step */
+typedef void (*AEC_update_func_t) (float *w, const float *x, float mikro_ef, unsigned n);
+
+/* These replace *dotp and *update if the CPU supports the instruction set */
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+void AEC_nlms_init_sse(pa_cpu_x86_flag_t flags, AEC_dotp_func_t *dotp, AEC_update_func_t *update);
+#endif
+#ifdef HAVE_AVX2
+void AEC_nlms_init_avx(pa_cpu_x86_flag_t flags, AEC_dotp_func_t *dotp, AEC_update_func_t *update);
+#endif
+#endif
+
+#endif
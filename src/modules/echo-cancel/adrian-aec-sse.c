@@ -0,0 +1,69 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "adrian-aec-nlms.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <xmmintrin.h>
+
+static float dotp_sse(const float *w, const float *x, unsigned n) {
+    /* This is taken from speex's inner product implementation */
+    unsigned j;
+    float sum;
+    __m128 acc = _mm_setzero_ps();
+
+    for (j = 0; j < n; j += 8) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(w + j), _mm_loadu_ps(x + j)));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(w + j + 4), _mm_loadu_ps(x + j + 4)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+    _mm_store_ss(&sum, acc);
+
+    return sum;
+}
+
+static void update_sse(float *w, const float *x, float mikro_ef, unsigned n) {
+    unsigned j;
+    __m128 m = _mm_set1_ps(mikro_ef);
+
+    for (j = 0; j < n; j += 8) {
+        _mm_store_ps(w + j, _mm_add_ps(_mm_load_ps(w + j), _mm_mul_ps(m, _mm_loadu_ps(x + j))));
+        _mm_store_ps(w + j + 4, _mm_add_ps(_mm_load_ps(w + j + 4), _mm_mul_ps(m, _mm_loadu_ps(x + j + 4))));
+    }
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void AEC_nlms_init_sse(pa_cpu_x86_flag_t flags, AEC_dotp_func_t *dotp, AEC_update_func_t *update) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_SSE) {
+        pa_log_info("Initialising SSE optimized NLMS functions.");
+
+        *dotp = dotp_sse;
+        *update = update_sse;
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -30,17 +30,116 @@
 #include "adrian-aec-orc-gen.h"
 #endif
 
-#ifdef __SSE__
-#include <xmmintrin.h>
+/* Double-Talk Detector
+ *
+ * in d: microphone sample (PCM as REALing point value)
+ * in x: loudspeaker sample (PCM as REALing point value)
+ * return: from 0 for doubletalk to 1.0 for single talk
+ */
+static float AEC_dtd(AEC *a, REAL d, REAL x);
+
+static void AEC_leaky(AEC *a);
+
+/* Normalized Least Mean Square Algorithm pre-whitening (NLMS-pw)
+ * The LMS algorithm was developed by Bernard Widrow
+ * book: Haykin, Adaptive Filter Theory, 4. edition, Prentice Hall, 2002
+ *
+ * in d: microphone sample (16bit PCM value)
+ * in x_: loudspeaker sample (16bit PCM value)
+ * in stepsize: NLMS adaptation variable
+ * return: echo cancelled microphone sample
+ */
+static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize);
+
+static  IIR_HP* IIR_HP_init(void) {
+    IIR_HP *i = pa_xnew(IIR_HP, 1);
+    i->x = 0.0f;
+    return i;
+  }
+
+static  REAL IIR_HP_highpass(IIR_HP *i, REAL in) {
+    const REAL a0 = 0.01f;      /* controls Transfer Frequency */
+    /* Highpass = Signal - Lowpass. Lowpass = Exponential Smoothing */
+    i->x += a0 * (in - i->x);
+    return in - i->x;
+  }
+
+static  FIR_HP_300Hz* FIR_HP_300Hz_init(void) {
+    FIR_HP_300Hz *ret = pa_xnew(FIR_HP_300Hz, 1);
+    memset(ret, 0, sizeof(FIR_HP_300Hz));
+    return ret;
+  }
+
+static  REAL FIR_HP_300Hz_highpass(FIR_HP_300Hz *f, REAL in) {
+    REAL sum0 = 0.0, sum1 = 0.0;
+    int j;
+    const REAL a[36] = {
+      // Kaiser Window FIR Filter, Filter type: High pass
+      // Passband: 150.0 - 4000.0 Hz, Order: 34
+      // Transition band: 34.0 Hz, Stopband attenuation: 10.0 dB
+      -0.016165324, -0.017454365, -0.01871232, -0.019931411,
+      -0.021104068, -0.022222936, -0.02328091, -0.024271343,
+      -0.025187887, -0.02602462, -0.026776174, -0.027437767,
+      -0.028004972, -0.028474221, -0.028842418, -0.029107114,
+      -0.02926664, 0.8524841, -0.02926664, -0.029107114,
+      -0.028842418, -0.028474221, -0.028004972, -0.027437767,
+      -0.026776174, -0.02602462, -0.025187887, -0.024271343,
+      -0.02328091, -0.022222936, -0.021104068, -0.019931411,
+      -0.01871232, -0.017454365, -0.016165324, 0.0
+    };
+    memmove(f->z + 1, f->z, 35 * sizeof(REAL));
+    f->z[0] = in;
+
+    for (j = 0; j < 36; j += 2) {
+      // optimize: partial loop unrolling
+      sum0 += a[j] * f->z[j];
+      sum1 += a[j + 1] * f->z[j + 1];
+    }
+    return sum0 + sum1;
+  }
+
+static  IIR1* IIR1_init(REAL Fc) {
+    IIR1 *i = pa_xnew(IIR1, 1);
+    i->b1 = expf(-2.0f * M_PI * Fc);
+    i->a0 = (1.0f + i->b1) / 2.0f;
+    i->a1 = -(i->a0);
+    i->in0 = 0.0f;
+    i->out0 = 0.0f;
+    return i;
+  }
+
+static  REAL IIR1_highpass(IIR1 *i, REAL in) {
+    REAL out = i->a0 * in + i->a1 * i->in0 + i->b1 * i->out0;
+    i->in0 = in;
+    i->out0 = out;
+    return out;
+  }
+
+PA_GCC_UNUSED static  float AEC_getambient(AEC *a) {
+    return a->dfast;
+  }
+static  void AEC_setambient(AEC *a, float Min_xf) {
+    a->dotp_xf_xf -= a->delta;  // subtract old delta
+    a->delta = (NLMS_LEN-1) * Min_xf * Min_xf;
+    a->dotp_xf_xf += a->delta;  // add new delta
+  }
+PA_GCC_UNUSED static  void AEC_setgain(AEC *a, float gain_) {
+    a->gain = gain_;
+  }
+#if 0
+  void AEC_openwdisplay(AEC *a);
 #endif
+PA_GCC_UNUSED static  void AEC_setaes(AEC *a, float aes_y2_) {
+    a->aes_y2 = aes_y2_;
+  }
 
 /* Vector Dot Product */
-static REAL dotp(REAL a[], REAL b[])
+static REAL dotp(const REAL a[], const REAL b[], unsigned n)
 {
   REAL sum0 = 0.0f, sum1 = 0.0f;
-  int j;
+  unsigned j;
 
-  for (j = 0; j < NLMS_LEN; j += 2) {
+  for (j = 0; j < n; j += 2) {
     // optimize: partial loop unrolling
     sum0 += a[j] * b[j];
     sum1 += a[j + 1] * b[j + 1];
@@ -48,31 +147,24 @@ static REAL dotp(REAL a[], REAL b[])
   return sum0 + sum1;
 }
 
-static REAL dotp_sse(REAL a[], REAL b[])
+/* Update tap weights (filter learning) */
+static void update(REAL w[], const REAL xf[], REAL mikro_ef, unsigned n)
 {
-#ifdef __SSE__
-  /* This is taken from speex's inner product implementation */
-  int j;
-  REAL sum;
-  __m128 acc = _mm_setzero_ps();
-
-  for (j=0;j<NLMS_LEN;j+=8)
-  {
-    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(a+j), _mm_loadu_ps(b+j)));
-    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(a+j+4), _mm_loadu_ps(b+j+4)));
-  }
-  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
-  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
-  _mm_store_ss(&sum, acc);
+#ifdef DISABLE_ORC
+  unsigned i;
 
-  return sum;
+  for (i = 0; i < n; i += 2) {
+    // optimize: partial loop unrolling
+    w[i] += mikro_ef * xf[i];
+    w[i + 1] += mikro_ef * xf[i + 1];
+  }
 #else
-  return dotp(a, b);
+  update_tap_weights(w, xf, mikro_ef, n);
 #endif
 }
 
 
-AEC* AEC_init(int RATE, int have_vector)
+AEC* AEC_init(int RATE, const pa_cpu_info *cpu_info)
 {
   AEC *a = pa_xnew0(AEC, 1);
   a->j = NLMS_EXT;
@@ -90,14 +182,23 @@ AEC* AEC_init(int RATE, int have_vector)
 
   a->fdwdisplay = -1;
 
-  if (have_vector) {
-      /* Get a 16-byte aligned location */
-      a->w = (REAL *) (((uintptr_t) a->w_arr) - (((uintptr_t) a->w_arr) % 16) + 16);
-      a->dotp = dotp_sse;
-  } else {
-      /* We don't care about alignment, just use the array as-is */
-      a->w = a->w_arr;
-      a->dotp = dotp;
+  /* Get a 32-byte aligned location, as the vector implementations need */
+  a->w = (REAL *) (((uintptr_t) a->w_arr) - (((uintptr_t) a->w_arr) % 32) + 32);
+
+  a->dotp = dotp;
+  a->update = update;
+
+  if (!cpu_info->force_generic_code) {
+#if defined (__i386__) || defined (__amd64__)
+      if (cpu_info->cpu_type == PA_CPU_X86) {
+#ifdef HAVE_SSE2
+          AEC_nlms_init_sse(cpu_info->flags.x86, &a->dotp, &a->update);
+#endif
+#ifdef HAVE_AVX2
+          AEC_nlms_init_avx(cpu_info->flags.x86, &a->dotp, &a->update);
+#endif
+      }
+#endif
   }
 
   return a;
@@ -196,7 +297,7 @@ static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize)
   // (mic signal - estimated mic signal from spk signal)
   e = d;
   if (a->hangover > 0) {
-    e -= a->dotp(a->w, a->x + a->j);
+    e -= a->dotp(a->w, a->x + a->j, NLMS_LEN);
   }
   ef = IIR1_highpass(a->Fe, e);     // pre-whitening of e
 
@@ -207,17 +308,8 @@ static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize)
     // calculate variable step size
     REAL mikro_ef = stepsize * ef / a->dotp_xf_xf;
 
-#ifdef DISABLE_ORC
     // update tap weights (filter learning)
-    int i;
-    for (i = 0; i < NLMS_LEN; i += 2) {
-      // optimize: partial loop unrolling
-      a->w[i] += mikro_ef * a->xf[i + a->j];
-      a->w[i + 1] += mikro_ef * a->xf[i + a->j + 1];
-    }
-#else
-    update_tap_weights(a->w, &a->xf[a->j], mikro_ef, NLMS_LEN);
-#endif
+    a->update(a->w, &a->xf[a->j], mikro_ef, NLMS_LEN);
   }
 
   if (--(a->j) < 0) {
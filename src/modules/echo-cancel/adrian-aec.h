@@ -20,11 +20,15 @@
 #include <pulse/gccmacro.h>
 #include <pulse/xmalloc.h>
 
+#include <pulsecore/cpu.h>
 #include <pulsecore/macro.h>
 
+#include "adrian-aec-nlms.h"
+
 #define WIDEB 2
 
 // use double if your CPU does software-emulation of float
+// (the vector implementations in adrian-aec-nlms.h need float)
 #define REAL float
 
 /* dB Values */
@@ -112,19 +116,6 @@ struct IIR_HP {
   REAL x;
 };
 
-static  IIR_HP* IIR_HP_init(void) {
-    IIR_HP *i = pa_xnew(IIR_HP, 1);
-    i->x = 0.0f;
-    return i;
-  }
-
-static  REAL IIR_HP_highpass(IIR_HP *i, REAL in) {
-    const REAL a0 = 0.01f;      /* controls Transfer Frequency */
-    /* Highpass = Signal - Lowpass. Lowpass = Exponential Smoothing */
-    i->x += a0 * (in - i->x);
-    return in - i->x;
-  }
-
 typedef struct FIR_HP_300Hz FIR_HP_300Hz;
 
 #if WIDEB==1
@@ -177,39 +168,6 @@ struct FIR_HP_300Hz {
   REAL z[36];
 };
 
-static  FIR_HP_300Hz* FIR_HP_300Hz_init(void) {
-    FIR_HP_300Hz *ret = pa_xnew(FIR_HP_300Hz, 1);
-    memset(ret, 0, sizeof(FIR_HP_300Hz));
-    return ret;
-  }
-
-static  REAL FIR_HP_300Hz_highpass(FIR_HP_300Hz *f, REAL in) {
-    REAL sum0 = 0.0, sum1 = 0.0;
-    int j;
-    const REAL a[36] = {
-      // Kaiser Window FIR Filter, Filter type: High pass
-      // Passband: 150.0 - 4000.0 Hz, Order: 34
-      // Transition band: 34.0 Hz, Stopband attenuation: 10.0 dB
-      -0.016165324, -0.017454365, -0.01871232, -0.019931411,
-      -0.021104068, -0.022222936, -0.02328091, -0.024271343,
-      -0.025187887, -0.02602462, -0.026776174, -0.027437767,
-      -0.028004972, -0.028474221, -0.028842418, -0.029107114,
-      -0.02926664, 0.8524841, -0.02926664, -0.029107114,
-      -0.028842418, -0.028474221, -0.028004972, -0.027437767,
-      -0.026776174, -0.02602462, -0.025187887, -0.024271343,
-      -0.02328091, -0.022222936, -0.021104068, -0.019931411,
-      -0.01871232, -0.017454365, -0.016165324, 0.0
-    };
-    memmove(f->z + 1, f->z, 35 * sizeof(REAL));
-    f->z[0] = in;
-
-    for (j = 0; j < 36; j += 2) {
-      // optimize: partial loop unrolling
-      sum0 += a[j] * f->z[j];
-      sum1 += a[j + 1] * f->z[j + 1];
-    }
-    return sum0 + sum1;
-  }
 #endif
 
 typedef struct IIR1 IIR1;
@@ -237,22 +195,6 @@ struct IIR1 {
   }
 #endif
 
-static  IIR1* IIR1_init(REAL Fc) {
-    IIR1 *i = pa_xnew(IIR1, 1);
-    i->b1 = expf(-2.0f * M_PI * Fc);
-    i->a0 = (1.0f + i->b1) / 2.0f;
-    i->a1 = -(i->a0);
-    i->in0 = 0.0f;
-    i->out0 = 0.0f;
-    return i;
-  }
-
-static  REAL IIR1_highpass(IIR1 *i, REAL in) {
-    REAL out = i->a0 * in + i->a1 * i->in0 + i->b1 * i->out0;
-    i->in0 = in;
-    i->out0 = out;
-    return out;
-  }
 
 
 #if 0
@@ -308,8 +250,8 @@ struct AEC {
   // NLMS-pw
   REAL x[NLMS_LEN + NLMS_EXT];  // tap delayed loudspeaker signal
   REAL xf[NLMS_LEN + NLMS_EXT]; // pre-whitening tap delayed signal
-  REAL w_arr[NLMS_LEN + (16 / sizeof(REAL))]; // tap weights
-  REAL *w;                      // this will be a 16-byte aligned pointer into w_arr
+  REAL w_arr[NLMS_LEN + (32 / sizeof(REAL))]; // tap weights
+  REAL *w;                      // this will be a 32-byte aligned pointer into w_arr
   int j;                        // optimize: less memory copies
   double dotp_xf_xf;            // double to avoid loss of precision
   float delta;                  // noise floor to stabilize NLMS
@@ -327,31 +269,11 @@ struct AEC {
   float stepsize;
 
   // vfuncs that are picked based on processor features available
-  REAL (*dotp) (REAL[], REAL[]);
+  AEC_dotp_func_t dotp;
+  AEC_update_func_t update;
 };
 
-/* Double-Talk Detector
- *
- * in d: microphone sample (PCM as REALing point value)
- * in x: loudspeaker sample (PCM as REALing point value)
- * return: from 0 for doubletalk to 1.0 for single talk
- */
-static  float AEC_dtd(AEC *a, REAL d, REAL x);
-
-static  void AEC_leaky(AEC *a);
-
-/* Normalized Least Mean Square Algorithm pre-whitening (NLMS-pw)
- * The LMS algorithm was developed by Bernard Widrow
- * book: Haykin, Adaptive Filter Theory, 4. edition, Prentice Hall, 2002
- *
- * in d: microphone sample (16bit PCM value)
- * in x_: loudspeaker sample (16bit PCM value)
- * in stepsize: NLMS adaptation variable
- * return: echo cancelled microphone sample
- */
-static  REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize);
-
-AEC* AEC_init(int RATE, int have_vector);
+AEC* AEC_init(int RATE, const pa_cpu_info *cpu_info);
 void AEC_done(AEC *a);
 
 /* Acoustic Echo Cancellation and Suppression of one sample
@@ -361,23 +283,5 @@ void AEC_done(AEC *a);
  */
   int AEC_doAEC(AEC *a, int d_, int x_);
 
-PA_GCC_UNUSED static  float AEC_getambient(AEC *a) {
-    return a->dfast;
-  }
-static  void AEC_setambient(AEC *a, float Min_xf) {
-    a->dotp_xf_xf -= a->delta;  // subtract old delta
-    a->delta = (NLMS_LEN-1) * Min_xf * Min_xf;
-    a->dotp_xf_xf += a->delta;  // add new delta
-  }
-PA_GCC_UNUSED static  void AEC_setgain(AEC *a, float gain_) {
-    a->gain = gain_;
-  }
-#if 0
-  void AEC_openwdisplay(AEC *a);
-#endif
-PA_GCC_UNUSED static  void AEC_setaes(AEC *a, float aes_y2_) {
-    a->aes_y2 = aes_y2_;
-  }
-
 #define _AEC_H
 #endif
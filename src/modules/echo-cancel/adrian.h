@@ -21,10 +21,12 @@
     along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <pulsecore/cpu.h>
+
 /* Forward declarations */
 
 typedef struct AEC AEC;
 
-AEC* AEC_init(int RATE, int have_vector);
+AEC* AEC_init(int RATE, const pa_cpu_info *cpu_info);
 void AEC_done(AEC *a);
 int AEC_doAEC(AEC *a, int d_, int x_);
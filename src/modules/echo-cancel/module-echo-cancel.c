@@ -50,6 +50,10 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/ringq.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
 
 #include "module-echo-cancel-symdef.h"
 
@@ -76,6 +80,7 @@ PA_MODULE_USAGE(
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
           "use_master_format=<yes or no> "
+          "aec_thread=<run the canceller in its own thread?> "
         ));
 
 /* NOTE: Make sure the enum and ec_table are maintained in the correct order */
@@ -142,6 +147,10 @@ static const pa_echo_canceller ec_table[] = {
 #define DEFAULT_SAVE_AEC false
 #define DEFAULT_AUTOLOADED false
 #define DEFAULT_USE_MASTER_FORMAT false
+#define DEFAULT_AEC_THREAD false
+
+/* How many blocks may be queued up for and by the canceller thread */
+#define AEC_THREAD_BLOCKS 4
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
@@ -176,6 +185,12 @@ static const pa_echo_canceller ec_table[] = {
  *    be before capture and the difference should not be bigger than one frame
  *    size. We would ideally like to resample the sink_input but most driver
  *    don't give enough accuracy to be able to do that right now.
+ *
+ * With aec_thread=yes the canceller itself runs in a thread of its own: the
+ * source I/O thread only copies fixed sized blocks of capture and playback
+ * data into lock-free queues, and posts the blocks the canceller thread
+ * hands back through a third queue. This adds the time the blocks spend in
+ * these queues to the latency of the source, which is reported as such.
  */
 
 struct userdata;
@@ -254,6 +269,32 @@ struct userdata {
     struct {
         pa_cvolume current_volume;
     } thread_info;
+
+    /* Only used with aec_thread=yes */
+    struct {
+        pa_thread *thread;
+        pa_semaphore *semaphore;
+        bool quit;
+
+        /* So that the canceller can talk to the main thread */
+        pa_thread_mq thread_mq;
+        pa_rtpoll *rtpoll;
+
+        /* Written by the source I/O thread, read by the canceller thread */
+        pa_ringq *capture_q, *play_q;
+        /* Written by the canceller thread, read by the source I/O thread */
+        pa_ringq *out_q;
+
+        /* The capture volume each block in capture_q was recorded at, in
+         * the same order. The canceller's gain control must not look at
+         * thread_info, which belongs to the source I/O thread. */
+        pa_volume_t volumes[AEC_THREAD_BLOCKS];
+        unsigned volumes_write, volumes_read;
+        /* The one of the block being cancelled, canceller thread only */
+        pa_volume_t current_volume;
+
+        pa_atomic_t cancelled_posted;
+    } worker;
 };
 
 static void source_output_snapshot_within_thread(struct userdata *u, struct snapshot *snapshot);
@@ -277,6 +318,7 @@ static const char* const valid_modargs[] = {
     "autoloaded",
     "use_volume_sharing",
     "use_master_format",
+    "aec_thread",
     NULL
 };
 
@@ -284,7 +326,8 @@ enum {
     SOURCE_OUTPUT_MESSAGE_POST = PA_SOURCE_OUTPUT_MESSAGE_MAX,
     SOURCE_OUTPUT_MESSAGE_REWIND,
     SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT,
-    SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME
+    SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME,
+    SOURCE_OUTPUT_MESSAGE_CANCELLED
 };
 
 enum {
@@ -421,6 +464,12 @@ static int source_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t
                 /* and the buffering we do on the source */
                 pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec);
 
+            /* and the blocks queued up for and by the canceller thread */
+            if (u->worker.thread)
+                *((pa_usec_t*) data) +=
+                    pa_bytes_to_usec(pa_ringq_get_length(u->worker.capture_q), &u->source_output->sample_spec) +
+                    pa_bytes_to_usec(pa_ringq_get_length(u->worker.out_q), &u->source->sample_spec);
+
             return 0;
 
         case PA_SOURCE_MESSAGE_SET_VOLUME_SYNCED:
@@ -864,6 +913,170 @@ static void do_push(struct userdata *u) {
     }
 }
 
+/* Pass on the blocks the canceller thread has finished.
+ *
+ * Called from source I/O thread context. */
+static void post_cancelled(struct userdata *u) {
+    pa_memchunk chunk, cchunk;
+
+    pa_atomic_store(&u->worker.cancelled_posted, 0);
+
+    while (pa_ringq_peek_fixed_size(u->worker.out_q, u->source_blocksize, &chunk) >= 0) {
+
+        /* The queue's memory is reused, so the source gets a copy */
+        cchunk.index = 0;
+        cchunk.length = u->source_blocksize;
+        cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
+        pa_memchunk_memcpy(&cchunk, &chunk);
+
+        pa_memblock_unref(chunk.memblock);
+        pa_ringq_drop(u->worker.out_q, u->source_blocksize);
+
+        pa_source_post(u->source, &cchunk);
+        pa_memblock_unref(cchunk.memblock);
+    }
+}
+
+/* Like do_push(), but only hand the blocks over to the canceller thread
+ * instead of running the canceller here.
+ *
+ * Called from source I/O thread context. */
+static void do_push_thread(struct userdata *u) {
+    size_t rlen, plen;
+    pa_memchunk rchunk, pchunk, cchunk;
+
+    post_cancelled(u);
+
+    rlen = pa_memblockq_get_length(u->source_memblockq);
+    plen = pa_memblockq_get_length(u->sink_memblockq);
+
+    while (rlen >= u->source_output_blocksize) {
+
+        /* take fixed blocks from recorded and played samples */
+        pa_memblockq_peek_fixed_size(u->source_memblockq, u->source_output_blocksize, &rchunk);
+        pa_memblockq_peek_fixed_size(u->sink_memblockq, u->sink_blocksize, &pchunk);
+
+        /* we ran out of played data and pchunk has been filled with silence bytes */
+        if (plen < u->sink_blocksize)
+            pa_memblockq_seek(u->sink_memblockq, u->sink_blocksize - plen, PA_SEEK_RELATIVE, true);
+
+        /* Both queues always hold the same number of blocks, so checking
+         * one of them is enough. The free space can only grow behind our
+         * back. */
+        if (pa_ringq_get_capacity(u->worker.capture_q) - pa_ringq_get_length(u->worker.capture_q) >= u->source_output_blocksize) {
+            /* Before the block itself, which makes it visible */
+            u->worker.volumes[u->worker.volumes_write++ % AEC_THREAD_BLOCKS] = pa_cvolume_avg(&u->thread_info.current_volume);
+            pa_ringq_push(u->worker.capture_q, &rchunk);
+            pa_ringq_push(u->worker.play_q, &pchunk);
+        } else {
+            /* The canceller can't keep up, keep the source going with
+             * silence rather than blocking */
+            pa_log_debug("Canceller thread overrun, dropping %lu bytes of capture data.", (unsigned long) u->source_output_blocksize);
+
+            pa_silence_memchunk_get(&u->source->core->silence_cache, u->source->core->mempool, &cchunk,
+                                    &u->source->sample_spec, u->source_blocksize);
+            pa_source_post(u->source, &cchunk);
+            pa_memblock_unref(cchunk.memblock);
+        }
+
+        /* drop consumed source samples */
+        pa_memblockq_drop(u->source_memblockq, u->source_output_blocksize);
+        pa_memblock_unref(rchunk.memblock);
+        rlen -= u->source_output_blocksize;
+
+        /* drop consumed sink samples */
+        pa_memblockq_drop(u->sink_memblockq, u->sink_blocksize);
+        pa_memblock_unref(pchunk.memblock);
+
+        if (plen >= u->sink_blocksize)
+            plen -= u->sink_blocksize;
+        else
+            plen = 0;
+    }
+
+    if (pa_ringq_get_length(u->worker.capture_q) > 0)
+        pa_semaphore_post(u->worker.semaphore);
+}
+
+/* Called from the canceller thread. */
+static void worker_thread_func(void *userdata) {
+    struct userdata *u = userdata;
+    pa_memchunk rchunk, pchunk;
+    uint8_t *rdata, *pdata, *cdata;
+    size_t length;
+    bool cancelled;
+    int unused PA_GCC_UNUSED;
+
+    pa_assert(u);
+
+    pa_log_debug("Canceller thread starting up");
+
+    pa_thread_mq_install(&u->worker.thread_mq);
+
+    if (u->core->realtime_scheduling)
+        pa_make_realtime(u->core->realtime_priority);
+
+    for (;;) {
+        pa_semaphore_wait(u->worker.semaphore);
+
+        if (u->worker.quit)
+            break;
+
+        cancelled = false;
+
+        while (pa_ringq_get_length(u->worker.capture_q) >= u->source_output_blocksize) {
+
+            /* The source I/O thread hasn't picked up our output yet, we'll
+             * be woken up again when it queues more data */
+            cdata = pa_ringq_begin_write(u->worker.out_q, &length);
+            if (length < u->source_blocksize)
+                break;
+
+            pa_assert_se(pa_ringq_peek_fixed_size(u->worker.capture_q, u->source_output_blocksize, &rchunk) >= 0);
+            pa_assert_se(pa_ringq_peek_fixed_size(u->worker.play_q, u->sink_blocksize, &pchunk) >= 0);
+            u->worker.current_volume = u->worker.volumes[u->worker.volumes_read++ % AEC_THREAD_BLOCKS];
+
+            rdata = pa_memblock_acquire(rchunk.memblock);
+            rdata += rchunk.index;
+            pdata = pa_memblock_acquire(pchunk.memblock);
+            pdata += pchunk.index;
+
+            if (u->save_aec) {
+                if (u->captured_file)
+                    unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
+                if (u->played_file)
+                    unused = fwrite(pdata, 1, u->sink_blocksize, u->played_file);
+            }
+
+            /* perform echo cancellation */
+            u->ec->run(u->ec, rdata, pdata, cdata);
+
+            if (u->save_aec) {
+                if (u->canceled_file)
+                    unused = fwrite(cdata, 1, u->source_blocksize, u->canceled_file);
+            }
+
+            pa_memblock_release(pchunk.memblock);
+            pa_memblock_release(rchunk.memblock);
+            pa_memblock_unref(pchunk.memblock);
+            pa_memblock_unref(rchunk.memblock);
+
+            pa_ringq_drop(u->worker.capture_q, u->source_output_blocksize);
+            pa_ringq_drop(u->worker.play_q, u->sink_blocksize);
+            pa_ringq_end_write(u->worker.out_q, u->source_blocksize);
+
+            cancelled = true;
+        }
+
+        /* Wake up the source I/O thread, unless we already did and it
+         * hasn't got to it yet */
+        if (cancelled && pa_atomic_cmpxchg(&u->worker.cancelled_posted, 0, 1))
+            pa_asyncmsgq_post(u->asyncmsgq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_CANCELLED, NULL, 0, NULL, NULL);
+    }
+
+    pa_log_debug("Canceller thread shutting down");
+}
+
 /* Called from source I/O thread context. */
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
@@ -936,7 +1149,9 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
     }
 
     /* process and push out samples, do drift compensation only if the sink is actually running */
-    if (u->ec->params.drift_compensation && u->sink->thread_info.state == PA_SINK_RUNNING)
+    if (u->worker.thread)
+        do_push_thread(u);
+    else if (u->ec->params.drift_compensation && u->sink->thread_info.state == PA_SINK_RUNNING)
         do_push_drift_comp(u);
     else
         do_push(u);
@@ -1070,6 +1285,14 @@ static int source_output_process_msg_cb(pa_msgobject *obj, int code, void *data,
             apply_diff_time(u, offset);
             return 0;
 
+        case SOURCE_OUTPUT_MESSAGE_CANCELLED:
+            pa_source_output_assert_io_context(u->source_output);
+
+            if (PA_SOURCE_IS_LINKED(u->source->thread_info.state))
+                post_cancelled(u);
+
+            return 0;
+
     }
 
     return pa_source_output_process_msg(obj, code, data, offset, chunk);
@@ -1544,19 +1767,27 @@ static int canceller_process_msg_cb(pa_msgobject *o, int code, void *userdata, i
     return 0;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread context, or the canceller
+ * thread's with aec_thread=yes. In the latter case this is the volume the
+ * block being cancelled was recorded at. */
 pa_volume_t pa_echo_canceller_get_capture_volume(pa_echo_canceller *ec) {
 #ifndef ECHO_CANCEL_TEST
-    return pa_cvolume_avg(&ec->msg->userdata->thread_info.current_volume);
+    struct userdata *u = ec->msg->userdata;
+
+    if (u->worker.capture_q)
+        return u->worker.current_volume;
+
+    return pa_cvolume_avg(&u->thread_info.current_volume);
 #else
     return PA_VOLUME_NORM;
 #endif
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread context, or the canceller
+ * thread's with aec_thread=yes. */
 void pa_echo_canceller_set_capture_volume(pa_echo_canceller *ec, pa_volume_t v) {
 #ifndef ECHO_CANCEL_TEST
-    if (pa_cvolume_avg(&ec->msg->userdata->thread_info.current_volume) != v) {
+    if (pa_echo_canceller_get_capture_volume(ec) != v) {
         pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME, PA_UINT_TO_PTR(v),
                 0, NULL, NULL);
     }
@@ -1653,6 +1884,7 @@ int pa__init(pa_module*m) {
     uint32_t temp;
     uint32_t nframes = 0;
     bool use_master_format;
+    bool aec_thread;
 
     pa_assert(m);
 
@@ -1783,6 +2015,17 @@ int pa__init(pa_module*m) {
     if (u->ec->params.drift_compensation)
         pa_assert(u->ec->set_drift);
 
+    aec_thread = DEFAULT_AEC_THREAD;
+    if (pa_modargs_get_value_boolean(ma, "aec_thread", &aec_thread) < 0) {
+        pa_log("aec_thread= expects a boolean argument");
+        goto fail;
+    }
+
+    if (aec_thread && u->ec->params.drift_compensation) {
+        pa_log("aec_thread is not supported with cancellers that do drift compensation");
+        goto fail;
+    }
+
     /* Create source */
     pa_source_new_data_init(&source_data);
     source_data.driver = __FILE__;
@@ -2010,6 +2253,29 @@ int pa__init(pa_module*m) {
 
     u->thread_info.current_volume = u->source->reference_volume;
 
+    if (aec_thread) {
+        u->worker.current_volume = pa_cvolume_avg(&u->thread_info.current_volume);
+
+        u->worker.capture_q = pa_ringq_new("module-echo-cancel capture_q", u->core->mempool,
+                                           &source_output_ss, AEC_THREAD_BLOCKS * u->source_output_blocksize);
+        u->worker.play_q = pa_ringq_new("module-echo-cancel play_q", u->core->mempool,
+                                        &sink_ss, AEC_THREAD_BLOCKS * u->sink_blocksize);
+        u->worker.out_q = pa_ringq_new("module-echo-cancel out_q", u->core->mempool,
+                                       &source_ss, AEC_THREAD_BLOCKS * u->source_blocksize);
+
+        u->worker.semaphore = pa_semaphore_new(0);
+        u->worker.rtpoll = pa_rtpoll_new();
+        pa_thread_mq_init(&u->worker.thread_mq, u->core->mainloop, u->worker.rtpoll);
+
+        if (!(u->worker.thread = pa_thread_new("echo-cancel", worker_thread_func, u))) {
+            pa_log("Failed to create canceller thread.");
+            goto fail;
+        }
+
+        pa_log_info("Running the canceller in its own thread, this adds up to %0.2f ms of latency.",
+                    (double) pa_bytes_to_usec(2 * AEC_THREAD_BLOCKS * u->source_blocksize, &source_ss) / PA_USEC_PER_MSEC);
+    }
+
     pa_sink_put(u->sink);
     pa_source_put(u->source);
 
@@ -2055,6 +2321,15 @@ void pa__done(pa_module*m) {
     if (u->time_event)
         u->core->mainloop->time_free(u->time_event);
 
+    /* The canceller thread posts to the source output, so it has to be
+     * stopped first. The source I/O thread may go on filling the queues
+     * until the source output is unlinked, but nobody reads them then. */
+    if (u->worker.thread) {
+        u->worker.quit = true;
+        pa_semaphore_post(u->worker.semaphore);
+        pa_thread_free(u->worker.thread);
+    }
+
     if (u->source_output)
         pa_source_output_unlink(u->source_output);
     if (u->sink_input)
@@ -2080,6 +2355,21 @@ void pa__done(pa_module*m) {
     if (u->sink_memblockq)
         pa_memblockq_free(u->sink_memblockq);
 
+    if (u->worker.rtpoll) {
+        pa_thread_mq_done(&u->worker.thread_mq);
+        pa_rtpoll_free(u->worker.rtpoll);
+    }
+
+    if (u->worker.semaphore)
+        pa_semaphore_free(u->worker.semaphore);
+
+    if (u->worker.capture_q)
+        pa_ringq_free(u->worker.capture_q);
+    if (u->worker.play_q)
+        pa_ringq_free(u->worker.play_q);
+    if (u->worker.out_q)
+        pa_ringq_free(u->worker.out_q);
+
     if (u->ec) {
         if (u->ec->done)
             u->ec->done(u->ec);
@@ -60,7 +60,8 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "rate=<sample rate> "
         "channels=<number of channels> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "render_ahead=<render into a shared queue ahead of time instead of on request of the slaves?>");
 
 #define DEFAULT_SINK_NAME "combined"
 
@@ -70,6 +71,9 @@ PA_MODULE_USAGE(
 
 #define BLOCK_USEC (PA_USEC_PER_MSEC * 200)
 
+/* Must be a power of two, so that the ring indexes may wrap around */
+#define RENDER_RING_SLOTS 64
+
 static const char* const valid_modargs[] = {
     "sink_name",
     "sink_properties",
@@ -80,6 +84,7 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "render_ahead",
     NULL
 };
 
@@ -115,6 +120,12 @@ struct output {
 
     pa_memblockq *memblockq;
 
+    /* In render-ahead mode: the index of the next slot of the render
+     * ring this output will read. Only written by the output thread, but
+     * read by the sink thread to know which slots are free again. */
+    pa_atomic_t ring_read_index;
+    pa_atomic_t ring_pull_requested;
+
     /* For communication of the stream latencies to the main thread */
     pa_usec_t total_latency;
 
@@ -153,11 +164,24 @@ struct userdata {
 
     pa_idxset* outputs; /* managed in main context */
 
+    /* In render-ahead mode the sink thread renders on its own clock
+     * into this ring, and every output copies the chunks into its own
+     * memblockq from its own thread, without waiting for the sink
+     * thread. Slots are only reused once all active outputs have read
+     * them. */
+    bool render_ahead;
+    struct {
+        pa_memchunk slots[RENDER_RING_SLOTS];
+        pa_atomic_t write_index;
+        pa_atomic_t render_requested;
+    } ring;
+
     struct {
         PA_LLIST_HEAD(struct output, active_outputs); /* managed in IO thread context */
         pa_atomic_t running;  /* we cache that value here, so that every thread can query it cheaply */
         pa_usec_t timestamp;
         bool in_null_mode;
+        bool in_render_ahead_mode;
         pa_smoother *smoother;
         uint64_t counter;
     } thread_info;
@@ -167,6 +191,7 @@ enum {
     SINK_MESSAGE_ADD_OUTPUT = PA_SINK_MESSAGE_MAX,
     SINK_MESSAGE_REMOVE_OUTPUT,
     SINK_MESSAGE_NEED,
+    SINK_MESSAGE_RENDER_AHEAD,
     SINK_MESSAGE_UPDATE_LATENCY,
     SINK_MESSAGE_UPDATE_MAX_REQUEST,
     SINK_MESSAGE_UPDATE_LATENCY_RANGE
@@ -174,6 +199,7 @@ enum {
 
 enum {
     SINK_INPUT_MESSAGE_POST = PA_SINK_INPUT_MESSAGE_MAX,
+    SINK_INPUT_MESSAGE_PULL_RING,
     SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY
 };
 
@@ -313,6 +339,69 @@ static void process_render_null(struct userdata *u, pa_usec_t now) {
                     pa_bytes_to_usec(u->thread_info.counter, &u->sink->sample_spec) - (u->thread_info.timestamp - now));
 }
 
+/* Called from combine sink I/O thread context */
+static bool render_ring_push(struct userdata *u, size_t length) {
+    struct output *o;
+    pa_memchunk *slot;
+    unsigned w;
+    bool full = false;
+
+    pa_assert(u);
+
+    w = (unsigned) pa_atomic_load(&u->ring.write_index);
+
+    /* Outputs that fall behind by more than half the ring, because their
+     * sink doesn't ask for data right now, are asked to move the data
+     * into their own queue, so that they don't hold up the others. */
+    PA_LLIST_FOREACH(o, u->thread_info.active_outputs) {
+        unsigned r = (unsigned) pa_atomic_load(&o->ring_read_index);
+
+        if (w - r >= RENDER_RING_SLOTS / 2 && pa_atomic_cmpxchg(&o->ring_pull_requested, 0, 1))
+            pa_asyncmsgq_post(o->audio_inq, PA_MSGOBJECT(o->sink_input), SINK_INPUT_MESSAGE_PULL_RING, NULL, 0, NULL, NULL);
+
+        if (w - r >= RENDER_RING_SLOTS)
+            full = true;
+    }
+
+    if (full)
+        return false;
+
+    slot = &u->ring.slots[w % RENDER_RING_SLOTS];
+
+    if (slot->memblock)
+        pa_memblock_unref(slot->memblock);
+
+    pa_sink_render(u->sink, length, slot);
+
+    u->thread_info.counter += slot->length;
+    u->thread_info.timestamp += pa_bytes_to_usec(slot->length, &u->sink->sample_spec);
+
+    /* Make the slot visible to the outputs */
+    pa_atomic_store(&u->ring.write_index, (int) (w + 1));
+
+    return true;
+}
+
+/* Called from combine sink I/O thread context */
+static void process_render_ahead(struct userdata *u, pa_usec_t now) {
+    size_t length;
+
+    pa_assert(u);
+    pa_assert(u->sink->thread_info.state == PA_SINK_RUNNING);
+
+    if (!u->thread_info.in_render_ahead_mode)
+        u->thread_info.timestamp = now;
+
+    /* Render in pieces of half the latency, so that we are woken up
+     * about twice per latency period */
+    length = pa_usec_to_bytes(u->block_usec / 2, &u->sink->sample_spec);
+    length = PA_CLAMP(length, pa_frame_size(&u->sink->sample_spec), u->sink->thread_info.max_request);
+
+    while (u->thread_info.timestamp < now + u->block_usec)
+        if (!render_ring_push(u, length))
+            break;
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -345,9 +434,29 @@ static void thread_func(void *userdata) {
 
             pa_rtpoll_set_timer_absolute(u->rtpoll, u->thread_info.timestamp);
             u->thread_info.in_null_mode = true;
+            u->thread_info.in_render_ahead_mode = false;
+
+        /* In render-ahead mode we keep the ring filled on our own clock,
+         * the outputs never wait for us. */
+        } else if (u->sink->thread_info.state == PA_SINK_RUNNING && u->render_ahead) {
+            pa_usec_t now, next;
+
+            now = pa_rtclock_now();
+
+            process_render_ahead(u, now);
+
+            /* If the ring is full, retry later */
+            next = u->thread_info.timestamp - u->block_usec / 2;
+            if (next <= now)
+                next = now + u->block_usec / 2;
+
+            pa_rtpoll_set_timer_absolute(u->rtpoll, next);
+            u->thread_info.in_null_mode = false;
+            u->thread_info.in_render_ahead_mode = true;
         } else {
             pa_rtpoll_set_timer_disabled(u->rtpoll);
             u->thread_info.in_null_mode = false;
+            u->thread_info.in_render_ahead_mode = false;
         }
 
         /* Hmm, nothing to do. Let's sleep */
@@ -433,6 +542,72 @@ static void request_memblock(struct output *o, size_t length) {
         pa_asyncmsgq_send(o->outq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_NEED, o, (int64_t) length, NULL);
 }
 
+/* Called from I/O thread context */
+static void pull_ring(struct output *o) {
+    struct userdata *u;
+    unsigned r, w;
+    bool opened;
+
+    pa_assert(o);
+    pa_assert_se(u = o->userdata);
+
+    r = (unsigned) pa_atomic_load(&o->ring_read_index);
+    w = (unsigned) pa_atomic_load(&u->ring.write_index);
+
+    if (r == w)
+        return;
+
+    opened = PA_SINK_IS_OPENED(o->sink_input->sink->thread_info.state);
+
+    /* The memblockq takes its own references, so the slots may be
+     * reused by the sink thread as soon as we have moved on */
+    for (; r != w; r++)
+        if (opened)
+            pa_memblockq_push_align(o->memblockq, &u->ring.slots[r % RENDER_RING_SLOTS]);
+
+    if (!opened)
+        pa_memblockq_flush_write(o->memblockq, true);
+
+    pa_atomic_store(&o->ring_read_index, (int) r);
+}
+
+/* Called from I/O thread context */
+static size_t get_ring_length(struct output *o) {
+    struct userdata *u;
+    unsigned r, w;
+    size_t length = 0;
+
+    pa_assert(o);
+    pa_assert_se(u = o->userdata);
+
+    r = (unsigned) pa_atomic_load(&o->ring_read_index);
+    w = (unsigned) pa_atomic_load(&u->ring.write_index);
+
+    for (; r != w; r++)
+        length += u->ring.slots[r % RENDER_RING_SLOTS].length;
+
+    return length;
+}
+
+/* Called from I/O thread context */
+static void request_memblock_ahead(struct output *o, size_t length) {
+    struct userdata *u;
+
+    pa_assert(o);
+    pa_sink_input_assert_ref(o->sink_input);
+    pa_assert_se(u = o->userdata);
+
+    pull_ring(o);
+
+    if (pa_memblockq_is_readable(o->memblockq))
+        return;
+
+    /* The sink thread fell behind. Don't wait for it, but let it know
+     * that it should render something right away. */
+    if (pa_atomic_load(&u->thread_info.running) && pa_atomic_cmpxchg(&u->ring.render_requested, 0, 1))
+        pa_asyncmsgq_post(o->outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_RENDER_AHEAD, NULL, (int64_t) length, NULL, NULL);
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct output *o;
@@ -441,7 +616,10 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_assert_se(o = i->userdata);
 
     /* If necessary, get some new data */
-    request_memblock(o, nbytes);
+    if (o->userdata->render_ahead)
+        request_memblock_ahead(o, nbytes);
+    else
+        request_memblock(o, nbytes);
 
     /* pa_log("%s q size is %u + %u (%u/%u)", */
     /*        i->sink->name, */
@@ -624,6 +802,9 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
 
             *r = pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq), &o->sink_input->sample_spec);
 
+            if (o->userdata->render_ahead)
+                *r += pa_bytes_to_usec(get_ring_length(o), &o->sink_input->sample_spec);
+
             /* Fall through, the default handler will add in the extra
              * latency added by the resampler */
             break;
@@ -638,6 +819,11 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
 
             return 0;
 
+        case SINK_INPUT_MESSAGE_PULL_RING:
+            pa_atomic_store(&o->ring_pull_requested, 0);
+            pull_ring(o);
+            return 0;
+
         case SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY: {
             pa_usec_t latency = (pa_usec_t) offset;
 
@@ -786,6 +972,10 @@ static void output_add_within_thread(struct output *o) {
 
     PA_LLIST_PREPEND(struct output, o->userdata->thread_info.active_outputs, o);
 
+    /* New outputs start with what is rendered next */
+    pa_atomic_store(&o->ring_read_index, pa_atomic_load(&o->userdata->ring.write_index));
+    pa_atomic_store(&o->ring_pull_requested, 0);
+
     pa_assert(!o->outq_rtpoll_item_read);
     pa_assert(!o->audio_inq_rtpoll_item_write);
     pa_assert(!o->control_inq_rtpoll_item_write);
@@ -901,6 +1091,14 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             render_memblock(u, (struct output*) data, (size_t) offset);
             return 0;
 
+        case SINK_MESSAGE_RENDER_AHEAD:
+            pa_atomic_store(&u->ring.render_requested, 0);
+
+            if (pa_atomic_load(&u->thread_info.running))
+                render_ring_push(u, (size_t) offset);
+
+            return 0;
+
         case SINK_MESSAGE_UPDATE_LATENCY: {
             pa_usec_t x, y, latency = (pa_usec_t) offset;
 
@@ -1303,6 +1501,12 @@ int pa__init(pa_module*m) {
     else
         u->adjust_time = DEFAULT_ADJUST_TIME_USEC;
 
+    u->render_ahead = false;
+    if (pa_modargs_get_value_boolean(ma, "render_ahead", &u->render_ahead) < 0) {
+        pa_log("Failed to parse render_ahead value");
+        goto fail;
+    }
+
     slaves = pa_modargs_get_value(ma, "slaves", NULL);
     u->automatic = !slaves;
 
@@ -1495,6 +1699,7 @@ fail:
 
 void pa__done(pa_module*m) {
     struct userdata *u;
+    unsigned i;
 
     pa_assert(m);
 
@@ -1534,6 +1739,10 @@ void pa__done(pa_module*m) {
     if (u->time_event)
         u->core->mainloop->time_free(u->time_event);
 
+    for (i = 0; i < RENDER_RING_SLOTS; i++)
+        if (u->ring.slots[i].memblock)
+            pa_memblock_unref(u->ring.slots[i].memblock);
+
     if (u->thread_info.smoother)
         pa_smoother_free(u->thread_info.smoother);
 
@@ -58,6 +58,8 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/shared.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/semaphore.h>
 #include <pulsecore/idxset.h>
 #include <pulsecore/strlist.h>
 #include <pulsecore/database.h>
@@ -80,11 +82,32 @@ PA_MODULE_USAGE(
           "channel_map=<channel map> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "batched=<transform all channels with one batched FFT and keep the input in a ring?> "
+          "threads=<number of threads to spread the channels over in batched mode> "
          ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED false
 
+struct userdata;
+
+/* In batched mode the channels are split into groups, each of which
+ * is transformed with a single pair of batched plans. The first group
+ * is processed by the I/O thread itself, the others by a worker thread
+ * each. */
+struct fft_group {
+    struct userdata *u;
+    size_t first_channel, n_channels;
+
+    float *time;//n_channels windows of fft_size
+    fftwf_complex *freq;//n_channels spectra of FILTER_SIZE
+    fftwf_plan forward_plan, inverse_plan;
+
+    pa_thread *thread;
+    pa_semaphore *start;
+    size_t iterations;
+};
+
 struct userdata {
     pa_module *module;
     pa_sink *sink;
@@ -122,6 +145,15 @@ struct userdata {
     pa_memblockq *output_q;
     bool first_iteration;
 
+    //batched mode, input[] is a ring of input_buffer_max samples
+    //whose oldest sample is at input_start
+    bool batched;
+    size_t input_start;
+    struct fft_group *groups;
+    unsigned n_groups;
+    pa_semaphore *groups_done;
+    bool groups_quit;
+
     pa_dbus_protocol *dbus_protocol;
     char *dbus_path;
 
@@ -139,6 +171,8 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "autoloaded",
     "use_volume_sharing",
+    "batched",
+    "threads",
     NULL
 };
 
@@ -228,13 +262,18 @@ static void alloc_input_buffers(struct userdata *u, size_t min_buffer_length) {
     for (size_t c = 0; c < u->channels; ++c) {
         float *tmp = alloc(min_buffer_length, sizeof(float));
         if (u->input[c]) {
-            if (!u->first_iteration)
-                memcpy(tmp, u->input[c], u->overlap_size * sizeof(float));
+            if (!u->first_iteration) {
+                //the overlap may wrap around the end of the ring
+                size_t n = PA_MIN(u->overlap_size, u->input_buffer_max - u->input_start);
+                memcpy(tmp, u->input[c] + u->input_start, n * sizeof(float));
+                memcpy(tmp + n, u->input[c], (u->overlap_size - n) * sizeof(float));
+            }
             fftwf_free(u->input[c]);
         }
         u->input[c] = tmp;
     }
     u->input_buffer_max = min_buffer_length;
+    u->input_start = 0;
 }
 
 /* Called from I/O thread context */
@@ -519,6 +558,113 @@ static void flatten_to_memblockq(struct userdata *u) {
     }
 }
 
+/* Called from I/O thread context or from a worker thread */
+static void process_group(struct fft_group *g, size_t iterations) {
+    struct userdata *u = g->u;
+    size_t fs = pa_frame_size(&(u->sink->sample_spec));
+    size_t start = u->input_start;
+    unsigned a_i[PA_CHANNELS_MAX];
+
+    for(size_t iter = 0; iter < iterations; ++iter) {
+        size_t offset = iter * u->R * fs;
+        //the window may wrap around the end of the input ring
+        size_t n = PA_MIN(u->window_size, u->input_buffer_max - start);
+
+        //window and zero pad all channels of the group
+        for(size_t k = 0; k < g->n_channels; ++k) {
+            size_t c = g->first_channel + k;
+            float *dst = g->time + k * u->fft_size;
+            const float *src = u->input[c];
+            float X;
+
+            a_i[k] = pa_aupdate_read_begin(u->a_H[c]);
+            X = u->Xs[c][a_i[k]];
+            for(size_t j = 0; j < n; ++j)
+                dst[j] = X * u->W[j] * src[start + j];
+            for(size_t j = n; j < u->window_size; ++j)
+                dst[j] = X * u->W[j] * src[j - n];
+            memset(dst + u->window_size, 0, (u->fft_size - u->window_size) * sizeof(float));
+        }
+
+        fftwf_execute(g->forward_plan);
+
+        for(size_t k = 0; k < g->n_channels; ++k) {
+            size_t c = g->first_channel + k;
+            const float *H = u->Hs[c][a_i[k]];
+            fftwf_complex *freq = g->freq + k * FILTER_SIZE(u);
+
+            for(size_t j = 0; j < FILTER_SIZE(u); ++j) {
+                freq[j][0] *= H[j];
+                freq[j][1] *= H[j];
+            }
+            pa_aupdate_read_end(u->a_H[c]);
+        }
+
+        fftwf_execute(g->inverse_plan);
+
+        //overlap add, preserve the overlap and interleave the output
+        for(size_t k = 0; k < g->n_channels; ++k) {
+            size_t c = g->first_channel + k;
+            float *dst = g->time + k * u->fft_size;
+            float *overlap = u->overlap_accum[c];
+
+            for(size_t j = 0; j < u->overlap_size; ++j) {
+                dst[j] += overlap[j];
+                overlap[j] = dst[u->R + j];
+            }
+            if (u->first_iteration && iter == 0) {
+                //see process_samples()
+                for(size_t j = 0; j < u->overlap_size; ++j)
+                    dst[j] = u->W[j] <= FLT_EPSILON ? dst[j] : dst[j] / u->W[j];
+            }
+            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, (uint8_t *) (((float *)u->output_buffer) + c) + offset, fs, dst, sizeof(float), u->R);
+        }
+
+        start = (start + u->R) % u->input_buffer_max;
+    }
+}
+
+static void group_thread_func(void *data) {
+    struct fft_group *g = data;
+    struct userdata *u = g->u;
+
+    pa_log_debug("Equalizer thread starting up, channels %zu-%zu", g->first_channel, g->first_channel + g->n_channels - 1);
+
+    if (u->module->core->realtime_scheduling)
+        pa_make_realtime(u->module->core->realtime_priority);
+
+    for (;;) {
+        pa_semaphore_wait(g->start);
+
+        if (u->groups_quit)
+            break;
+
+        process_group(g, g->iterations);
+        pa_semaphore_post(u->groups_done);
+    }
+
+    pa_log_debug("Equalizer thread shutting down");
+}
+
+/* Called from I/O thread context */
+static void process_samples_batched(struct userdata *u, size_t iterations) {
+    unsigned g;
+
+    for (g = 1; g < u->n_groups; ++g) {
+        u->groups[g].iterations = iterations;
+        pa_semaphore_post(u->groups[g].start);
+    }
+
+    process_group(&u->groups[0], iterations);
+
+    for (g = 1; g < u->n_groups; ++g)
+        pa_semaphore_wait(u->groups_done);
+
+    u->first_iteration = false;
+    u->input_start = (u->input_start + iterations * u->R) % u->input_buffer_max;
+    u->samples_gathered -= iterations * u->R;
+}
+
 static void process_samples(struct userdata *u) {
     size_t fs = pa_frame_size(&(u->sink->sample_spec));
     unsigned a_i;
@@ -534,6 +680,12 @@ static void process_samples(struct userdata *u) {
     }
     u->output_buffer_length = iterations * u->R * fs;
 
+    if (u->batched) {
+        process_samples_batched(u, iterations);
+        flatten_to_memblockq(u);
+        return;
+    }
+
     for(size_t iter = 0; iter < iterations; ++iter) {
         offset = iter * u->R * fs;
         for(size_t c = 0;c < u->channels; c++) {
@@ -573,14 +725,18 @@ static void input_buffer(struct userdata *u, pa_memchunk *in) {
     size_t fs = pa_frame_size(&(u->sink->sample_spec));
     size_t samples = in->length/fs;
     float *src = pa_memblock_acquire_chunk(in);
+    size_t pos, n;
     pa_assert(u->samples_gathered + samples <= u->input_buffer_max);
+    //in batched mode the input buffers are rings, elsewise
+    //input_start stays 0 and this never wraps
+    pos = (u->input_start + u->samples_gathered) % u->input_buffer_max;
+    n = PA_MIN(samples, u->input_buffer_max - pos);
     for(size_t c = 0; c < u->channels; c++) {
         //buffer with an offset after the overlap from previous
         //iterations
-        pa_assert_se(
-            u->input[c] + u->samples_gathered + samples <= u->input[c] + u->input_buffer_max
-        );
-        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c] + u->samples_gathered, sizeof(float), src + c, fs, samples);
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c] + pos, sizeof(float), src + c, fs, n);
+        if (n < samples)
+            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c], sizeof(float), src + c + n * u->channels, fs, samples - n);
     }
     u->samples_gathered += samples;
     pa_memblock_release(in->memblock);
@@ -1092,6 +1248,8 @@ int pa__init(pa_module*m) {
     float *H;
     unsigned a_i;
     bool use_volume_sharing = true;
+    bool batched = false;
+    uint32_t n_threads = 1;
 
     pa_assert(m);
 
@@ -1124,6 +1282,21 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "batched", &batched) < 0) {
+        pa_log("batched= expects a boolean argument");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "threads", &n_threads) < 0 || n_threads < 1) {
+        pa_log("threads= expects a positive integer argument");
+        goto fail;
+    }
+
+    if (n_threads > 1 && !batched) {
+        pa_log("threads= requires batched=yes");
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
@@ -1163,6 +1336,43 @@ int pa__init(pa_module*m) {
     u->forward_plan = fftwf_plan_dft_r2c_1d(u->fft_size, u->work_buffer, u->output_window, FFTW_ESTIMATE);
     u->inverse_plan = fftwf_plan_dft_c2r_1d(u->fft_size, u->output_window, u->work_buffer, FFTW_ESTIMATE);
 
+    if (batched) {
+        int n = (int) u->fft_size;
+
+        u->batched = true;
+        u->n_groups = PA_MIN(n_threads, (uint32_t) u->channels);
+        u->groups = pa_xnew0(struct fft_group, u->n_groups);
+        u->groups_done = pa_semaphore_new(0);
+
+        for (i = 0; i < u->n_groups; ++i) {
+            struct fft_group *g = &u->groups[i];
+
+            g->u = u;
+            g->first_channel = i * u->channels / u->n_groups;
+            g->n_channels = (i + 1) * u->channels / u->n_groups - g->first_channel;
+            g->time = alloc(g->n_channels * u->fft_size, sizeof(float));
+            g->freq = alloc(g->n_channels * FILTER_SIZE(u), sizeof(fftwf_complex));
+            g->forward_plan = fftwf_plan_many_dft_r2c(1, &n, (int) g->n_channels,
+                                                      g->time, NULL, 1, (int) u->fft_size,
+                                                      g->freq, NULL, 1, (int) FILTER_SIZE(u),
+                                                      FFTW_ESTIMATE);
+            g->inverse_plan = fftwf_plan_many_dft_c2r(1, &n, (int) g->n_channels,
+                                                      g->freq, NULL, 1, (int) FILTER_SIZE(u),
+                                                      g->time, NULL, 1, (int) u->fft_size,
+                                                      FFTW_ESTIMATE);
+
+            /* The first group is processed by the I/O thread */
+            if (i == 0)
+                continue;
+
+            g->start = pa_semaphore_new(0);
+            if (!(g->thread = pa_thread_new("equalizer", group_thread_func, g))) {
+                pa_log("Failed to create thread.");
+                goto fail;
+            }
+        }
+    }
+
     hanning_window(u->W, u->window_size);
     u->first_iteration = true;
 
@@ -1341,6 +1551,30 @@ void pa__done(pa_module*m) {
     pa_memblockq_free(u->output_q);
     pa_memblockq_free(u->input_q);
 
+    if (u->groups) {
+        u->groups_quit = true;
+
+        for (c = 0; c < u->n_groups; ++c) {
+            struct fft_group *g = &u->groups[c];
+
+            if (g->thread) {
+                pa_semaphore_post(g->start);
+                pa_thread_free(g->thread);
+            }
+            if (g->start)
+                pa_semaphore_free(g->start);
+            if (g->forward_plan)
+                fftwf_destroy_plan(g->forward_plan);
+            if (g->inverse_plan)
+                fftwf_destroy_plan(g->inverse_plan);
+            fftwf_free(g->time);
+            fftwf_free(g->freq);
+        }
+
+        pa_semaphore_free(u->groups_done);
+        pa_xfree(u->groups);
+    }
+
     fftwf_destroy_plan(u->inverse_plan);
     fftwf_destroy_plan(u->forward_plan);
     fftwf_free(u->output_window);
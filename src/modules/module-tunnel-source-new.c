@@ -40,6 +40,10 @@
 #include <pulsecore/poll.h>
 #include <pulsecore/proplist-util.h>
 
+#ifdef HAVE_OPUS
+#include <pulsecore/opus-codec.h>
+#endif
+
 #include "module-tunnel-source-new-symdef.h"
 
 PA_MODULE_AUTHOR("Alexander Couzens");
@@ -55,7 +59,10 @@ PA_MODULE_USAGE(
         "channels=<number of channels> "
         "rate=<sample rate> "
         "channel_map=<channel map> "
-        "cookie=<cookie file path>"
+        "cookie=<cookie file path> "
+        "encoding=<pcm or opus> "
+        "bitrate=<opus bitrate in bits/s> "
+        "frame_duration=<opus frame duration in ms>"
         );
 
 #define TUNNEL_THREAD_FAILED_MAINLOOP 1
@@ -83,6 +90,13 @@ struct userdata {
     char *cookie_file;
     char *remote_server;
     char *remote_source_name;
+
+#ifdef HAVE_OPUS
+    /* Offer Opus to the server instead of PCM */
+    bool opus;
+    uint32_t opus_bitrate;
+    uint32_t opus_frame_duration;
+#endif
 };
 
 static const char* const valid_modargs[] = {
@@ -95,6 +109,9 @@ static const char* const valid_modargs[] = {
     "rate",
     "channel_map",
     "cookie",
+    "encoding",
+    "bitrate",
+    "frame_duration",
    /* "reconnect", reconnect if server comes back again - unimplemented */
     NULL,
 };
@@ -310,11 +327,31 @@ static void context_state_cb(pa_context *c, void *userdata) {
             pa_assert(!u->stream);
 
             proplist = tunnel_new_proplist(u);
-            u->stream = pa_stream_new_with_proplist(u->context,
-                                                    stream_name,
-                                                    &u->source->sample_spec,
-                                                    &u->source->channel_map,
-                                                    proplist);
+
+#ifdef HAVE_OPUS
+            if (u->opus && pa_context_get_server_protocol_version(u->context) < 33)
+                pa_log_info("The server doesn't support Opus, falling back to PCM.");
+
+            if (u->opus && pa_context_get_server_protocol_version(u->context) >= 33) {
+                pa_format_info *formats[2];
+
+                /* PCM is only there in case the server can't use Opus
+                 * after all */
+                formats[0] = pa_opus_format_new(&u->source->sample_spec, &u->source->channel_map,
+                                                u->opus_bitrate, u->opus_frame_duration);
+                formats[1] = pa_format_info_from_sample_spec(&u->source->sample_spec, &u->source->channel_map);
+
+                u->stream = pa_stream_new_extended(u->context, stream_name, formats, 2, proplist);
+
+                pa_format_info_free(formats[0]);
+                pa_format_info_free(formats[1]);
+            } else
+#endif
+                u->stream = pa_stream_new_with_proplist(u->context,
+                                                        stream_name,
+                                                        &u->source->sample_spec,
+                                                        &u->source->channel_map,
+                                                        proplist);
             pa_proplist_free(proplist);
             pa_xfree(stream_name);
 
@@ -459,6 +496,7 @@ int pa__init(pa_module *m) {
     pa_sample_spec ss;
     pa_channel_map map;
     const char *remote_server = NULL;
+    const char *encoding;
     const char *source_name = NULL;
     char *default_source_name = NULL;
 
@@ -495,6 +533,41 @@ int pa__init(pa_module *m) {
     u->cookie_file = pa_xstrdup(pa_modargs_get_value(ma, "cookie", NULL));
     u->remote_source_name = pa_xstrdup(pa_modargs_get_value(ma, "source", NULL));
 
+    encoding = pa_modargs_get_value(ma, "encoding", "pcm");
+    if (pa_streq(encoding, "opus")) {
+#ifdef HAVE_OPUS
+        u->opus = true;
+
+        /* The codec works on float samples */
+        ss.format = PA_SAMPLE_FLOAT32NE;
+
+        if (ss.channels > 2) {
+            pa_log("Opus supports at most two channels.");
+            goto fail;
+        }
+
+        if (!pa_opus_sample_spec_supported(&ss))
+            ss.rate = 48000;
+
+        if (pa_modargs_get_value_u32(ma, "bitrate", &u->opus_bitrate) < 0) {
+            pa_log("Invalid bitrate.");
+            goto fail;
+        }
+
+        if (pa_modargs_get_value_u32(ma, "frame_duration", &u->opus_frame_duration) < 0 ||
+            (u->opus_frame_duration > 0 && !pa_opus_frame_duration_valid(u->opus_frame_duration))) {
+            pa_log("Invalid frame duration, must be one of 5, 10, 20, 40 or 60 ms.");
+            goto fail;
+        }
+#else
+        pa_log("Opus support was not enabled at build time.");
+        goto fail;
+#endif
+    } else if (!pa_streq(encoding, "pcm")) {
+        pa_log("Invalid encoding '%s'.", encoding);
+        goto fail;
+    }
+
     u->thread_mq = pa_xnew0(pa_thread_mq, 1);
     pa_thread_mq_init_thread_mainloop(u->thread_mq, m->core->mainloop, u->thread_mainloop_api);
 
@@ -38,6 +38,7 @@
 #include <pulsecore/ltdl-helper.h>
 #include <pulsecore/sound-file.h>
 #include <pulsecore/resampler.h>
+#include <pulsecore/filter/convolver.h>
 
 #include <math.h>
 
@@ -62,6 +63,12 @@ PA_MODULE_USAGE(
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* Impulse responses up to this length are folded in directly, longer ones
+ * go through the FFT convolver, which adds up to CONVOLVER_BLOCK_SIZE frames
+ * of latency. */
+#define DIRECT_HRIR_SAMPLES_MAX 64
+#define CONVOLVER_BLOCK_SIZE 256U
+
 struct userdata {
     pa_module *module;
 
@@ -87,6 +94,8 @@ struct userdata {
 
     float *input_buffer;
     int input_buffer_offset;
+
+    pa_convolver *convolver;
 };
 
 static const char* const valid_modargs[] = {
@@ -128,6 +137,10 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
                 /* Add the latency internal to our sink input on top */
                 pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
 
+            /* And the block delay of the convolver */
+            if (u->convolver)
+                *((pa_usec_t*) data) += pa_bytes_to_usec(pa_convolver_get_latency(u->convolver) * u->sink_fs, &u->sink->sample_spec);
+
             return 0;
     }
 
@@ -211,6 +224,47 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+/* Called from I/O thread context */
+static void fold_hrir_direct(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned j, k, l;
+    float sum_right, sum_left;
+    float current_sample;
+
+    for (l = 0; l < n; l++) {
+        memcpy(((char*) u->input_buffer) + u->input_buffer_offset * u->sink_fs, ((const char *) src) + l * u->sink_fs, u->sink_fs);
+
+        sum_right = 0;
+        sum_left = 0;
+
+        /* fold the input buffer with the impulse response */
+        for (j = 0; j < u->hrir_samples; j++) {
+            for (k = 0; k < u->channels; k++) {
+                current_sample = u->input_buffer[((u->input_buffer_offset + j) % u->hrir_samples) * u->channels + k];
+
+                sum_left += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_left[k]];
+                sum_right += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_right[k]];
+            }
+        }
+
+        dst[2 * l] = PA_CLAMP_UNLIKELY(sum_left, -1.0f, 1.0f);
+        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(sum_right, -1.0f, 1.0f);
+
+        u->input_buffer_offset--;
+        if (u->input_buffer_offset < 0)
+            u->input_buffer_offset += u->hrir_samples;
+    }
+}
+
+/* Called from I/O thread context */
+static void fold_hrir_convolver(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned l;
+
+    pa_convolver_process(u->convolver, src, dst, n);
+
+    for (l = 0; l < 2 * n; l++)
+        dst[l] = PA_CLAMP_UNLIKELY(dst[l], -1.0f, 1.0f);
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
@@ -218,10 +272,6 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     unsigned n;
     pa_memchunk tchunk;
 
-    unsigned j, k, l;
-    float sum_right, sum_left;
-    float current_sample;
-
     pa_sink_input_assert_ref(i);
     pa_assert(chunk);
     pa_assert_se(u = i->userdata);
@@ -253,29 +303,10 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = pa_memblock_acquire_chunk(&tchunk);
     dst = pa_memblock_acquire(chunk->memblock);
 
-    for (l = 0; l < n; l++) {
-        memcpy(((char*) u->input_buffer) + u->input_buffer_offset * u->sink_fs, ((char *) src) + l * u->sink_fs, u->sink_fs);
-
-        sum_right = 0;
-        sum_left = 0;
-
-        /* fold the input buffer with the impulse response */
-        for (j = 0; j < u->hrir_samples; j++) {
-            for (k = 0; k < u->channels; k++) {
-                current_sample = u->input_buffer[((u->input_buffer_offset + j) % u->hrir_samples) * u->channels + k];
-
-                sum_left += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_left[k]];
-                sum_right += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_right[k]];
-            }
-        }
-
-        dst[2 * l] = PA_CLAMP_UNLIKELY(sum_left, -1.0f, 1.0f);
-        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(sum_right, -1.0f, 1.0f);
-
-        u->input_buffer_offset--;
-        if (u->input_buffer_offset < 0)
-            u->input_buffer_offset += u->hrir_samples;
-    }
+    if (u->convolver)
+        fold_hrir_convolver(u, src, dst, n);
+    else
+        fold_hrir_direct(u, src, dst, n);
 
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
@@ -304,8 +335,12 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, true);
 
             /* Reset the input buffer */
-            memset(u->input_buffer, 0, u->hrir_samples * u->sink_fs);
-            u->input_buffer_offset = 0;
+            if (u->convolver)
+                pa_convolver_reset(u->convolver);
+            else {
+                memset(u->input_buffer, 0, u->hrir_samples * u->sink_fs);
+                u->input_buffer_offset = 0;
+            }
         }
     }
 
@@ -747,10 +782,6 @@ int pa__init(pa_module*m) {
                                  PA_RESAMPLER_SRC_SINC_BEST_QUALITY, PA_RESAMPLER_NO_REMAP);
 
     u->hrir_samples = hrir_temp_chunk.length / pa_frame_size(&hrir_temp_ss) * hrir_ss.rate / hrir_temp_ss.rate;
-    if (u->hrir_samples > 64) {
-        u->hrir_samples = 64;
-        pa_log("The (resampled) hrir contains more than 64 samples. Only the first 64 samples will be used to limit processor usage.");
-    }
 
     hrir_total_length = u->hrir_samples * pa_frame_size(&hrir_ss);
     u->hrir_channels = hrir_ss.channels;
@@ -771,10 +802,10 @@ int pa__init(pa_module*m) {
             hrir_data = (float *) pa_memblock_acquire(hrir_temp_chunk_resampled.memblock);
 
             if (hrir_total_length - hrir_copied_length >= hrir_temp_chunk_resampled.length) {
-                memcpy(u->hrir_data + hrir_copied_length, hrir_data, hrir_temp_chunk_resampled.length);
+                memcpy((char *) u->hrir_data + hrir_copied_length, hrir_data, hrir_temp_chunk_resampled.length);
                 hrir_copied_length += hrir_temp_chunk_resampled.length;
             } else {
-                memcpy(u->hrir_data + hrir_copied_length, hrir_data, hrir_total_length - hrir_copied_length);
+                memcpy((char *) u->hrir_data + hrir_copied_length, hrir_data, hrir_total_length - hrir_copied_length);
                 hrir_copied_length = hrir_total_length;
             }
 
@@ -825,8 +856,29 @@ int pa__init(pa_module*m) {
         }
     }
 
-    u->input_buffer = pa_xmalloc0(u->hrir_samples * u->sink_fs);
-    u->input_buffer_offset = 0;
+    if (u->hrir_samples > DIRECT_HRIR_SAMPLES_MAX) {
+        float *ir;
+
+        pa_log_debug("Using FFT convolution for %u hrir samples", u->hrir_samples);
+
+        u->convolver = pa_convolver_new(PA_MIN(pa_make_power_of_two(u->hrir_samples), CONVOLVER_BLOCK_SIZE),
+                                        u->channels, 2, u->hrir_samples);
+
+        ir = pa_xnew(float, u->hrir_samples);
+        for (i = 0; i < u->channels; i++) {
+            for (j = 0; j < u->hrir_samples; j++)
+                ir[j] = u->hrir_data[j * u->hrir_channels + u->mapping_left[i]];
+            pa_convolver_set_filter(u->convolver, i, 0, ir, u->hrir_samples);
+
+            for (j = 0; j < u->hrir_samples; j++)
+                ir[j] = u->hrir_data[j * u->hrir_channels + u->mapping_right[i]];
+            pa_convolver_set_filter(u->convolver, i, 1, ir, u->hrir_samples);
+        }
+        pa_xfree(ir);
+    } else {
+        u->input_buffer = pa_xmalloc0(u->hrir_samples * u->sink_fs);
+        u->input_buffer_offset = 0;
+    }
 
     pa_sink_put(u->sink);
     pa_sink_input_put(u->sink_input);
@@ -890,6 +942,9 @@ void pa__done(pa_module*m) {
     if (u->input_buffer)
         pa_xfree(u->input_buffer);
 
+    if (u->convolver)
+        pa_convolver_free(u->convolver);
+
     if (u->mapping_left)
         pa_xfree(u->mapping_left);
     if (u->mapping_right)
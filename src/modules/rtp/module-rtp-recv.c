@@ -76,6 +76,7 @@ PA_MODULE_USAGE(
 #define MAX_SESSIONS 16
 #define DEATH_TIMEOUT 20
 #define RATE_UPDATE_INTERVAL (5*PA_USEC_PER_SEC)
+#define MAX_RECV_BATCHES 8
 
 static const char* const valid_modargs[] = {
     "sink",
@@ -204,55 +205,35 @@ static void sink_input_suspend_within_thread(pa_sink_input* i, bool b) {
         s->first_packet = false;
 }
 
-/* Called from I/O thread context */
-static int rtpoll_work_cb(pa_rtpoll_item *i) {
-    pa_memchunk chunk;
+/* Called from I/O thread context. Queues one received packet and returns
+ * false if it had to be dropped. Takes over the reference to p->chunk. */
+static bool session_push_packet(struct session *s, pa_rtp_packet *p) {
     int64_t k, j, delta;
-    struct timeval now = { 0, 0 };
-    struct session *s;
-    struct pollfd *p;
-
-    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
-
-    p = pa_rtpoll_item_get_pollfd(i, NULL);
-
-    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
-        pa_log("poll() signalled bad revents.");
-        return -1;
-    }
 
-    if ((p->revents & POLLIN) == 0)
-        return 0;
-
-    p->revents = 0;
-
-    if (pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now) < 0)
-        return 0;
-
-    if (s->sdp_info.payload != s->rtp_context.payload ||
+    if (s->sdp_info.payload != p->payload ||
         !PA_SINK_IS_OPENED(s->sink_input->sink->thread_info.state)) {
-        pa_memblock_unref(chunk.memblock);
-        return 0;
+        pa_memblock_unref(p->chunk.memblock);
+        return false;
     }
 
     if (!s->first_packet) {
         s->first_packet = true;
 
-        s->ssrc = s->rtp_context.ssrc;
-        s->offset = s->rtp_context.timestamp;
+        s->ssrc = p->ssrc;
+        s->offset = p->timestamp;
 
         if (s->ssrc == s->userdata->module->core->cookie)
             pa_log_warn("Detected RTP packet loop!");
     } else {
-        if (s->ssrc != s->rtp_context.ssrc) {
-            pa_memblock_unref(chunk.memblock);
-            return 0;
+        if (s->ssrc != p->ssrc) {
+            pa_memblock_unref(p->chunk.memblock);
+            return false;
         }
     }
 
     /* Check whether there was a timestamp overflow */
-    k = (int64_t) s->rtp_context.timestamp - (int64_t) s->offset;
-    j = (int64_t) 0x100000000LL - (int64_t) s->offset + (int64_t) s->rtp_context.timestamp;
+    k = (int64_t) p->timestamp - (int64_t) s->offset;
+    j = (int64_t) 0x100000000LL - (int64_t) s->offset + (int64_t) p->timestamp;
 
     if ((k < 0 ? -k : k) < (j < 0 ? -j : j))
         delta = k;
@@ -261,25 +242,77 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
 
     pa_memblockq_seek(s->memblockq, delta * (int64_t) s->rtp_context.frame_size, PA_SEEK_RELATIVE, true);
 
-    if (now.tv_sec == 0) {
+    if (p->tstamp.tv_sec == 0) {
         PA_ONCE_BEGIN {
             pa_log_warn("Using artificial time instead of timestamp");
         } PA_ONCE_END;
-        pa_rtclock_get(&now);
+        pa_rtclock_get(&p->tstamp);
     } else
-        pa_rtclock_from_wallclock(&now);
+        pa_rtclock_from_wallclock(&p->tstamp);
 
-    if (pa_memblockq_push(s->memblockq, &chunk) < 0) {
+    if (pa_memblockq_push(s->memblockq, &p->chunk) < 0) {
         pa_log_warn("Queue overrun");
-        pa_memblockq_seek(s->memblockq, (int64_t) chunk.length, PA_SEEK_RELATIVE, true);
+        pa_memblockq_seek(s->memblockq, (int64_t) p->chunk.length, PA_SEEK_RELATIVE, true);
     }
 
 /*     pa_log("blocks in q: %u", pa_memblockq_get_nblocks(s->memblockq)); */
 
-    pa_memblock_unref(chunk.memblock);
+    pa_memblock_unref(p->chunk.memblock);
 
     /* The next timestamp we expect */
-    s->offset = s->rtp_context.timestamp + (uint32_t) (chunk.length / s->rtp_context.frame_size);
+    s->offset = p->timestamp + (uint32_t) (p->chunk.length / s->rtp_context.frame_size);
+
+    return true;
+}
+
+/* Called from I/O thread context */
+static int rtpoll_work_cb(pa_rtpoll_item *i) {
+    pa_rtp_packet packets[PA_RTP_RECV_BATCH_MAX];
+    struct timeval now = { 0, 0 };
+    bool pushed = false;
+    struct session *s;
+    struct pollfd *p;
+    unsigned n;
+
+    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
+
+    p = pa_rtpoll_item_get_pollfd(i, NULL);
+
+    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
+        pa_log("poll() signalled bad revents.");
+        return -1;
+    }
+
+    if ((p->revents & POLLIN) == 0)
+        return 0;
+
+    p->revents = 0;
+
+    /* Drain everything that is pending, so that a burst of packets costs one
+     * wakeup instead of one per packet. Bounded, so that a flood can't keep
+     * us from rendering. */
+    for (n = 0; n < MAX_RECV_BATCHES; n++) {
+        int r, k;
+
+        if ((r = pa_rtp_recv_batch(&s->rtp_context, packets, PA_RTP_RECV_BATCH_MAX, s->userdata->module->core->mempool)) < 0)
+            break;
+
+        for (k = 0; k < r; k++) {
+            if (!packets[k].chunk.memblock)
+                continue;
+
+            if (session_push_packet(s, &packets[k])) {
+                now = packets[k].tstamp;
+                pushed = true;
+            }
+        }
+
+        if (r < PA_RTP_RECV_BATCH_MAX)
+            break;
+    }
+
+    if (!pushed)
+        return 0;
 
     pa_atomic_store(&s->timestamp, (int) now.tv_sec);
 
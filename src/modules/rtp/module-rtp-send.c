@@ -67,7 +67,9 @@ PA_MODULE_USAGE(
         "mtu=<maximum transfer unit> "
         "loop=<loopback to local host?> "
         "ttl=<ttl value> "
-        "inhibit_auto_suspend=<always|never|only_with_non_monitor_sources>"
+        "inhibit_auto_suspend=<always|never|only_with_non_monitor_sources> "
+        "batch=<maximum number of packets to send per system call> "
+        "gso=<use UDP segmentation offload for batches?>"
 );
 
 #define DEFAULT_PORT 46000
@@ -92,6 +94,8 @@ static const char* const valid_modargs[] = {
     "loop",
     "ttl",
     "inhibit_auto_suspend",
+    "batch",
+    "gso",
     NULL
 };
 
@@ -212,6 +216,8 @@ int pa__init(pa_module*m) {
     const char *src_addr;
     uint32_t port = DEFAULT_PORT, mtu;
     uint32_t ttl = DEFAULT_TTL;
+    uint32_t batch = 1;
+    bool gso = false;
     sa_family_t af;
     int fd = -1, sap_fd = -1;
     pa_source *s;
@@ -302,6 +308,16 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "batch", &batch) < 0 || batch < 1 || batch > PA_RTP_SEND_BATCH_MAX) {
+        pa_log("batch= expects a numerical argument between 1 and %u.", PA_RTP_SEND_BATCH_MAX);
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "gso", &gso) < 0) {
+        pa_log("Failed to parse \"gso\" parameter.");
+        goto fail;
+    }
+
     src_addr = pa_modargs_get_value(ma, "source_ip", DEFAULT_SOURCE_IP);
 
     if (inet_pton(AF_INET, src_addr, &src_sa4.sin_addr) > 0) {
@@ -448,9 +464,6 @@ int pa__init(pa_module*m) {
     o->moving = source_output_moving_cb;
     o->kill = source_output_kill_cb;
 
-    pa_log_info("Configured source latency of %llu ms.",
-                (unsigned long long) pa_source_output_set_requested_latency(o, pa_bytes_to_usec(mtu, &o->sample_spec)) / PA_USEC_PER_MSEC);
-
     m->userdata = o->userdata = u = pa_xnew(struct userdata, 1);
     u->module = m;
     u->source_output = o;
@@ -458,8 +471,8 @@ int pa__init(pa_module*m) {
     u->memblockq = pa_memblockq_new(
             "module-rtp-send memblockq",
             0,
-            MEMBLOCKQ_MAXLENGTH,
-            MEMBLOCKQ_MAXLENGTH,
+            PA_MAX((size_t) MEMBLOCKQ_MAXLENGTH, (size_t) 2 * mtu * batch),
+            PA_MAX((size_t) MEMBLOCKQ_MAXLENGTH, (size_t) 2 * mtu * batch),
             &ss,
             1,
             0,
@@ -490,6 +503,12 @@ int pa__init(pa_module*m) {
     pa_xfree(n);
 
     pa_rtp_context_init_send(&u->rtp_context, fd, m->core->cookie, payload, pa_frame_size(&ss));
+    batch = pa_rtp_context_set_send_batch(&u->rtp_context, batch, gso);
+
+    /* Wake up only once there is enough data for a whole batch */
+    pa_log_info("Configured source latency of %llu ms.",
+                (unsigned long long) pa_source_output_set_requested_latency(o, pa_bytes_to_usec((uint64_t) mtu * batch, &o->sample_spec)) / PA_USEC_PER_MSEC);
+
     pa_sap_context_init_send(&u->sap_context, sap_fd, p);
 
     pa_log_info("RTP stream initialized with mtu %u on %s:%u from %s ttl=%u, SSRC=0x%08x, payload=%u, initial sequence #%u", mtu, dst_addr, port, src_addr, ttl, u->rtp_context.ssrc, payload, u->rtp_context.sequence);
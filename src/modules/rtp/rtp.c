@@ -35,6 +35,10 @@
 #include <sys/uio.h>
 #endif
 
+#ifdef HAVE_NETINET_UDP_H
+#include <netinet/udp.h>
+#endif
+
 #include <pulsecore/core-error.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -53,14 +57,186 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
     c->ssrc = ssrc ? ssrc : (uint32_t) (rand()*rand());
     c->payload = (uint8_t) (payload & 127U);
     c->frame_size = frame_size;
+    c->send_batch = 1;
+    c->send_gso = false;
+    c->recv_unbatched = false;
+    c->recv_truncated = 0;
 
     pa_memchunk_reset(&c->memchunk);
 
     return c;
 }
 
+unsigned pa_rtp_context_set_send_batch(pa_rtp_context *c, unsigned max_packets, bool gso) {
+    pa_assert(c);
+    pa_assert(max_packets > 0);
+
+#ifdef HAVE_SENDMMSG
+    c->send_batch = PA_MIN(max_packets, (unsigned) PA_RTP_SEND_BATCH_MAX);
+    c->send_gso = false;
+
+    if (gso && c->send_batch > 1) {
+#ifdef UDP_SEGMENT
+        int zero = 0;
+
+        /* Setting a segment size of 0 does nothing, it just tells us
+         * whether the kernel knows about UDP GSO at all */
+        if (setsockopt(c->fd, IPPROTO_UDP, UDP_SEGMENT, &zero, sizeof(zero)) < 0)
+            pa_log_warn("UDP segmentation offload not supported by the kernel: %s", pa_cstrerror(errno));
+        else
+            c->send_gso = true;
+#else
+        pa_log_warn("UDP segmentation offload not supported on this platform.");
+#endif
+    }
+#else
+    if (max_packets > 1)
+        pa_log_warn("Batched sending not supported on this platform.");
+#endif
+
+    return c->send_batch;
+}
+
 #define MAX_IOVECS 16
 
+#ifdef HAVE_SENDMMSG
+/* Hands the packets to the kernel, returns the number of packets sent */
+static int send_packets(pa_rtp_context *c, struct mmsghdr *m, unsigned n_packets, struct iovec *iov, unsigned n_iov, size_t size) {
+#ifdef UDP_SEGMENT
+    if (c->send_gso && n_packets > 1) {
+        union {
+            struct cmsghdr cm;
+            uint8_t data[CMSG_SPACE(sizeof(uint16_t))];
+        } aux;
+        struct msghdr gm;
+        struct cmsghdr *cm;
+        uint16_t segment_size = (uint16_t) (12 + size);
+
+        /* All packets are sent as one big datagram with every packet
+         * being one segment, the kernel or the network card cuts it up */
+        pa_zero(gm);
+        gm.msg_iov = iov;
+        gm.msg_iovlen = n_iov;
+        gm.msg_control = &aux;
+        gm.msg_controllen = sizeof(aux);
+
+        cm = CMSG_FIRSTHDR(&gm);
+        cm->cmsg_level = IPPROTO_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cm), &segment_size, sizeof(uint16_t));
+
+        if (sendmsg(c->fd, &gm, MSG_DONTWAIT) >= 0)
+            return (int) n_packets;
+
+        /* EIO means the device can't do checksum offloading */
+        if (errno != EIO && errno != EINVAL)
+            return -1;
+
+        pa_log_warn("UDP segmentation offload failed, falling back to sendmmsg(): %s", pa_cstrerror(errno));
+        c->send_gso = false;
+    }
+#endif
+
+    return sendmmsg(c->fd, m, n_packets, MSG_DONTWAIT);
+}
+
+/* Like the single packet loop in pa_rtp_send(), but collects up to
+ * c->send_batch packets before sending them with a single system call */
+static int send_batch(pa_rtp_context *c, size_t size, pa_memblockq *q) {
+    struct iovec iov[PA_RTP_SEND_BATCH_MAX * MAX_IOVECS];
+    pa_memblock *mb[PA_RTP_SEND_BATCH_MAX * MAX_IOVECS];
+    uint32_t header[PA_RTP_SEND_BATCH_MAX][3];
+    struct mmsghdr m[PA_RTP_SEND_BATCH_MAX];
+    unsigned max_packets = c->send_batch;
+    bool eof = false;
+
+    if (c->send_gso)
+        /* A GSO datagram can't be larger than the largest UDP datagram */
+        max_packets = PA_MIN(max_packets, (unsigned) (65507 / (12 + size)));
+
+    while (!eof && pa_memblockq_get_length(q) >= size) {
+        unsigned n_packets = 0, n_iov = 0, i;
+        int r;
+
+        while (n_packets < max_packets && pa_memblockq_get_length(q) >= size) {
+            unsigned first = n_iov++;
+            size_t n = 0;
+
+            while (n < size && n_iov - first < MAX_IOVECS) {
+                pa_memchunk chunk;
+                size_t k;
+
+                pa_memchunk_reset(&chunk);
+
+                if (pa_memblockq_peek(q, &chunk) < 0) {
+                    eof = true;
+                    break;
+                }
+
+                pa_assert(chunk.memblock);
+
+                k = n + chunk.length > size ? size - n : chunk.length;
+
+                iov[n_iov].iov_base = pa_memblock_acquire_chunk(&chunk);
+                iov[n_iov].iov_len = k;
+                mb[n_iov] = chunk.memblock;
+                n_iov++;
+
+                n += k;
+                pa_memblockq_drop(q, k);
+            }
+
+            pa_assert(n % c->frame_size == 0);
+
+            if (n == 0) {
+                n_iov--;
+                break;
+            }
+
+            header[n_packets][0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
+            header[n_packets][1] = htonl(c->timestamp);
+            header[n_packets][2] = htonl(c->ssrc);
+
+            iov[first].iov_base = header[n_packets];
+            iov[first].iov_len = sizeof(header[n_packets]);
+            mb[first] = NULL;
+
+            pa_zero(m[n_packets]);
+            m[n_packets].msg_hdr.msg_iov = &iov[first];
+            m[n_packets].msg_hdr.msg_iovlen = n_iov - first;
+            n_packets++;
+
+            c->sequence++;
+            c->timestamp += (unsigned) (n/c->frame_size);
+
+            /* With GSO only the last segment may be shorter */
+            if (eof || (c->send_gso && n < size))
+                break;
+        }
+
+        if (n_packets == 0)
+            break;
+
+        r = send_packets(c, m, n_packets, iov, n_iov, size);
+
+        for (i = 0; i < n_iov; i++)
+            if (mb[i]) {
+                pa_memblock_release(mb[i]);
+                pa_memblock_unref(mb[i]);
+            }
+
+        if (r < 0) {
+            if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
+                pa_log("sendmmsg() failed: %s", pa_cstrerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+#endif
+
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
     struct iovec iov[MAX_IOVECS];
     pa_memblock* mb[MAX_IOVECS];
@@ -74,6 +250,11 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
     if (pa_memblockq_get_length(q) < size)
         return 0;
 
+#ifdef HAVE_SENDMMSG
+    if (c->send_batch > 1)
+        return send_batch(c, size, q);
+#endif
+
     for (;;) {
         int r;
         pa_memchunk chunk;
@@ -154,40 +335,143 @@ pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame
 
     c->fd = fd;
     c->frame_size = frame_size;
+    c->recv_unbatched = false;
+    c->recv_truncated = 0;
 
     pa_memchunk_reset(&c->memchunk);
     return c;
 }
 
+/* Makes sure that at least size bytes are left in c->memchunk */
+static void reserve_memchunk(pa_rtp_context *c, pa_mempool *pool, size_t size) {
+    size_t l;
+
+    if (c->memchunk.length >= size)
+        return;
+
+    if (c->memchunk.memblock)
+        pa_memblock_unref(c->memchunk.memblock);
+
+    l = PA_MAX(size, pa_mempool_block_size_max(pool));
+
+    c->memchunk.memblock = pa_memblock_new(pool, l);
+    c->memchunk.index = 0;
+    c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock);
+}
+
+/* Marks everything in c->memchunk up to index end as used */
+static void consume_memchunk(pa_rtp_context *c, size_t end) {
+    c->memchunk.index = end;
+    c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock) - c->memchunk.index;
+
+    if (c->memchunk.length <= 0) {
+        pa_memblock_unref(c->memchunk.memblock);
+        pa_memchunk_reset(&c->memchunk);
+    }
+}
+
+/* Parses the RTP header at data, which is where p->chunk.index points to,
+ * and adjusts p->chunk to cover just the payload. */
+static int parse_packet(pa_rtp_context *c, pa_rtp_packet *p, const uint8_t *data, size_t size) {
+    uint32_t header;
+    unsigned cc;
+
+    if (size < 12) {
+        pa_log_warn("RTP packet too short.");
+        return -1;
+    }
+
+    memcpy(&header, data, sizeof(uint32_t));
+    memcpy(&p->timestamp, data + 4, sizeof(uint32_t));
+    memcpy(&p->ssrc, data + 8, sizeof(uint32_t));
+
+    header = ntohl(header);
+    p->timestamp = ntohl(p->timestamp);
+    p->ssrc = ntohl(p->ssrc);
+
+    if ((header >> 30) != 2) {
+        pa_log_warn("Unsupported RTP version.");
+        return -1;
+    }
+
+    if ((header >> 29) & 1) {
+        pa_log_warn("RTP padding not supported.");
+        return -1;
+    }
+
+    if ((header >> 28) & 1) {
+        pa_log_warn("RTP header extensions not supported.");
+        return -1;
+    }
+
+    cc = (header >> 24) & 0xF;
+    p->payload = (uint8_t) ((header >> 16) & 127U);
+    p->sequence = (uint16_t) (header & 0xFFFFU);
+
+    if (12 + cc*4 > size) {
+        pa_log_warn("RTP packet too short. (CSRC)");
+        return -1;
+    }
+
+    p->chunk.index += 12 + cc*4;
+    p->chunk.length = size - 12 - cc*4;
+
+    if (p->chunk.length % c->frame_size != 0) {
+        pa_log_warn("Bad RTP packet size.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void find_timestamp(struct msghdr *m, struct timeval *tstamp) {
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR(m); cm; cm = CMSG_NXTHDR(m, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
+            memcpy(tstamp, CMSG_DATA(cm), sizeof(struct timeval));
+            return;
+        }
+
+    pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
+    pa_zero(*tstamp);
+}
+
+/* Returns the size of the next pending packet, or 0 if it is empty */
+static int next_packet_size(pa_rtp_context *c) {
+    int size;
+
+    if (ioctl(c->fd, FIONREAD, &size) < 0) {
+        pa_log_warn("FIONREAD failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return PA_MAX(size, 0);
+}
+
 int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
     int size;
     struct msghdr m;
-    struct cmsghdr *cm;
     struct iovec iov;
-    uint32_t header;
-    unsigned cc;
     ssize_t r;
     uint8_t aux[1024];
-    bool found_tstamp = false;
+    pa_rtp_packet p;
 
     pa_assert(c);
     pa_assert(chunk);
 
     pa_memchunk_reset(chunk);
+    pa_memchunk_reset(&p.chunk);
 
-    if (ioctl(c->fd, FIONREAD, &size) < 0) {
-        pa_log_warn("FIONREAD failed: %s", pa_cstrerror(errno));
+    if ((size = next_packet_size(c)) < 0)
         goto fail;
-    }
 
-    if (size <= 0) {
+    if (size == 0) {
         /* size can be 0 due to any of the following reasons:
          *
          * 1. Somebody sent us a perfectly valid zero-length UDP packet.
          * 2. Somebody sent us a UDP packet with a bad CRC.
          *
-         * It is unknown whether size can actually be less than zero.
-         *
          * In the first case, the packet has to be read out, otherwise the
          * kernel will tell us again and again about it, thus preventing
          * reception of any further packets. So let's just read it out
@@ -204,25 +488,12 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
         size = 1;
     }
 
-    if (c->memchunk.length < (unsigned) size) {
-        size_t l;
-
-        if (c->memchunk.memblock)
-            pa_memblock_unref(c->memchunk.memblock);
-
-        l = PA_MAX((size_t) size, pa_mempool_block_size_max(pool));
-
-        c->memchunk.memblock = pa_memblock_new(pool, l);
-        c->memchunk.index = 0;
-        c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock);
-    }
-
-    pa_assert(c->memchunk.length >= (size_t) size);
+    reserve_memchunk(c, pool, (size_t) size);
 
-    chunk->memblock = pa_memblock_ref(c->memchunk.memblock);
-    chunk->index = c->memchunk.index;
+    p.chunk.memblock = pa_memblock_ref(c->memchunk.memblock);
+    p.chunk.index = c->memchunk.index;
 
-    iov.iov_base = pa_memblock_acquire_chunk(chunk);
+    iov.iov_base = pa_memblock_acquire_chunk(&p.chunk);
     iov.iov_len = (size_t) size;
 
     m.msg_name = NULL;
@@ -234,87 +505,158 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
     m.msg_flags = 0;
 
     r = recvmsg(c->fd, &m, 0);
-    pa_memblock_release(chunk->memblock);
 
     if (r != size) {
+        pa_memblock_release(p.chunk.memblock);
+
         if (r < 0 && errno != EAGAIN && errno != EINTR)
             pa_log_warn("recvmsg() failed: %s", r < 0 ? pa_cstrerror(errno) : "size mismatch");
 
         goto fail;
     }
 
-    if (size < 12) {
-        pa_log_warn("RTP packet too short.");
+    r = parse_packet(c, &p, iov.iov_base, (size_t) size);
+    pa_memblock_release(p.chunk.memblock);
+
+    if (r < 0)
         goto fail;
-    }
 
-    memcpy(&header, iov.iov_base, sizeof(uint32_t));
-    memcpy(&c->timestamp, (uint8_t*) iov.iov_base + 4, sizeof(uint32_t));
-    memcpy(&c->ssrc, (uint8_t*) iov.iov_base + 8, sizeof(uint32_t));
+    c->sequence = p.sequence;
+    c->timestamp = p.timestamp;
+    c->ssrc = p.ssrc;
+    c->payload = p.payload;
 
-    header = ntohl(header);
-    c->timestamp = ntohl(c->timestamp);
-    c->ssrc = ntohl(c->ssrc);
+    consume_memchunk(c, p.chunk.index + p.chunk.length);
+    find_timestamp(&m, tstamp);
 
-    if ((header >> 30) != 2) {
-        pa_log_warn("Unsupported RTP version.");
-        goto fail;
-    }
+    *chunk = p.chunk;
 
-    if ((header >> 29) & 1) {
-        pa_log_warn("RTP padding not supported.");
-        goto fail;
-    }
+    return 0;
 
-    if ((header >> 28) & 1) {
-        pa_log_warn("RTP header extensions not supported.");
-        goto fail;
-    }
+fail:
+    if (p.chunk.memblock)
+        pa_memblock_unref(p.chunk.memblock);
 
-    cc = (header >> 24) & 0xF;
-    c->payload = (uint8_t) ((header >> 16) & 127U);
-    c->sequence = (uint16_t) (header & 0xFFFFU);
+    return -1;
+}
 
-    if (12 + cc*4 > (unsigned) size) {
-        pa_log_warn("RTP packet too short. (CSRC)");
-        goto fail;
+/* Reads a single packet with pa_rtp_recv() */
+static int recv_single(pa_rtp_context *c, pa_rtp_packet *p, pa_mempool *pool) {
+    if (pa_rtp_recv(c, &p->chunk, pool, &p->tstamp) < 0)
+        return -1;
+
+    p->sequence = c->sequence;
+    p->timestamp = c->timestamp;
+    p->ssrc = c->ssrc;
+    p->payload = c->payload;
+
+    return 1;
+}
+
+int pa_rtp_recv_batch(pa_rtp_context *c, pa_rtp_packet *packets, unsigned n, pa_mempool *pool) {
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr m[PA_RTP_RECV_BATCH_MAX];
+    struct iovec iov[PA_RTP_RECV_BATCH_MAX];
+    union {
+        struct cmsghdr cm;
+        uint8_t data[CMSG_SPACE(sizeof(struct timeval))];
+    } aux[PA_RTP_RECV_BATCH_MAX];
+    pa_memblock *b;
+    uint8_t *d;
+    size_t end;
+    unsigned i;
+    int r, size;
+
+    pa_assert(c);
+    pa_assert(packets);
+    pa_assert(n > 0);
+
+    if (c->recv_unbatched)
+        return recv_single(c, &packets[0], pool);
+
+    /* A sender whose packets don't fit into the slots is handled by
+     * pa_rtp_recv(), which sizes every read after the packet */
+    if ((size = next_packet_size(c)) > PA_RTP_RECV_SLOT_SIZE) {
+        pa_log_info("RTP packets larger than %u bytes, reading them one at a time.", (unsigned) PA_RTP_RECV_SLOT_SIZE);
+        c->recv_unbatched = true;
+        return recv_single(c, &packets[0], pool);
     }
 
-    chunk->index += 12 + cc*4;
-    chunk->length = (size_t) size - 12 + cc*4;
+    /* The packets are received right into slots of c->memchunk. Only as
+     * many as fit into what is left of it are read, a new memblock is only
+     * started if not even one does. */
+    if (c->memchunk.length < PA_RTP_RECV_SLOT_SIZE)
+        reserve_memchunk(c, pool, PA_RTP_RECV_BATCH_MAX * PA_RTP_RECV_SLOT_SIZE);
 
-    if (chunk->length % c->frame_size != 0) {
-        pa_log_warn("Bad RTP packet size.");
-        goto fail;
+    n = PA_MIN(n, (unsigned) PA_RTP_RECV_BATCH_MAX);
+    n = PA_MIN(n, (unsigned) (c->memchunk.length / PA_RTP_RECV_SLOT_SIZE));
+
+    b = c->memchunk.memblock;
+    d = pa_memblock_acquire_chunk(&c->memchunk);
+
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = d + i * PA_RTP_RECV_SLOT_SIZE;
+        iov[i].iov_len = PA_RTP_RECV_SLOT_SIZE;
+
+        pa_zero(m[i]);
+        m[i].msg_hdr.msg_iov = &iov[i];
+        m[i].msg_hdr.msg_iovlen = 1;
+        m[i].msg_hdr.msg_control = &aux[i];
+        m[i].msg_hdr.msg_controllen = sizeof(aux[i]);
     }
 
-    c->memchunk.index = chunk->index + chunk->length;
-    c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock) - c->memchunk.index;
+    if ((r = recvmmsg(c->fd, m, n, MSG_DONTWAIT, NULL)) <= 0) {
+        pa_memblock_release(b);
 
-    if (c->memchunk.length <= 0) {
-        pa_memblock_unref(c->memchunk.memblock);
-        pa_memchunk_reset(&c->memchunk);
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            pa_log_warn("recvmmsg() failed: %s", pa_cstrerror(errno));
+
+        return -1;
     }
 
-    for (cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm))
-        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
-            memcpy(tstamp, CMSG_DATA(cm), sizeof(struct timeval));
-            found_tstamp = true;
-            break;
+    for (i = 0; i < (unsigned) r; i++) {
+        pa_rtp_packet *p = &packets[i];
+        size_t length = m[i].msg_len;
+
+        pa_memchunk_reset(&p->chunk);
+
+        /* Empty packets are dropped, see pa_rtp_recv() */
+        if (length <= 0)
+            continue;
+
+        if (m[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            c->recv_truncated++;
+            c->recv_unbatched = true;
+            pa_log_warn("RTP packet larger than %u bytes, dropped (%u so far). Reading packets one at a time from now on.",
+                        (unsigned) PA_RTP_RECV_SLOT_SIZE, c->recv_truncated);
+            continue;
+        }
+
+        p->chunk.index = c->memchunk.index + i * PA_RTP_RECV_SLOT_SIZE;
+
+        if (parse_packet(c, p, iov[i].iov_base, length) < 0) {
+            pa_memchunk_reset(&p->chunk);
+            continue;
         }
 
-    if (!found_tstamp) {
-        pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
-        pa_zero(*tstamp);
+        p->chunk.memblock = pa_memblock_ref(b);
+        find_timestamp(&m[i].msg_hdr, &p->tstamp);
     }
 
-    return 0;
+    pa_memblock_release(b);
 
-fail:
-    if (chunk->memblock)
-        pa_memblock_unref(chunk->memblock);
+    /* The next batch starts after the last packet */
+    end = c->memchunk.index + (size_t) (r - 1) * PA_RTP_RECV_SLOT_SIZE + m[r - 1].msg_len;
+    consume_memchunk(c, end);
 
-    return -1;
+    return r;
+#else
+    pa_assert(c);
+    pa_assert(packets);
+    pa_assert(n > 0);
+
+    return recv_single(c, &packets[0], pool);
+#endif
 }
 
 uint8_t pa_rtp_payload_from_sample_spec(const pa_sample_spec *ss) {
@@ -397,6 +739,7 @@ void pa_rtp_context_destroy(pa_rtp_context *c) {
 
     if (c->memchunk.memblock)
         pa_memblock_unref(c->memchunk.memblock);
+
 }
 
 const char* pa_rtp_format_to_string(pa_sample_format_t f) {
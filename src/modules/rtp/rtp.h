@@ -22,6 +22,7 @@
 
 #include <inttypes.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <pulsecore/memblockq.h>
 #include <pulsecore/memchunk.h>
@@ -34,18 +35,58 @@ typedef struct pa_rtp_context {
     uint8_t payload;
     size_t frame_size;
 
+    unsigned send_batch;
+    bool send_gso;
+
     pa_memchunk memchunk;
+
+    /* Set once a packet didn't fit into a pa_rtp_recv_batch() slot */
+    bool recv_unbatched;
+    unsigned recv_truncated;
 } pa_rtp_context;
 
+/* The most packets pa_rtp_send() will pass to the kernel in one go */
+#define PA_RTP_SEND_BATCH_MAX 64
+
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size);
 
+/* Let pa_rtp_send() hand up to max_packets packets to the kernel with a
+ * single sendmmsg() call, or with UDP segmentation offload if gso is true.
+ * Returns the number of packets that will actually be batched, which is 1
+ * if the system doesn't support it. */
+unsigned pa_rtp_context_set_send_batch(pa_rtp_context *c, unsigned max_packets, bool gso);
+
 /* If the memblockq doesn't have a silence memchunk set, then the caller must
  * guarantee that the current read index doesn't point to a hole. */
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q);
 
+/* The most packets pa_rtp_recv_batch() will read in one go */
+#define PA_RTP_RECV_BATCH_MAX 32
+
+/* pa_rtp_recv_batch() receives every packet into a slot of this size, the
+ * Ethernet MTU. If a packet is larger, it is counted in recv_truncated and
+ * dropped, and pa_rtp_recv_batch() reads one packet at a time from then
+ * on. */
+#define PA_RTP_RECV_SLOT_SIZE 1500
+
+typedef struct pa_rtp_packet {
+    pa_memchunk chunk;
+    uint16_t sequence;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    uint8_t payload;
+    struct timeval tstamp;
+} pa_rtp_packet;
+
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size);
 int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp);
 
+/* Reads up to n (at most PA_RTP_RECV_BATCH_MAX) pending packets without
+ * blocking and returns how many were read, or -1 if there was nothing to
+ * read. Packets that turned out to be invalid are returned with a NULL
+ * chunk.memblock, the caller has to unref the others. */
+int pa_rtp_recv_batch(pa_rtp_context *c, pa_rtp_packet *packets, unsigned n, pa_mempool *pool);
+
 void pa_rtp_context_destroy(pa_rtp_context *c);
 
 pa_sample_spec* pa_rtp_sample_spec_fixup(pa_sample_spec *ss);
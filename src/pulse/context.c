@@ -66,6 +66,10 @@
 #include "internal.h"
 #include "context.h"
 
+/* The server maps only a limited number of memory segments per client,
+ * leave some room for the context's own pool */
+#define MEM_REGIONS_MAX 8
+
 void pa_command_extension(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void pa_command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void pa_command_disable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
@@ -413,6 +417,23 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
 
     if ((s = pa_hashmap_get(c->record_streams, PA_UINT32_TO_PTR(channel)))) {
 
+#ifdef HAVE_OPUS
+        if (s->opus_decoder) {
+            pa_memchunk decoded;
+
+            if (!chunk->memblock || pa_opus_decoder_decode(s->opus_decoder, chunk, &decoded) < 0) {
+                pa_context_fail(c, PA_ERR_PROTOCOL);
+                pa_context_unref(c);
+                return;
+            }
+
+            if (decoded.memblock) {
+                pa_memblockq_seek(s->record_memblockq, offset, seek, true);
+                pa_memblockq_push_align(s->record_memblockq, &decoded);
+                pa_memblock_unref(decoded.memblock);
+            }
+        } else
+#endif
         if (chunk->memblock) {
             pa_memblockq_seek(s->record_memblockq, offset, seek, true);
             pa_memblockq_push_align(s->record_memblockq, chunk);
@@ -1644,3 +1665,127 @@ int pa_context_load_cookie_from_file(pa_context *c, const char *cookie_file_path
 
     return 0;
 }
+
+static void register_mem_region_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    pa_mem_region *r;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    r = o->private;
+    o->private = NULL;
+
+    if (!o->context)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, false) < 0)
+            goto finish;
+
+        pa_mem_region_unref(r);
+        r = NULL;
+    } else if (!pa_tagstruct_eof(t)) {
+        pa_context_fail(o->context, PA_ERR_PROTOCOL);
+        goto finish;
+    }
+
+    if (o->callback) {
+        pa_context_mem_region_cb_t cb = (pa_context_mem_region_cb_t) o->callback;
+        cb(o->context, r, o->userdata);
+    }
+
+finish:
+    if (r)
+        pa_mem_region_unref(r);
+
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+/* Called instead of the above if no reply ever arrives */
+static void register_mem_region_free(pa_operation *o) {
+    pa_assert(o);
+
+    if (o->private)
+        pa_mem_region_unref(o->private);
+
+    pa_operation_unref(o);
+}
+
+pa_operation* pa_context_register_mem_region(pa_context *c, size_t size, pa_context_mem_region_cb_t cb, void *userdata) {
+    pa_operation *o;
+    pa_mem_region *r;
+    pa_mempool *pool;
+    const char *reason;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, size > 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 33, PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, pa_pstream_get_memfd(c->pstream), PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->n_mem_regions < MEM_REGIONS_MAX, PA_ERR_TOOLARGE);
+
+    if (!(pool = pa_mempool_new_user(PA_MEM_TYPE_SHARED_MEMFD, size))) {
+        pa_context_set_error(c, PA_ERR_INTERNAL);
+        return NULL;
+    }
+
+    /* The server replies once it has attached the pool, blocks from it
+     * must not be sent before that, so the region is only handed out
+     * then */
+    tag = c->ctag++;
+    if (pa_pstream_register_memfd_mempool_with_tag(c->pstream, pool, tag, &reason)) {
+        pa_log("Failed to register memory region: %s", reason);
+        pa_mempool_unref(pool);
+        pa_context_set_error(c, PA_ERR_NOTSUPPORTED);
+        return NULL;
+    }
+
+    c->n_mem_regions++;
+
+    r = pa_xnew0(pa_mem_region, 1);
+    PA_REFCNT_INIT(r);
+    r->context = c;
+    r->pool = pool;
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+    o->private = r;
+
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, register_mem_region_callback, pa_operation_ref(o), (pa_free_cb_t) register_mem_region_free);
+
+    return o;
+}
+
+void* pa_mem_region_get_data(pa_mem_region *r, size_t *size) {
+    pa_assert(r);
+    pa_assert(PA_REFCNT_VALUE(r) >= 1);
+    pa_assert(size);
+
+    return pa_mempool_get_user_memory(r->pool, size);
+}
+
+pa_mem_region* pa_mem_region_ref(pa_mem_region *r) {
+    pa_assert(r);
+    pa_assert(PA_REFCNT_VALUE(r) >= 1);
+
+    PA_REFCNT_INC(r);
+    return r;
+}
+
+void pa_mem_region_unref(pa_mem_region *r) {
+    pa_assert(r);
+    pa_assert(PA_REFCNT_VALUE(r) >= 1);
+
+    if (PA_REFCNT_DEC(r) > 0)
+        return;
+
+    /* Blocks that are still in flight keep the pool alive */
+    pa_mempool_unref(r->pool);
+    pa_xfree(r);
+}
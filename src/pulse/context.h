@@ -286,6 +286,40 @@ size_t pa_context_get_tile_size(pa_context *c, const pa_sample_spec *ss);
  * location, feel free to use this function. \since 5.0 */
 int pa_context_load_cookie_from_file(pa_context *c, const char *cookie_file_path);
 
+/** A region of shared memory registered with a context, to write
+ * stream data from without copying it. \since 10.0 */
+typedef struct pa_mem_region pa_mem_region;
+
+/** Called when the registration of a memory region is done. \a r is
+ * NULL if it failed. The region is only valid during the callback, take
+ * a reference with pa_mem_region_ref() to keep it. \since 10.0 */
+typedef void (*pa_context_mem_region_cb_t)(pa_context *c, pa_mem_region *r, void *userdata);
+
+/** Allocate a region of shared memory of at least \a size bytes and
+ * register it with the server. Stream data placed in the region can
+ * then be written with pa_stream_write_mem_region() without being
+ * copied, the server reads it directly from the region. The region is
+ * passed to \a cb once the server has mapped it, data can only be
+ * written from it from then on. This is only possible on connections
+ * that use memfd based shared memory, to servers with protocol version
+ * 33 or newer, otherwise NULL is returned and the error is set to
+ * PA_ERR_NOTSUPPORTED. Only a few regions can be registered per
+ * connection, and the server keeps them mapped until the connection is
+ * closed, so allocate them once and reuse them. \since 10.0 */
+pa_operation* pa_context_register_mem_region(pa_context *c, size_t size, pa_context_mem_region_cb_t cb, void *userdata);
+
+/** Return a pointer to the memory of the region, and its size, which
+ * may be larger than requested, in \a size. \since 10.0 */
+void* pa_mem_region_get_data(pa_mem_region *r, size_t *size);
+
+/** Increase the reference counter of the region by one. \since 10.0 */
+pa_mem_region* pa_mem_region_ref(pa_mem_region *r);
+
+/** Decrease the reference counter of the region by one. The memory is
+ * freed once the last reference is gone and the server is done with
+ * all data written from it. \since 10.0 */
+void pa_mem_region_unref(pa_mem_region *r);
+
 PA_C_DECL_END
 
 #endif
@@ -724,6 +724,28 @@ typedef struct pa_timing_info {
 
 } pa_timing_info;
 
+/** The number of buckets of a pa_io_histogram. \since 10.0 */
+#define PA_IO_HISTOGRAM_BUCKETS 16U
+
+/** A histogram of times measured in the IO thread of a sink or
+ * source. Bucket 0 counts times below 2 usec, bucket i counts times of
+ * at least 2^i usec and below 2^(i+1) usec. The last bucket counts
+ * everything from 2^(PA_IO_HISTOGRAM_BUCKETS-1) usec (about 33 ms)
+ * on. \since 10.0 */
+typedef struct pa_io_histogram {
+    uint64_t count;
+    /**< Number of measurements */
+
+    pa_usec_t total;
+    /**< Sum of all measurements */
+
+    pa_usec_t max;
+    /**< Largest measurement */
+
+    uint32_t buckets[PA_IO_HISTOGRAM_BUCKETS];
+    /**< Number of measurements per bucket */
+} pa_io_histogram;
+
 /** A structure for the spawn api. This may be used to integrate auto
  * spawned daemons into your application. For more information see
  * pa_context_connect(). When spawning a new child process the
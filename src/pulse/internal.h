@@ -44,6 +44,9 @@
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-util.h>
 #endif
+#ifdef HAVE_OPUS
+#include <pulsecore/opus-codec.h>
+#endif
 
 #include "client-conf.h"
 
@@ -104,6 +107,10 @@ struct pa_context {
 
     pa_mem_type_t shm_type;
 
+    /* Regions registered with pa_context_register_mem_region(). The
+     * server keeps them mapped until the connection is closed. */
+    unsigned n_mem_regions;
+
     pa_strlist *server_list;
 
     char *server;
@@ -186,6 +193,12 @@ struct pa_stream {
     void *peek_data;
     pa_memblockq *record_memblockq;
 
+#ifdef HAVE_OPUS
+    /* Set if the negotiated format is PA_ENCODING_OPUS */
+    pa_opus_encoder *opus_encoder;
+    pa_opus_decoder *opus_decoder;
+#endif
+
     /* Store latest latency info */
     pa_timing_info timing_info;
 
@@ -231,6 +244,15 @@ struct pa_stream {
     void *buffer_attr_userdata;
 };
 
+struct pa_mem_region {
+    PA_REFCNT_DECLARE;
+
+    /* Not referenced, only used to check that the region is written
+     * to streams of the context it was registered with */
+    pa_context *context;
+    pa_mempool *pool;
+};
+
 typedef void (*pa_operation_cb_t)(void);
 
 struct pa_operation {
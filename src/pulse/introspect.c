@@ -78,6 +78,125 @@ pa_operation* pa_context_stat(pa_context *c, pa_stat_info_cb_t cb, void *userdat
     return pa_context_send_simple_command(c, PA_COMMAND_STAT, context_stat_callback, (pa_operation_cb_t) cb, userdata);
 }
 
+static int io_histogram_get(pa_tagstruct *t, pa_io_histogram *h) {
+    uint8_t n;
+    unsigned i;
+
+    if (pa_tagstruct_getu64(t, &h->count) < 0 ||
+        pa_tagstruct_get_usec(t, &h->total) < 0 ||
+        pa_tagstruct_get_usec(t, &h->max) < 0 ||
+        pa_tagstruct_getu8(t, &n) < 0)
+        return -1;
+
+    /* Newer servers might send more buckets, the last one we know about
+     * then has to take all of them */
+    for (i = 0; i < n; i++) {
+        uint32_t b;
+
+        if (pa_tagstruct_getu32(t, &b) < 0)
+            return -1;
+
+        h->buckets[PA_MIN(i, PA_IO_HISTOGRAM_BUCKETS - 1)] += b;
+    }
+
+    return 0;
+}
+
+static void context_get_io_stats_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    int eol = 1;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (!o->context)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, false) < 0)
+            goto finish;
+
+        eol = -1;
+    } else {
+
+        while (!pa_tagstruct_eof(t)) {
+            pa_io_stats_info i;
+
+            pa_zero(i);
+
+            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
+                pa_tagstruct_gets(t, &i.name) < 0 ||
+                io_histogram_get(t, &i.render) < 0 ||
+                io_histogram_get(t, &i.lateness) < 0 ||
+                pa_tagstruct_get_usec(t, &i.poll_time) < 0 ||
+                pa_tagstruct_getu64(t, &i.underruns) < 0 ||
+                pa_tagstruct_getu64(t, &i.rewinds) < 0 ||
+                pa_tagstruct_getu64(t, &i.bytes) < 0) {
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                goto finish;
+            }
+
+            if (o->callback) {
+                pa_io_stats_info_cb_t cb = (pa_io_stats_info_cb_t) o->callback;
+                cb(o->context, &i, 0, o->userdata);
+            }
+        }
+    }
+
+    if (o->callback) {
+        pa_io_stats_info_cb_t cb = (pa_io_stats_info_cb_t) o->callback;
+        cb(o->context, NULL, eol, o->userdata);
+    }
+
+finish:
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+static pa_operation* get_io_stats(pa_context *c, uint32_t command, uint32_t idx, pa_io_stats_info_cb_t cb, void *userdata) {
+    pa_tagstruct *t;
+    pa_operation *o;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+    pa_assert(cb);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 33, PA_ERR_NOTSUPPORTED);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, command, &tag);
+    pa_tagstruct_putu32(t, idx);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, context_get_io_stats_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+pa_operation* pa_context_get_sink_io_stats_by_index(pa_context *c, uint32_t idx, pa_io_stats_info_cb_t cb, void *userdata) {
+    PA_CHECK_VALIDITY_RETURN_NULL(c, idx != PA_INVALID_INDEX, PA_ERR_INVALID);
+
+    return get_io_stats(c, PA_COMMAND_GET_SINK_IO_STATS, idx, cb, userdata);
+}
+
+pa_operation* pa_context_get_sink_io_stats_list(pa_context *c, pa_io_stats_info_cb_t cb, void *userdata) {
+    return get_io_stats(c, PA_COMMAND_GET_SINK_IO_STATS, PA_INVALID_INDEX, cb, userdata);
+}
+
+pa_operation* pa_context_get_source_io_stats_by_index(pa_context *c, uint32_t idx, pa_io_stats_info_cb_t cb, void *userdata) {
+    PA_CHECK_VALIDITY_RETURN_NULL(c, idx != PA_INVALID_INDEX, PA_ERR_INVALID);
+
+    return get_io_stats(c, PA_COMMAND_GET_SOURCE_IO_STATS, idx, cb, userdata);
+}
+
+pa_operation* pa_context_get_source_io_stats_list(pa_context *c, pa_io_stats_info_cb_t cb, void *userdata) {
+    return get_io_stats(c, PA_COMMAND_GET_SOURCE_IO_STATS, PA_INVALID_INDEX, cb, userdata);
+}
+
 /*** Server Info ***/
 
 static void context_get_server_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
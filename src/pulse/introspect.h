@@ -77,6 +77,14 @@
  * Statistics about memory usage can be fetched using pa_context_stat(),
  * giving a pa_stat_info structure.
  *
+ * \subsection iostat_subsec IO Thread Timing
+ *
+ * How much time the IO threads of sinks and sources spend rendering,
+ * how late they wake up and how often the devices under- or overrun can
+ * be fetched with pa_context_get_sink_io_stats_list() and
+ * pa_context_get_source_io_stats_list(), giving pa_io_stats_info
+ * structures.
+ *
  * \subsection sinksrc_subsec Sinks and Sources
  *
  * The server can have an arbitrary number of sinks and sources. Each sink
@@ -675,6 +683,36 @@ typedef void (*pa_stat_info_cb_t) (pa_context *c, const pa_stat_info *i, void *u
 /** Get daemon memory block statistics */
 pa_operation* pa_context_stat(pa_context *c, pa_stat_info_cb_t cb, void *userdata);
 
+/** Timing statistics of the IO thread of a sink or source, counted from
+ * when the sink or source was created. Please note that this structure
+ * can be extended as part of evolutionary API updates at any time in
+ * any new release. \since 10.0 */
+typedef struct pa_io_stats_info {
+    uint32_t index;                   /**< Index of the sink or source */
+    const char *name;                 /**< Name of the sink or source */
+    pa_io_histogram render;           /**< Time spent rendering one chunk (sinks) or passing one chunk on to the source outputs (sources), including resampling */
+    pa_io_histogram lateness;         /**< How much later than its timer asked for the IO thread woke up. This belongs to the thread, so it is shared by all sinks and sources that run in it */
+    pa_usec_t poll_time;              /**< Total time the IO thread spent waiting for something to do. Shared like lateness */
+    uint64_t underruns;               /**< Number of underruns (sinks) or overruns (sources) of the device */
+    uint64_t rewinds;                 /**< Number of rewinds */
+    uint64_t bytes;                   /**< Number of bytes rendered (sinks) or captured (sources) */
+} pa_io_stats_info;
+
+/** Callback prototype for pa_context_get_sink_io_stats_list() and friends. \since 10.0 */
+typedef void (*pa_io_stats_info_cb_t) (pa_context *c, const pa_io_stats_info *i, int eol, void *userdata);
+
+/** Get the IO thread statistics of a sink by its index. \since 10.0 */
+pa_operation* pa_context_get_sink_io_stats_by_index(pa_context *c, uint32_t idx, pa_io_stats_info_cb_t cb, void *userdata);
+
+/** Get the IO thread statistics of all sinks. \since 10.0 */
+pa_operation* pa_context_get_sink_io_stats_list(pa_context *c, pa_io_stats_info_cb_t cb, void *userdata);
+
+/** Get the IO thread statistics of a source by its index. \since 10.0 */
+pa_operation* pa_context_get_source_io_stats_by_index(pa_context *c, uint32_t idx, pa_io_stats_info_cb_t cb, void *userdata);
+
+/** Get the IO thread statistics of all sources. \since 10.0 */
+pa_operation* pa_context_get_source_io_stats_list(pa_context *c, pa_io_stats_info_cb_t cb, void *userdata);
+
 /** @} */
 
 /** @{ \name Cached Samples */
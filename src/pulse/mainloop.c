@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <errno.h>
 
@@ -32,6 +33,10 @@
 #include <pulsecore/pipe.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
@@ -72,6 +77,10 @@ struct pa_time_event {
     bool use_rtclock:1;
     pa_usec_t time;
 
+    /* Position in the time event heap, only valid while enabled */
+    unsigned heap_index;
+    unsigned dispatch_serial;
+
     pa_time_event_cb_t callback;
     void *userdata;
     pa_time_event_destroy_cb_t destroy_callback;
@@ -104,8 +113,28 @@ struct pa_mainloop {
     struct pollfd *pollfds;
     unsigned max_pollfds, n_pollfds;
 
+#ifdef HAVE_SYS_EPOLL_H
+    /* When epoll_fd is valid, io events are registered with it as they
+     * come and go, and the pollfd array is not used at all */
+    int epoll_fd;
+    struct epoll_event *epoll_events;
+    unsigned max_epoll_events;
+    bool polled_with_epoll:1;
+
+    /* The io event registered with epoll for each fd. epoll only knows the
+     * fd, which may have been closed and reused by a newer io event by the
+     * time the old one is changed or freed. */
+    pa_io_event **epoll_registered;
+    unsigned max_epoll_registered;
+#endif
+
     pa_usec_t prepared_timeout;
-    pa_time_event *cached_next_time_event;
+
+    /* The enabled time events, as a binary min-heap ordered by time. It
+     * holds n_enabled_time_events entries. */
+    pa_time_event **time_event_heap;
+    unsigned max_time_event_heap;
+    unsigned dispatch_serial;
 
     pa_mainloop_api api;
 
@@ -144,6 +173,98 @@ static pa_io_event_flags_t map_flags_from_libc(short flags) {
         (flags & POLLHUP ? PA_IO_EVENT_HANGUP : 0);
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static uint32_t map_flags_to_epoll(pa_io_event_flags_t flags) {
+    return
+        (flags & PA_IO_EVENT_INPUT ? EPOLLIN : 0) |
+        (flags & PA_IO_EVENT_OUTPUT ? EPOLLOUT : 0) |
+        (flags & PA_IO_EVENT_ERROR ? EPOLLERR : 0) |
+        (flags & PA_IO_EVENT_HANGUP ? EPOLLHUP : 0);
+}
+
+static pa_io_event_flags_t map_flags_from_epoll(uint32_t flags) {
+    return
+        (flags & EPOLLIN ? PA_IO_EVENT_INPUT : 0) |
+        (flags & EPOLLOUT ? PA_IO_EVENT_OUTPUT : 0) |
+        (flags & EPOLLERR ? PA_IO_EVENT_ERROR : 0) |
+        (flags & EPOLLHUP ? PA_IO_EVENT_HANGUP : 0);
+}
+
+/* Go back to poll() for good */
+static void disable_epoll(pa_mainloop *m) {
+    if (m->epoll_fd < 0)
+        return;
+
+    pa_close(m->epoll_fd);
+    m->epoll_fd = -1;
+    m->rebuild_pollfds = true;
+}
+
+static void init_epoll(pa_mainloop *m) {
+    struct epoll_event ev;
+
+    if ((m->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        pa_log_debug("epoll_create1() failed, using poll(): %s", pa_cstrerror(errno));
+        return;
+    }
+
+    /* The wakeup pipe is the only fd without an io event */
+    pa_zero(ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->wakeup_pipe[0], &ev) < 0) {
+        pa_log_debug("epoll_ctl() failed, using poll(): %s", pa_cstrerror(errno));
+        disable_epoll(m);
+    }
+}
+
+static void update_epoll(pa_mainloop *m, int op, pa_io_event *e) {
+    struct epoll_event ev;
+    unsigned fd = (unsigned) e->fd;
+
+    if (m->epoll_fd < 0)
+        return;
+
+    if (op == EPOLL_CTL_ADD) {
+        if (fd >= m->max_epoll_registered) {
+            unsigned l = PA_MAX(fd + 1, 2 * m->max_epoll_registered);
+
+            m->epoll_registered = pa_xrealloc(m->epoll_registered, sizeof(pa_io_event *) * l);
+            memset(m->epoll_registered + m->max_epoll_registered, 0,
+                   sizeof(pa_io_event *) * (l - m->max_epoll_registered));
+            m->max_epoll_registered = l;
+        }
+    } else if (fd >= m->max_epoll_registered || m->epoll_registered[fd] != e) {
+        /* The fd was closed, which dropped it from the epoll set, and is now
+         * used by another io event. Removing or changing it would hit that
+         * one, and if the old file is still open through a dup() epoll might
+         * report it for an event that is about to be freed. */
+        pa_log_debug("fd %i was closed before its io event was freed, falling back to poll()", e->fd);
+        disable_epoll(m);
+        return;
+    }
+
+    pa_zero(ev);
+    ev.events = map_flags_to_epoll(e->events);
+    ev.data.ptr = e;
+
+    /* epoll can't watch the same fd for two io events, or fds like regular
+     * files, and we can't remove an fd that was closed before its io event
+     * was freed. poll() doesn't mind any of this, so just switch over. */
+    if (epoll_ctl(m->epoll_fd, op, e->fd, &ev) < 0) {
+        pa_log_debug("epoll_ctl() failed for fd %i, falling back to poll(): %s", e->fd, pa_cstrerror(errno));
+        disable_epoll(m);
+        return;
+    }
+
+    if (op == EPOLL_CTL_ADD)
+        m->epoll_registered[fd] = e;
+    else if (op == EPOLL_CTL_DEL)
+        m->epoll_registered[fd] = NULL;
+}
+#endif
+
 /* IO events */
 static pa_io_event* mainloop_io_new(
         pa_mainloop_api *a,
@@ -176,6 +297,10 @@ static pa_io_event* mainloop_io_new(
     m->rebuild_pollfds = true;
     m->n_io_events ++;
 
+#ifdef HAVE_SYS_EPOLL_H
+    update_epoll(m, EPOLL_CTL_ADD, e);
+#endif
+
     pa_mainloop_wakeup(m);
 
     return e;
@@ -195,6 +320,10 @@ static void mainloop_io_enable(pa_io_event *e, pa_io_event_flags_t events) {
     else
         e->mainloop->rebuild_pollfds = true;
 
+#ifdef HAVE_SYS_EPOLL_H
+    update_epoll(e->mainloop, EPOLL_CTL_MOD, e);
+#endif
+
     pa_mainloop_wakeup(e->mainloop);
 }
 
@@ -208,6 +337,10 @@ static void mainloop_io_free(pa_io_event *e) {
     e->mainloop->n_io_events --;
     e->mainloop->rebuild_pollfds = true;
 
+#ifdef HAVE_SYS_EPOLL_H
+    update_epoll(e->mainloop, EPOLL_CTL_DEL, e);
+#endif
+
     pa_mainloop_wakeup(e->mainloop);
 }
 
@@ -286,6 +419,89 @@ static void mainloop_defer_set_destroy(pa_defer_event *e, pa_defer_event_destroy
 }
 
 /* Time events */
+static void heap_set(pa_mainloop *m, unsigned i, pa_time_event *e) {
+    m->time_event_heap[i] = e;
+    e->heap_index = i;
+}
+
+static void heap_sift_up(pa_mainloop *m, unsigned i) {
+    pa_time_event *e = m->time_event_heap[i];
+
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+
+        if (m->time_event_heap[parent]->time <= e->time)
+            break;
+
+        heap_set(m, i, m->time_event_heap[parent]);
+        i = parent;
+    }
+
+    heap_set(m, i, e);
+}
+
+static void heap_sift_down(pa_mainloop *m, unsigned i) {
+    pa_time_event *e = m->time_event_heap[i];
+    unsigned n = m->n_enabled_time_events;
+
+    for (;;) {
+        unsigned child = 2 * i + 1;
+
+        if (child >= n)
+            break;
+
+        if (child + 1 < n && m->time_event_heap[child + 1]->time < m->time_event_heap[child]->time)
+            child++;
+
+        if (e->time <= m->time_event_heap[child]->time)
+            break;
+
+        heap_set(m, i, m->time_event_heap[child]);
+        i = child;
+    }
+
+    heap_set(m, i, e);
+}
+
+static void heap_insert(pa_mainloop *m, pa_time_event *e) {
+    if (m->n_enabled_time_events >= m->max_time_event_heap) {
+        m->max_time_event_heap = PA_MAX(16U, m->max_time_event_heap * 2);
+        m->time_event_heap = pa_xrealloc(m->time_event_heap, sizeof(pa_time_event*) * m->max_time_event_heap);
+    }
+
+    heap_set(m, m->n_enabled_time_events++, e);
+    heap_sift_up(m, e->heap_index);
+}
+
+static void heap_remove(pa_mainloop *m, pa_time_event *e) {
+    unsigned i = e->heap_index;
+    pa_time_event *last;
+
+    pa_assert(m->n_enabled_time_events > 0);
+    pa_assert(m->time_event_heap[i] == e);
+
+    last = m->time_event_heap[--m->n_enabled_time_events];
+
+    if (last == e)
+        return;
+
+    /* Put the last entry into the gap, and move it to where it belongs */
+    heap_set(m, i, last);
+
+    if (i > 0 && m->time_event_heap[(i - 1) / 2]->time > last->time)
+        heap_sift_up(m, i);
+    else
+        heap_sift_down(m, i);
+}
+
+/* Call after changing the time of an enabled event */
+static void heap_update(pa_mainloop *m, pa_time_event *e, pa_usec_t old_time) {
+    if (e->time < old_time)
+        heap_sift_up(m, e->heap_index);
+    else if (e->time > old_time)
+        heap_sift_down(m, e->heap_index);
+}
+
 static pa_usec_t make_rt(const struct timeval *tv, bool *use_rtclock) {
     struct timeval ttv;
 
@@ -332,14 +548,7 @@ static pa_time_event* mainloop_time_new(
         e->time = t;
         e->use_rtclock = use_rtclock;
 
-        m->n_enabled_time_events++;
-
-        if (m->cached_next_time_event) {
-            pa_assert(m->cached_next_time_event->enabled);
-
-            if (t < m->cached_next_time_event->time)
-                m->cached_next_time_event = e;
-        }
+        heap_insert(m, e);
     }
 
     e->callback = callback;
@@ -364,27 +573,28 @@ static void mainloop_time_restart(pa_time_event *e, const struct timeval *tv) {
     t = make_rt(tv, &use_rtclock);
 
     valid = (t != PA_USEC_INVALID);
-    if (e->enabled && !valid) {
-        pa_assert(e->mainloop->n_enabled_time_events > 0);
-        e->mainloop->n_enabled_time_events--;
-    } else if (!e->enabled && valid)
-        e->mainloop->n_enabled_time_events++;
 
-    if ((e->enabled = valid)) {
-        e->time = t;
-        e->use_rtclock = use_rtclock;
-        pa_mainloop_wakeup(e->mainloop);
-    }
+    if (!valid) {
+        if (e->enabled)
+            heap_remove(e->mainloop, e);
 
-    if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
+        e->enabled = false;
+        return;
+    }
 
-    if (e->mainloop->cached_next_time_event && e->enabled) {
-        pa_assert(e->mainloop->cached_next_time_event->enabled);
+    if (e->enabled) {
+        pa_usec_t old_time = e->time;
 
-        if (t < e->mainloop->cached_next_time_event->time)
-            e->mainloop->cached_next_time_event = e;
+        e->time = t;
+        heap_update(e->mainloop, e, old_time);
+    } else {
+        e->time = t;
+        e->enabled = true;
+        heap_insert(e->mainloop, e);
     }
+
+    e->use_rtclock = use_rtclock;
+    pa_mainloop_wakeup(e->mainloop);
 }
 
 static void mainloop_time_free(pa_time_event *e) {
@@ -395,14 +605,10 @@ static void mainloop_time_free(pa_time_event *e) {
     e->mainloop->time_events_please_scan ++;
 
     if (e->enabled) {
-        pa_assert(e->mainloop->n_enabled_time_events > 0);
-        e->mainloop->n_enabled_time_events--;
+        heap_remove(e->mainloop, e);
         e->enabled = false;
     }
 
-    if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
-
     /* no wakeup needed here. Think about it! */
 }
 
@@ -465,6 +671,10 @@ pa_mainloop *pa_mainloop_new(void) {
 
     m->rebuild_pollfds = true;
 
+#ifdef HAVE_SYS_EPOLL_H
+    init_epoll(m);
+#endif
+
     m->api = vtable;
     m->api.userdata = m;
 
@@ -520,8 +730,7 @@ static void cleanup_time_events(pa_mainloop *m, bool force) {
             }
 
             if (!e->dead && e->enabled) {
-                pa_assert(m->n_enabled_time_events > 0);
-                m->n_enabled_time_events--;
+                heap_remove(m, e);
                 e->enabled = false;
             }
 
@@ -575,6 +784,13 @@ void pa_mainloop_free(pa_mainloop *m) {
     cleanup_time_events(m, true);
 
     pa_xfree(m->pollfds);
+    pa_xfree(m->time_event_heap);
+
+#ifdef HAVE_SYS_EPOLL_H
+    disable_epoll(m);
+    pa_xfree(m->epoll_events);
+    pa_xfree(m->epoll_registered);
+#endif
 
     pa_close_pipe(m->wakeup_pipe);
 
@@ -661,6 +877,35 @@ static unsigned dispatch_pollfds(pa_mainloop *m) {
     return r;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static unsigned dispatch_epoll(pa_mainloop *m) {
+    unsigned r = 0;
+    int i;
+
+    pa_assert(m->poll_func_ret > 0);
+
+    for (i = 0; i < m->poll_func_ret; i++) {
+        pa_io_event *e = m->epoll_events[i].data.ptr;
+
+        if (m->quit)
+            break;
+
+        /* NULL is the wakeup pipe, which is drained in pa_mainloop_prepare().
+         * Events freed by an earlier callback are still around until the
+         * next scan_dead(). */
+        if (!e || e->dead)
+            continue;
+
+        pa_assert(e->callback);
+
+        e->callback(&m->api, e, e->fd, map_flags_from_epoll(m->epoll_events[i].events), e->userdata);
+        r++;
+    }
+
+    return r;
+}
+#endif
+
 static unsigned dispatch_defer(pa_mainloop *m) {
     pa_defer_event *e;
     unsigned r = 0;
@@ -685,28 +930,12 @@ static unsigned dispatch_defer(pa_mainloop *m) {
 }
 
 static pa_time_event* find_next_time_event(pa_mainloop *m) {
-    pa_time_event *t, *n = NULL;
     pa_assert(m);
 
-    if (m->cached_next_time_event)
-        return m->cached_next_time_event;
-
-    PA_LLIST_FOREACH(t, m->time_events) {
-
-        if (t->dead || !t->enabled)
-            continue;
-
-        if (!n || t->time < n->time) {
-            n = t;
-
-            /* Shortcut for time == 0 */
-            if (n->time == 0)
-                break;
-        }
-    }
+    if (m->n_enabled_time_events <= 0)
+        return NULL;
 
-    m->cached_next_time_event = n;
-    return n;
+    return m->time_event_heap[0];
 }
 
 static pa_usec_t calc_next_timeout(pa_mainloop *m) {
@@ -740,25 +969,28 @@ static unsigned dispatch_timeout(pa_mainloop *m) {
 
     now = pa_rtclock_now();
 
-    PA_LLIST_FOREACH(e, m->time_events) {
+    /* Every event is dispatched at most once per iteration, an event
+     * that is restarted into the past by its callback has to wait for
+     * the next one. */
+    m->dispatch_serial++;
 
-        if (m->quit)
+    while ((e = find_next_time_event(m)) && e->time <= now) {
+        struct timeval tv;
+
+        if (m->quit || e->dispatch_serial == m->dispatch_serial)
             break;
 
-        if (e->dead || !e->enabled)
-            continue;
+        pa_assert(!e->dead);
+        pa_assert(e->callback);
 
-        if (e->time <= now) {
-            struct timeval tv;
-            pa_assert(e->callback);
+        e->dispatch_serial = m->dispatch_serial;
 
-            /* Disable time event */
-            mainloop_time_restart(e, NULL);
+        /* Disable time event */
+        mainloop_time_restart(e, NULL);
 
-            e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
+        e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
 
-            r++;
-        }
+        r++;
     }
 
     return r;
@@ -794,6 +1026,17 @@ int pa_mainloop_prepare(pa_mainloop *m, int timeout) {
 
     if (m->n_enabled_defer_events <= 0) {
 
+#ifdef HAVE_SYS_EPOLL_H
+        if (m->epoll_fd >= 0) {
+            unsigned l = m->n_io_events + 1;
+
+            if (m->max_epoll_events < l) {
+                l *= 2;
+                m->epoll_events = pa_xrealloc(m->epoll_events, sizeof(struct epoll_event)*l);
+                m->max_epoll_events = l;
+            }
+        } else
+#endif
         if (m->rebuild_pollfds)
             rebuild_pollfds(m);
 
@@ -835,8 +1078,27 @@ int pa_mainloop_poll(pa_mainloop *m) {
 
     m->state = STATE_POLLING;
 
+#ifdef HAVE_SYS_EPOLL_H
+    m->polled_with_epoll = false;
+#endif
+
     if (m->n_enabled_defer_events)
         m->poll_func_ret = 0;
+#ifdef HAVE_SYS_EPOLL_H
+    else if (m->epoll_fd >= 0) {
+        m->polled_with_epoll = true;
+        m->poll_func_ret = epoll_wait(
+                m->epoll_fd, m->epoll_events, (int) m->max_epoll_events,
+                usec_to_timeout(m->prepared_timeout));
+
+        if (m->poll_func_ret < 0) {
+            if (errno == EINTR)
+                m->poll_func_ret = 0;
+            else
+                pa_log("epoll_wait(): %s", pa_cstrerror(errno));
+        }
+    }
+#endif
     else {
         pa_assert(!m->rebuild_pollfds);
 
@@ -894,8 +1156,14 @@ int pa_mainloop_dispatch(pa_mainloop *m) {
         if (m->quit)
             goto quit;
 
-        if (m->poll_func_ret > 0)
-            dispatched += dispatch_pollfds(m);
+        if (m->poll_func_ret > 0) {
+#ifdef HAVE_SYS_EPOLL_H
+            if (m->polled_with_epoll)
+                dispatched += dispatch_epoll(m);
+            else
+#endif
+                dispatched += dispatch_pollfds(m);
+        }
     }
 
     if (m->quit)
@@ -969,6 +1237,12 @@ void pa_mainloop_set_poll_func(pa_mainloop *m, pa_poll_func poll_func, void *use
 
     m->poll_func = poll_func;
     m->poll_func_userdata = userdata;
+
+#ifdef HAVE_SYS_EPOLL_H
+    /* The poll function wants to see the pollfd array */
+    if (poll_func)
+        disable_epoll(m);
+#endif
 }
 
 bool pa_mainloop_is_our_api(pa_mainloop_api *m) {
@@ -177,6 +177,11 @@ static pa_stream *pa_stream_new_with_proplist_internal(
     s->peek_data = NULL;
     s->record_memblockq = NULL;
 
+#ifdef HAVE_OPUS
+    s->opus_encoder = NULL;
+    s->opus_decoder = NULL;
+#endif
+
     memset(&s->timing_info, 0, sizeof(s->timing_info));
     s->timing_info_valid = false;
 
@@ -299,6 +304,14 @@ static void stream_free(pa_stream *s) {
     if (s->record_memblockq)
         pa_memblockq_free(s->record_memblockq);
 
+#ifdef HAVE_OPUS
+    if (s->opus_encoder)
+        pa_opus_encoder_free(s->opus_encoder);
+
+    if (s->opus_decoder)
+        pa_opus_decoder_free(s->opus_decoder);
+#endif
+
     if (s->proplist)
         pa_proplist_free(s->proplist);
 
@@ -1155,6 +1168,36 @@ void pa_create_stream_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag,
         goto finish;
     }
 
+    if (s->format && s->format->encoding == PA_ENCODING_OPUS) {
+        /* The server only picks Opus if we offered it, and it is only
+         * ever used on the wire */
+#ifdef HAVE_OPUS
+        if (s->direction == PA_STREAM_PLAYBACK)
+            s->opus_encoder = pa_opus_encoder_new(s->context->mempool, s->format);
+        else
+            s->opus_decoder = pa_opus_decoder_new(s->context->mempool, s->format);
+
+        if (!s->opus_encoder && !s->opus_decoder)
+#endif
+        {
+            pa_tagstruct *cmd;
+            uint32_t cmd_tag;
+
+            /* Only this stream is affected, so let the server delete it
+             * again and fail just the stream */
+            cmd = pa_tagstruct_command(
+                    s->context,
+                    (uint32_t) (s->direction == PA_STREAM_PLAYBACK ? PA_COMMAND_DELETE_PLAYBACK_STREAM : PA_COMMAND_DELETE_RECORD_STREAM),
+                    &cmd_tag);
+            pa_tagstruct_putu32(cmd, s->channel);
+            pa_pstream_send_tagstruct(s->context->pstream, cmd);
+
+            pa_context_set_error(s->context, PA_ERR_NOTSUPPORTED);
+            pa_stream_set_state(s, PA_STREAM_FAILED);
+            goto finish;
+        }
+    }
+
     if (s->direction == PA_STREAM_RECORD) {
         pa_assert(!s->record_memblockq);
 
@@ -1179,6 +1222,29 @@ finish:
     pa_stream_unref(s);
 }
 
+/* Whether we can offer the format to the server. Opus is only ever used
+ * on the wire, so we have to be able to encode and decode it ourselves. */
+static bool format_usable(pa_stream *s, const pa_format_info *f) {
+    if (f->encoding != PA_ENCODING_OPUS)
+        return true;
+
+#ifdef HAVE_OPUS
+    return s->context->version >= 33;
+#else
+    return false;
+#endif
+}
+
+static unsigned n_usable_formats(pa_stream *s) {
+    unsigned i, n = 0;
+
+    for (i = 0; i < s->n_formats; i++)
+        if (format_usable(s, s->req_formats[i]))
+            n++;
+
+    return n;
+}
+
 static int create_stream(
         pa_stream_direction_t direction,
         pa_stream *s,
@@ -1233,6 +1299,7 @@ static int create_stream(
     PA_CHECK_VALIDITY(s->context, direction == PA_STREAM_RECORD || !(flags & (PA_STREAM_PEAK_DETECT)), PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context, !sync_stream || (direction == PA_STREAM_PLAYBACK && sync_stream->direction == PA_STREAM_PLAYBACK), PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context, (flags & (PA_STREAM_ADJUST_LATENCY|PA_STREAM_EARLY_REQUESTS)) != (PA_STREAM_ADJUST_LATENCY|PA_STREAM_EARLY_REQUESTS), PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, s->n_formats == 0 || n_usable_formats(s) > 0, PA_ERR_NOTSUPPORTED);
 
     pa_stream_ref(s);
 
@@ -1365,9 +1432,10 @@ static int create_stream(
     if ((s->context->version >= 21 && s->direction == PA_STREAM_PLAYBACK)
         || s->context->version >= 22) {
 
-        pa_tagstruct_putu8(t, s->n_formats);
+        pa_tagstruct_putu8(t, (uint8_t) n_usable_formats(s));
         for (i = 0; i < s->n_formats; i++)
-            pa_tagstruct_put_format_info(t, s->req_formats[i]);
+            if (format_usable(s, s->req_formats[i]))
+                pa_tagstruct_put_format_info(t, s->req_formats[i]);
     }
 
     if (s->context->version >= 22 && s->direction == PA_STREAM_RECORD) {
@@ -1471,6 +1539,51 @@ int pa_stream_cancel_write(
     return 0;
 }
 
+static void stream_written(pa_stream *s, size_t length, int64_t offset, pa_seek_mode_t seek) {
+    pa_assert(s);
+
+    /* This is obviously wrong since we ignore the seeking index . But
+     * that's OK, the server side applies the same error */
+    s->requested_bytes -= (seek == PA_SEEK_RELATIVE ? offset : 0) + (int64_t) length;
+
+#ifdef STREAM_DEBUG
+    pa_log_debug("wrote %lli, now at %lli", (long long) length, (long long) s->requested_bytes);
+#endif
+
+    if (s->direction == PA_STREAM_PLAYBACK) {
+
+        /* Update latency request correction */
+        if (s->write_index_corrections[s->current_write_index_correction].valid) {
+
+            if (seek == PA_SEEK_ABSOLUTE) {
+                s->write_index_corrections[s->current_write_index_correction].corrupt = false;
+                s->write_index_corrections[s->current_write_index_correction].absolute = true;
+                s->write_index_corrections[s->current_write_index_correction].value = offset + (int64_t) length;
+            } else if (seek == PA_SEEK_RELATIVE) {
+                if (!s->write_index_corrections[s->current_write_index_correction].corrupt)
+                    s->write_index_corrections[s->current_write_index_correction].value += offset + (int64_t) length;
+            } else
+                s->write_index_corrections[s->current_write_index_correction].corrupt = true;
+        }
+
+        /* Update the write index in the already available latency data */
+        if (s->timing_info_valid) {
+
+            if (seek == PA_SEEK_ABSOLUTE) {
+                s->timing_info.write_index_corrupt = false;
+                s->timing_info.write_index = offset + (int64_t) length;
+            } else if (seek == PA_SEEK_RELATIVE) {
+                if (!s->timing_info.write_index_corrupt)
+                    s->timing_info.write_index += offset + (int64_t) length;
+            } else
+                s->timing_info.write_index_corrupt = true;
+        }
+
+        if (!s->timing_info_valid || s->timing_info.write_index_corrupt)
+            request_auto_timing_update(s, true);
+    }
+}
+
 int pa_stream_write_ext_free(
         pa_stream *s,
         const void *data,
@@ -1497,7 +1610,41 @@ int pa_stream_write_ext_free(
     PA_CHECK_VALIDITY(s->context, offset % pa_frame_size(&s->sample_spec) == 0, PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context, length % pa_frame_size(&s->sample_spec) == 0, PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context, !free_cb || !s->write_memblock, PA_ERR_INVALID);
+#ifdef HAVE_OPUS
+    PA_CHECK_VALIDITY(s->context, !s->opus_encoder || (seek == PA_SEEK_RELATIVE && offset == 0), PA_ERR_NOTSUPPORTED);
+
+    if (s->opus_encoder) {
+        pa_memchunk chunk, encoded;
+
+        /* Only the encoded data goes to the server, so we never need
+         * to keep the PCM around */
+        if (s->write_memblock) {
+            pa_memblock_release(s->write_memblock);
+
+            chunk.memblock = s->write_memblock;
+            chunk.index = (const char *) data - (const char *) s->write_data;
+
+            s->write_memblock = NULL;
+            s->write_data = NULL;
+        } else {
+            chunk.memblock = pa_memblock_new_fixed(s->context->mempool, (void*) data, length, true);
+            chunk.index = 0;
+        }
+
+        chunk.length = length;
+        pa_opus_encoder_encode(s->opus_encoder, &chunk, &encoded);
+        pa_memblock_unref(chunk.memblock);
+
+        if (encoded.memblock) {
+            pa_pstream_send_memblock(s->context->pstream, s->channel, 0, PA_SEEK_RELATIVE, &encoded);
+            pa_memblock_unref(encoded.memblock);
+        }
 
+        if (free_cb)
+            free_cb(free_cb_data);
+
+    } else
+#endif
     if (s->write_memblock) {
         pa_memchunk chunk;
 
@@ -1561,46 +1708,7 @@ int pa_stream_write_ext_free(
             free_cb(free_cb_data);
     }
 
-    /* This is obviously wrong since we ignore the seeking index . But
-     * that's OK, the server side applies the same error */
-    s->requested_bytes -= (seek == PA_SEEK_RELATIVE ? offset : 0) + (int64_t) length;
-
-#ifdef STREAM_DEBUG
-    pa_log_debug("wrote %lli, now at %lli", (long long) length, (long long) s->requested_bytes);
-#endif
-
-    if (s->direction == PA_STREAM_PLAYBACK) {
-
-        /* Update latency request correction */
-        if (s->write_index_corrections[s->current_write_index_correction].valid) {
-
-            if (seek == PA_SEEK_ABSOLUTE) {
-                s->write_index_corrections[s->current_write_index_correction].corrupt = false;
-                s->write_index_corrections[s->current_write_index_correction].absolute = true;
-                s->write_index_corrections[s->current_write_index_correction].value = offset + (int64_t) length;
-            } else if (seek == PA_SEEK_RELATIVE) {
-                if (!s->write_index_corrections[s->current_write_index_correction].corrupt)
-                    s->write_index_corrections[s->current_write_index_correction].value += offset + (int64_t) length;
-            } else
-                s->write_index_corrections[s->current_write_index_correction].corrupt = true;
-        }
-
-        /* Update the write index in the already available latency data */
-        if (s->timing_info_valid) {
-
-            if (seek == PA_SEEK_ABSOLUTE) {
-                s->timing_info.write_index_corrupt = false;
-                s->timing_info.write_index = offset + (int64_t) length;
-            } else if (seek == PA_SEEK_RELATIVE) {
-                if (!s->timing_info.write_index_corrupt)
-                    s->timing_info.write_index += offset + (int64_t) length;
-            } else
-                s->timing_info.write_index_corrupt = true;
-        }
-
-        if (!s->timing_info_valid || s->timing_info.write_index_corrupt)
-            request_auto_timing_update(s, true);
-    }
+    stream_written(s, length, offset, seek);
 
     return 0;
 }
@@ -1616,6 +1724,55 @@ int pa_stream_write(
     return pa_stream_write_ext_free(s, data, length, free_cb, (void*) data, offset, seek);
 }
 
+int pa_stream_write_mem_region(
+        pa_stream *s,
+        pa_mem_region *r,
+        size_t region_offset,
+        size_t length,
+        pa_free_cb_t free_cb,
+        void *free_cb_data,
+        int64_t offset,
+        pa_seek_mode_t seek) {
+
+    pa_memchunk chunk;
+    size_t size;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(r);
+    pa_assert(PA_REFCNT_VALUE(r) >= 1);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, !s->write_memblock, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, r->context == s->context, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, seek <= PA_SEEK_RELATIVE_END, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || (seek == PA_SEEK_RELATIVE && offset == 0), PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, offset % pa_frame_size(&s->sample_spec) == 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, length > 0 && length % pa_frame_size(&s->sample_spec) == 0, PA_ERR_INVALID);
+#ifdef HAVE_OPUS
+    PA_CHECK_VALIDITY(s->context, !s->opus_encoder, PA_ERR_NOTSUPPORTED);
+#endif
+
+    pa_mempool_get_user_memory(r->pool, &size);
+    PA_CHECK_VALIDITY(s->context, region_offset < size && length <= size - region_offset, PA_ERR_INVALID);
+
+    /* The block is passed to the server as a reference into the
+     * region. It is freed, and free_cb called, once the server
+     * released all parts of it. */
+    chunk.memblock = pa_memblock_new_pool_user(r->pool, region_offset, length, free_cb, free_cb_data);
+    chunk.index = 0;
+    chunk.length = length;
+
+    pa_pstream_send_memblock(s->context->pstream, s->channel, offset, seek, &chunk);
+    pa_memblock_unref(chunk.memblock);
+
+    stream_written(s, length, offset, seek);
+
+    return 0;
+}
+
 int pa_stream_peek(pa_stream *s, const void **data, size_t *length) {
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
@@ -1717,6 +1874,21 @@ pa_operation * pa_stream_drain(pa_stream *s, pa_stream_success_cb_t cb, void *us
      * check_smoother_status() call in the started callback */
     request_auto_timing_update(s, true);
 
+#ifdef HAVE_OPUS
+    if (s->opus_encoder) {
+        pa_memchunk encoded;
+
+        /* Make sure that the end of the stream gets played too, even if
+         * it doesn't fill a whole Opus frame */
+        pa_opus_encoder_flush(s->opus_encoder, &encoded);
+
+        if (encoded.memblock) {
+            pa_pstream_send_memblock(s->context->pstream, s->channel, 0, PA_SEEK_RELATIVE, &encoded);
+            pa_memblock_unref(encoded.memblock);
+        }
+    }
+#endif
+
     o = pa_operation_new(s->context, s, (pa_operation_cb_t) cb, userdata);
 
     t = pa_tagstruct_command(s->context, PA_COMMAND_DRAIN_PLAYBACK_STREAM, &tag);
@@ -2343,6 +2515,11 @@ pa_operation* pa_stream_flush(pa_stream *s, pa_stream_success_cb_t cb, void *use
 
     if (s->direction == PA_STREAM_PLAYBACK) {
 
+#ifdef HAVE_OPUS
+        if (s->opus_encoder)
+            pa_opus_encoder_reset(s->opus_encoder);
+#endif
+
         if (s->write_index_corrections[s->current_write_index_correction].valid)
             s->write_index_corrections[s->current_write_index_correction].corrupt = true;
 
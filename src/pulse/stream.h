@@ -563,6 +563,22 @@ int pa_stream_write_ext_free(
         int64_t offset           /**< Offset for seeking, must be 0 for upload streams */,
         pa_seek_mode_t seek      /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */);
 
+/** Write data from a region of the stream's context, as passed to the
+ * callback of pa_context_register_mem_region(). In contrast
+ * to pa_stream_write() no copy of the data is made, the server is
+ * passed a reference to it. The data must not be modified until
+ * \a free_cb is called, which happens once the server no longer needs
+ * it. \since 10.0 */
+int pa_stream_write_mem_region(
+        pa_stream *p             /**< The stream to use */,
+        pa_mem_region *r         /**< The region the data is in */,
+        size_t region_offset     /**< Where the data starts in the region */,
+        size_t nbytes            /**< The length of the data to write in bytes, must be in multiples of the stream's sample spec frame size */,
+        pa_free_cb_t free_cb     /**< Called when the data may be modified again, or NULL */,
+        void *free_cb_data       /**< Argument passed to free_cb function */,
+        int64_t offset           /**< Offset for seeking, must be 0 for upload streams, must be in multiples of the stream's sample spec frame size */,
+        pa_seek_mode_t seek      /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */);
+
 /** Read the next fragment from the buffer (for recording streams).
  * If there is data at the current read index, \a data will point to
  * the actual data and \a nbytes will contain the size of the data in
@@ -715,6 +715,68 @@ char *pa_scache_list_to_string(pa_core *c) {
     return pa_strbuf_to_string_free(s);
 }
 
+static void append_io_histogram(pa_strbuf *s, const char *what, const pa_io_histogram *h) {
+    unsigned i;
+
+    pa_strbuf_printf(s, "\t%s: %llu times, average %llu usec, max %llu usec\n",
+                     what,
+                     (unsigned long long) h->count,
+                     (unsigned long long) (h->count ? h->total / h->count : 0),
+                     (unsigned long long) h->max);
+
+    pa_strbuf_puts(s, "\t\t");
+    for (i = 0; i < PA_IO_HISTOGRAM_BUCKETS; i++)
+        pa_strbuf_printf(s, "%s%u", i ? " " : "", h->buckets[i]);
+    pa_strbuf_puts(s, "\n");
+}
+
+static void append_io_stats(pa_strbuf *s, const char *type, uint32_t idx, const char *name, const pa_io_stats *stats) {
+    pa_strbuf_printf(s, "    %s index: %u\n\tname: <%s>\n", type, idx, name);
+
+    append_io_histogram(s, "render", &stats->render);
+    append_io_histogram(s, "wakeup lateness", &stats->lateness);
+
+    pa_strbuf_printf(s,
+                     "\tpoll time: %0.1f s\n"
+                     "\tunderruns: %llu\n"
+                     "\trewinds: %llu\n"
+                     "\tbytes: %llu\n",
+                     (double) stats->poll_time / PA_USEC_PER_SEC,
+                     (unsigned long long) stats->underruns,
+                     (unsigned long long) stats->rewinds,
+                     (unsigned long long) stats->bytes);
+}
+
+char *pa_io_stats_list_to_string(pa_core *c) {
+    pa_strbuf *s;
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t idx;
+
+    pa_assert(c);
+
+    s = pa_strbuf_new();
+
+    pa_strbuf_printf(s, "Histogram buckets are <2 usec, then [2^i, 2^(i+1)) usec for i = 1..%u, then >= %u usec.\n",
+                     PA_IO_HISTOGRAM_BUCKETS - 2, 1U << (PA_IO_HISTOGRAM_BUCKETS - 1));
+
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        pa_io_stats stats;
+
+        pa_sink_get_io_stats(sink, &stats);
+        append_io_stats(s, "sink", sink->index, sink->name, &stats);
+    }
+
+    PA_IDXSET_FOREACH(source, c->sources, idx) {
+        pa_io_stats stats;
+
+        pa_source_get_io_stats(source, &stats);
+        append_io_stats(s, "source", source->index, source->name, &stats);
+    }
+
+    return pa_strbuf_to_string_free(s);
+}
+
 char *pa_full_status_string(pa_core *c) {
     pa_strbuf *s;
     int i;
@@ -225,6 +225,21 @@ int pa_format_info_to_sample_spec_fake(const pa_format_info *f, pa_sample_spec *
     /* Note: When we add support for non-IEC61937 encapsulated compressed
      * formats, this function should return a non-zero values for these. */
 
+    if (f->encoding == PA_ENCODING_OPUS) {
+        /* Opus is only used on the wire, the stream itself carries the
+         * float PCM that gets encoded and decoded */
+        ss->format = PA_SAMPLE_FLOAT32NE;
+        pa_return_val_if_fail(pa_format_info_get_rate(f, &ss->rate) == 0, -PA_ERR_INVALID);
+
+        if (pa_format_info_get_channels(f, &ss->channels) < 0)
+            ss->channels = 2;
+
+        if (map && (pa_format_info_get_channel_map(f, map) < 0 || map->channels != ss->channels))
+            pa_channel_map_init_extend(map, ss->channels, PA_CHANNEL_MAP_DEFAULT);
+
+        return 0;
+    }
+
     ss->format = PA_SAMPLE_S16LE;
     ss->channels = 2;
 
@@ -28,8 +28,14 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #ifdef HAVE_GLOB_H
 #include <glob.h>
@@ -57,11 +63,398 @@
 #include <pulsecore/log.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/resampler.h>
 
 #include "core-scache.h"
 
 #define UNLOAD_POLL_TIME (60 * PA_USEC_PER_SEC)
 
+/* How many converted copies of one sample we keep at most */
+#define CONVERTED_MAX 4
+
+typedef struct converted_chunk {
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_memchunk memchunk;
+} converted_chunk;
+
+#ifdef HAVE_SYS_MMAN_H
+
+/* With enable-scache-mmap, samples loaded from files are stored decoded
+ * (and converted, for the converted copies) in cache files, which are
+ * then mapped in. The pages belong to the page cache rather than to
+ * the daemon, and the next time a lazy sample is loaded it does not need
+ * to be decoded again. The samples start at CACHE_HEADER_SIZE in the
+ * file, the header says which version of which sound file they were
+ * made from. */
+
+#define CACHE_MAGIC "PASCACH1"
+#define CACHE_HEADER_SIZE 256
+
+typedef struct cache_header {
+    char magic[8];
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t length;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+} cache_header;
+
+typedef struct cache_mapping {
+    void *data;
+    size_t size;
+} cache_mapping;
+
+static void cache_mapping_free(void *userdata) {
+    cache_mapping *m = userdata;
+
+    pa_assert(m);
+
+    munmap(m->data, m->size);
+    pa_xfree(m);
+}
+
+/* Returns the name of the cache file for the sample loaded from source,
+ * converted to ss and map if they are not NULL */
+static char *cache_path(const char *source, const pa_sample_spec *ss, const pa_channel_map *map) {
+    char t[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
+    char *dir, *key, *path;
+    uint64_t hash = 14695981039346656037ULL;
+    const char *k;
+
+    if (!(dir = pa_state_path("scache", true)))
+        return NULL;
+
+    if (pa_make_secure_dir(dir, 0700, (uid_t) -1, (gid_t) -1, false) < 0) {
+        pa_log_warn("Failed to create sample cache directory %s: %s", dir, pa_cstrerror(errno));
+        pa_xfree(dir);
+        return NULL;
+    }
+
+    if (ss)
+        key = pa_sprintf_malloc("%s\n%s\n%s", source,
+                                pa_sample_spec_snprint(t, sizeof(t), ss),
+                                pa_channel_map_snprint(cm, sizeof(cm), map));
+    else
+        key = pa_xstrdup(source);
+
+    /* FNV-1a */
+    for (k = key; *k; k++) {
+        hash ^= (uint8_t) *k;
+        hash *= 1099511628211ULL;
+    }
+
+    path = pa_sprintf_malloc("%s" PA_PATH_SEP "%016llx." CANONICAL_HOST ".pcm", dir, (unsigned long long) hash);
+
+    pa_xfree(key);
+    pa_xfree(dir);
+
+    return path;
+}
+
+/* Maps the cache file in, if it is there and up to date. If check is
+ * true, it must contain samples in *ss and *map, otherwise *ss and *map
+ * are filled in from the file. */
+static int cache_map(pa_core *c, const char *path, const struct stat *source, pa_sample_spec *ss, pa_channel_map *map, bool check, pa_memchunk *chunk) {
+    struct stat st;
+    cache_header h;
+    cache_mapping *m;
+    void *data;
+    int fd;
+
+    if ((fd = pa_open_cloexec(path, O_RDONLY, 0)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 || st.st_size < CACHE_HEADER_SIZE) {
+        pa_close(fd);
+        return -1;
+    }
+
+    data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    pa_close(fd);
+
+    if (data == MAP_FAILED)
+        return -1;
+
+    memcpy(&h, data, sizeof(h));
+
+    if (memcmp(h.magic, CACHE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.source_size != (uint64_t) source->st_size ||
+        h.source_mtime != (int64_t) source->st_mtime ||
+        h.length > (uint64_t) st.st_size - CACHE_HEADER_SIZE ||
+        h.length == 0 ||
+        !pa_sample_spec_valid(&h.sample_spec) ||
+        !pa_channel_map_valid(&h.channel_map) ||
+        !pa_channel_map_compatible(&h.channel_map, &h.sample_spec) ||
+        h.length % pa_frame_size(&h.sample_spec) != 0 ||
+        (check && (!pa_sample_spec_equal(&h.sample_spec, ss) || !pa_channel_map_equal(&h.channel_map, map)))) {
+
+        pa_log_debug("Sample cache file %s is stale.", path);
+        munmap(data, (size_t) st.st_size);
+        return -1;
+    }
+
+    if (!check) {
+        *ss = h.sample_spec;
+        *map = h.channel_map;
+    }
+
+    m = pa_xnew(cache_mapping, 1);
+    m->data = data;
+    m->size = (size_t) st.st_size;
+
+    chunk->memblock = pa_memblock_new_user(c->mempool, data, (size_t) st.st_size, cache_mapping_free, m, true);
+    chunk->index = CACHE_HEADER_SIZE;
+    chunk->length = (size_t) h.length;
+
+    return 0;
+}
+
+static int cache_store(const char *path, const struct stat *source, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk) {
+    uint8_t header[CACHE_HEADER_SIZE];
+    cache_header h;
+    char *tmp;
+    void *data;
+    ssize_t r;
+    int fd;
+
+    pa_assert_cc(sizeof(cache_header) <= CACHE_HEADER_SIZE);
+
+    pa_zero(h);
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.source_size = (uint64_t) source->st_size;
+    h.source_mtime = (int64_t) source->st_mtime;
+    h.length = chunk->length;
+    h.sample_spec = *ss;
+    h.channel_map = *map;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, &h, sizeof(h));
+
+    tmp = pa_sprintf_malloc("%s.tmp", path);
+
+    if ((fd = pa_open_cloexec(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0) {
+        pa_log_warn("Failed to open %s: %s", tmp, pa_cstrerror(errno));
+        pa_xfree(tmp);
+        return -1;
+    }
+
+    data = pa_memblock_acquire_chunk(chunk);
+    r = pa_loop_write(fd, header, sizeof(header), NULL);
+    if (r == (ssize_t) sizeof(header))
+        r = pa_loop_write(fd, data, chunk->length, NULL) == (ssize_t) chunk->length ? 0 : -1;
+    else
+        r = -1;
+    pa_memblock_release(chunk->memblock);
+
+    /* Make sure we never map a file whose contents did not make it to
+     * the disk */
+    if (r == 0)
+        r = fsync(fd);
+
+    if (pa_close(fd) < 0)
+        r = -1;
+
+    if (r < 0 || rename(tmp, path) < 0) {
+        pa_log_warn("Failed to write sample cache file %s: %s", path, pa_cstrerror(errno));
+        unlink(tmp);
+        pa_xfree(tmp);
+        return -1;
+    }
+
+    pa_xfree(tmp);
+    return 0;
+}
+
+/* Replaces *chunk by a mapping of a cache file with the same contents */
+static void cache_chunk(pa_core *c, const char *path, const struct stat *source, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk) {
+    pa_memchunk mapped;
+
+    if (cache_store(path, source, ss, map, chunk) < 0)
+        return;
+
+    if (cache_map(c, path, source, ss, map, true, &mapped) < 0)
+        return;
+
+    pa_memblock_unref(chunk->memblock);
+    *chunk = mapped;
+}
+
+#endif
+
+static int load_file(pa_core *c, const char *filename, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p) {
+#ifdef HAVE_SYS_MMAN_H
+    struct stat st;
+    char *path = NULL;
+
+    if (c->scache_mmap && stat(filename, &st) == 0 && (path = cache_path(filename, NULL, NULL))) {
+        if (cache_map(c, path, &st, ss, map, false, chunk) == 0) {
+            pa_log_debug("Loaded %s from sample cache file %s.", filename, path);
+            pa_xfree(path);
+            return 0;
+        }
+    }
+#endif
+
+    if (pa_sound_file_load(c->mempool, filename, ss, map, chunk, p) < 0) {
+#ifdef HAVE_SYS_MMAN_H
+        pa_xfree(path);
+#endif
+        return -1;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    if (path) {
+        cache_chunk(c, path, &st, ss, map, chunk);
+        pa_xfree(path);
+    }
+#endif
+
+    return 0;
+}
+
+static void free_converted(converted_chunk *cc) {
+    pa_assert(cc);
+
+    pa_memblock_unref(cc->memchunk.memblock);
+    pa_xfree(cc);
+}
+
+static int convert_chunk(pa_core *c, pa_scache_entry *e, converted_chunk *cc) {
+    pa_resampler *r;
+    uint8_t *data = NULL;
+    size_t block, done = 0, length = 0, allocated = 0;
+
+    if (!(r = pa_resampler_new(c->mempool,
+                               &e->sample_spec, &e->channel_map,
+                               &cc->sample_spec, &cc->channel_map,
+                               c->lfe_crossover_freq,
+                               c->resample_method,
+                               (c->disable_remixing ? PA_RESAMPLER_NO_REMIX : 0) |
+                               (c->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0))))
+        return -1;
+
+    block = pa_resampler_max_block_size(r);
+
+    while (done < e->memchunk.length) {
+        pa_memchunk in, out;
+
+        in = e->memchunk;
+        in.index += done;
+        in.length = PA_MIN(block, e->memchunk.length - done);
+
+        pa_resampler_run(r, &in, &out);
+        done += in.length;
+
+        if (!out.memblock)
+            continue;
+
+        if (length + out.length > allocated) {
+            allocated = PA_MAX(allocated * 2, length + out.length);
+            data = pa_xrealloc(data, allocated);
+        }
+
+        memcpy(data + length, pa_memblock_acquire_chunk(&out), out.length);
+        pa_memblock_release(out.memblock);
+        pa_memblock_unref(out.memblock);
+
+        length += out.length;
+    }
+
+    pa_resampler_free(r);
+
+    if (length == 0) {
+        pa_xfree(data);
+        return -1;
+    }
+
+    cc->memchunk.memblock = pa_memblock_new_malloced(c->mempool, data, length);
+    cc->memchunk.index = 0;
+    cc->memchunk.length = length;
+
+    return 0;
+}
+
+/* Returns a copy of the sample in the format of the sink, or NULL if
+ * the sample can be played as it is or should be converted by the sink
+ * input as usual */
+static converted_chunk* get_converted(pa_core *c, pa_scache_entry *e, pa_sink *sink) {
+    char t[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
+    converted_chunk *cc;
+    char *key;
+#ifdef HAVE_SYS_MMAN_H
+    const char *source;
+    struct stat st;
+    char *path = NULL;
+#endif
+
+    if (pa_sink_is_passthrough(sink))
+        return NULL;
+
+    /* The sink input would try this too, and when it works no conversion
+     * is needed at all */
+    if (e->sample_spec.rate != sink->sample_spec.rate)
+        pa_sink_update_rate(sink, e->sample_spec.rate, false);
+
+    if (pa_sample_spec_equal(&e->sample_spec, &sink->sample_spec) &&
+        pa_channel_map_equal(&e->channel_map, &sink->channel_map))
+        return NULL;
+
+    key = pa_sprintf_malloc("%s %s",
+                            pa_sample_spec_snprint(t, sizeof(t), &sink->sample_spec),
+                            pa_channel_map_snprint(cm, sizeof(cm), &sink->channel_map));
+
+    if (!e->converted)
+        e->converted = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func,
+                                           pa_xfree, (pa_free_cb_t) free_converted);
+    else if ((cc = pa_hashmap_get(e->converted, key))) {
+        pa_xfree(key);
+        return cc;
+    }
+
+    if (pa_hashmap_size(e->converted) >= CONVERTED_MAX)
+        pa_hashmap_remove_all(e->converted);
+
+    cc = pa_xnew0(converted_chunk, 1);
+    cc->sample_spec = sink->sample_spec;
+    cc->channel_map = sink->channel_map;
+
+#ifdef HAVE_SYS_MMAN_H
+    if (c->scache_mmap &&
+        (source = pa_proplist_gets(e->proplist, PA_PROP_MEDIA_FILENAME)) &&
+        stat(source, &st) == 0 &&
+        (path = cache_path(source, &cc->sample_spec, &cc->channel_map)) &&
+        cache_map(c, path, &st, &cc->sample_spec, &cc->channel_map, true, &cc->memchunk) == 0) {
+
+        pa_xfree(path);
+        pa_hashmap_put(e->converted, key, cc);
+        return cc;
+    }
+#endif
+
+    if (convert_chunk(c, e, cc) < 0) {
+        pa_log_debug("Failed to convert sample \"%s\" to %s.", e->name, key);
+#ifdef HAVE_SYS_MMAN_H
+        pa_xfree(path);
+#endif
+        pa_xfree(key);
+        pa_xfree(cc);
+        return NULL;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    if (path) {
+        cache_chunk(c, path, &st, &cc->sample_spec, &cc->channel_map, &cc->memchunk);
+        pa_xfree(path);
+    }
+#endif
+
+    pa_log_debug("Converted sample \"%s\" to %s.", e->name, key);
+
+    pa_hashmap_put(e->converted, key, cc);
+    return cc;
+}
+
 static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     pa_core *c = userdata;
 
@@ -84,6 +477,8 @@ static void free_entry(pa_scache_entry *e) {
     pa_xfree(e->filename);
     if (e->memchunk.memblock)
         pa_memblock_unref(e->memchunk.memblock);
+    if (e->converted)
+        pa_hashmap_free(e->converted);
     if (e->proplist)
         pa_proplist_free(e->proplist);
     pa_xfree(e);
@@ -100,6 +495,11 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name, bool *new_
         if (e->memchunk.memblock)
             pa_memblock_unref(e->memchunk.memblock);
 
+        if (e->converted) {
+            pa_hashmap_free(e->converted);
+            e->converted = NULL;
+        }
+
         pa_xfree(e->filename);
         pa_proplist_clear(e->proplist);
 
@@ -118,6 +518,7 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name, bool *new_
         e->name = pa_xstrdup(name);
         e->core = c;
         e->proplist = pa_proplist_new();
+        e->converted = NULL;
 
         pa_idxset_put(c->scache, e, &e->index);
 
@@ -225,7 +626,7 @@ int pa_scache_add_file(pa_core *c, const char *name, const char *filename, uint3
     p = pa_proplist_new();
     pa_proplist_sets(p, PA_PROP_MEDIA_FILENAME, filename);
 
-    if (pa_sound_file_load(c->mempool, filename, &ss, &map, &chunk, p) < 0) {
+    if (load_file(c, filename, &ss, &map, &chunk, p) < 0) {
         pa_proplist_free(p);
         return -1;
     }
@@ -302,6 +703,10 @@ void pa_scache_free_all(pa_core *c) {
 
 int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
     pa_scache_entry *e;
+    converted_chunk *cc;
+    const pa_sample_spec *ss;
+    const pa_channel_map *map;
+    const pa_memchunk *chunk;
     pa_cvolume r;
     pa_proplist *merged;
     bool pass_volume;
@@ -320,7 +725,7 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     if (e->lazy && !e->memchunk.memblock) {
         pa_channel_map old_channel_map = e->channel_map;
 
-        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
+        if (load_file(c, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
             goto fail;
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
@@ -338,6 +743,16 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
 
     pa_log_debug("Playing sample \"%s\" on \"%s\"", name, sink->name);
 
+    if ((cc = get_converted(c, e, sink))) {
+        ss = &cc->sample_spec;
+        map = &cc->channel_map;
+        chunk = &cc->memchunk;
+    } else {
+        ss = &e->sample_spec;
+        map = &e->channel_map;
+        chunk = &e->memchunk;
+    }
+
     pass_volume = true;
 
     if (e->volume_is_set && PA_VOLUME_IS_VALID(volume)) {
@@ -350,14 +765,17 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     else
         pass_volume = false;
 
+    if (pass_volume && cc)
+        pa_cvolume_remap(&r, &e->channel_map, map);
+
     pa_proplist_update(merged, PA_UPDATE_REPLACE, e->proplist);
 
     if (p)
         pa_proplist_update(merged, PA_UPDATE_REPLACE, p);
 
     if (pa_play_memchunk(sink,
-                         &e->sample_spec, &e->channel_map,
-                         &e->memchunk,
+                         ss, map,
+                         chunk,
                          pass_volume ? &r : NULL,
                          merged,
                          PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
@@ -451,6 +869,11 @@ void pa_scache_unload_unused(pa_core *c) {
         pa_memblock_unref(e->memchunk.memblock);
         pa_memchunk_reset(&e->memchunk);
 
+        if (e->converted) {
+            pa_hashmap_free(e->converted);
+            e->converted = NULL;
+        }
+
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
     }
 }
@@ -22,6 +22,7 @@
 ***/
 
 #include <pulsecore/core.h>
+#include <pulsecore/hashmap.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/sink.h>
 
@@ -39,6 +40,11 @@ typedef struct pa_scache_entry {
     pa_channel_map channel_map;
     pa_memchunk memchunk;
 
+    /* Copies of memchunk converted to the sample spec and channel map
+     * of the sinks the sample was played on, so that playing it again
+     * needs no resampling. NULL until one is needed. */
+    pa_hashmap *converted;
+
     char *filename;
 
     bool lazy;
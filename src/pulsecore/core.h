@@ -202,6 +202,7 @@ struct pa_core {
     bool disable_remixing:1;
     bool disable_lfe_remixing:1;
     bool deferred_volume:1;
+    bool scache_mmap:1;
 
     pa_resample_method_t resample_method;
     int realtime_priority;
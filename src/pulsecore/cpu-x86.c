@@ -37,15 +37,29 @@ static void get_cpuid(uint32_t op, uint32_t *a, uint32_t *b, uint32_t *c, uint32
         "  pop %%"PA_REG_b"    \n\t"
 
         : "=a" (*a), "=S" (*b), "=c" (*c), "=d" (*d)
-        : "0" (op)
+        : "0" (op), "2" (0)
     );
 }
+
+/* Reads extended control register 0, which tells us which register states
+ * the OS saves on context switch. Only valid if CPUID reports OSXSAVE. */
+static uint32_t get_xcr0(void) {
+    uint32_t eax, edx;
+
+    __asm__ __volatile__ (
+        "  .byte 0x0f, 0x01, 0xd0 \n\t" /* xgetbv */
+        : "=a" (eax), "=d" (edx)
+        : "c" (0)
+    );
+
+    return eax;
+}
 #endif
 
 void pa_cpu_get_x86_flags(pa_cpu_x86_flag_t *flags) {
 #if defined (__i386__) || defined (__amd64__)
     uint32_t eax, ebx, ecx, edx;
-    uint32_t level;
+    uint32_t level, xcr0 = 0;
 
     *flags = 0;
 
@@ -77,6 +91,28 @@ void pa_cpu_get_x86_flags(pa_cpu_x86_flag_t *flags) {
 
         if (ecx & (1<<20))
           *flags |= PA_CPU_X86_SSE4_2;
+
+        if (ecx & (1<<27))
+          xcr0 = get_xcr0();
+
+        /* AVX needs both CPU support and the OS saving the YMM state */
+        if ((ecx & (1<<28)) && (xcr0 & 0x6) == 0x6) {
+          *flags |= PA_CPU_X86_AVX;
+
+          if (ecx & (1<<12))
+            *flags |= PA_CPU_X86_FMA;
+        }
+    }
+
+    if (level >= 7 && (*flags & PA_CPU_X86_AVX)) {
+        get_cpuid(0x00000007, &eax, &ebx, &ecx, &edx);
+
+        if (ebx & (1<<5))
+          *flags |= PA_CPU_X86_AVX2;
+
+        /* AVX-512 additionally needs the opmask and ZMM states enabled */
+        if ((ebx & (1<<16)) && (xcr0 & 0xe6) == 0xe6)
+          *flags |= PA_CPU_X86_AVX512F;
     }
 
     /* get extended level */
@@ -97,7 +133,7 @@ void pa_cpu_get_x86_flags(pa_cpu_x86_flag_t *flags) {
           *flags |= PA_CPU_X86_3DNOW;
     }
 
-    pa_log_info("CPU flags: %s%s%s%s%s%s%s%s%s%s%s",
+    pa_log_info("CPU flags: %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s",
     (*flags & PA_CPU_X86_CMOV) ? "CMOV " : "",
     (*flags & PA_CPU_X86_MMX) ? "MMX " : "",
     (*flags & PA_CPU_X86_SSE) ? "SSE " : "",
@@ -106,6 +142,10 @@ void pa_cpu_get_x86_flags(pa_cpu_x86_flag_t *flags) {
     (*flags & PA_CPU_X86_SSSE3) ? "SSSE3 " : "",
     (*flags & PA_CPU_X86_SSE4_1) ? "SSE4_1 " : "",
     (*flags & PA_CPU_X86_SSE4_2) ? "SSE4_2 " : "",
+    (*flags & PA_CPU_X86_AVX) ? "AVX " : "",
+    (*flags & PA_CPU_X86_AVX2) ? "AVX2 " : "",
+    (*flags & PA_CPU_X86_FMA) ? "FMA " : "",
+    (*flags & PA_CPU_X86_AVX512F) ? "AVX512F " : "",
     (*flags & PA_CPU_X86_MMXEXT) ? "MMXEXT " : "",
     (*flags & PA_CPU_X86_3DNOW) ? "3DNOW " : "",
     (*flags & PA_CPU_X86_3DNOWEXT) ? "3DNOWEXT " : "");
@@ -128,6 +168,23 @@ bool pa_cpu_init_x86(pa_cpu_x86_flag_t *flags) {
         pa_convert_func_init_sse(*flags);
     }
 
+#ifdef HAVE_SSE2
+    if (*flags & PA_CPU_X86_SSE2) {
+        pa_mix_func_init_sse(*flags);
+        pa_polyphase_func_init_sse(*flags);
+    }
+#endif
+
+#ifdef HAVE_AVX2
+    if (*flags & PA_CPU_X86_AVX2) {
+        pa_volume_func_init_avx(*flags);
+        pa_remap_func_init_avx(*flags);
+        pa_convert_func_init_avx(*flags);
+        pa_mix_func_init_avx(*flags);
+        pa_polyphase_func_init_avx(*flags);
+    }
+#endif
+
     return true;
 #else /* defined (__i386__) || defined (__amd64__) */
     return false;
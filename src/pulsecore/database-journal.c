@@ -0,0 +1,768 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/atomic.h>
+
+#include "database.h"
+
+/* Like the simple backend this keeps everything in a hashmap, but on
+ * disk it is a journal: pa_database_sync() only appends the records
+ * that changed since the last sync. When the journal has grown to a
+ * multiple of what the live data needs, it is rewritten from a
+ * snapshot in a separate thread, and the result is renamed over the
+ * journal.
+ *
+ * The file starts with JOURNAL_MAGIC, followed by records:
+ *
+ *     uint8_t type, uint32_t key_size, uint32_t data_size,
+ *     key, data, uint32_t checksum
+ *
+ * All integers are little endian, the checksum covers everything
+ * before it in the record. When loading, everything from the first
+ * incomplete or damaged record on is dropped, which is what a crash in
+ * the middle of an append leaves behind. */
+
+#define JOURNAL_MAGIC "PAJRNL01"
+#define JOURNAL_MAGIC_SIZE 8
+
+/* Don't bother compacting journals smaller than this */
+#define COMPACT_MIN_SIZE (64*1024)
+
+/* Compact once the journal is this many times larger than the data */
+#define COMPACT_FACTOR 2
+
+enum {
+    RECORD_SET = 1,
+    RECORD_UNSET = 2,
+    RECORD_CLEAR = 3
+};
+
+#define RECORD_OVERHEAD (1 + 4 + 4 + 4)
+
+typedef struct buffer {
+    uint8_t *data;
+    size_t length;
+    size_t allocated;
+} buffer;
+
+typedef struct compact_job {
+    char *filename;
+    char *tmp_filename;
+    buffer buf;
+    int result;
+    pa_atomic_t done;
+} compact_job;
+
+typedef struct journal_data {
+    char *filename;
+    char *tmp_filename;
+    pa_hashmap *map;
+    bool read_only;
+
+    /* Keys changed since the last sync. If a key is no longer in map,
+     * it has been removed. */
+    pa_hashmap *dirty;
+    bool cleared;
+
+    int fd;
+    size_t file_size;
+    size_t live_size;
+
+    pa_thread *compact_thread;
+    compact_job *compact_job;
+    bool compact_failed;
+} journal_data;
+
+typedef struct entry {
+    pa_datum key;
+    pa_datum data;
+} entry;
+
+void pa_datum_free(pa_datum *d) {
+    pa_assert(d);
+
+    pa_xfree(d->data);
+    d->data = NULL;
+    d->size = 0;
+}
+
+static int compare_func(const void *a, const void *b) {
+    const pa_datum *aa, *bb;
+
+    aa = (const pa_datum*)a;
+    bb = (const pa_datum*)b;
+
+    if (aa->size != bb->size)
+        return aa->size > bb->size ? 1 : -1;
+
+    return memcmp(aa->data, bb->data, aa->size);
+}
+
+/* pa_idxset_string_hash_func modified for our use */
+static unsigned hash_func(const void *p) {
+    const pa_datum *d;
+    unsigned hash = 0;
+    const char *c;
+    unsigned i;
+
+    d = (const pa_datum*)p;
+    c = d->data;
+
+    for (i = 0; i < d->size; i++) {
+        hash = 31 * hash + (unsigned) *c;
+        c++;
+    }
+
+    return hash;
+}
+
+static entry* new_entry(const pa_datum *key, const pa_datum *data) {
+    entry *e;
+
+    pa_assert(key);
+    pa_assert(data);
+
+    e = pa_xnew0(entry, 1);
+    e->key.data = key->size > 0 ? pa_xmemdup(key->data, key->size) : NULL;
+    e->key.size = key->size;
+    e->data.data = data->size > 0 ? pa_xmemdup(data->data, data->size) : NULL;
+    e->data.size = data->size;
+    return e;
+}
+
+static void free_entry(entry *e) {
+    if (e) {
+        pa_xfree(e->key.data);
+        pa_xfree(e->data.data);
+        pa_xfree(e);
+    }
+}
+
+static void free_datum(pa_datum *d) {
+    pa_datum_free(d);
+    pa_xfree(d);
+}
+
+static size_t record_size(const entry *e) {
+    return RECORD_OVERHEAD + e->key.size + e->data.size;
+}
+
+static uint32_t checksum(const uint8_t *p, size_t size) {
+    uint32_t h = 2166136261U;
+
+    /* FNV-1a */
+    while (size--) {
+        h ^= *(p++);
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static uint32_t read_uint(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void buffer_reserve(buffer *b, size_t length) {
+    if (b->length + length <= b->allocated)
+        return;
+
+    b->allocated = PA_MAX(b->allocated * 2, b->length + length);
+    b->data = pa_xrealloc(b->data, b->allocated);
+}
+
+static void buffer_append(buffer *b, const void *data, size_t length) {
+    if (length == 0)
+        return;
+
+    buffer_reserve(b, length);
+    memcpy(b->data + b->length, data, length);
+    b->length += length;
+}
+
+static void buffer_append_uint(buffer *b, uint32_t num) {
+    uint8_t values[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        values[i] = (num >> (i*8)) & 0xFF;
+
+    buffer_append(b, values, sizeof(values));
+}
+
+static void buffer_append_record(buffer *b, uint8_t type, const pa_datum *key, const pa_datum *data) {
+    size_t start = b->length;
+
+    buffer_append(b, &type, 1);
+    buffer_append_uint(b, key ? (uint32_t) key->size : 0);
+    buffer_append_uint(b, data ? (uint32_t) data->size : 0);
+
+    if (key)
+        buffer_append(b, key->data, key->size);
+    if (data)
+        buffer_append(b, data->data, data->size);
+
+    buffer_append_uint(b, checksum(b->data + start, b->length - start));
+}
+
+static void buffer_done(buffer *b) {
+    pa_xfree(b->data);
+    b->data = NULL;
+    b->length = b->allocated = 0;
+}
+
+static void mark_dirty(journal_data *db, const pa_datum *key) {
+    pa_datum *d;
+
+    if (pa_hashmap_get(db->dirty, key))
+        return;
+
+    d = pa_xnew0(pa_datum, 1);
+    d->data = key->size > 0 ? pa_xmemdup(key->data, key->size) : NULL;
+    d->size = key->size;
+    pa_hashmap_put(db->dirty, d, d);
+}
+
+static void put_entry(journal_data *db, entry *e) {
+    entry *old;
+
+    if ((old = pa_hashmap_remove(db->map, &e->key))) {
+        db->live_size -= record_size(old);
+        free_entry(old);
+    }
+
+    pa_hashmap_put(db->map, &e->key, e);
+    db->live_size += record_size(e);
+}
+
+static void remove_entry(journal_data *db, const pa_datum *key) {
+    entry *e;
+
+    if ((e = pa_hashmap_remove(db->map, key))) {
+        db->live_size -= record_size(e);
+        free_entry(e);
+    }
+}
+
+/* Applies the records in p to the hashmap and returns how many bytes
+ * of valid records there were */
+static size_t replay(journal_data *db, const uint8_t *p, size_t size) {
+    size_t offset = 0;
+
+    while (size - offset >= RECORD_OVERHEAD) {
+        const uint8_t *r = p + offset;
+        uint8_t type;
+        uint32_t key_size, data_size;
+        size_t n;
+        pa_datum key, data;
+
+        type = r[0];
+        key_size = read_uint(r + 1);
+        data_size = read_uint(r + 5);
+
+        if (key_size > size - offset - RECORD_OVERHEAD ||
+            data_size > size - offset - RECORD_OVERHEAD - key_size)
+            break;
+
+        n = RECORD_OVERHEAD + key_size + data_size;
+
+        if (read_uint(r + n - 4) != checksum(r, n - 4))
+            break;
+
+        key.data = (void*) (r + 9);
+        key.size = key_size;
+        data.data = (void*) (r + 9 + key_size);
+        data.size = data_size;
+
+        if (type == RECORD_SET)
+            put_entry(db, new_entry(&key, &data));
+        else if (type == RECORD_UNSET)
+            remove_entry(db, &key);
+        else if (type == RECORD_CLEAR) {
+            pa_hashmap_remove_all(db->map);
+            db->live_size = 0;
+        } else
+            break;
+
+        offset += n;
+    }
+
+    return offset;
+}
+
+static int load(journal_data *db, int fd) {
+    struct stat st;
+    uint8_t *p;
+    size_t valid;
+    ssize_t r;
+
+    if (fstat(fd, &st) < 0)
+        return -1;
+
+    if (st.st_size == 0)
+        return 0;
+
+    p = pa_xmalloc((size_t) st.st_size);
+
+    if ((r = pa_loop_read(fd, p, (size_t) st.st_size, NULL)) != (ssize_t) st.st_size) {
+        if (r >= 0)
+            errno = EIO;
+        pa_xfree(p);
+        return -1;
+    }
+
+    if (st.st_size < JOURNAL_MAGIC_SIZE || memcmp(p, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0) {
+        pa_log_warn("%s is not a database journal, ignoring its contents.", db->filename);
+        pa_xfree(p);
+        return 0;
+    }
+
+    valid = JOURNAL_MAGIC_SIZE + replay(db, p + JOURNAL_MAGIC_SIZE, (size_t) st.st_size - JOURNAL_MAGIC_SIZE);
+    pa_xfree(p);
+
+    if (valid < (size_t) st.st_size)
+        pa_log_warn("Dropping %lu bytes of incomplete or damaged records at the end of %s.",
+                    (unsigned long) ((size_t) st.st_size - valid), db->filename);
+
+    db->file_size = valid;
+    return 0;
+}
+
+/* Opens the journal for appending, throwing away anything after
+ * db->file_size */
+static int open_for_append(journal_data *db) {
+    int fd;
+
+    if ((fd = pa_open_cloexec(db->filename, O_WRONLY|O_CREAT, 0666)) < 0) {
+        pa_log_warn("Failed to open %s: %s", db->filename, pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (db->file_size < JOURNAL_MAGIC_SIZE)
+        db->file_size = 0;
+
+    if (ftruncate(fd, (off_t) db->file_size) < 0 ||
+        lseek(fd, (off_t) db->file_size, SEEK_SET) < 0) {
+        pa_log_warn("Failed to truncate %s: %s", db->filename, pa_cstrerror(errno));
+        pa_close(fd);
+        return -1;
+    }
+
+    if (db->file_size == 0) {
+        if (pa_loop_write(fd, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE, NULL) != JOURNAL_MAGIC_SIZE) {
+            pa_log_warn("Failed to write to %s: %s", db->filename, pa_cstrerror(errno));
+            pa_close(fd);
+            return -1;
+        }
+
+        db->file_size = JOURNAL_MAGIC_SIZE;
+    }
+
+    db->fd = fd;
+    return 0;
+}
+
+/* Called from the compaction thread */
+static void compact_thread_func(void *userdata) {
+    compact_job *job = userdata;
+    int fd;
+
+    job->result = -1;
+
+    if ((fd = pa_open_cloexec(job->tmp_filename, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
+        pa_log_warn("Failed to open %s: %s", job->tmp_filename, pa_cstrerror(errno));
+        goto finish;
+    }
+
+    if (pa_loop_write(fd, job->buf.data, job->buf.length, NULL) != (ssize_t) job->buf.length) {
+        pa_log_warn("Failed to write to %s: %s", job->tmp_filename, pa_cstrerror(errno));
+        pa_close(fd);
+        goto finish;
+    }
+
+    /* The rename has to be the last thing to reach the disk */
+    if (fsync(fd) < 0) {
+        pa_log_warn("Failed to sync %s: %s", job->tmp_filename, pa_cstrerror(errno));
+        pa_close(fd);
+        goto finish;
+    }
+
+    pa_close(fd);
+
+    if (rename(job->tmp_filename, job->filename) < 0) {
+        pa_log_warn("Failed to rename %s to %s: %s", job->tmp_filename, job->filename, pa_cstrerror(errno));
+        goto finish;
+    }
+
+    job->result = 0;
+
+finish:
+    pa_atomic_store(&job->done, 1);
+}
+
+/* Picks up the result of a compaction, if there is one. If wait is
+ * true, waits for a running compaction to finish first. */
+static void finish_compaction(journal_data *db, bool wait) {
+    compact_job *job;
+
+    if (!(job = db->compact_job))
+        return;
+
+    if (!wait && !pa_atomic_load(&job->done))
+        return;
+
+    if (db->compact_thread) {
+        pa_thread_free(db->compact_thread);
+        db->compact_thread = NULL;
+    }
+
+    if (job->result >= 0) {
+        /* The old journal is gone, continue appending to the new one */
+        if (db->fd >= 0)
+            pa_close(db->fd);
+        db->fd = -1;
+        db->file_size = job->buf.length;
+
+        if (open_for_append(db) < 0)
+            db->compact_failed = true;
+        else
+            pa_log_debug("Compacted %s to %lu bytes.", db->filename, (unsigned long) db->file_size);
+    } else
+        /* The changes that went into the snapshot are not in the journal,
+         * so a new snapshot has to be written */
+        db->compact_failed = true;
+
+    pa_xfree(job->filename);
+    pa_xfree(job->tmp_filename);
+    buffer_done(&job->buf);
+    pa_xfree(job);
+    db->compact_job = NULL;
+}
+
+static void start_compaction(journal_data *db) {
+    compact_job *job;
+    entry *e;
+    void *state;
+
+    pa_assert(!db->compact_job);
+
+    job = pa_xnew0(compact_job, 1);
+    job->filename = pa_xstrdup(db->filename);
+    job->tmp_filename = pa_xstrdup(db->tmp_filename);
+    pa_atomic_store(&job->done, 0);
+
+    buffer_reserve(&job->buf, JOURNAL_MAGIC_SIZE + db->live_size);
+    buffer_append(&job->buf, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE);
+
+    PA_HASHMAP_FOREACH(e, db->map, state)
+        buffer_append_record(&job->buf, RECORD_SET, &e->key, &e->data);
+
+    /* The snapshot contains all pending changes */
+    pa_hashmap_remove_all(db->dirty);
+    db->cleared = false;
+    db->compact_failed = false;
+    db->compact_job = job;
+
+    if (!(db->compact_thread = pa_thread_new("db-compact", compact_thread_func, job))) {
+        compact_thread_func(job);
+        finish_compaction(db, true);
+    }
+}
+
+static bool needs_compaction(journal_data *db) {
+    return db->compact_failed ||
+        (db->file_size > COMPACT_MIN_SIZE &&
+         db->file_size > COMPACT_FACTOR * (JOURNAL_MAGIC_SIZE + db->live_size));
+}
+
+pa_database* pa_database_open(const char *fn, bool for_write) {
+    int fd;
+    char *path;
+    journal_data *db;
+
+    pa_assert(fn);
+
+    path = pa_sprintf_malloc("%s."CANONICAL_HOST".journal", fn);
+    errno = 0;
+
+    fd = pa_open_cloexec(path, O_RDONLY, 0);
+
+    if (fd < 0 && errno != ENOENT) {
+        if (errno == 0)
+            errno = EIO;
+        pa_xfree(path);
+        return NULL;
+    }
+
+    db = pa_xnew0(journal_data, 1);
+    db->map = pa_hashmap_new_full(hash_func, compare_func, NULL, (pa_free_cb_t) free_entry);
+    db->dirty = pa_hashmap_new_full(hash_func, compare_func, NULL, (pa_free_cb_t) free_datum);
+    db->filename = path;
+    db->tmp_filename = pa_sprintf_malloc("%s.tmp", db->filename);
+    db->read_only = !for_write;
+    db->fd = -1;
+
+    if (fd >= 0) {
+        if (load(db, fd) < 0) {
+            pa_log_warn("Failed to read %s: %s", db->filename, pa_cstrerror(errno));
+            pa_database_clear((pa_database*) db);
+            db->file_size = 0;
+        }
+
+        pa_close(fd);
+    }
+
+    if (!db->read_only && open_for_append(db) < 0) {
+        /* Appending is impossible, try writing a complete file on the
+         * next sync */
+        db->compact_failed = true;
+    }
+
+    return (pa_database*) db;
+}
+
+void pa_database_close(pa_database *database) {
+    journal_data *db = (journal_data*)database;
+    pa_assert(db);
+
+    finish_compaction(db, true);
+    pa_database_sync(database);
+    finish_compaction(db, true);
+
+    if (db->fd >= 0)
+        pa_close(db->fd);
+
+    pa_xfree(db->filename);
+    pa_xfree(db->tmp_filename);
+    pa_hashmap_free(db->dirty);
+    pa_hashmap_free(db->map);
+    pa_xfree(db);
+}
+
+pa_datum* pa_database_get(pa_database *database, const pa_datum *key, pa_datum* data) {
+    journal_data *db = (journal_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    e = pa_hashmap_get(db->map, key);
+
+    if (!e)
+        return NULL;
+
+    data->data = e->data.size > 0 ? pa_xmemdup(e->data.data, e->data.size) : NULL;
+    data->size = e->data.size;
+
+    return data;
+}
+
+int pa_database_set(pa_database *database, const pa_datum *key, const pa_datum* data, bool overwrite) {
+    journal_data *db = (journal_data*)database;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    if (db->read_only)
+        return -1;
+
+    if (!overwrite && pa_hashmap_get(db->map, key))
+        return -1;
+
+    put_entry(db, new_entry(key, data));
+    mark_dirty(db, key);
+
+    return 0;
+}
+
+int pa_database_unset(pa_database *database, const pa_datum *key) {
+    journal_data *db = (journal_data*)database;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    if (!pa_hashmap_get(db->map, key))
+        return -1;
+
+    remove_entry(db, key);
+    mark_dirty(db, key);
+
+    return 0;
+}
+
+int pa_database_clear(pa_database *database) {
+    journal_data *db = (journal_data*)database;
+
+    pa_assert(db);
+
+    pa_hashmap_remove_all(db->map);
+    pa_hashmap_remove_all(db->dirty);
+    db->live_size = 0;
+    db->cleared = true;
+
+    return 0;
+}
+
+signed pa_database_size(pa_database *database) {
+    journal_data *db = (journal_data*)database;
+    pa_assert(db);
+
+    return (signed) pa_hashmap_size(db->map);
+}
+
+pa_datum* pa_database_first(pa_database *database, pa_datum *key, pa_datum *data) {
+    journal_data *db = (journal_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    e = pa_hashmap_first(db->map);
+
+    if (!e)
+        return NULL;
+
+    key->data = e->key.size > 0 ? pa_xmemdup(e->key.data, e->key.size) : NULL;
+    key->size = e->key.size;
+
+    if (data) {
+        data->data = e->data.size > 0 ? pa_xmemdup(e->data.data, e->data.size) : NULL;
+        data->size = e->data.size;
+    }
+
+    return key;
+}
+
+pa_datum* pa_database_next(pa_database *database, const pa_datum *key, pa_datum *next, pa_datum *data) {
+    journal_data *db = (journal_data*)database;
+    entry *e;
+    entry *search;
+    void *state;
+    bool pick_now;
+
+    pa_assert(db);
+    pa_assert(next);
+
+    if (!key)
+        return pa_database_first(database, next, data);
+
+    search = pa_hashmap_get(db->map, key);
+
+    state = NULL;
+    pick_now = false;
+
+    while ((e = pa_hashmap_iterate(db->map, &state, NULL))) {
+        if (pick_now)
+            break;
+
+        if (search == e)
+            pick_now = true;
+    }
+
+    if (!pick_now || !e)
+        return NULL;
+
+    next->data = e->key.size > 0 ? pa_xmemdup(e->key.data, e->key.size) : NULL;
+    next->size = e->key.size;
+
+    if (data) {
+        data->data = e->data.size > 0 ? pa_xmemdup(e->data.data, e->data.size) : NULL;
+        data->size = e->data.size;
+    }
+
+    return next;
+}
+
+int pa_database_sync(pa_database *database) {
+    journal_data *db = (journal_data*)database;
+    buffer buf;
+    pa_datum *key;
+    entry *e;
+    void *state;
+
+    pa_assert(db);
+
+    if (db->read_only)
+        return 0;
+
+    /* Changes made while a compaction is running have to go to the new
+     * file, so if there are any, wait for it */
+    finish_compaction(db, db->cleared || !pa_hashmap_isempty(db->dirty));
+
+    if (db->compact_job)
+        return 0;
+
+    if (needs_compaction(db)) {
+        start_compaction(db);
+        return db->compact_failed ? -1 : 0;
+    }
+
+    if (!db->cleared && pa_hashmap_isempty(db->dirty))
+        return 0;
+
+    pa_zero(buf);
+
+    if (db->cleared)
+        buffer_append_record(&buf, RECORD_CLEAR, NULL, NULL);
+
+    PA_HASHMAP_FOREACH(key, db->dirty, state) {
+        if ((e = pa_hashmap_get(db->map, key)))
+            buffer_append_record(&buf, RECORD_SET, &e->key, &e->data);
+        else
+            buffer_append_record(&buf, RECORD_UNSET, key, NULL);
+    }
+
+    if (pa_loop_write(db->fd, buf.data, buf.length, NULL) != (ssize_t) buf.length) {
+        pa_log_warn("error while writing to file. %s", pa_cstrerror(errno));
+
+        /* Don't leave a partial record behind, everything appended after
+         * it would be lost when loading */
+        if (ftruncate(db->fd, (off_t) db->file_size) < 0 ||
+            lseek(db->fd, (off_t) db->file_size, SEEK_SET) < 0)
+            db->compact_failed = true;
+
+        buffer_done(&buf);
+        return -1;
+    }
+
+    db->file_size += buf.length;
+    buffer_done(&buf);
+
+    pa_hashmap_remove_all(db->dirty);
+    db->cleared = false;
+
+    return 0;
+}
@@ -0,0 +1,388 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "convolver.h"
+
+/* Each block of B new samples is transformed together with the previous B
+ * samples using a real FFT of size 2B, which is done as a complex FFT of size
+ * B. Spectra are kept with separate real and imaginary arrays of B + 1 bins,
+ * which keeps the multiply-accumulate loops simple enough for the compiler
+ * to vectorize. */
+struct pa_convolver {
+    unsigned block_size;
+    unsigned n_bins;
+    unsigned n_inputs, n_outputs;
+    unsigned n_partitions;
+
+    /* complex FFT of size block_size */
+    unsigned *bitrev;
+    float *twiddle_re, *twiddle_im;
+    /* e^(-i*pi*k/block_size) for splitting the real FFT, k = 0..block_size */
+    float *split_re, *split_im;
+
+    /* per input the previous and the current block of samples */
+    float *input;
+    /* per output the result of the last block, played back while the
+     * current one is filled */
+    float *output;
+    unsigned fill;
+
+    /* frequency domain delay line: the spectra of the last n_partitions
+     * input blocks, per input, newest at fdl_head */
+    float *fdl_re, *fdl_im;
+    unsigned fdl_head;
+
+    /* per output and input, the spectra of all partitions */
+    float *filter_re, *filter_im;
+    bool *filter_set;
+
+    /* scratch space */
+    float *acc_re, *acc_im;
+    float *work_re, *work_im;
+    float *time;
+};
+
+static void fft_complex(pa_convolver *c, float *re, float *im, bool inverse) {
+    const unsigned n = c->block_size;
+    unsigned i, j, k, size;
+
+    for (i = 0; i < n; i++) {
+        j = c->bitrev[i];
+
+        if (j > i) {
+            float t;
+
+            t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for (size = 2; size <= n; size <<= 1) {
+        const unsigned half = size >> 1, step = n / size;
+
+        for (i = 0; i < n; i += size) {
+            for (j = i, k = 0; j < i + half; j++, k += step) {
+                float w_re = c->twiddle_re[k];
+                float w_im = inverse ? -c->twiddle_im[k] : c->twiddle_im[k];
+                float t_re = re[j + half] * w_re - im[j + half] * w_im;
+                float t_im = re[j + half] * w_im + im[j + half] * w_re;
+
+                re[j + half] = re[j] - t_re;
+                im[j + half] = im[j] - t_im;
+                re[j] += t_re;
+                im[j] += t_im;
+            }
+        }
+    }
+}
+
+/* Forward real FFT of 2 * block_size samples into block_size + 1 bins */
+static void fft_real_forward(pa_convolver *c, const float *x, float *x_re, float *x_im) {
+    const unsigned n = c->block_size;
+    float *z_re = c->work_re, *z_im = c->work_im;
+    unsigned k;
+
+    for (k = 0; k < n; k++) {
+        z_re[k] = x[2 * k];
+        z_im[k] = x[2 * k + 1];
+    }
+
+    fft_complex(c, z_re, z_im, false);
+
+    for (k = 0; k <= n; k++) {
+        unsigned a = k < n ? k : 0, b = k > 0 ? n - k : 0;
+        /* spectra of the even (e) and odd (o) samples */
+        float e_re = (z_re[a] + z_re[b]) * 0.5f;
+        float e_im = (z_im[a] - z_im[b]) * 0.5f;
+        float o_re = (z_im[a] + z_im[b]) * 0.5f;
+        float o_im = (z_re[b] - z_re[a]) * 0.5f;
+
+        x_re[k] = e_re + o_re * c->split_re[k] - o_im * c->split_im[k];
+        x_im[k] = e_im + o_re * c->split_im[k] + o_im * c->split_re[k];
+    }
+}
+
+/* Inverse of fft_real_forward(), scaled by block_size */
+static void fft_real_inverse(pa_convolver *c, const float *x_re, const float *x_im, float *x) {
+    const unsigned n = c->block_size;
+    float *z_re = c->work_re, *z_im = c->work_im;
+    unsigned k;
+
+    for (k = 0; k < n; k++) {
+        float e_re = (x_re[k] + x_re[n - k]) * 0.5f;
+        float e_im = (x_im[k] - x_im[n - k]) * 0.5f;
+        float d_re = (x_re[k] - x_re[n - k]) * 0.5f;
+        float d_im = (x_im[k] + x_im[n - k]) * 0.5f;
+        /* o = d * conj(split) */
+        float o_re = d_re * c->split_re[k] + d_im * c->split_im[k];
+        float o_im = d_im * c->split_re[k] - d_re * c->split_im[k];
+
+        z_re[k] = e_re - o_im;
+        z_im[k] = e_im + o_re;
+    }
+
+    fft_complex(c, z_re, z_im, true);
+
+    for (k = 0; k < n; k++) {
+        x[2 * k] = z_re[k];
+        x[2 * k + 1] = z_im[k];
+    }
+}
+
+pa_convolver *pa_convolver_new(unsigned block_size, unsigned n_inputs, unsigned n_outputs, unsigned max_ir_length) {
+    pa_convolver *c;
+    unsigned i, bits, n_spectra;
+
+    pa_assert(pa_is_power_of_two(block_size));
+    pa_assert(block_size >= 4);
+    pa_assert(n_inputs > 0);
+    pa_assert(n_outputs > 0);
+    pa_assert(max_ir_length > 0);
+
+    c = pa_xnew0(pa_convolver, 1);
+
+    c->block_size = block_size;
+    c->n_bins = block_size + 1;
+    c->n_inputs = n_inputs;
+    c->n_outputs = n_outputs;
+    c->n_partitions = (max_ir_length + block_size - 1) / block_size;
+
+    c->bitrev = pa_xnew(unsigned, block_size);
+    for (bits = 0; (1U << bits) < block_size; bits++)
+        ;
+    for (i = 0; i < block_size; i++) {
+        unsigned j, r = 0;
+
+        for (j = 0; j < bits; j++)
+            r |= ((i >> j) & 1) << (bits - 1 - j);
+
+        c->bitrev[i] = r;
+    }
+
+    c->twiddle_re = pa_xnew(float, block_size / 2);
+    c->twiddle_im = pa_xnew(float, block_size / 2);
+    for (i = 0; i < block_size / 2; i++) {
+        c->twiddle_re[i] = (float) cos(2 * M_PI * i / block_size);
+        c->twiddle_im[i] = (float) -sin(2 * M_PI * i / block_size);
+    }
+
+    c->split_re = pa_xnew(float, c->n_bins);
+    c->split_im = pa_xnew(float, c->n_bins);
+    for (i = 0; i < c->n_bins; i++) {
+        c->split_re[i] = (float) cos(M_PI * i / block_size);
+        c->split_im[i] = (float) -sin(M_PI * i / block_size);
+    }
+
+    c->input = pa_xnew0(float, n_inputs * 2 * block_size);
+    c->output = pa_xnew0(float, n_outputs * block_size);
+
+    n_spectra = n_inputs * c->n_partitions * c->n_bins;
+    c->fdl_re = pa_xnew0(float, n_spectra);
+    c->fdl_im = pa_xnew0(float, n_spectra);
+
+    n_spectra *= n_outputs;
+    c->filter_re = pa_xnew0(float, n_spectra);
+    c->filter_im = pa_xnew0(float, n_spectra);
+    c->filter_set = pa_xnew0(bool, n_inputs * n_outputs);
+
+    c->acc_re = pa_xnew(float, c->n_bins);
+    c->acc_im = pa_xnew(float, c->n_bins);
+    c->work_re = pa_xnew(float, block_size);
+    c->work_im = pa_xnew(float, block_size);
+    c->time = pa_xnew(float, 2 * block_size);
+
+    return c;
+}
+
+void pa_convolver_free(pa_convolver *c) {
+    pa_assert(c);
+
+    pa_xfree(c->bitrev);
+    pa_xfree(c->twiddle_re);
+    pa_xfree(c->twiddle_im);
+    pa_xfree(c->split_re);
+    pa_xfree(c->split_im);
+    pa_xfree(c->input);
+    pa_xfree(c->output);
+    pa_xfree(c->fdl_re);
+    pa_xfree(c->fdl_im);
+    pa_xfree(c->filter_re);
+    pa_xfree(c->filter_im);
+    pa_xfree(c->filter_set);
+    pa_xfree(c->acc_re);
+    pa_xfree(c->acc_im);
+    pa_xfree(c->work_re);
+    pa_xfree(c->work_im);
+    pa_xfree(c->time);
+    pa_xfree(c);
+}
+
+void pa_convolver_set_filter(pa_convolver *c, unsigned input, unsigned output, const float *ir, unsigned length) {
+    float scale;
+    unsigned p, k, offset;
+
+    pa_assert(c);
+    pa_assert(input < c->n_inputs);
+    pa_assert(output < c->n_outputs);
+    pa_assert(ir);
+    pa_assert(length <= c->n_partitions * c->block_size);
+
+    /* fft_real_inverse() is not normalized, so do that here once */
+    scale = 1.0f / c->block_size;
+    offset = (output * c->n_inputs + input) * c->n_partitions * c->n_bins;
+
+    for (p = 0; p < c->n_partitions; p++) {
+        float *h_re = c->filter_re + offset + p * c->n_bins;
+        float *h_im = c->filter_im + offset + p * c->n_bins;
+        unsigned start = p * c->block_size;
+
+        /* each partition is zero padded to twice its size */
+        memset(c->time, 0, 2 * c->block_size * sizeof(float));
+        if (start < length)
+            memcpy(c->time, ir + start, PA_MIN(length - start, c->block_size) * sizeof(float));
+
+        fft_real_forward(c, c->time, h_re, h_im);
+
+        for (k = 0; k < c->n_bins; k++) {
+            h_re[k] *= scale;
+            h_im[k] *= scale;
+        }
+    }
+
+    c->filter_set[output * c->n_inputs + input] = true;
+}
+
+void pa_convolver_reset(pa_convolver *c) {
+    unsigned n_spectra;
+
+    pa_assert(c);
+
+    n_spectra = c->n_inputs * c->n_partitions * c->n_bins;
+
+    memset(c->input, 0, c->n_inputs * 2 * c->block_size * sizeof(float));
+    memset(c->output, 0, c->n_outputs * c->block_size * sizeof(float));
+    memset(c->fdl_re, 0, n_spectra * sizeof(float));
+    memset(c->fdl_im, 0, n_spectra * sizeof(float));
+    c->fill = 0;
+    c->fdl_head = 0;
+}
+
+static void process_block(pa_convolver *c) {
+    const unsigned block_size = c->block_size, n_bins = c->n_bins, n_partitions = c->n_partitions;
+    unsigned i, o, p, k;
+
+    /* transform the new input blocks into the head of the delay line */
+    for (i = 0; i < c->n_inputs; i++) {
+        float *x = c->input + i * 2 * block_size;
+        unsigned slot = (i * n_partitions + c->fdl_head) * n_bins;
+
+        fft_real_forward(c, x, c->fdl_re + slot, c->fdl_im + slot);
+
+        /* the current block is the previous one next time */
+        memcpy(x, x + block_size, block_size * sizeof(float));
+    }
+
+    for (o = 0; o < c->n_outputs; o++) {
+        float *acc_re = c->acc_re, *acc_im = c->acc_im;
+
+        memset(acc_re, 0, n_bins * sizeof(float));
+        memset(acc_im, 0, n_bins * sizeof(float));
+
+        for (i = 0; i < c->n_inputs; i++) {
+            unsigned filter = (o * c->n_inputs + i) * n_partitions * n_bins;
+
+            if (!c->filter_set[o * c->n_inputs + i])
+                continue;
+
+            /* partition p is applied to the input block that is p blocks old */
+            for (p = 0; p < n_partitions; p++) {
+                unsigned slot = (i * n_partitions + (c->fdl_head + p) % n_partitions) * n_bins;
+                const float *x_re = c->fdl_re + slot, *x_im = c->fdl_im + slot;
+                const float *h_re = c->filter_re + filter + p * n_bins;
+                const float *h_im = c->filter_im + filter + p * n_bins;
+
+                for (k = 0; k < n_bins; k++) {
+                    acc_re[k] += x_re[k] * h_re[k] - x_im[k] * h_im[k];
+                    acc_im[k] += x_re[k] * h_im[k] + x_im[k] * h_re[k];
+                }
+            }
+        }
+
+        fft_real_inverse(c, acc_re, acc_im, c->time);
+
+        /* overlap-save: the first half is wrapped around, only the second
+         * half is valid */
+        memcpy(c->output + o * block_size, c->time + block_size, block_size * sizeof(float));
+    }
+
+    c->fdl_head = (c->fdl_head + n_partitions - 1) % n_partitions;
+}
+
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n) {
+    const unsigned block_size = c->block_size;
+
+    pa_assert(c);
+    pa_assert(src);
+    pa_assert(dst);
+
+    while (n > 0) {
+        unsigned i, o, f, frames;
+
+        frames = PA_MIN(n, block_size - c->fill);
+
+        for (i = 0; i < c->n_inputs; i++) {
+            float *x = c->input + i * 2 * block_size + block_size + c->fill;
+
+            for (f = 0; f < frames; f++)
+                x[f] = src[f * c->n_inputs + i];
+        }
+
+        for (o = 0; o < c->n_outputs; o++) {
+            const float *y = c->output + o * block_size + c->fill;
+
+            for (f = 0; f < frames; f++)
+                dst[f * c->n_outputs + o] = y[f];
+        }
+
+        src += frames * c->n_inputs;
+        dst += frames * c->n_outputs;
+        c->fill += frames;
+        n -= frames;
+
+        if (c->fill == block_size) {
+            process_block(c);
+            c->fill = 0;
+        }
+    }
+}
+
+unsigned pa_convolver_get_latency(pa_convolver *c) {
+    pa_assert(c);
+
+    return c->block_size;
+}
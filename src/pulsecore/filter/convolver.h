@@ -0,0 +1,49 @@
+#ifndef fooconvolverhfoo
+#define fooconvolverhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Uniformly partitioned overlap-save FFT convolution.
+ *
+ * Every output channel is the sum of all input channels, each convolved with
+ * its own impulse response. The impulse responses are cut into partitions of
+ * block_size samples, so the cost per sample grows with the number of
+ * partitions rather than with the number of taps. The input is processed in
+ * blocks, which delays the output by block_size frames. */
+
+typedef struct pa_convolver pa_convolver;
+
+/* block_size must be a power of two and at least 4 */
+pa_convolver *pa_convolver_new(unsigned block_size, unsigned n_inputs, unsigned n_outputs, unsigned max_ir_length);
+void pa_convolver_free(pa_convolver *c);
+
+/* Set the impulse response from input to output, at most max_ir_length
+ * samples long. Filters that are never set are silent. */
+void pa_convolver_set_filter(pa_convolver *c, unsigned input, unsigned output, const float *ir, unsigned length);
+
+/* Forget all history, e.g. after a rewind */
+void pa_convolver_reset(pa_convolver *c);
+
+/* Convolve n interleaved float frames. src has n_inputs channels, dst
+ * n_outputs channels, and they must not overlap. */
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n);
+
+/* The delay introduced by the convolver, in frames */
+unsigned pa_convolver_get_latency(pa_convolver *c);
+
+#endif
@@ -26,17 +26,16 @@
 #include <pulse/xmalloc.h>
 #include <pulsecore/idxset.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/hashtable.h>
 #include <pulsecore/macro.h>
 
 #include "hashmap.h"
 
-#define NBUCKETS 127
-
 struct hashmap_entry {
     void *key;
     void *value;
+    unsigned hash;
 
-    struct hashmap_entry *bucket_next, *bucket_previous;
     struct hashmap_entry *iterate_next, *iterate_previous;
 };
 
@@ -47,18 +46,18 @@ struct pa_hashmap {
     pa_free_cb_t key_free_func;
     pa_free_cb_t value_free_func;
 
+    pa_hashtable table;
+
     struct hashmap_entry *iterate_list_head, *iterate_list_tail;
     unsigned n_entries;
 };
 
-#define BY_HASH(h) ((struct hashmap_entry**) ((uint8_t*) (h) + PA_ALIGN(sizeof(pa_hashmap))))
-
 PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
 
 pa_hashmap *pa_hashmap_new_full(pa_hash_func_t hash_func, pa_compare_func_t compare_func, pa_free_cb_t key_free_func, pa_free_cb_t value_free_func) {
     pa_hashmap *h;
 
-    h = pa_xmalloc0(PA_ALIGN(sizeof(pa_hashmap)) + NBUCKETS*sizeof(struct hashmap_entry*));
+    h = pa_xnew0(pa_hashmap, 1);
 
     h->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     h->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
@@ -66,6 +65,8 @@ pa_hashmap *pa_hashmap_new_full(pa_hash_func_t hash_func, pa_compare_func_t comp
     h->key_free_func = key_free_func;
     h->value_free_func = value_free_func;
 
+    pa_hashtable_init(&h->table);
+
     h->n_entries = 0;
     h->iterate_list_head = h->iterate_list_tail = NULL;
 
@@ -91,16 +92,8 @@ static void remove_entry(pa_hashmap *h, struct hashmap_entry *e) {
     else
         h->iterate_list_head = e->iterate_next;
 
-    /* Remove from hash table bucket list */
-    if (e->bucket_next)
-        e->bucket_next->bucket_previous = e->bucket_previous;
-
-    if (e->bucket_previous)
-        e->bucket_previous->bucket_next = e->bucket_next;
-    else {
-        unsigned hash = h->hash_func(e->key) % NBUCKETS;
-        BY_HASH(h)[hash] = e->bucket_next;
-    }
+    /* Remove from hash table */
+    pa_hashtable_remove(&h->table, e->hash, e);
 
     if (h->key_free_func)
         h->key_free_func(e->key);
@@ -116,15 +109,17 @@ void pa_hashmap_free(pa_hashmap *h) {
     pa_assert(h);
 
     pa_hashmap_remove_all(h);
+    pa_hashtable_done(&h->table);
     pa_xfree(h);
 }
 
 static struct hashmap_entry *hash_scan(pa_hashmap *h, unsigned hash, const void *key) {
     struct hashmap_entry *e;
+    unsigned state = 0;
+
     pa_assert(h);
-    pa_assert(hash < NBUCKETS);
 
-    for (e = BY_HASH(h)[hash]; e; e = e->bucket_next)
+    while ((e = pa_hashtable_lookup(&h->table, hash, &state)))
         if (h->compare_func(e->key, key) == 0)
             return e;
 
@@ -137,7 +132,7 @@ int pa_hashmap_put(pa_hashmap *h, void *key, void *value) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (hash_scan(h, hash, key))
         return -1;
@@ -147,13 +142,10 @@ int pa_hashmap_put(pa_hashmap *h, void *key, void *value) {
 
     e->key = key;
     e->value = value;
+    e->hash = hash;
 
     /* Insert into hash table */
-    e->bucket_next = BY_HASH(h)[hash];
-    e->bucket_previous = NULL;
-    if (BY_HASH(h)[hash])
-        BY_HASH(h)[hash]->bucket_previous = e;
-    BY_HASH(h)[hash] = e;
+    pa_hashtable_insert(&h->table, hash, e);
 
     /* Insert into iteration list */
     e->iterate_previous = h->iterate_list_tail;
@@ -179,7 +171,7 @@ void* pa_hashmap_get(pa_hashmap *h, const void *key) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (!(e = hash_scan(h, hash, key)))
         return NULL;
@@ -194,7 +186,7 @@ void* pa_hashmap_remove(pa_hashmap *h, const void *key) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (!(e = hash_scan(h, hash, key)))
         return NULL;
@@ -0,0 +1,183 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/macro.h>
+
+#include "hashtable.h"
+
+/* The table never gets smaller than this. It is only allocated when the
+ * first entry is added. */
+#define MIN_SLOTS 8
+
+/* Entries are kept in the slot their hash points to, or shortly after it.
+ * When inserting, an entry may take the slot of another entry that is
+ * closer to its own preferred slot, which keeps the probe sequences short
+ * even when the table is quite full. */
+
+/* The hash functions passed to pa_hashmap and pa_idxset are often weak in
+ * the lower bits (pointers, sequential indexes), so everything is mixed
+ * before taking the lower bits as the slot number. This is the finalizer
+ * of MurmurHash3. */
+static unsigned mix(unsigned hash) {
+    uint32_t h = hash;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/* How far the entry in slot i is away from the slot it wants to be in */
+static unsigned probe_distance(pa_hashtable *t, unsigned i) {
+    return (i - (t->slots[i].hash & t->mask)) & t->mask;
+}
+
+static void insert_slot(pa_hashtable *t, unsigned hash, void *entry) {
+    unsigned i = hash & t->mask, distance = 0;
+
+    for (;; i = (i + 1) & t->mask, distance++) {
+        pa_hashtable_slot *s = &t->slots[i];
+        unsigned d;
+
+        if (!s->entry) {
+            s->entry = entry;
+            s->hash = hash;
+            return;
+        }
+
+        /* Take the slot from an entry that is better off than us, and
+         * carry on finding a place for that one */
+        if ((d = probe_distance(t, i)) < distance) {
+            void *e = s->entry;
+            unsigned h = s->hash;
+
+            s->entry = entry;
+            s->hash = hash;
+
+            entry = e;
+            hash = h;
+            distance = d;
+        }
+    }
+}
+
+static void resize(pa_hashtable *t, unsigned n_slots) {
+    pa_hashtable_slot *old = t->slots;
+    unsigned i, old_n_slots = old ? t->mask + 1 : 0;
+
+    pa_assert(n_slots >= MIN_SLOTS);
+    pa_assert((n_slots & (n_slots - 1)) == 0);
+
+    t->slots = pa_xnew0(pa_hashtable_slot, n_slots);
+    t->mask = n_slots - 1;
+
+    for (i = 0; i < old_n_slots; i++)
+        if (old[i].entry)
+            insert_slot(t, old[i].hash, old[i].entry);
+
+    pa_xfree(old);
+}
+
+void pa_hashtable_init(pa_hashtable *t) {
+    pa_assert(t);
+
+    t->slots = NULL;
+    t->mask = 0;
+    t->n_entries = 0;
+}
+
+void pa_hashtable_done(pa_hashtable *t) {
+    pa_assert(t);
+
+    pa_xfree(t->slots);
+    pa_hashtable_init(t);
+}
+
+void pa_hashtable_insert(pa_hashtable *t, unsigned hash, void *entry) {
+    pa_assert(t);
+    pa_assert(entry);
+
+    /* Keep the table at most 3/4 full */
+    if (!t->slots)
+        resize(t, MIN_SLOTS);
+    else if ((t->n_entries + 1) * 4 > (t->mask + 1) * 3)
+        resize(t, (t->mask + 1) * 2);
+
+    insert_slot(t, mix(hash), entry);
+    t->n_entries++;
+}
+
+void pa_hashtable_remove(pa_hashtable *t, unsigned hash, void *entry) {
+    unsigned i, j;
+
+    pa_assert(t);
+    pa_assert(entry);
+    pa_assert(t->n_entries > 0);
+
+    hash = mix(hash);
+
+    for (i = hash & t->mask; t->slots[i].entry != entry; i = (i + 1) & t->mask)
+        pa_assert(t->slots[i].entry);
+
+    /* Move the following entries one slot back, up to the first one that
+     * already is in its preferred slot. That way no tombstones are needed. */
+    for (j = (i + 1) & t->mask; t->slots[j].entry && probe_distance(t, j) > 0; i = j, j = (j + 1) & t->mask)
+        t->slots[i] = t->slots[j];
+
+    t->slots[i].entry = NULL;
+    t->n_entries--;
+
+    if (t->mask + 1 > MIN_SLOTS && t->n_entries * 8 < t->mask + 1)
+        resize(t, (t->mask + 1) / 2);
+}
+
+void *pa_hashtable_lookup(pa_hashtable *t, unsigned hash, unsigned *state) {
+    pa_assert(t);
+    pa_assert(state);
+
+    if (!t->slots)
+        return NULL;
+
+    hash = mix(hash);
+
+    for (; *state <= t->mask; (*state)++) {
+        unsigned i = (hash + *state) & t->mask;
+        pa_hashtable_slot *s = &t->slots[i];
+
+        /* An entry with our hash would have taken this slot */
+        if (!s->entry || probe_distance(t, i) < *state)
+            break;
+
+        if (s->hash == hash) {
+            (*state)++;
+            return s->entry;
+        }
+    }
+
+    *state = t->mask + 1;
+    return NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef foopulsecorehashtablehfoo
+#define foopulsecorehashtablehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* The hash index behind pa_hashmap and pa_idxset: an open addressing table
+ * using Robin Hood hashing, which grows and shrinks with the number of
+ * entries. It only stores pointers to the entries of its user together
+ * with their hash, comparing keys and keeping the entries in order is left
+ * to the user. The table is embedded in the user's structure. */
+
+typedef struct pa_hashtable_slot {
+    void *entry;
+    unsigned hash;
+} pa_hashtable_slot;
+
+typedef struct pa_hashtable {
+    pa_hashtable_slot *slots;
+    unsigned mask;
+    unsigned n_entries;
+} pa_hashtable;
+
+void pa_hashtable_init(pa_hashtable *t);
+void pa_hashtable_done(pa_hashtable *t);
+
+/* Add an entry. There may already be entries with the same hash, but
+ * the entry itself must not be in the table yet. */
+void pa_hashtable_insert(pa_hashtable *t, unsigned hash, void *entry);
+
+/* Remove an entry that was added with the same hash */
+void pa_hashtable_remove(pa_hashtable *t, unsigned hash, void *entry);
+
+/* Return the entries that were added with this hash, one per call. *state
+ * has to be 0 initially. After the last matching entry NULL is returned. */
+void *pa_hashtable_lookup(pa_hashtable *t, unsigned hash, unsigned *state);
+
+#endif
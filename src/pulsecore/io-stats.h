@@ -0,0 +1,60 @@
+#ifndef foopulsecoreiostatshfoo
+#define foopulsecoreiostatshfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulse/def.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+/* Counters that sinks and sources keep in their IO threads. They are
+ * only ever touched from there, so no locking is needed. They are
+ * copied out with PA_SINK_MESSAGE_GET_IO_STATS and
+ * PA_SOURCE_MESSAGE_GET_IO_STATS. */
+typedef struct pa_io_stats {
+    pa_io_histogram render;
+
+    /* These belong to the thread rather than to the sink or source, and
+     * are only filled in from its pa_rtpoll when the stats are copied
+     * out */
+    pa_io_histogram lateness;
+    pa_usec_t poll_time;
+
+    uint64_t underruns;
+    uint64_t rewinds;
+    uint64_t bytes;
+} pa_io_stats;
+
+static inline void pa_io_histogram_add(pa_io_histogram *h, pa_usec_t usec) {
+    unsigned bucket;
+
+    pa_assert(h);
+
+    if (usec >= (pa_usec_t) 1 << (PA_IO_HISTOGRAM_BUCKETS - 1))
+        bucket = PA_IO_HISTOGRAM_BUCKETS - 1;
+    else
+        bucket = pa_ulog2((unsigned) usec);
+
+    h->count++;
+    h->total += usec;
+    h->max = PA_MAX(h->max, usec);
+    h->buckets[bucket]++;
+}
+
+#endif
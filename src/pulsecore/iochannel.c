@@ -41,6 +41,11 @@
 
 #include "iochannel.h"
 
+/* Not all platforms have this */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 struct pa_iochannel {
     int ifd, ofd;
     int ifd_type, ofd_type;
@@ -240,6 +245,61 @@ ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l) {
     return r;
 }
 
+#ifdef HAVE_SYS_UIO_H
+ssize_t pa_iochannel_writev(pa_iochannel*io, const struct iovec *iov, int iovcnt) {
+    ssize_t r = -1;
+    size_t l = 0;
+    int i;
+
+    pa_assert(io);
+    pa_assert(iov);
+    pa_assert(iovcnt > 0);
+    pa_assert(io->ofd >= 0);
+
+    for (i = 0; i < iovcnt; i++)
+        l += iov[i].iov_len;
+
+    pa_assert(l);
+
+    /* Same as pa_write(): try sendmsg() first, so that we get
+     * MSG_NOSIGNAL, and remember if the fd turns out not to be a
+     * socket */
+    if (io->ofd_type == 0) {
+        struct msghdr mh;
+
+        pa_zero(mh);
+        mh.msg_iov = (struct iovec*) iov;
+        mh.msg_iovlen = iovcnt;
+
+        while ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+            ;
+
+        if (r < 0 && errno == ENOTSOCK)
+            io->ofd_type = 1;
+    }
+
+    if (io->ofd_type != 0)
+        while ((r = writev(io->ofd, iov, iovcnt)) < 0 && errno == EINTR)
+            ;
+
+    if ((size_t) r == l)
+        return r;
+
+    if (r < 0) {
+        if (errno == EAGAIN)
+            r = 0;
+        else
+            return r;
+    }
+
+    /* Partial write - let's get a notification when we can write more */
+    io->writable = io->hungup = false;
+    enable_events(io);
+
+    return r;
+}
+#endif
+
 ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l) {
     ssize_t r;
 
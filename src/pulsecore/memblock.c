@@ -79,9 +79,9 @@ struct pa_memblock {
 
     union {
         struct {
-            /* If type == PA_MEMBLOCK_USER this points to a function for freeing this memory block */
+            /* If type == PA_MEMBLOCK_USER or PA_MEMBLOCK_POOL_USER this points to a function for freeing this memory block */
             pa_free_cb_t free_cb;
-            /* If type == PA_MEMBLOCK_USER this is passed as free_cb argument */
+            /* If type == PA_MEMBLOCK_USER or PA_MEMBLOCK_POOL_USER this is passed as free_cb argument */
             void *free_cb_data;
         } user;
 
@@ -188,6 +188,9 @@ struct pa_mempool {
 
     bool global;
 
+    /* The memory is managed by the user, not handed out in slots */
+    bool user;
+
     size_t block_size;
     unsigned n_blocks;
     bool is_remote_writable;
@@ -376,6 +379,9 @@ pa_memblock *pa_memblock_new_pool(pa_mempool *p, size_t length) {
     if (mempool_disable > 0)
         return NULL;
 
+    if (p->user)
+        return NULL;
+
     /* If -1 is passed as length we choose the size for the caller: we
      * take the largest size that fits in one of our slots. */
 
@@ -484,6 +490,42 @@ pa_memblock *pa_memblock_new_user(
     return b;
 }
 
+/* No lock necessary */
+pa_memblock *pa_memblock_new_pool_user(
+        pa_mempool *p,
+        size_t offset,
+        size_t length,
+        pa_free_cb_t free_cb,
+        void *free_cb_data) {
+    pa_memblock *b;
+
+    pa_assert(p);
+    pa_assert(p->user);
+    pa_assert(length);
+    pa_assert(offset + length > offset);
+    pa_assert(offset + length <= p->memory.size);
+
+    if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
+        b = pa_xnew(pa_memblock, 1);
+
+    PA_REFCNT_INIT(b);
+    b->pool = p;
+    pa_mempool_ref(b->pool);
+    b->type = PA_MEMBLOCK_POOL_USER;
+    b->read_only = true;
+    b->is_silence = false;
+    pa_atomic_ptr_store(&b->data, (uint8_t*) p->memory.ptr + offset);
+    b->length = length;
+    pa_atomic_store(&b->n_acquired, 0);
+    pa_atomic_store(&b->please_signal, 0);
+
+    b->per_type.user.free_cb = free_cb;
+    b->per_type.user.free_cb_data = free_cb_data;
+
+    stat_add(b);
+    return b;
+}
+
 /* No lock necessary */
 bool pa_memblock_is_ours(pa_memblock *b) {
     pa_assert(b);
@@ -606,6 +648,15 @@ static void memblock_free(pa_memblock *b) {
 
             break;
 
+        case PA_MEMBLOCK_POOL_USER:
+            if (b->per_type.user.free_cb)
+                b->per_type.user.free_cb(b->per_type.user.free_cb_data);
+
+            if (pa_flist_push(PA_STATIC_FLIST_GET(unused_memblocks), b) < 0)
+                pa_xfree(b);
+
+            break;
+
         case PA_MEMBLOCK_APPENDED:
 
             /* We could attach it to unused_memblocks, but that would
@@ -873,6 +924,40 @@ pa_mempool *pa_mempool_new(pa_mem_type_t type, size_t size, bool per_client) {
     return p;
 }
 
+pa_mempool *pa_mempool_new_user(pa_mem_type_t type, size_t size) {
+    pa_mempool *p;
+    size_t block_size;
+
+    pa_assert(type != PA_MEM_TYPE_PRIVATE);
+    pa_assert(size > 0);
+
+    block_size = PA_PAGE_ALIGN(PA_MEMPOOL_SLOT_SIZE);
+    if (block_size < pa_page_size())
+        block_size = pa_page_size();
+
+    if (!(p = pa_mempool_new(type, PA_ROUND_UP(size, block_size), true)))
+        return NULL;
+
+    p->user = true;
+
+    return p;
+}
+
+void* pa_mempool_get_user_memory(pa_mempool *p, size_t *size) {
+    pa_assert(p);
+    pa_assert(p->user);
+    pa_assert(size);
+
+    *size = p->memory.size;
+    return p->memory.ptr;
+}
+
+bool pa_mempool_is_user(pa_mempool *p) {
+    pa_assert(p);
+
+    return p->user;
+}
+
 static void mempool_free(pa_mempool *p) {
     pa_assert(p);
 
@@ -1438,7 +1523,8 @@ static pa_memblock *memblock_shared_copy(pa_mempool *p, pa_memblock *b) {
 
     if (b->type == PA_MEMBLOCK_IMPORTED ||
         b->type == PA_MEMBLOCK_POOL ||
-        b->type == PA_MEMBLOCK_POOL_EXTERNAL) {
+        b->type == PA_MEMBLOCK_POOL_EXTERNAL ||
+        b->type == PA_MEMBLOCK_POOL_USER) {
         pa_assert(b->pool == p);
         return pa_memblock_ref(b);
     }
@@ -1495,7 +1581,7 @@ int pa_memexport_put(pa_memexport *e, pa_memblock *b, pa_mem_type_t *type, uint3
         pa_assert(b->per_type.imported.segment);
         memory = &b->per_type.imported.segment->memory;
     } else {
-        pa_assert(b->type == PA_MEMBLOCK_POOL || b->type == PA_MEMBLOCK_POOL_EXTERNAL);
+        pa_assert(b->type == PA_MEMBLOCK_POOL || b->type == PA_MEMBLOCK_POOL_EXTERNAL || b->type == PA_MEMBLOCK_POOL_USER);
         pa_assert(b->pool);
         pa_assert(pa_mempool_is_shared(b->pool));
         memory = &b->pool->memory;
@@ -45,6 +45,7 @@ typedef enum pa_memblock_type {
     PA_MEMBLOCK_USER,             /* User supplied memory, to be freed with free_cb */
     PA_MEMBLOCK_FIXED,            /* Data is a pointer to fixed memory that needs not to be freed */
     PA_MEMBLOCK_IMPORTED,         /* Memory is imported from another process via shm */
+    PA_MEMBLOCK_POOL_USER,        /* Memory is part of a user pool, free_cb is called when it is no longer needed */
     PA_MEMBLOCK_TYPE_MAX
 } pa_memblock_type_t;
 
@@ -95,6 +96,11 @@ static inline pa_memblock *pa_memblock_new_malloced(pa_mempool *p, void *data, s
 /* Allocate a new memory block of type PA_MEMBLOCK_FIXED */
 pa_memblock *pa_memblock_new_fixed(pa_mempool *, void *data, size_t length, bool read_only);
 
+/* Allocate a new memory block of type PA_MEMBLOCK_POOL_USER, referring
+ * to length bytes at offset in the memory of a pool created with
+ * pa_mempool_new_user(). free_cb may be NULL. */
+pa_memblock *pa_memblock_new_pool_user(pa_mempool *, size_t offset, size_t length, pa_free_cb_t free_cb, void *free_cb_data);
+
 void pa_memblock_unref(pa_memblock*b);
 pa_memblock* pa_memblock_ref(pa_memblock*b);
 
@@ -125,6 +131,15 @@ pa_memblock *pa_memblock_will_need(pa_memblock *b);
 
 /* The memory block manager */
 pa_mempool *pa_mempool_new(pa_mem_type_t type, size_t size, bool per_client);
+
+/* A per-client shared pool that is not used for allocating blocks, but
+ * whose memory is handed to the caller as a whole. The caller refers
+ * to parts of it with pa_memblock_new_pool_user(), which can be passed
+ * to other processes without copying, just like blocks from ordinary
+ * shared pools. The size is rounded up to whole slots. */
+pa_mempool *pa_mempool_new_user(pa_mem_type_t type, size_t size);
+void* pa_mempool_get_user_memory(pa_mempool *p, size_t *size);
+bool pa_mempool_is_user(pa_mempool *p);
 void pa_mempool_unref(pa_mempool *p);
 pa_mempool* pa_mempool_ref(pa_mempool *p);
 const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p);
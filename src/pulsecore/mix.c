@@ -24,6 +24,7 @@
 #endif
 
 #include <math.h>
+#include <string.h>
 
 #include <pulsecore/sample-util.h>
 #include <pulsecore/macro.h>
@@ -121,6 +122,126 @@ static const pa_calc_stream_volumes_func_t calc_stream_volumes_table[] = {
   [PA_SAMPLE_S24_32BE]  = (pa_calc_stream_volumes_func_t) calc_linear_integer_stream_volumes
 };
 
+/* With many streams, going through all of them for every sample touches
+ * more memory locations at once than the caches and the prefetcher can
+ * keep up with. Instead, the streams are added up one after the other
+ * in tiles that fit into the L1 cache, in an accumulator wide enough to
+ * not overflow, and only the final sum is clamped.
+ *
+ * The volumes of a stream are repeated for MIX_PATTERN_FRAMES frames, so
+ * that the inner loops don't need to track the channel and can be
+ * vectorized by the compiler. The tiles are a multiple of that pattern. */
+#define MIX_TILE_SAMPLES 1024
+#define MIX_PATTERN_FRAMES 16
+
+/* Below this, mixing sample by sample is faster */
+#define MIX_TILED_MIN_STREAMS 8
+
+static unsigned tile_samples(unsigned channels) {
+    unsigned pattern = channels * MIX_PATTERN_FRAMES;
+
+    return MIX_TILE_SAMPLES - MIX_TILE_SAMPLES % pattern;
+}
+
+/* Computes the same as pa_mult_s16_volume(), with the volume split into
+ * its integer and fractional part so that everything fits into 32 bits */
+static void pa_mix_tiled_s16ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    int32_t acc[MIX_TILE_SAMPLES];
+    int32_t hi[PA_CHANNELS_MAX * MIX_PATTERN_FRAMES], lo[PA_CHANNELS_MAX * MIX_PATTERN_FRAMES];
+    unsigned start, n, tile, pattern, i, j, k;
+
+    length /= sizeof(int16_t);
+    tile = tile_samples(channels);
+    pattern = channels * MIX_PATTERN_FRAMES;
+
+    for (start = 0; start < length; start += n) {
+        n = PA_MIN(length - start, tile);
+        memset(acc, 0, n * sizeof(int32_t));
+
+        for (i = 0; i < nstreams; i++) {
+            const int16_t *src = (const int16_t*) streams[i].ptr + start;
+
+            for (j = 0; j < pattern; j++) {
+                hi[j] = streams[i].linear[j % channels].i >> 16;
+                lo[j] = streams[i].linear[j % channels].i & 0xFFFF;
+            }
+
+            for (k = 0; k + pattern <= n; k += pattern)
+                for (j = 0; j < pattern; j++)
+                    acc[k + j] += src[k + j] * hi[j] + ((src[k + j] * lo[j]) >> 16);
+
+            for (j = 0; k + j < n; j++)
+                acc[k + j] += src[k + j] * hi[j] + ((src[k + j] * lo[j]) >> 16);
+        }
+
+        for (k = 0; k < n; k++)
+            data[start + k] = (int16_t) PA_CLAMP_UNLIKELY(acc[k], -0x8000, 0x7FFF);
+    }
+}
+
+static void pa_mix_tiled_s32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    int64_t acc[MIX_TILE_SAMPLES];
+    int64_t volumes[PA_CHANNELS_MAX * MIX_PATTERN_FRAMES];
+    unsigned start, n, tile, pattern, i, j, k;
+
+    length /= sizeof(int32_t);
+    tile = tile_samples(channels);
+    pattern = channels * MIX_PATTERN_FRAMES;
+
+    for (start = 0; start < length; start += n) {
+        n = PA_MIN(length - start, tile);
+        memset(acc, 0, n * sizeof(int64_t));
+
+        for (i = 0; i < nstreams; i++) {
+            const int32_t *src = (const int32_t*) streams[i].ptr + start;
+
+            for (j = 0; j < pattern; j++)
+                volumes[j] = streams[i].linear[j % channels].i;
+
+            for (k = 0; k + pattern <= n; k += pattern)
+                for (j = 0; j < pattern; j++)
+                    acc[k + j] += (src[k + j] * volumes[j]) >> 16;
+
+            for (j = 0; k + j < n; j++)
+                acc[k + j] += (src[k + j] * volumes[j]) >> 16;
+        }
+
+        for (k = 0; k < n; k++)
+            data[start + k] = (int32_t) PA_CLAMP_UNLIKELY(acc[k], -0x80000000LL, 0x7FFFFFFFLL);
+    }
+}
+
+static void pa_mix_tiled_float32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    float acc[MIX_TILE_SAMPLES];
+    float volumes[PA_CHANNELS_MAX * MIX_PATTERN_FRAMES];
+    unsigned start, n, tile, pattern, i, j, k;
+
+    length /= sizeof(float);
+    tile = tile_samples(channels);
+    pattern = channels * MIX_PATTERN_FRAMES;
+
+    for (start = 0; start < length; start += n) {
+        n = PA_MIN(length - start, tile);
+        memset(acc, 0, n * sizeof(float));
+
+        for (i = 0; i < nstreams; i++) {
+            const float *src = (const float*) streams[i].ptr + start;
+
+            for (j = 0; j < pattern; j++)
+                volumes[j] = streams[i].linear[j % channels].f;
+
+            for (k = 0; k + pattern <= n; k += pattern)
+                for (j = 0; j < pattern; j++)
+                    acc[k + j] += src[k + j] * volumes[j];
+
+            for (j = 0; k + j < n; j++)
+                acc[k + j] += src[k + j] * volumes[j];
+        }
+
+        memcpy(data + start, acc, n * sizeof(float));
+    }
+}
+
 /* special case: mix 2 s16ne streams, 1 channel each */
 static void pa_mix2_ch1_s16ne(pa_mix_info streams[], int16_t *data, unsigned length) {
     const int16_t *ptr0 = streams[0].ptr;
@@ -241,7 +362,9 @@ static void pa_mix_generic_s16ne(pa_mix_info streams[], unsigned nstreams, unsig
 }
 
 static void pa_mix_s16ne_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
-    if (nstreams == 2 && channels == 1)
+    if (nstreams >= MIX_TILED_MIN_STREAMS)
+        pa_mix_tiled_s16ne(streams, nstreams, channels, data, length);
+    else if (nstreams == 2 && channels == 1)
         pa_mix2_ch1_s16ne(streams, data, length);
     else if (nstreams == 2 && channels == 2)
         pa_mix2_ch2_s16ne(streams, data, length);
@@ -282,6 +405,11 @@ static void pa_mix_s16re_c(pa_mix_info streams[], unsigned nstreams, unsigned ch
 static void pa_mix_s32ne_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
     unsigned channel = 0;
 
+    if (nstreams >= MIX_TILED_MIN_STREAMS) {
+        pa_mix_tiled_s32ne(streams, nstreams, channels, data, length);
+        return;
+    }
+
     length /= sizeof(int32_t);
 
     for (; length > 0; length--, data++) {
@@ -539,6 +667,11 @@ static void pa_mix_alaw_c(pa_mix_info streams[], unsigned nstreams, unsigned cha
 static void pa_mix_float32ne_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
     unsigned channel = 0;
 
+    if (nstreams >= MIX_TILED_MIN_STREAMS) {
+        pa_mix_tiled_float32ne(streams, nstreams, channels, data, length);
+        return;
+    }
+
     length /= sizeof(float);
 
     for (; length > 0; length--, data++) {
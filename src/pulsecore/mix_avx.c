@@ -0,0 +1,304 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+
+#include "cpu-x86.h"
+#include "mix.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <immintrin.h>
+
+/* Same tiling as the SSE2 code, see mix_sse.c */
+#define TILE_SAMPLES 512U
+#define LANES 8
+
+static void build_integer_volumes(const pa_mix_info *m, unsigned channels, int32_t *volumes) {
+    unsigned k, channel = 0;
+
+    for (k = 0; k < channels + LANES; k++) {
+        int32_t cv = m->linear[channel].i;
+
+        volumes[k] = PA_LIKELY(cv > 0) ? cv : 0;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void build_float_volumes(const pa_mix_info *m, unsigned channels, float *volumes) {
+    unsigned k, channel = 0;
+
+    for (k = 0; k < channels + LANES; k++) {
+        float cv = m->linear[channel].f;
+
+        volumes[k] = PA_LIKELY(cv > 0) ? cv : 0;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+/* Mixes the samples that do not fill a whole vector, same as the generic code */
+static void mix_tail_s16ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned start, unsigned end) {
+    unsigned channel = start % channels;
+
+    for (; start < end; start++) {
+        int32_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            int32_t cv = streams[i].linear[channel].i;
+
+            if (PA_LIKELY(cv > 0))
+                sum += pa_mult_s16_volume(((int16_t *) streams[i].ptr)[start], cv);
+        }
+
+        data[start] = PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void mix_tail_s32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned start, unsigned end) {
+    unsigned channel = start % channels;
+
+    for (; start < end; start++) {
+        int64_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            int32_t cv = streams[i].linear[channel].i;
+
+            if (PA_LIKELY(cv > 0))
+                sum += (((int32_t *) streams[i].ptr)[start] * (int64_t) cv) >> 16;
+        }
+
+        data[start] = (int32_t) PA_CLAMP_UNLIKELY(sum, -0x80000000LL, 0x7FFFFFFFLL);
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void mix_tail_float32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned start, unsigned end) {
+    unsigned channel = start % channels;
+
+    for (; start < end; start++) {
+        float sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            float cv = streams[i].linear[channel].f;
+
+            if (PA_LIKELY(cv > 0))
+                sum += ((float *) streams[i].ptr)[start] * cv;
+        }
+
+        data[start] = sum;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+/* (v * cv) >> 16 is computed exactly as v * hi + ((v * lo) >> 16), the same
+ * as pa_mult_s16_volume(); both products fit in 32 bits. */
+static void pa_mix_s16ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    PA_DECLARE_ALIGNED(32, int32_t, acc[TILE_SAMPLES]);
+    int32_t lo[PA_CHANNELS_MAX + LANES], hi[PA_CHANNELS_MAX + LANES];
+    unsigned start, n, i, k, step, block;
+
+    length /= sizeof(int16_t);
+    step = LANES % channels;
+    /* whole frames that are also whole vectors, so the tail starts at channel 0 */
+    block = LANES * channels / pa_gcd(LANES, channels);
+
+    for (start = 0; start + block <= length; start += n) {
+        unsigned offset = start % channels;
+
+        n = PA_MIN(length - start, TILE_SAMPLES);
+        n -= n % block;
+        memset(acc, 0, n * sizeof(int32_t));
+
+        for (i = 0; i < nstreams; i++) {
+            const int16_t *src = (const int16_t *) streams[i].ptr + start;
+            unsigned channel = offset;
+
+            build_integer_volumes(&streams[i], channels, lo);
+            for (k = 0; k < channels + LANES; k++) {
+                hi[k] = lo[k] >> 16;
+                lo[k] &= 0xFFFF;
+            }
+
+            for (k = 0; k < n; k += LANES) {
+                __m256i v, vlo, vhi, p;
+                __m256i *a = (__m256i *) (acc + k);
+
+                v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (src + k)));
+                vlo = _mm256_loadu_si256((const __m256i *) (lo + channel));
+                vhi = _mm256_loadu_si256((const __m256i *) (hi + channel));
+
+                p = _mm256_add_epi32(_mm256_mullo_epi32(v, vhi),
+                                     _mm256_srai_epi32(_mm256_mullo_epi32(v, vlo), 16));
+                *a = _mm256_add_epi32(*a, p);
+
+                channel += step;
+                if (channel >= channels)
+                    channel -= channels;
+            }
+        }
+
+        for (k = 0; k < n; k += LANES) {
+            __m256i a = _mm256_load_si256((const __m256i *) (acc + k));
+
+            _mm_storeu_si128((__m128i *) (data + start + k),
+                             _mm_packs_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)));
+        }
+    }
+
+    mix_tail_s16ne(streams, nstreams, channels, data, start, length);
+}
+
+/* 64 bit products, offset by 2^63 so that a logical shift can be used; see
+ * pa_mix_s32ne_sse2(). Even samples of each vector are kept in the first
+ * half of the accumulator, odd ones in the second half. */
+static void pa_mix_s32ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    PA_DECLARE_ALIGNED(32, int64_t, acc[TILE_SAMPLES]);
+    int32_t volumes[PA_CHANNELS_MAX + LANES];
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    unsigned start, n, i, k, step, block;
+
+    length /= sizeof(int32_t);
+    step = LANES % channels;
+    block = LANES * channels / pa_gcd(LANES, channels);
+
+    for (start = 0; start + block <= length; start += n) {
+        unsigned offset = start % channels;
+
+        n = PA_MIN(length - start, TILE_SAMPLES);
+        n -= n % block;
+        for (k = 0; k < n; k++)
+            acc[k] = -((int64_t) nstreams << 47);
+
+        for (i = 0; i < nstreams; i++) {
+            const int32_t *src = (const int32_t *) streams[i].ptr + start;
+            unsigned channel = offset;
+
+            build_integer_volumes(&streams[i], channels, volumes);
+
+            for (k = 0; k < n; k += LANES) {
+                __m256i v, cv, even, odd;
+                __m256i *a = (__m256i *) (acc + k);
+
+                v = _mm256_loadu_si256((const __m256i *) (src + k));
+                cv = _mm256_loadu_si256((const __m256i *) (volumes + channel));
+
+                even = _mm256_mul_epi32(v, cv);
+                odd = _mm256_mul_epi32(_mm256_srli_epi64(v, 32), _mm256_srli_epi64(cv, 32));
+
+                a[0] = _mm256_add_epi64(a[0], _mm256_srli_epi64(_mm256_xor_si256(even, sign), 16));
+                a[1] = _mm256_add_epi64(a[1], _mm256_srli_epi64(_mm256_xor_si256(odd, sign), 16));
+
+                channel += step;
+                if (channel >= channels)
+                    channel -= channels;
+            }
+        }
+
+        for (k = 0; k < n; k += LANES) {
+            unsigned j;
+
+            for (j = 0; j < LANES / 2; j++) {
+                data[start + k + 2 * j] = (int32_t) PA_CLAMP_UNLIKELY(acc[k + j], -0x80000000LL, 0x7FFFFFFFLL);
+                data[start + k + 2 * j + 1] = (int32_t) PA_CLAMP_UNLIKELY(acc[k + LANES / 2 + j], -0x80000000LL, 0x7FFFFFFFLL);
+            }
+        }
+    }
+
+    mix_tail_s32ne(streams, nstreams, channels, data, start, length);
+}
+
+static void pa_mix_float32ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    PA_DECLARE_ALIGNED(32, float, acc[TILE_SAMPLES]);
+    float volumes[PA_CHANNELS_MAX + LANES];
+    const __m256 zero = _mm256_setzero_ps();
+    unsigned start, n, i, k, step, block;
+
+    length /= sizeof(float);
+    step = LANES % channels;
+    block = LANES * channels / pa_gcd(LANES, channels);
+
+    for (start = 0; start + block <= length; start += n) {
+        unsigned offset = start % channels;
+
+        n = PA_MIN(length - start, TILE_SAMPLES);
+        n -= n % block;
+        memset(acc, 0, n * sizeof(float));
+
+        for (i = 0; i < nstreams; i++) {
+            const float *src = (const float *) streams[i].ptr + start;
+            unsigned channel = offset;
+
+            build_float_volumes(&streams[i], channels, volumes);
+
+            for (k = 0; k < n; k += LANES) {
+                __m256 v, cv;
+
+                v = _mm256_loadu_ps(src + k);
+                cv = _mm256_loadu_ps(volumes + channel);
+
+                /* no FMA here, the result has to match the other implementations bit by bit */
+                v = _mm256_and_ps(_mm256_mul_ps(v, cv), _mm256_cmp_ps(cv, zero, _CMP_GT_OQ));
+                _mm256_store_ps(acc + k, _mm256_add_ps(_mm256_load_ps(acc + k), v));
+
+                channel += step;
+                if (channel >= channels)
+                    channel -= channels;
+            }
+        }
+
+        memcpy(data + start, acc, n * sizeof(float));
+    }
+
+    mix_tail_float32ne(streams, nstreams, channels, data, start, length);
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_mix_func_init_avx(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized mixing functions.");
+
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_avx2);
+        pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_avx2);
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_avx2);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
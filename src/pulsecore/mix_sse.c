@@ -0,0 +1,319 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+
+#include "cpu-x86.h"
+#include "mix.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <emmintrin.h>
+
+/* The streams are mixed in tiles of this many samples: each stream is
+ * multiplied and added into a 32 or 64 bit accumulator that stays in L1,
+ * the result is clamped and written out once per tile. */
+#define TILE_SAMPLES 512U
+
+/* The volume tables are padded with a full vector worth of entries, so that
+ * a vector load starting at any channel picks up the right factor for each
+ * lane without having to wrap around. */
+#define LANES 4
+
+static void build_integer_volumes(const pa_mix_info *m, unsigned channels, int32_t *volumes) {
+    unsigned k, channel = 0;
+
+    for (k = 0; k < channels + 2 * LANES; k++) {
+        int32_t cv = m->linear[channel].i;
+
+        volumes[k] = PA_LIKELY(cv > 0) ? cv : 0;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void build_float_volumes(const pa_mix_info *m, unsigned channels, float *volumes) {
+    unsigned k, channel = 0;
+
+    for (k = 0; k < channels + LANES; k++) {
+        float cv = m->linear[channel].f;
+
+        volumes[k] = PA_LIKELY(cv > 0) ? cv : 0;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+/* Mixes the samples that do not fill a whole vector, same as the generic code */
+static void mix_tail_s16ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned start, unsigned end) {
+    unsigned channel = start % channels;
+
+    for (; start < end; start++) {
+        int32_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            int32_t cv = streams[i].linear[channel].i;
+
+            if (PA_LIKELY(cv > 0))
+                sum += pa_mult_s16_volume(((int16_t *) streams[i].ptr)[start], cv);
+        }
+
+        data[start] = PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void mix_tail_s32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned start, unsigned end) {
+    unsigned channel = start % channels;
+
+    for (; start < end; start++) {
+        int64_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            int32_t cv = streams[i].linear[channel].i;
+
+            if (PA_LIKELY(cv > 0))
+                sum += (((int32_t *) streams[i].ptr)[start] * (int64_t) cv) >> 16;
+        }
+
+        data[start] = (int32_t) PA_CLAMP_UNLIKELY(sum, -0x80000000LL, 0x7FFFFFFFLL);
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void mix_tail_float32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned start, unsigned end) {
+    unsigned channel = start % channels;
+
+    for (; start < end; start++) {
+        float sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            float cv = streams[i].linear[channel].f;
+
+            if (PA_LIKELY(cv > 0))
+                sum += ((float *) streams[i].ptr)[start] * cv;
+        }
+
+        data[start] = sum;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+/* The volume factor is split into its 16 bit integer and fractional parts,
+ * (v * cv) >> 16 is then computed exactly as v * hi + ((v * lo) >> 16), the
+ * same as pa_mult_s16_volume(). The fractional product uses an unsigned high
+ * multiply, corrected for negative samples. */
+static void pa_mix_s16ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    PA_DECLARE_ALIGNED(16, int32_t, acc[TILE_SAMPLES]);
+    int32_t volumes[PA_CHANNELS_MAX + 2 * LANES];
+    uint16_t lo[PA_CHANNELS_MAX + 2 * LANES];
+    int16_t hi[PA_CHANNELS_MAX + 2 * LANES];
+    unsigned start, n, i, k, step;
+
+    length /= sizeof(int16_t);
+    step = (2 * LANES) % channels;
+
+    for (start = 0; start + 2 * LANES <= length; start += n) {
+        unsigned offset = start % channels;
+
+        n = PA_MIN(length - start, TILE_SAMPLES) & ~(2 * LANES - 1);
+        memset(acc, 0, n * sizeof(int32_t));
+
+        for (i = 0; i < nstreams; i++) {
+            const int16_t *src = (const int16_t *) streams[i].ptr + start;
+            unsigned channel = offset;
+
+            build_integer_volumes(&streams[i], channels, volumes);
+            for (k = 0; k < channels + 2 * LANES; k++) {
+                lo[k] = (uint16_t) (volumes[k] & 0xFFFF);
+                hi[k] = (int16_t) (volumes[k] >> 16);
+            }
+
+            for (k = 0; k < n; k += 2 * LANES) {
+                __m128i v, vlo, vhi, frac, pl, ph;
+                __m128i *a = (__m128i *) (acc + k);
+
+                v = _mm_loadu_si128((const __m128i *) (src + k));
+                vlo = _mm_loadu_si128((const __m128i *) (lo + channel));
+                vhi = _mm_loadu_si128((const __m128i *) (hi + channel));
+
+                /* (v * lo) >> 16, fits in 16 bits */
+                frac = _mm_mulhi_epu16(v, vlo);
+                frac = _mm_sub_epi16(frac, _mm_and_si128(_mm_srai_epi16(v, 15), vlo));
+
+                /* v * hi, 32 bits */
+                pl = _mm_mullo_epi16(v, vhi);
+                ph = _mm_mulhi_epi16(v, vhi);
+
+                a[0] = _mm_add_epi32(a[0], _mm_add_epi32(_mm_unpacklo_epi16(pl, ph),
+                                                         _mm_srai_epi32(_mm_unpacklo_epi16(frac, frac), 16)));
+                a[1] = _mm_add_epi32(a[1], _mm_add_epi32(_mm_unpackhi_epi16(pl, ph),
+                                                         _mm_srai_epi32(_mm_unpackhi_epi16(frac, frac), 16)));
+
+                channel += step;
+                if (channel >= channels)
+                    channel -= channels;
+            }
+        }
+
+        for (k = 0; k < n; k += 2 * LANES) {
+            const __m128i *a = (const __m128i *) (acc + k);
+
+            _mm_storeu_si128((__m128i *) (data + start + k), _mm_packs_epi32(a[0], a[1]));
+        }
+    }
+
+    mix_tail_s16ne(streams, nstreams, channels, data, start, length);
+}
+
+/* Each product is computed in 64 bits. Offsetting it by 2^63 lets us use a
+ * logical instead of an arithmetic shift, the offset (2^47 after the shift)
+ * is taken out of the accumulator up front. The accumulator holds the even
+ * samples of a vector followed by the odd ones. */
+static void pa_mix_s32ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    PA_DECLARE_ALIGNED(16, int64_t, acc[TILE_SAMPLES]);
+    int32_t volumes[PA_CHANNELS_MAX + 2 * LANES];
+    const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    unsigned start, n, i, k, step;
+
+    length /= sizeof(int32_t);
+    step = LANES % channels;
+
+    for (start = 0; start + LANES <= length; start += n) {
+        unsigned offset = start % channels;
+
+        n = PA_MIN(length - start, TILE_SAMPLES) & ~(LANES - 1);
+        for (k = 0; k < n; k++)
+            acc[k] = -((int64_t) nstreams << 47);
+
+        for (i = 0; i < nstreams; i++) {
+            const int32_t *src = (const int32_t *) streams[i].ptr + start;
+            unsigned channel = offset;
+
+            build_integer_volumes(&streams[i], channels, volumes);
+
+            for (k = 0; k < n; k += LANES) {
+                __m128i v, cv, vo, cvo, even, odd;
+                __m128i *a = (__m128i *) (acc + k);
+
+                v = _mm_loadu_si128((const __m128i *) (src + k));
+                cv = _mm_loadu_si128((const __m128i *) (volumes + channel));
+                vo = _mm_srli_epi64(v, 32);
+                cvo = _mm_srli_epi64(cv, 32);
+
+                /* unsigned multiply, then correct for negative samples; the
+                 * volume factors are never negative */
+                even = _mm_mul_epu32(v, cv);
+                even = _mm_sub_epi64(even, _mm_slli_epi64(_mm_and_si128(_mm_srai_epi32(v, 31), cv), 32));
+                odd = _mm_mul_epu32(vo, cvo);
+                odd = _mm_sub_epi64(odd, _mm_slli_epi64(_mm_and_si128(_mm_srai_epi32(vo, 31), cvo), 32));
+
+                a[0] = _mm_add_epi64(a[0], _mm_srli_epi64(_mm_xor_si128(even, sign), 16));
+                a[1] = _mm_add_epi64(a[1], _mm_srli_epi64(_mm_xor_si128(odd, sign), 16));
+
+                channel += step;
+                if (channel >= channels)
+                    channel -= channels;
+            }
+        }
+
+        for (k = 0; k < n; k += LANES) {
+            data[start + k + 0] = (int32_t) PA_CLAMP_UNLIKELY(acc[k + 0], -0x80000000LL, 0x7FFFFFFFLL);
+            data[start + k + 1] = (int32_t) PA_CLAMP_UNLIKELY(acc[k + 2], -0x80000000LL, 0x7FFFFFFFLL);
+            data[start + k + 2] = (int32_t) PA_CLAMP_UNLIKELY(acc[k + 1], -0x80000000LL, 0x7FFFFFFFLL);
+            data[start + k + 3] = (int32_t) PA_CLAMP_UNLIKELY(acc[k + 3], -0x80000000LL, 0x7FFFFFFFLL);
+        }
+    }
+
+    mix_tail_s32ne(streams, nstreams, channels, data, start, length);
+}
+
+static void pa_mix_float32ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    PA_DECLARE_ALIGNED(16, float, acc[TILE_SAMPLES]);
+    float volumes[PA_CHANNELS_MAX + LANES];
+    const __m128 zero = _mm_setzero_ps();
+    unsigned start, n, i, k, step;
+
+    length /= sizeof(float);
+    step = LANES % channels;
+
+    for (start = 0; start + LANES <= length; start += n) {
+        unsigned offset = start % channels;
+
+        n = PA_MIN(length - start, TILE_SAMPLES) & ~(LANES - 1);
+        memset(acc, 0, n * sizeof(float));
+
+        for (i = 0; i < nstreams; i++) {
+            const float *src = (const float *) streams[i].ptr + start;
+            unsigned channel = offset;
+
+            build_float_volumes(&streams[i], channels, volumes);
+
+            for (k = 0; k < n; k += LANES) {
+                __m128 v, cv;
+
+                v = _mm_loadu_ps(src + k);
+                cv = _mm_loadu_ps(volumes + channel);
+
+                /* muted channels are skipped, not multiplied by zero */
+                v = _mm_and_ps(_mm_mul_ps(v, cv), _mm_cmpgt_ps(cv, zero));
+                _mm_store_ps(acc + k, _mm_add_ps(_mm_load_ps(acc + k), v));
+
+                channel += step;
+                if (channel >= channels)
+                    channel -= channels;
+            }
+        }
+
+        memcpy(data + start, acc, n * sizeof(float));
+    }
+
+    mix_tail_float32ne(streams, nstreams, channels, data, start, length);
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_mix_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized mixing functions.");
+
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_sse2);
+        pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_sse2);
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_sse2);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -187,6 +187,10 @@ enum {
      * BOTH DIRECTIONS */
     PA_COMMAND_REGISTER_MEMFD_SHMID,
 
+    /* Supported since protocol v33 (10.0) */
+    PA_COMMAND_GET_SINK_IO_STATS,
+    PA_COMMAND_GET_SOURCE_IO_STATS,
+
     PA_COMMAND_MAX
 };
 
@@ -0,0 +1,488 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <opus.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-format.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "opus-codec.h"
+
+/* The largest packet we let the encoder produce, as recommended by the
+ * libopus documentation */
+#define MAX_PACKET_SIZE 4000
+
+/* Opus packets may be up to 120 ms long */
+#define MAX_PACKET_FRAMES (48000 * 120 / 1000)
+
+#define HEADER_SIZE 6
+
+struct pa_opus_encoder {
+    pa_mempool *pool;
+    OpusEncoder *encoder;
+    pa_sample_spec sample_spec;
+
+    /* PCM that doesn't fill a whole Opus frame yet */
+    float *pending;
+    unsigned n_pending, frame_frames;
+
+    /* The decoded audio lags behind what we give to the encoder by its
+     * lookahead. We count, in frames of the encoder input, how far our
+     * input goes, how far the packets so far stand for it, and how much
+     * they decode to, to tell the decoder which part of every packet is
+     * our input. */
+    unsigned lookahead;
+    uint64_t n_in, n_out, n_decoded;
+
+    /* The encoded packets of the current call */
+    uint8_t *buf;
+    size_t buf_length, buf_allocated;
+};
+
+struct pa_opus_decoder {
+    pa_mempool *pool;
+    OpusDecoder *decoder;
+    pa_sample_spec sample_spec;
+
+    /* Encoded data that doesn't form a complete packet yet */
+    uint8_t *buf;
+    size_t buf_length, buf_allocated;
+
+    float *pcm;
+};
+
+bool pa_opus_sample_spec_supported(const pa_sample_spec *ss) {
+    pa_assert(ss);
+
+    if (ss->channels < 1 || ss->channels > 2)
+        return false;
+
+    switch (ss->rate) {
+        case 8000:
+        case 12000:
+        case 16000:
+        case 24000:
+        case 48000:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool pa_opus_frame_duration_valid(unsigned frame_duration) {
+    return frame_duration == 5 || frame_duration == 10 || frame_duration == 20 || frame_duration == 40 || frame_duration == 60;
+}
+
+pa_format_info *pa_opus_format_new(const pa_sample_spec *ss, const pa_channel_map *map, uint32_t bitrate, unsigned frame_duration) {
+    pa_format_info *f;
+
+    pa_assert(ss);
+    pa_assert(pa_opus_sample_spec_supported(ss));
+    pa_assert(frame_duration == 0 || pa_opus_frame_duration_valid(frame_duration));
+
+    f = pa_format_info_new();
+    f->encoding = PA_ENCODING_OPUS;
+
+    pa_format_info_set_rate(f, (int) ss->rate);
+    pa_format_info_set_channels(f, ss->channels);
+
+    if (map)
+        pa_format_info_set_channel_map(f, map);
+
+    if (bitrate > 0)
+        pa_format_info_set_prop_int(f, PA_OPUS_PROP_BITRATE, (int) bitrate);
+
+    if (frame_duration > 0)
+        pa_format_info_set_prop_int(f, PA_OPUS_PROP_FRAME_DURATION, (int) frame_duration);
+
+    return f;
+}
+
+int pa_opus_format_to_sample_spec(const pa_format_info *f, pa_sample_spec *ss, pa_channel_map *map) {
+    pa_channel_map m;
+    int frame_duration;
+
+    pa_assert(f);
+    pa_assert(ss);
+
+    if (f->encoding != PA_ENCODING_OPUS)
+        return -PA_ERR_INVALID;
+
+    if (pa_format_info_to_sample_spec_fake(f, ss, &m) < 0)
+        return -PA_ERR_INVALID;
+
+    if (!pa_opus_sample_spec_supported(ss))
+        return -PA_ERR_NOTSUPPORTED;
+
+    if (pa_format_info_get_prop_int(f, PA_OPUS_PROP_FRAME_DURATION, &frame_duration) == 0 &&
+        (frame_duration < 0 || !pa_opus_frame_duration_valid((unsigned) frame_duration)))
+        return -PA_ERR_NOTSUPPORTED;
+
+    if (map)
+        *map = m;
+
+    return 0;
+}
+
+pa_opus_encoder *pa_opus_encoder_new(pa_mempool *pool, const pa_format_info *f) {
+    pa_opus_encoder *e;
+    pa_sample_spec ss;
+    int bitrate, frame_duration, error;
+    opus_int32 lookahead;
+
+    pa_assert(pool);
+    pa_assert(f);
+
+    if (pa_opus_format_to_sample_spec(f, &ss, NULL) < 0)
+        return NULL;
+
+    if (pa_format_info_get_prop_int(f, PA_OPUS_PROP_BITRATE, &bitrate) < 0)
+        bitrate = PA_OPUS_BITRATE_DEFAULT * ss.channels;
+
+    if (pa_format_info_get_prop_int(f, PA_OPUS_PROP_FRAME_DURATION, &frame_duration) < 0)
+        frame_duration = PA_OPUS_FRAME_DURATION_DEFAULT;
+
+    e = pa_xnew0(pa_opus_encoder, 1);
+    e->pool = pa_mempool_ref(pool);
+    e->sample_spec = ss;
+
+    if (!(e->encoder = opus_encoder_create((opus_int32) ss.rate, ss.channels, OPUS_APPLICATION_AUDIO, &error))) {
+        pa_log("Failed to create Opus encoder: %s", opus_strerror(error));
+        pa_opus_encoder_free(e);
+        return NULL;
+    }
+
+    if ((error = opus_encoder_ctl(e->encoder, OPUS_SET_BITRATE(bitrate))) != OPUS_OK) {
+        pa_log("Failed to set Opus bitrate %i: %s", bitrate, opus_strerror(error));
+        pa_opus_encoder_free(e);
+        return NULL;
+    }
+
+    if ((error = opus_encoder_ctl(e->encoder, OPUS_GET_LOOKAHEAD(&lookahead))) != OPUS_OK || lookahead < 0) {
+        pa_log("Failed to get the Opus lookahead: %s", opus_strerror(error));
+        pa_opus_encoder_free(e);
+        return NULL;
+    }
+
+    e->lookahead = (unsigned) lookahead;
+    e->frame_frames = ss.rate * (unsigned) frame_duration / 1000;
+    e->pending = pa_xnew(float, e->frame_frames * ss.channels);
+
+    pa_log_debug("Opus encoder: %u Hz, %u channels, %i bit/s, %i ms frames, %u frames lookahead",
+                 ss.rate, ss.channels, bitrate, frame_duration, e->lookahead);
+
+    return e;
+}
+
+void pa_opus_encoder_free(pa_opus_encoder *e) {
+    pa_assert(e);
+
+    if (e->encoder)
+        opus_encoder_destroy(e->encoder);
+
+    pa_xfree(e->pending);
+    pa_xfree(e->buf);
+    pa_mempool_unref(e->pool);
+    pa_xfree(e);
+}
+
+/* Append the packet for a whole Opus frame to the output buffer. Its
+ * header says how much of the decoded frame to skip, and how many of the
+ * frames after that are our input: the decoded frame lags behind by the
+ * lookahead, and only n_in frames were real input. */
+static void encode_frame(pa_opus_encoder *e, const float *pcm) {
+    uint64_t start, end;
+    unsigned skip, n;
+    uint8_t *p;
+    opus_int32 r;
+
+    if (e->buf_allocated - e->buf_length < HEADER_SIZE + MAX_PACKET_SIZE) {
+        e->buf_allocated = PA_MAX(2 * e->buf_allocated, e->buf_length + HEADER_SIZE + MAX_PACKET_SIZE);
+        e->buf = pa_xrealloc(e->buf, e->buf_allocated);
+    }
+
+    /* start is where the next frame of our input is in the decoded audio */
+    start = e->n_out + e->lookahead;
+    end = PA_MIN(e->n_decoded + e->frame_frames, e->n_in + e->lookahead);
+
+    skip = (unsigned) PA_MIN(start - e->n_decoded, (uint64_t) e->frame_frames);
+    n = end > start ? (unsigned) (end - start) : 0;
+
+    e->n_decoded += e->frame_frames;
+    e->n_out += n;
+
+    p = e->buf + e->buf_length;
+
+    if ((r = opus_encode_float(e->encoder, pcm, (int) e->frame_frames, p + HEADER_SIZE, MAX_PACKET_SIZE)) < 0) {
+        /* Can't happen with valid parameters, but better lose a
+         * frame than the stream */
+        pa_log_warn("Opus encoding failed: %s", opus_strerror(r));
+        return;
+    }
+
+    p[0] = (uint8_t) (r >> 8);
+    p[1] = (uint8_t) r;
+    p[2] = (uint8_t) (skip >> 8);
+    p[3] = (uint8_t) skip;
+    p[4] = (uint8_t) (n >> 8);
+    p[5] = (uint8_t) n;
+
+    e->buf_length += HEADER_SIZE + (size_t) r;
+}
+
+static void take_output(pa_opus_encoder *e, pa_memchunk *out) {
+    void *d;
+
+    if (e->buf_length <= 0) {
+        pa_memchunk_reset(out);
+        return;
+    }
+
+    out->memblock = pa_memblock_new(e->pool, e->buf_length);
+    out->index = 0;
+    out->length = e->buf_length;
+
+    d = pa_memblock_acquire(out->memblock);
+    memcpy(d, e->buf, e->buf_length);
+    pa_memblock_release(out->memblock);
+
+    e->buf_length = 0;
+}
+
+void pa_opus_encoder_encode(pa_opus_encoder *e, const pa_memchunk *in, pa_memchunk *out) {
+    const float *src = NULL;
+    size_t fs;
+    unsigned n;
+
+    pa_assert(e);
+    pa_assert(in);
+    pa_assert(out);
+
+    fs = pa_frame_size(&e->sample_spec);
+    pa_assert(in->length % fs == 0);
+
+    n = (unsigned) (in->length / fs);
+    e->n_in += n;
+
+    if (in->memblock)
+        src = (const float*) ((uint8_t*) pa_memblock_acquire(in->memblock) + in->index);
+
+    while (n > 0) {
+        unsigned l;
+
+        /* Encode straight from the input if we have no leftovers */
+        if (e->n_pending == 0 && n >= e->frame_frames && src) {
+            encode_frame(e, src);
+            src += e->frame_frames * e->sample_spec.channels;
+            n -= e->frame_frames;
+            continue;
+        }
+
+        l = PA_MIN(n, e->frame_frames - e->n_pending);
+
+        if (src) {
+            memcpy(e->pending + e->n_pending * e->sample_spec.channels, src, l * fs);
+            src += l * e->sample_spec.channels;
+        } else
+            memset(e->pending + e->n_pending * e->sample_spec.channels, 0, l * fs);
+
+        e->n_pending += l;
+        n -= l;
+
+        if (e->n_pending >= e->frame_frames) {
+            encode_frame(e, e->pending);
+            e->n_pending = 0;
+        }
+    }
+
+    if (in->memblock)
+        pa_memblock_release(in->memblock);
+
+    take_output(e, out);
+}
+
+void pa_opus_encoder_flush(pa_opus_encoder *e, pa_memchunk *out) {
+    pa_assert(e);
+    pa_assert(out);
+
+    /* Pad with silence until the decoded audio has caught up with all of
+     * the input, including what is still in the lookahead */
+    while (e->n_out < e->n_in) {
+        memset(e->pending + e->n_pending * e->sample_spec.channels, 0,
+               (e->frame_frames - e->n_pending) * pa_frame_size(&e->sample_spec));
+        encode_frame(e, e->pending);
+        e->n_pending = 0;
+    }
+
+    pa_assert(e->n_pending == 0);
+
+    /* The silence after the input is not part of the stream */
+    e->n_in = e->n_out = e->n_decoded;
+
+    take_output(e, out);
+}
+
+void pa_opus_encoder_reset(pa_opus_encoder *e) {
+    pa_assert(e);
+
+    /* Also drop what is still in the lookahead, the next packets skip
+     * it */
+    e->n_pending = 0;
+    e->n_in = e->n_out = e->n_decoded;
+}
+
+pa_opus_decoder *pa_opus_decoder_new(pa_mempool *pool, const pa_format_info *f) {
+    pa_opus_decoder *d;
+    pa_sample_spec ss;
+    int error;
+
+    pa_assert(pool);
+    pa_assert(f);
+
+    if (pa_opus_format_to_sample_spec(f, &ss, NULL) < 0)
+        return NULL;
+
+    d = pa_xnew0(pa_opus_decoder, 1);
+    d->pool = pa_mempool_ref(pool);
+    d->sample_spec = ss;
+
+    if (!(d->decoder = opus_decoder_create((opus_int32) ss.rate, ss.channels, &error))) {
+        pa_log("Failed to create Opus decoder: %s", opus_strerror(error));
+        pa_opus_decoder_free(d);
+        return NULL;
+    }
+
+    d->pcm = pa_xnew(float, MAX_PACKET_FRAMES * ss.channels);
+
+    return d;
+}
+
+void pa_opus_decoder_free(pa_opus_decoder *d) {
+    pa_assert(d);
+
+    if (d->decoder)
+        opus_decoder_destroy(d->decoder);
+
+    pa_xfree(d->pcm);
+    pa_xfree(d->buf);
+    pa_mempool_unref(d->pool);
+    pa_xfree(d);
+}
+
+int pa_opus_decoder_decode(pa_opus_decoder *d, const pa_memchunk *in, pa_memchunk *out) {
+    size_t i, end, n_frames = 0, fs;
+    uint8_t *dst = NULL;
+
+    pa_assert(d);
+    pa_assert(in);
+    pa_assert(in->memblock);
+    pa_assert(out);
+
+    pa_memchunk_reset(out);
+
+    if (d->buf_allocated - d->buf_length < in->length) {
+        d->buf_allocated = PA_MAX(2 * d->buf_allocated, d->buf_length + in->length);
+        d->buf = pa_xrealloc(d->buf, d->buf_allocated);
+    }
+
+    memcpy(d->buf + d->buf_length, (uint8_t*) pa_memblock_acquire(in->memblock) + in->index, in->length);
+    pa_memblock_release(in->memblock);
+    d->buf_length += in->length;
+
+    /* First find out how much PCM the complete packets stand for */
+    for (i = 0; i + HEADER_SIZE <= d->buf_length;) {
+        size_t length = ((size_t) d->buf[i] << 8) | d->buf[i + 1];
+        size_t skip = ((size_t) d->buf[i + 2] << 8) | d->buf[i + 3];
+        size_t frames = ((size_t) d->buf[i + 4] << 8) | d->buf[i + 5];
+
+        if (length <= 0 || length > MAX_PACKET_SIZE || skip + frames > MAX_PACKET_FRAMES) {
+            pa_log_warn("Received invalid Opus packet header.");
+            return -1;
+        }
+
+        if (i + HEADER_SIZE + length > d->buf_length)
+            break;
+
+        n_frames += frames;
+        i += HEADER_SIZE + length;
+    }
+
+    /* Packets that stand for no PCM still have to be decoded, the ones
+     * after them depend on them */
+    end = i;
+    if (end <= 0)
+        return 0;
+
+    fs = pa_frame_size(&d->sample_spec);
+
+    if (n_frames > 0) {
+        out->memblock = pa_memblock_new(d->pool, n_frames * fs);
+        out->index = 0;
+        out->length = n_frames * fs;
+
+        dst = pa_memblock_acquire(out->memblock);
+    }
+
+    for (i = 0; i < end;) {
+        size_t length = ((size_t) d->buf[i] << 8) | d->buf[i + 1];
+        size_t skip = ((size_t) d->buf[i + 2] << 8) | d->buf[i + 3];
+        size_t frames = ((size_t) d->buf[i + 4] << 8) | d->buf[i + 5];
+        size_t n;
+        int r;
+
+        if ((r = opus_decode_float(d->decoder, d->buf + i + HEADER_SIZE, (opus_int32) length, d->pcm, MAX_PACKET_FRAMES, 0)) < 0) {
+            pa_log_warn("Failed to decode Opus packet: %s", opus_strerror(r));
+
+            if (out->memblock) {
+                pa_memblock_release(out->memblock);
+                pa_memblock_unref(out->memblock);
+                pa_memchunk_reset(out);
+            }
+
+            return -1;
+        }
+
+        /* Only part of what the packet decodes to may be the sender's
+         * input, see encode_frame() */
+        if (frames > 0) {
+            n = (size_t) r > skip ? PA_MIN(frames, (size_t) r - skip) : 0;
+            memcpy(dst, d->pcm + skip * d->sample_spec.channels, n * fs);
+            memset(dst + n * fs, 0, (frames - n) * fs);
+
+            dst += frames * fs;
+        }
+
+        i += HEADER_SIZE + length;
+    }
+
+    if (out->memblock)
+        pa_memblock_release(out->memblock);
+
+    d->buf_length -= i;
+    memmove(d->buf, d->buf + i, d->buf_length);
+
+    return 0;
+}
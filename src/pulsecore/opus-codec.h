@@ -0,0 +1,87 @@
+#ifndef foopulseopuscodechfoo
+#define foopulseopuscodechfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulse/format.h>
+#include <pulse/sample.h>
+#include <pulse/channelmap.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/memchunk.h>
+
+/* Encoding and decoding of the memblocks of streams that use
+ * PA_ENCODING_OPUS on the native protocol. The PCM side is always
+ * float32ne. On the wire every Opus packet is preceded by its length,
+ * the number of decoded frames to skip and the number of PCM frames it
+ * stands for after those, all as 16 bit network byte order integers.
+ * That way the decoded audio doesn't lag behind by the encoder's
+ * lookahead, and the end of a stream can be sent when it is drained.
+ * See the PROTOCOL file. */
+
+/* Format properties that configure the encoder */
+#define PA_OPUS_PROP_BITRATE "opus.bitrate"
+#define PA_OPUS_PROP_FRAME_DURATION "opus.frame_duration"
+
+#define PA_OPUS_BITRATE_DEFAULT 64000 /* per channel */
+#define PA_OPUS_FRAME_DURATION_DEFAULT 20 /* ms */
+
+typedef struct pa_opus_encoder pa_opus_encoder;
+typedef struct pa_opus_decoder pa_opus_decoder;
+
+/* Returns true if Opus can encode audio of this rate and channel count */
+bool pa_opus_sample_spec_supported(const pa_sample_spec *ss);
+
+/* Returns true if frame_duration (in ms) is a valid Opus frame size */
+bool pa_opus_frame_duration_valid(unsigned frame_duration);
+
+/* Create a new Opus format for the given float PCM sample spec. Pass 0 for
+ * bitrate or frame_duration to leave them to the encoder's default. */
+pa_format_info *pa_opus_format_new(const pa_sample_spec *ss, const pa_channel_map *map, uint32_t bitrate, unsigned frame_duration);
+
+/* Fill in the float PCM sample spec and channel map of an Opus format.
+ * Returns negative if the format can't be used. */
+int pa_opus_format_to_sample_spec(const pa_format_info *f, pa_sample_spec *ss, pa_channel_map *map);
+
+pa_opus_encoder *pa_opus_encoder_new(pa_mempool *pool, const pa_format_info *f);
+void pa_opus_encoder_free(pa_opus_encoder *e);
+
+/* Encode the PCM data in the chunk. A chunk without a memblock is
+ * encoded as silence. Only whole Opus frames are encoded, the rest is
+ * kept until the next call. *out is reset if nothing was encoded,
+ * otherwise the caller has to unref out->memblock. */
+void pa_opus_encoder_encode(pa_opus_encoder *e, const pa_memchunk *in, pa_memchunk *out);
+
+/* Encode the PCM that is left over from earlier calls, and what is
+ * still in the encoder's lookahead, padded with silence. Afterwards the
+ * packets stand for exactly the PCM that was passed in. */
+void pa_opus_encoder_flush(pa_opus_encoder *e, pa_memchunk *out);
+
+/* Drop the PCM that is left over from earlier calls, including what is
+ * still in the encoder's lookahead */
+void pa_opus_encoder_reset(pa_opus_encoder *e);
+
+pa_opus_decoder *pa_opus_decoder_new(pa_mempool *pool, const pa_format_info *f);
+void pa_opus_decoder_free(pa_opus_decoder *d);
+
+/* Decode the encoded data in the chunk. Packets may be split across
+ * chunks. *out is reset if no complete packet was available. Returns
+ * negative if the data is corrupt. */
+int pa_opus_decoder_decode(pa_opus_decoder *d, const pa_memchunk *in, pa_memchunk *out);
+
+#endif
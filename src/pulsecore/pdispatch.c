@@ -199,6 +199,10 @@ static const char *command_names[PA_COMMAND_MAX] = {
     /* Supported since protocol v31 (9.0) */
     /* BOTH DIRECTIONS */
     [PA_COMMAND_REGISTER_MEMFD_SHMID] = "REGISTER_MEMFD_SHMID",
+
+    /* Supported since protocol v33 (10.0) */
+    [PA_COMMAND_GET_SINK_IO_STATS] = "GET_SINK_IO_STATS",
+    [PA_COMMAND_GET_SOURCE_IO_STATS] = "GET_SOURCE_IO_STATS",
 };
 
 #endif
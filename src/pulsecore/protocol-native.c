@@ -58,6 +58,10 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/mem.h>
 
+#ifdef HAVE_OPUS
+#include <pulsecore/opus-codec.h>
+#endif
+
 #include "protocol-native.h"
 
 /* #define PROTOCOL_NATIVE_DEBUG */
@@ -100,6 +104,11 @@ typedef struct record_stream {
     size_t on_the_fly_snapshot;
     pa_usec_t current_monitor_latency;
     pa_usec_t current_source_latency;
+
+#ifdef HAVE_OPUS
+    /* Set if the client asked for Opus on the wire */
+    pa_opus_encoder *encoder;
+#endif
 } record_stream;
 
 #define RECORD_STREAM(o) (record_stream_cast(o))
@@ -145,6 +154,11 @@ typedef struct playback_stream {
     size_t render_memblockq_length;
     pa_usec_t current_sink_latency;
     uint64_t playing_for, underrun_for;
+
+#ifdef HAVE_OPUS
+    /* Set if the client sends Opus on the wire */
+    pa_opus_decoder *decoder;
+#endif
 } playback_stream;
 
 #define PLAYBACK_STREAM(o) (playback_stream_cast(o))
@@ -352,6 +366,12 @@ static void record_stream_free(pa_object *o) {
     record_stream_unlink(s);
 
     pa_memblockq_free(s->memblockq);
+
+#ifdef HAVE_OPUS
+    if (s->encoder)
+        pa_opus_encoder_free(s->encoder);
+#endif
+
     pa_xfree(s);
 }
 
@@ -653,6 +673,12 @@ static void playback_stream_free(pa_object* o) {
     playback_stream_unlink(s);
 
     pa_memblockq_free(s->memblockq);
+
+#ifdef HAVE_OPUS
+    if (s->decoder)
+        pa_opus_decoder_free(s->decoder);
+#endif
+
     pa_xfree(s);
 }
 
@@ -1250,6 +1276,32 @@ static void native_connection_send_memblock(pa_native_connection *c) {
         else if (start == c->rrobin_index)
             return;
 
+#ifdef HAVE_OPUS
+        if (r->encoder) {
+            pa_memchunk encoded;
+
+            pa_memchunk_reset(&encoded);
+
+            /* The encoder keeps what doesn't fill a whole frame, so we
+             * might need to feed it more than one chunk */
+            while (!encoded.memblock && pa_memblockq_peek(r->memblockq, &chunk) >= 0) {
+                pa_opus_encoder_encode(r->encoder, &chunk, &encoded);
+
+                pa_memblockq_drop(r->memblockq, chunk.length);
+                if (chunk.memblock)
+                    pa_memblock_unref(chunk.memblock);
+            }
+
+            if (encoded.memblock) {
+                pa_pstream_send_memblock(c->pstream, r->index, 0, PA_SEEK_RELATIVE, &encoded);
+                pa_memblock_unref(encoded.memblock);
+                return;
+            }
+
+            continue;
+        }
+#endif
+
         if (pa_memblockq_peek(r->memblockq, &chunk) >= 0) {
             pa_memchunk schunk = chunk;
 
@@ -1839,6 +1891,33 @@ static pa_tagstruct *reply_new(uint32_t tag) {
     return reply;
 }
 
+#ifdef HAVE_OPUS
+/* If the client offered Opus, we take it, and let the stream itself use
+ * the float PCM that the codec works on. The Opus format is removed from
+ * the list and returned. */
+static pa_format_info *negotiate_opus_format(pa_idxset *formats) {
+    pa_format_info *f, *opus = NULL;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    uint32_t idx;
+
+    PA_IDXSET_FOREACH(f, formats, idx)
+        if (pa_opus_format_to_sample_spec(f, &ss, &map) >= 0) {
+            opus = f;
+            break;
+        }
+
+    if (!opus)
+        return NULL;
+
+    pa_assert_se(pa_idxset_remove_by_data(formats, opus, NULL) == opus);
+    pa_idxset_remove_all(formats, (pa_free_cb_t) pa_format_info_free);
+    pa_idxset_put(formats, pa_format_info_from_sample_spec(&ss, &map), NULL);
+
+    return opus;
+}
+#endif
+
 static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     playback_stream *s;
@@ -1875,6 +1954,9 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
     uint8_t n_formats = 0;
     pa_format_info *format;
     pa_idxset *formats = NULL;
+#ifdef HAVE_OPUS
+    pa_format_info *opus_format = NULL;
+#endif
     uint32_t i;
 
     pa_native_connection_assert_ref(c);
@@ -2012,6 +2094,11 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
         goto finish;
     }
 
+#ifdef HAVE_OPUS
+    if (formats && c->version >= 33)
+        opus_format = negotiate_opus_format(formats);
+#endif
+
     if (sink_index != PA_INVALID_INDEX) {
 
         if (!(sink = pa_idxset_get_by_index(c->protocol->core->sinks, sink_index))) {
@@ -2050,6 +2137,21 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
 
     CHECK_VALIDITY_GOTO(c->pstream, s, tag, ret, finish);
 
+#ifdef HAVE_OPUS
+    if (opus_format) {
+        pa_sample_spec opus_ss;
+
+        pa_assert_se(pa_opus_format_to_sample_spec(opus_format, &opus_ss, NULL) >= 0);
+
+        if (!pa_sample_spec_equal(&ss, &opus_ss) ||
+            !(s->decoder = pa_opus_decoder_new(c->protocol->core->mempool, opus_format))) {
+            playback_stream_unlink(s);
+            pa_pstream_send_error(c->pstream, tag, PA_ERR_NOTSUPPORTED);
+            goto finish;
+        }
+    }
+#endif
+
     reply = reply_new(tag);
     pa_tagstruct_putu32(reply, s->index);
     pa_assert(s->sink_input);
@@ -2088,6 +2190,11 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
 
     if (c->version >= 21) {
         /* Send back the format we negotiated */
+#ifdef HAVE_OPUS
+        if (opus_format)
+            pa_tagstruct_put_format_info(reply, opus_format);
+        else
+#endif
         if (s->sink_input->format)
             pa_tagstruct_put_format_info(reply, s->sink_input->format);
         else {
@@ -2104,6 +2211,10 @@ finish:
         pa_proplist_free(p);
     if (formats)
         pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
+#ifdef HAVE_OPUS
+    if (opus_format)
+        pa_format_info_free(opus_format);
+#endif
 }
 
 static void command_delete_stream(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -2203,6 +2314,9 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
     uint8_t n_formats = 0;
     pa_format_info *format;
     pa_idxset *formats = NULL;
+#ifdef HAVE_OPUS
+    pa_format_info *opus_format = NULL;
+#endif
     uint32_t i;
 
     pa_native_connection_assert_ref(c);
@@ -2331,6 +2445,11 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
         goto finish;
     }
 
+#ifdef HAVE_OPUS
+    if (formats && c->version >= 33)
+        opus_format = negotiate_opus_format(formats);
+#endif
+
     if (source_index != PA_INVALID_INDEX) {
 
         if (!(source = pa_idxset_get_by_index(c->protocol->core->sources, source_index))) {
@@ -2371,6 +2490,21 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
 
     CHECK_VALIDITY_GOTO(c->pstream, s, tag, ret, finish);
 
+#ifdef HAVE_OPUS
+    if (opus_format) {
+        pa_sample_spec opus_ss;
+
+        pa_assert_se(pa_opus_format_to_sample_spec(opus_format, &opus_ss, NULL) >= 0);
+
+        if (!pa_sample_spec_equal(&ss, &opus_ss) ||
+            !(s->encoder = pa_opus_encoder_new(c->protocol->core->mempool, opus_format))) {
+            record_stream_unlink(s);
+            pa_pstream_send_error(c->pstream, tag, PA_ERR_NOTSUPPORTED);
+            goto finish;
+        }
+    }
+#endif
+
     reply = reply_new(tag);
     pa_tagstruct_putu32(reply, s->index);
     pa_assert(s->source_output);
@@ -2402,6 +2536,11 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
 
     if (c->version >= 22) {
         /* Send back the format we negotiated */
+#ifdef HAVE_OPUS
+        if (opus_format)
+            pa_tagstruct_put_format_info(reply, opus_format);
+        else
+#endif
         if (s->source_output->format)
             pa_tagstruct_put_format_info(reply, s->source_output->format);
         else {
@@ -2418,6 +2557,10 @@ finish:
         pa_proplist_free(p);
     if (formats)
         pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
+#ifdef HAVE_OPUS
+    if (opus_format)
+        pa_format_info_free(opus_format);
+#endif
 }
 
 static void command_exit(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -2719,8 +2862,15 @@ static void command_register_memfd_shmid(pa_pdispatch *pd, uint32_t command, uin
     pa_native_connection_assert_ref(c);
     pa_assert(t);
 
-    if (pa_common_command_register_memfd_shmid(c->pstream, pd, c->version, command, t))
+    if (pa_common_command_register_memfd_shmid(c->pstream, pd, c->version, command, t)) {
         protocol_error(c);
+        return;
+    }
+
+    /* Since v33 clients may ask to be told when they can send blocks
+     * from the pool */
+    if (tag != (uint32_t) -1)
+        pa_pstream_send_simple_ack(c->pstream, tag);
 }
 
 static void command_set_client_name(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -3570,6 +3720,95 @@ static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
+static void io_histogram_put(pa_tagstruct *t, const pa_io_histogram *h) {
+    unsigned i;
+
+    pa_tagstruct_putu64(t, h->count);
+    pa_tagstruct_put_usec(t, h->total);
+    pa_tagstruct_put_usec(t, h->max);
+
+    pa_tagstruct_putu8(t, PA_IO_HISTOGRAM_BUCKETS);
+    for (i = 0; i < PA_IO_HISTOGRAM_BUCKETS; i++)
+        pa_tagstruct_putu32(t, h->buckets[i]);
+}
+
+static void io_stats_fill_tagstruct(pa_tagstruct *t, uint32_t idx, const char *name, const pa_io_stats *stats) {
+    pa_tagstruct_putu32(t, idx);
+    pa_tagstruct_puts(t, name);
+    io_histogram_put(t, &stats->render);
+    io_histogram_put(t, &stats->lateness);
+    pa_tagstruct_put_usec(t, stats->poll_time);
+    pa_tagstruct_putu64(t, stats->underruns);
+    pa_tagstruct_putu64(t, stats->rewinds);
+    pa_tagstruct_putu64(t, stats->bytes);
+}
+
+static void sink_io_stats_fill_tagstruct(pa_tagstruct *t, pa_sink *sink) {
+    pa_io_stats stats;
+
+    pa_sink_get_io_stats(sink, &stats);
+    io_stats_fill_tagstruct(t, sink->index, sink->name, &stats);
+}
+
+static void source_io_stats_fill_tagstruct(pa_tagstruct *t, pa_source *source) {
+    pa_io_stats stats;
+
+    pa_source_get_io_stats(source, &stats);
+    io_stats_fill_tagstruct(t, source->index, source->name, &stats);
+}
+
+static void command_get_io_stats(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t idx;
+    pa_tagstruct *reply;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    /* PA_INVALID_INDEX asks for all sinks or sources */
+    if (command == PA_COMMAND_GET_SINK_IO_STATS) {
+        pa_sink *sink;
+
+        if (idx != PA_INVALID_INDEX) {
+            sink = pa_idxset_get_by_index(c->protocol->core->sinks, idx);
+            CHECK_VALIDITY(c->pstream, sink, tag, PA_ERR_NOENTITY);
+
+            reply = reply_new(tag);
+            sink_io_stats_fill_tagstruct(reply, sink);
+        } else {
+            reply = reply_new(tag);
+            PA_IDXSET_FOREACH(sink, c->protocol->core->sinks, idx)
+                sink_io_stats_fill_tagstruct(reply, sink);
+        }
+    } else {
+        pa_source *source;
+
+        pa_assert(command == PA_COMMAND_GET_SOURCE_IO_STATS);
+
+        if (idx != PA_INVALID_INDEX) {
+            source = pa_idxset_get_by_index(c->protocol->core->sources, idx);
+            CHECK_VALIDITY(c->pstream, source, tag, PA_ERR_NOENTITY);
+
+            reply = reply_new(tag);
+            source_io_stats_fill_tagstruct(reply, source);
+        } else {
+            reply = reply_new(tag);
+            PA_IDXSET_FOREACH(source, c->protocol->core->sources, idx)
+                source_io_stats_fill_tagstruct(reply, source);
+        }
+    }
+
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
 static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_idxset *i;
@@ -4932,6 +5171,9 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 
     [PA_COMMAND_REGISTER_MEMFD_SHMID] = command_register_memfd_shmid,
 
+    [PA_COMMAND_GET_SINK_IO_STATS] = command_get_io_stats,
+    [PA_COMMAND_GET_SOURCE_IO_STATS] = command_get_io_stats,
+
     [PA_COMMAND_EXTENSION] = command_extension
 };
 
@@ -4970,8 +5212,32 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
 
     if (playback_stream_isinstance(stream)) {
         playback_stream *ps = PLAYBACK_STREAM(stream);
+        size_t frame_size;
+
+#ifdef HAVE_OPUS
+        if (ps->decoder) {
+            pa_memchunk decoded;
+
+            /* Once the packet framing is lost there is no way to find
+             * back in, so we give up on the client */
+            if (!chunk->memblock || seek != PA_SEEK_RELATIVE || offset != 0 ||
+                pa_opus_decoder_decode(ps->decoder, chunk, &decoded) < 0) {
+                pa_log_warn("Client sent invalid Opus data.");
+                protocol_error(c);
+                return;
+            }
+
+            if (decoded.memblock) {
+                pa_atomic_inc(&ps->seek_or_post_in_queue);
+                pa_asyncmsgq_post(ps->sink_input->sink->asyncmsgq, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, &decoded, NULL);
+                pa_memblock_unref(decoded.memblock);
+            }
+
+            return;
+        }
+#endif
 
-        size_t frame_size = pa_frame_size(&ps->sink_input->sample_spec);
+        frame_size = pa_frame_size(&ps->sink_input->sample_spec);
         if (chunk->index % frame_size != 0 || chunk->length % frame_size != 0) {
             pa_log_warn("Client sent non-aligned memblock: index %d, length %d, frame size: %d",
                         (int) chunk->index, (int) chunk->length, (int) frame_size);
@@ -128,8 +128,14 @@ void pa_pstream_send_simple_ack(pa_pstream *p, uint32_t tag) {
  * between that ID and the passed memfd memory area.
  *
  * By doing so, we won't need to reference the pool's memfd fd any
- * further - just its ID. Both endpoints can then close their fds. */
-int pa_pstream_register_memfd_mempool(pa_pstream *p, pa_mempool *pool, const char **fail_reason) {
+ * further - just its ID. Both endpoints can then close their fds.
+ *
+ * The packet goes over the pipe, while block references may go over
+ * the srbchannel, so the other end can see blocks from the pool before
+ * the registration. If tag is not -1, servers since protocol v33 reply
+ * once the registration is done; blocks from the pool must not be sent
+ * before that. */
+int pa_pstream_register_memfd_mempool_with_tag(pa_pstream *p, pa_mempool *pool, uint32_t tag, const char **fail_reason) {
 #if defined(HAVE_CREDS) && defined(HAVE_MEMFD)
     unsigned shm_id;
     int memfd_fd, ret = -1;
@@ -181,7 +187,7 @@ int pa_pstream_register_memfd_mempool(pa_pstream *p, pa_mempool *pool, const cha
 
     t = pa_tagstruct_new();
     pa_tagstruct_putu32(t, PA_COMMAND_REGISTER_MEMFD_SHMID);
-    pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
+    pa_tagstruct_putu32(t, tag);
     pa_tagstruct_putu32(t, shm_id);
     pa_pstream_send_tagstruct_with_fds(p, t, 1, &memfd_fd, per_client_mempool);
 
@@ -34,6 +34,9 @@ void pa_pstream_send_tagstruct_with_fds(pa_pstream *p, pa_tagstruct *t, int nfd,
 void pa_pstream_send_error(pa_pstream *p, uint32_t tag, uint32_t error);
 void pa_pstream_send_simple_ack(pa_pstream *p, uint32_t tag);
 
-int pa_pstream_register_memfd_mempool(pa_pstream *p, pa_mempool *pool, const char **fail_reason);
+int pa_pstream_register_memfd_mempool_with_tag(pa_pstream *p, pa_mempool *pool, uint32_t tag, const char **fail_reason);
+
+#define pa_pstream_register_memfd_mempool(p, pool, fail_reason) \
+    pa_pstream_register_memfd_mempool_with_tag((p), (pool), (uint32_t) -1, (fail_reason))
 
 #endif
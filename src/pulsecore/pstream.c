@@ -26,6 +26,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #endif
@@ -33,6 +37,7 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/idxset.h>
+#include <pulsecore/hashmap.h>
 #include <pulsecore/socket.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/log.h>
@@ -77,6 +82,12 @@ typedef uint32_t pa_pstream_descriptor[PA_PSTREAM_DESCRIPTOR_MAX];
 
 #define MINIBUF_SIZE (256)
 
+/* When writing to a socket, up to this many queued items are gathered
+ * into one write. We stop looking at further items once we have this
+ * many bytes, more wouldn't fit into the socket buffer anyway. */
+#define WRITE_BATCH_MAX (16)
+#define WRITE_BATCH_BYTES (64*1024)
+
 /* To allow uploading a single sample in one frame, this value should be the
  * same size (16 MB) as PA_SCACHE_ENTRY_SIZE_MAX from pulsecore/core-scache.h.
  */
@@ -109,6 +120,21 @@ struct item_info {
     uint32_t block_id;
 };
 
+struct pstream_write {
+    union {
+        uint8_t minibuf[MINIBUF_SIZE];
+        pa_pstream_descriptor descriptor;
+    };
+    struct item_info* current;
+    void *data;
+    size_t index;
+    int minibuf_validsize;
+    pa_memchunk memchunk;
+#ifdef HAVE_CREDS
+    bool send_ancil_data_now;
+#endif
+};
+
 struct pstream_read {
     pa_pstream_descriptor descriptor;
     pa_memblock *memblock;
@@ -131,17 +157,11 @@ struct pa_pstream {
 
     bool dead;
 
-    struct {
-        union {
-            uint8_t minibuf[MINIBUF_SIZE];
-            pa_pstream_descriptor descriptor;
-        };
-        struct item_info* current;
-        void *data;
-        size_t index;
-        int minibuf_validsize;
-        pa_memchunk memchunk;
-    } write;
+    /* The items that are currently being written. Usually this is
+     * only one, but when writing to a socket more are prepared so that
+     * they can be written together. */
+    struct pstream_write write[WRITE_BATCH_MAX];
+    unsigned n_write;
 
     struct pstream_read readio, readsrb;
 
@@ -159,6 +179,13 @@ struct pa_pstream {
     pa_memimport *import;
     pa_memexport *export;
 
+    /* Exports for blocks from registered user pools, see
+     * pa_mempool_new_user(). Unlike blocks from other foreign pools
+     * these stay referenced until the other side releases them, since
+     * the owner of the pool needs to know when it may reuse the
+     * memory. Keyed by pool. */
+    pa_hashmap *user_exports;
+
     pa_pstream_packet_cb_t receive_packet_callback;
     void *receive_packet_callback_userdata;
 
@@ -180,8 +207,7 @@ struct pa_pstream {
     pa_mempool *mempool;
 
 #ifdef HAVE_CREDS
-    pa_cmsg_ancil_data read_ancil_data, *write_ancil_data;
-    bool send_ancil_data_now;
+    pa_cmsg_ancil_data read_ancil_data;
 #endif
 };
 
@@ -401,17 +427,20 @@ static void item_free(void *item) {
 }
 
 static void pstream_free(pa_pstream *p) {
+    unsigned i;
+
     pa_assert(p);
 
     pa_pstream_unlink(p);
 
     pa_queue_free(p->send_queue, item_free);
 
-    if (p->write.current)
-        item_free(p->write.current);
+    for (i = 0; i < p->n_write; i++) {
+        item_free(p->write[i].current);
 
-    if (p->write.memchunk.memblock)
-        pa_memblock_unref(p->write.memchunk.memblock);
+        if (p->write[i].memchunk.memblock)
+            pa_memblock_unref(p->write[i].memchunk.memblock);
+    }
 
     if (p->readsrb.memblock)
         pa_memblock_unref(p->readsrb.memblock);
@@ -584,77 +613,94 @@ static void memexport_revoke_cb(pa_memexport *e, uint32_t block_id, void *userda
         pa_pstream_send_revoke(p, block_id);
 }
 
-static void prepare_next_write_item(pa_pstream *p) {
+/* Take the next item off the send queue and put it into the next free
+ * write slot. Returns false if there is nothing queued. */
+static bool prepare_next_write_item(pa_pstream *p) {
+    struct pstream_write *w;
+
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->n_write < WRITE_BATCH_MAX);
 
-    p->write.current = pa_queue_pop(p->send_queue);
+    w = &p->write[p->n_write];
+    w->current = pa_queue_pop(p->send_queue);
 
-    if (!p->write.current)
-        return;
-    p->write.index = 0;
-    p->write.data = NULL;
-    p->write.minibuf_validsize = 0;
-    pa_memchunk_reset(&p->write.memchunk);
-
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
-
-    if (p->write.current->type == PA_PSTREAM_ITEM_PACKET) {
+    if (!w->current)
+        return false;
+
+    p->n_write++;
+
+    w->index = 0;
+    w->data = NULL;
+    w->minibuf_validsize = 0;
+    pa_memchunk_reset(&w->memchunk);
+
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
+
+    if (w->current->type == PA_PSTREAM_ITEM_PACKET) {
         size_t plen;
 
-        pa_assert(p->write.current->packet);
+        pa_assert(w->current->packet);
 
-        p->write.data = (void *) pa_packet_data(p->write.current->packet, &plen);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) plen);
+        w->data = (void *) pa_packet_data(w->current->packet, &plen);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) plen);
 
         if (plen <= MINIBUF_SIZE - PA_PSTREAM_DESCRIPTOR_SIZE) {
-            memcpy(&p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE], p->write.data, plen);
-            p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + plen;
+            memcpy(&w->minibuf[PA_PSTREAM_DESCRIPTOR_SIZE], w->data, plen);
+            w->minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + plen;
         }
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
+    } else if (w->current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(w->current->block_id);
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
+    } else if (w->current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(w->current->block_id);
 
     } else {
         uint32_t flags;
         bool send_payload = true;
 
-        pa_assert(p->write.current->type == PA_PSTREAM_ITEM_MEMBLOCK);
-        pa_assert(p->write.current->chunk.memblock);
+        pa_assert(w->current->type == PA_PSTREAM_ITEM_MEMBLOCK);
+        pa_assert(w->current->chunk.memblock);
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(p->write.current->channel);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) p->write.current->offset) >> 32));
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) p->write.current->offset));
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(w->current->channel);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) w->current->offset) >> 32));
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) w->current->offset));
 
-        flags = (uint32_t) (p->write.current->seek_mode & PA_FLAG_SEEKMASK);
+        flags = (uint32_t) (w->current->seek_mode & PA_FLAG_SEEKMASK);
 
         if (p->use_shm) {
             pa_mem_type_t type;
             uint32_t block_id, shm_id;
             size_t offset, length;
-            uint32_t *shm_info = (uint32_t *) &p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE];
+            uint32_t *shm_info = (uint32_t *) &w->minibuf[PA_PSTREAM_DESCRIPTOR_SIZE];
             size_t shm_size = sizeof(uint32_t) * PA_PSTREAM_SHM_MAX;
-            pa_mempool *current_pool = pa_memblock_get_pool(p->write.current->chunk.memblock);
+            pa_mempool *current_pool = pa_memblock_get_pool(w->current->chunk.memblock);
             pa_memexport *current_export;
 
             if (p->mempool == current_pool)
                 pa_assert_se(current_export = p->export);
-            else
+            else if (pa_mempool_is_user(current_pool)) {
+                if (!p->user_exports)
+                    p->user_exports = pa_hashmap_new_full(NULL, NULL, NULL, (pa_free_cb_t) pa_memexport_free);
+
+                if (!(current_export = pa_hashmap_get(p->user_exports, current_pool))) {
+                    pa_assert_se(current_export = pa_memexport_new(current_pool, memexport_revoke_cb, p));
+                    pa_assert_se(pa_hashmap_put(p->user_exports, current_pool, current_export) == 0);
+                }
+            } else
                 pa_assert_se(current_export = pa_memexport_new(current_pool, memexport_revoke_cb, p));
 
             if (pa_memexport_put(current_export,
-                                 p->write.current->chunk.memblock,
+                                 w->current->chunk.memblock,
                                  &type,
                                  &block_id,
                                  &shm_id,
@@ -685,35 +731,36 @@ static void prepare_next_write_item(pa_pstream *p) {
 
                     shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
                     shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
-                    shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + p->write.current->chunk.index));
-                    shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
+                    shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + w->current->chunk.index));
+                    shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) w->current->chunk.length);
 
-                    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(shm_size);
-                    p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + shm_size;
+                    w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(shm_size);
+                    w->minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + shm_size;
                 }
             }
 /*             else */
 /*                 FIXME: Avoid memexport slot leaks. Call pa_memexport_process_release() */
 /*                 pa_log_warn("Failed to export memory block."); */
 
-            if (current_export != p->export)
+            if (current_export != p->export && !pa_mempool_is_user(current_pool))
                 pa_memexport_free(current_export);
             pa_mempool_unref(current_pool);
         }
 
         if (send_payload) {
-            p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
-            p->write.memchunk = p->write.current->chunk;
-            pa_memblock_ref(p->write.memchunk.memblock);
+            w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) w->current->chunk.length);
+            w->memchunk = w->current->chunk;
+            pa_memblock_ref(w->memchunk.memblock);
         }
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
     }
 
 #ifdef HAVE_CREDS
-    if ((p->send_ancil_data_now = p->write.current->with_ancil_data))
-        p->write_ancil_data = &p->write.current->ancil_data;
+    w->send_ancil_data_now = w->current->with_ancil_data;
 #endif
+
+    return true;
 }
 
 static void check_srbpending(pa_pstream *p) {
@@ -730,59 +777,187 @@ static void check_srbpending(pa_pstream *p) {
         pa_srbchannel_set_callback(p->srb, srb_callback, p);
 }
 
+/* Return the contiguous part of the item that starts index bytes into
+ * it. If that is in a memblock, the memblock is acquired and returned
+ * in *acquired, and has to be released by the caller. */
+static size_t get_write_segment(struct pstream_write *w, size_t index, void **d, pa_memblock **acquired) {
+    pa_assert(w);
+    pa_assert(d);
+    pa_assert(acquired);
+
+    *acquired = NULL;
+
+    if (w->minibuf_validsize > 0) {
+        *d = w->minibuf + index;
+        return w->minibuf_validsize - index;
+    }
+
+    if (index < PA_PSTREAM_DESCRIPTOR_SIZE) {
+        *d = (uint8_t*) w->descriptor + index;
+        return PA_PSTREAM_DESCRIPTOR_SIZE - index;
+    }
+
+    pa_assert(w->data || w->memchunk.memblock);
+
+    if (w->data)
+        *d = w->data;
+    else {
+        *d = pa_memblock_acquire_chunk(&w->memchunk);
+        *acquired = w->memchunk.memblock;
+    }
+
+    *d = (uint8_t*) *d + index - PA_PSTREAM_DESCRIPTOR_SIZE;
+    return ntohl(w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (index - PA_PSTREAM_DESCRIPTOR_SIZE);
+}
+
+static size_t get_write_item_size(struct pstream_write *w) {
+    pa_assert(w);
+
+    return PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+}
+
+/* Account for r bytes having been written, and free all items that
+ * have been written completely */
+static void advance_write(pa_pstream *p, size_t r) {
+    bool done = false;
+
+    pa_assert(p);
+
+    while (r > 0) {
+        struct pstream_write *w = &p->write[0];
+        size_t l;
+
+        pa_assert(p->n_write > 0);
+        pa_assert(w->current);
+
+        l = PA_MIN(r, get_write_item_size(w) - w->index);
+        w->index += l;
+        r -= l;
+
+        if (w->index < get_write_item_size(w))
+            break;
+
+        item_free(w->current);
+
+        if (w->memchunk.memblock)
+            pa_memblock_unref(w->memchunk.memblock);
+
+        p->n_write--;
+        memmove(p->write, p->write + 1, p->n_write * sizeof(struct pstream_write));
+        done = true;
+    }
+
+    if (done && p->drain_callback && !pa_pstream_is_pending(p))
+        p->drain_callback(p, p->drain_callback_userdata);
+}
+
+#ifdef HAVE_SYS_UIO_H
+/* Write as many of the queued items as we can with a single system
+ * call. Items that need to pass ancillary data are always written on
+ * their own by do_write(). */
+static int do_writev(pa_pstream *p) {
+    struct iovec iov[WRITE_BATCH_MAX * 2];
+    pa_memblock *acquired[WRITE_BATCH_MAX];
+    unsigned i, n_acquired = 0;
+    int n_iov = 0;
+    size_t l = 0;
+    ssize_t r;
+
+    for (i = 0;; i++) {
+        struct pstream_write *w;
+        size_t index;
+
+        if (i >= p->n_write)
+            if (i >= WRITE_BATCH_MAX || l >= WRITE_BATCH_BYTES || !prepare_next_write_item(p))
+                break;
+
+        w = &p->write[i];
+
+#ifdef HAVE_CREDS
+        if (w->send_ancil_data_now) {
+            pa_assert(i > 0);
+            break;
+        }
+#endif
+
+        /* At most two segments: the descriptor and the payload */
+        for (index = w->index; index < get_write_item_size(w);) {
+            pa_memblock *b;
+            size_t n;
+
+            n = get_write_segment(w, index, &iov[n_iov].iov_base, &b);
+            iov[n_iov++].iov_len = n;
+
+            if (b)
+                acquired[n_acquired++] = b;
+
+            index += n;
+            l += n;
+        }
+    }
+
+    pa_assert(n_iov > 0);
+
+    r = pa_iochannel_writev(p->io, iov, n_iov);
+
+    for (i = 0; i < n_acquired; i++)
+        pa_memblock_release(acquired[i]);
+
+    if (r < 0)
+        return -1;
+
+    advance_write(p, (size_t) r);
+
+    return (size_t) r == l ? 1 : 0;
+}
+#endif
+
 static int do_write(pa_pstream *p) {
+    struct pstream_write *w;
     void *d;
     size_t l;
     ssize_t r;
-    pa_memblock *release_memblock = NULL;
+    pa_memblock *release_memblock;
 
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (!p->write.current)
-        prepare_next_write_item(p);
-
-    if (!p->write.current) {
+    if (p->n_write <= 0 && !prepare_next_write_item(p)) {
         /* The out queue is empty, so switching channels is safe */
         check_srbpending(p);
         return 0;
     }
 
-    if (p->write.minibuf_validsize > 0) {
-        d = p->write.minibuf + p->write.index;
-        l = p->write.minibuf_validsize - p->write.index;
-    } else if (p->write.index < PA_PSTREAM_DESCRIPTOR_SIZE) {
-        d = (uint8_t*) p->write.descriptor + p->write.index;
-        l = PA_PSTREAM_DESCRIPTOR_SIZE - p->write.index;
-    } else {
-        pa_assert(p->write.data || p->write.memchunk.memblock);
+    w = &p->write[0];
 
-        if (p->write.data)
-            d = p->write.data;
-        else {
-            d = pa_memblock_acquire_chunk(&p->write.memchunk);
-            release_memblock = p->write.memchunk.memblock;
-        }
+#ifdef HAVE_SYS_UIO_H
+    if (!p->srb
+#ifdef HAVE_CREDS
+        && !w->send_ancil_data_now
+#endif
+        )
+        return do_writev(p);
+#endif
 
-        d = (uint8_t*) d + p->write.index - PA_PSTREAM_DESCRIPTOR_SIZE;
-        l = ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (p->write.index - PA_PSTREAM_DESCRIPTOR_SIZE);
-    }
+    l = get_write_segment(w, w->index, &d, &release_memblock);
 
     pa_assert(l > 0);
 
 #ifdef HAVE_CREDS
-    if (p->send_ancil_data_now) {
-        if (p->write_ancil_data->creds_valid) {
-            pa_assert(p->write_ancil_data->nfd == 0);
-            if ((r = pa_iochannel_write_with_creds(p->io, d, l, &p->write_ancil_data->creds)) < 0)
+    if (w->send_ancil_data_now) {
+        pa_cmsg_ancil_data *ancil_data = &w->current->ancil_data;
+
+        if (ancil_data->creds_valid) {
+            pa_assert(ancil_data->nfd == 0);
+            if ((r = pa_iochannel_write_with_creds(p->io, d, l, &ancil_data->creds)) < 0)
                 goto fail;
         }
         else
-            if ((r = pa_iochannel_write_with_fds(p->io, d, l, p->write_ancil_data->nfd, p->write_ancil_data->fds)) < 0)
+            if ((r = pa_iochannel_write_with_fds(p->io, d, l, ancil_data->nfd, ancil_data->fds)) < 0)
                 goto fail;
 
-        pa_cmsg_ancil_data_close_fds(p->write_ancil_data);
-        p->send_ancil_data_now = false;
+        pa_cmsg_ancil_data_close_fds(ancil_data);
+        w->send_ancil_data_now = false;
     } else
 #endif
     if (p->srb)
@@ -793,28 +968,14 @@ static int do_write(pa_pstream *p) {
     if (release_memblock)
         pa_memblock_release(release_memblock);
 
-    p->write.index += (size_t) r;
-
-    if (p->write.index >= PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH])) {
-        pa_assert(p->write.current);
-        item_free(p->write.current);
-        p->write.current = NULL;
-
-        if (p->write.memchunk.memblock)
-            pa_memblock_unref(p->write.memchunk.memblock);
-
-        pa_memchunk_reset(&p->write.memchunk);
-
-        if (p->drain_callback && !pa_pstream_is_pending(p))
-            p->drain_callback(p, p->drain_callback_userdata);
-    }
+    advance_write(p, (size_t) r);
 
     return (size_t) r == l ? 1 : 0;
 
 fail:
 #ifdef HAVE_CREDS
-    if (p->send_ancil_data_now)
-        pa_cmsg_ancil_data_close_fds(p->write_ancil_data);
+    if (w->send_ancil_data_now)
+        pa_cmsg_ancil_data_close_fds(&w->current->ancil_data);
 #endif
 
     if (release_memblock)
@@ -927,7 +1088,16 @@ static int do_read(pa_pstream *p, struct pstream_read *re) {
 /*             pa_log("Got release frame for %u", ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
 
             pa_assert(p->export);
-            pa_memexport_process_release(p->export, ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+
+            if (pa_memexport_process_release(p->export, ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) < 0 && p->user_exports) {
+                pa_memexport *e;
+                void *state;
+
+                /* Block IDs are unique across all exports */
+                PA_HASHMAP_FOREACH(e, p->user_exports, state)
+                    if (pa_memexport_process_release(e, ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) >= 0)
+                        break;
+            }
 
             goto frame_done;
 
@@ -1157,7 +1327,7 @@ bool pa_pstream_is_pending(pa_pstream *p) {
     if (p->dead)
         b = false;
     else
-        b = p->write.current || !pa_queue_isempty(p->send_queue);
+        b = p->n_write > 0 || !pa_queue_isempty(p->send_queue);
 
     return b;
 }
@@ -1199,6 +1369,11 @@ void pa_pstream_unlink(pa_pstream *p) {
         p->export = NULL;
     }
 
+    if (p->user_exports) {
+        pa_hashmap_free(p->user_exports);
+        p->user_exports = NULL;
+    }
+
     if (p->io) {
         pa_iochannel_free(p->io);
         p->io = NULL;
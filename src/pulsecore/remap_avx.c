@@ -0,0 +1,201 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/sample.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "cpu-x86.h"
+#include "remap.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <immintrin.h>
+
+/* A frame of up to this many output channels is kept in one register */
+#define LANES 8
+
+static void remap_mono_to_stereo_s16ne_avx2(pa_remap_t *m, int16_t *dst, const int16_t *src, unsigned n) {
+    for (; n >= 16; n -= 16, src += 16, dst += 32) {
+        __m256i v, lo, hi;
+
+        v = _mm256_loadu_si256((const __m256i *) src);
+        lo = _mm256_unpacklo_epi16(v, v); /* 0 1 2 3 | 8 9 10 11 */
+        hi = _mm256_unpackhi_epi16(v, v); /* 4 5 6 7 | 12 13 14 15 */
+
+        _mm256_storeu_si256((__m256i *) dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *) (dst + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    for (; n > 0; n--, src++, dst += 2)
+        dst[0] = dst[1] = src[0];
+}
+
+static void remap_mono_to_stereo_float32ne_avx2(pa_remap_t *m, float *dst, const float *src, unsigned n) {
+    for (; n >= 8; n -= 8, src += 8, dst += 16) {
+        __m256 v, lo, hi;
+
+        v = _mm256_loadu_ps(src);
+        lo = _mm256_unpacklo_ps(v, v); /* 0 1 | 4 5 */
+        hi = _mm256_unpackhi_ps(v, v); /* 2 3 | 6 7 */
+
+        _mm256_storeu_ps(dst, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+
+    for (; n > 0; n--, src++, dst += 2)
+        dst[0] = dst[1] = src[0];
+}
+
+/* The matrix functions compute a whole output frame at once: for each input
+ * channel the sample is broadcast and multiplied with that channel's column
+ * of the matrix, m->state holds the columns padded to LANES entries. Frames
+ * are written with full-width stores that overlap the next frames, as long as
+ * at least LANES samples of output are left; the last frames go through a
+ * temporary buffer.
+ *
+ * The columns are set up so that the results match the C code exactly: a
+ * volume of 0 or less contributes nothing, 1.0 (or 0x10000) is a plain copy
+ * and the additions happen in the same order. For s16 each term fits 16 bits
+ * and the sum wraps around like it does in the C version. */
+static void remap_channels_matrix_s16ne_avx2(pa_remap_t *m, int16_t *dst, const int16_t *src, unsigned n) {
+    const int32_t *columns = m->state;
+    const unsigned n_ic = m->i_ss.channels;
+    const unsigned n_oc = m->o_ss.channels;
+    const __m256i mask = _mm256_set1_epi32(0xFFFF);
+
+    for (; n > 0; n--, src += n_ic, dst += n_oc) {
+        __m256i acc = _mm256_setzero_si256();
+        __m128i frame;
+        unsigned ic;
+
+        for (ic = 0; ic < n_ic; ic++) {
+            __m256i p = _mm256_mullo_epi32(_mm256_set1_epi32(src[ic]),
+                                           _mm256_loadu_si256((const __m256i *) (columns + ic * LANES)));
+
+            acc = _mm256_add_epi32(acc, _mm256_srai_epi32(p, 16));
+        }
+
+        acc = _mm256_and_si256(acc, mask);
+        frame = _mm_packus_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+
+        if (PA_LIKELY(n * n_oc >= LANES))
+            _mm_storeu_si128((__m128i *) dst, frame);
+        else {
+            int16_t last[LANES];
+
+            _mm_storeu_si128((__m128i *) last, frame);
+            memcpy(dst, last, n_oc * sizeof(int16_t));
+        }
+    }
+}
+
+static void remap_channels_matrix_float32ne_avx2(pa_remap_t *m, float *dst, const float *src, unsigned n) {
+    const float *columns = m->state;
+    const unsigned n_ic = m->i_ss.channels;
+    const unsigned n_oc = m->o_ss.channels;
+
+    for (; n > 0; n--, src += n_ic, dst += n_oc) {
+        __m256 acc = _mm256_setzero_ps();
+        unsigned ic;
+
+        /* no FMA, it would round differently than the C code */
+        for (ic = 0; ic < n_ic; ic++)
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(src[ic]),
+                                                   _mm256_loadu_ps(columns + ic * LANES)));
+
+        if (PA_LIKELY(n * n_oc >= LANES))
+            _mm256_storeu_ps(dst, acc);
+        else {
+            float last[LANES];
+
+            _mm256_storeu_ps(last, acc);
+            memcpy(dst, last, n_oc * sizeof(float));
+        }
+    }
+}
+
+static void *setup_matrix_columns(const pa_remap_t *m) {
+    const unsigned n_ic = m->i_ss.channels;
+    const unsigned n_oc = m->o_ss.channels;
+    unsigned ic, oc;
+
+    if (m->format == PA_SAMPLE_S16NE) {
+        int32_t *columns = pa_xnew0(int32_t, n_ic * LANES);
+
+        for (ic = 0; ic < n_ic; ic++)
+            for (oc = 0; oc < n_oc; oc++)
+                columns[ic * LANES + oc] = PA_CLAMP(m->map_table_i[oc][ic], 0, 0x10000);
+
+        return columns;
+    } else {
+        float *columns = pa_xnew0(float, n_ic * LANES);
+
+        for (ic = 0; ic < n_ic; ic++)
+            for (oc = 0; oc < n_oc; oc++)
+                columns[ic * LANES + oc] = PA_CLAMP(m->map_table_f[oc][ic], 0.0f, 1.0f);
+
+        return columns;
+    }
+}
+
+/* set the function that will execute the remapping based on the matrices */
+static void init_remap_avx2(pa_remap_t *m) {
+    unsigned n_oc, n_ic;
+    int8_t arrange[PA_CHANNELS_MAX];
+
+    n_oc = m->o_ss.channels;
+    n_ic = m->i_ss.channels;
+
+    /* find some common channel remappings, fall back to full matrix operation. */
+    if (n_ic == 1 && n_oc == 2 &&
+            m->map_table_i[0][0] == 0x10000 && m->map_table_i[1][0] == 0x10000) {
+
+        pa_log_info("Using AVX2 mono to stereo remapping");
+        pa_set_remap_func(m, (pa_do_remap_func_t) remap_mono_to_stereo_s16ne_avx2,
+            (pa_do_remap_func_t) remap_mono_to_stereo_float32ne_avx2);
+    } else if (n_oc >= 2 && n_oc <= LANES &&
+            !(pa_setup_remap_arrange(m, arrange) && (n_oc == 2 || n_oc == 4))) {
+
+        /* stereo and 4-channel arrangements are left to the C copy loops */
+        pa_log_info("Using AVX2 matrix remapping");
+        pa_set_remap_func(m, (pa_do_remap_func_t) remap_channels_matrix_s16ne_avx2,
+            (pa_do_remap_func_t) remap_channels_matrix_float32ne_avx2);
+
+        /* setup state */
+        m->state = setup_matrix_columns(m);
+    }
+}
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_remap_func_init_avx(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized remappers.");
+        pa_set_init_remap_func((pa_init_remap_func_t) init_remap_avx2);
+    }
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -34,6 +34,10 @@
 /* Number of samples of extra space we allow the resamplers to return */
 #define EXTRA_FRAMES 128
 
+/* Size of the blocks that the fused conversion steps pass between each
+ * other, small enough to stay in the L1 cache */
+#define FUSED_BLOCK_SIZE 4096
+
 struct ffmpeg_data { /* data specific to ffmpeg */
     struct AVResampleContext *state;
 };
@@ -118,6 +122,9 @@ static int (* const init_table[])(pa_resampler *r) = {
     [PA_RESAMPLER_SOXR_HQ]                 = NULL,
     [PA_RESAMPLER_SOXR_VHQ]                = NULL,
 #endif
+    [PA_RESAMPLER_POLYPHASE_LQ]            = pa_resampler_polyphase_init,
+    [PA_RESAMPLER_POLYPHASE_MQ]            = pa_resampler_polyphase_init,
+    [PA_RESAMPLER_POLYPHASE_HQ]            = pa_resampler_polyphase_init,
 };
 
 static pa_resample_method_t choose_auto_resampler(pa_resample_flags_t flags) {
@@ -166,6 +173,9 @@ static pa_resample_method_t fix_method(
         case PA_RESAMPLER_SOXR_MQ:
         case PA_RESAMPLER_SOXR_HQ:
         case PA_RESAMPLER_SOXR_VHQ:
+        case PA_RESAMPLER_POLYPHASE_LQ:
+        case PA_RESAMPLER_POLYPHASE_MQ:
+        case PA_RESAMPLER_POLYPHASE_HQ:
             if (flags & PA_RESAMPLER_VARIABLE_RATE) {
                 pa_log_info("Resampler '%s' cannot do variable rate, reverting to resampler 'auto'.", pa_resample_method_to_string(method));
                 method = PA_RESAMPLER_AUTO;
@@ -424,6 +434,16 @@ pa_resampler* pa_resampler_new(
         pa_log_debug("  lfe filter activated (LR4 type), the crossover_freq = %uHz", crossover_freq);
     }
 
+    /* Scratch space for the fused conversion steps, one block for the
+     * output of each of the two steps that don't write directly into the
+     * final buffer */
+    if (r->map_required || (r->to_work_format_func && r->from_work_format_func)) {
+        unsigned max_channels = PA_MAX(r->i_ss.channels, r->o_ss.channels);
+
+        r->fused_block_frames = (unsigned) (FUSED_BLOCK_SIZE / (r->w_sz * max_channels));
+        r->fused_buf = pa_xmalloc(2 * FUSED_BLOCK_SIZE);
+    }
+
     /* initialize implementation */
     if (init_table[method](r) < 0)
         goto fail;
@@ -433,6 +453,7 @@ pa_resampler* pa_resampler_new(
 fail:
     if (r->lfe_filter)
       pa_lfe_filter_free(r->lfe_filter);
+    pa_xfree(r->fused_buf);
     pa_xfree(r);
 
     return NULL;
@@ -460,6 +481,7 @@ void pa_resampler_free(pa_resampler *r) {
 
     free_remap(&r->remap);
 
+    pa_xfree(r->fused_buf);
     pa_xfree(r);
 }
 
@@ -659,7 +681,10 @@ static const char * const resample_methods[] = {
     "peaks",
     "soxr-mq",
     "soxr-hq",
-    "soxr-vhq"
+    "soxr-vhq",
+    "polyphase-lq",
+    "polyphase-mq",
+    "polyphase-hq"
 };
 
 const char *pa_resample_method_to_string(pa_resample_method_t m) {
@@ -1364,6 +1389,82 @@ static pa_memchunk *convert_from_work_format(pa_resampler *r, pa_memchunk *input
     return &r->from_work_format_buf;
 }
 
+/* Do the conversion into the work format (if to_work), the channel
+ * remapping (if required) and the conversion out of the work format (if
+ * from_work) in a single pass over the data. Instead of writing the
+ * whole chunk to memory after each step, the intermediate results are
+ * passed on in blocks that stay in the cache. */
+static void convert_remap_blocks(pa_resampler *r, const uint8_t *src, uint8_t *dst, unsigned n_frames, bool to_work, bool from_work) {
+    size_t src_fz, dst_fz;
+
+    src_fz = to_work ? r->i_fz : r->w_sz * r->i_ss.channels;
+    dst_fz = from_work ? r->o_fz : r->w_sz * r->o_ss.channels;
+
+    while (n_frames > 0) {
+        unsigned n = PA_MIN(n_frames, r->fused_block_frames);
+        const void *work = src;
+        void *remapped;
+
+        if (to_work) {
+            r->to_work_format_func(n * r->i_ss.channels, src, r->fused_buf);
+            work = r->fused_buf;
+        }
+
+        if (r->map_required) {
+            remapped = from_work ? r->fused_buf + FUSED_BLOCK_SIZE : dst;
+            r->remap.do_remap(&r->remap, remapped, work, n);
+        } else
+            remapped = (void *) work;
+
+        if (from_work)
+            r->from_work_format_func(n * r->o_ss.channels, remapped, dst);
+
+        src += n * src_fz;
+        dst += n * dst_fz;
+        n_frames -= n;
+    }
+}
+
+static pa_memchunk *fused_convert_remap(pa_resampler *r, pa_memchunk *input, bool to_work, bool from_work) {
+    unsigned n_frames;
+    size_t leftover_length = 0;
+    pa_memchunk *buf;
+    uint8_t *src, *dst;
+
+    pa_assert(r);
+    pa_assert(input);
+    pa_assert(input->memblock);
+
+    /* Without a conversion out of the work format, the result is the input
+     * for the resampling step. Like in remap_channels() there may be
+     * leftover data in the beginning of remap_buf then. */
+
+    n_frames = (unsigned) (input->length / (to_work ? r->i_fz : r->w_sz * r->i_ss.channels));
+
+    if (from_work) {
+        buf = &r->from_work_format_buf;
+        fit_buf(r, buf, r->o_fz * n_frames, &r->from_work_format_buf_size, 0);
+    } else {
+        if (r->leftover_in_remap) {
+            leftover_length = r->remap_buf.length;
+            r->leftover_in_remap = false;
+        }
+
+        buf = &r->remap_buf;
+        fit_buf(r, buf, leftover_length + r->w_sz * r->o_ss.channels * n_frames, &r->remap_buf_size, leftover_length);
+    }
+
+    src = pa_memblock_acquire_chunk(input);
+    dst = (uint8_t *) pa_memblock_acquire(buf->memblock) + leftover_length;
+
+    convert_remap_blocks(r, src, dst, n_frames, to_work, from_work);
+
+    pa_memblock_release(input->memblock);
+    pa_memblock_release(buf->memblock);
+
+    return buf;
+}
+
 void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out) {
     pa_memchunk *buf;
 
@@ -1375,15 +1476,41 @@ void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out)
     pa_assert(in->length % r->i_fz == 0);
 
     buf = (pa_memchunk*) in;
-    buf = convert_to_work_format(r, buf);
+
+    /* Without resampling there is nothing to keep between the steps, so
+     * all of them can be done in one pass. */
+    if (!r->impl.resample && !r->lfe_filter &&
+        (r->to_work_format_func ? 1 : 0) + (r->map_required ? 1 : 0) + (r->from_work_format_func ? 1 : 0) >= 2) {
+
+        buf = fused_convert_remap(r, buf, !!r->to_work_format_func, !!r->from_work_format_func);
+        *out = *buf;
+        pa_memchunk_reset(buf);
+        return;
+    }
 
     /* Try to save resampling effort: if we have more output channels than
-     * input channels, do resampling first, then remapping. */
+     * input channels, do resampling first, then remapping. Where the
+     * remapping is next to a format conversion, do both in one pass. */
     if (r->o_ss.channels <= r->i_ss.channels) {
-        buf = remap_channels(r, buf);
+        if (r->to_work_format_func && r->map_required)
+            buf = fused_convert_remap(r, buf, true, false);
+        else {
+            buf = convert_to_work_format(r, buf);
+            buf = remap_channels(r, buf);
+        }
+
         buf = resample(r, buf);
     } else {
+        buf = convert_to_work_format(r, buf);
         buf = resample(r, buf);
+
+        if (r->map_required && r->from_work_format_func && !r->lfe_filter && buf->length) {
+            buf = fused_convert_remap(r, buf, false, true);
+            *out = *buf;
+            pa_memchunk_reset(buf);
+            return;
+        }
+
         buf = remap_channels(r, buf);
     }
 
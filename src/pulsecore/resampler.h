@@ -61,6 +61,9 @@ typedef enum pa_resample_method {
     PA_RESAMPLER_SOXR_MQ,
     PA_RESAMPLER_SOXR_HQ,
     PA_RESAMPLER_SOXR_VHQ,
+    PA_RESAMPLER_POLYPHASE_LQ,
+    PA_RESAMPLER_POLYPHASE_MQ,
+    PA_RESAMPLER_POLYPHASE_HQ,
     PA_RESAMPLER_MAX
 } pa_resample_method_t;
 
@@ -107,6 +110,11 @@ struct pa_resampler {
     pa_remap_t remap;
     bool map_required;
 
+    /* Scratch space for doing the format conversions and the remapping
+     * in one pass, one block of fused_block_frames at a time */
+    uint8_t *fused_buf;
+    unsigned fused_block_frames;
+
     pa_lfe_filter_t *lfe_filter;
 
     pa_resampler_impl impl;
@@ -172,6 +180,14 @@ int pa_resampler_peaks_init(pa_resampler *r);
 int pa_resampler_speex_init(pa_resampler *r);
 int pa_resampler_trivial_init(pa_resampler*r);
 int pa_resampler_soxr_init(pa_resampler *r);
+int pa_resampler_polyphase_init(pa_resampler *r);
+
+/* The inner loop of the polyphase resampler: the dot product of two
+ * vectors of n floats. n is always a multiple of 8. */
+typedef float (*pa_polyphase_dot_func_t)(const float *a, const float *b, unsigned n);
+
+pa_polyphase_dot_func_t pa_get_polyphase_dot_func(void);
+void pa_set_polyphase_dot_func(pa_polyphase_dot_func_t func);
 
 /* Resampler-specific quirks */
 bool pa_speex_is_fixed_point(void);
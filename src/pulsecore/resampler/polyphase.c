@@ -0,0 +1,446 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/resampler.h>
+
+/* A windowed sinc polyphase resampler. The ratio between the two rates is
+ * reduced to out_step/in_step, and for each of the out_step positions an
+ * output sample can have between two input samples there is one row of
+ * filter coefficients (a phase). Each output sample is then a single dot
+ * product of one row with the input.
+ *
+ * The coefficients only depend on the rates and the quality, so the
+ * tables are shared by all resamplers that use the same ones. If the
+ * reduced ratio needs too many phases (e.g. 44100 -> 48001), a table with
+ * a fixed number of phases is used instead, and the result is linearly
+ * interpolated between the two nearest phases. */
+
+/* Exact tables are used up to this many phases */
+#define MAX_PHASES 1024
+
+/* Number of phases of the tables for interpolation */
+#define INTERP_PHASES 256
+
+/* Limits the filter length when downsampling by large factors */
+#define MAX_TAPS 512
+
+/* The dot product implementations may assume this */
+#define TAPS_ALIGN 8
+
+struct quality {
+    unsigned taps;       /* filter length when not downsampling */
+    double beta;         /* of the Kaiser window */
+    double cutoff;       /* relative to the lower of the two Nyquist frequencies */
+};
+
+static const struct quality qualities[] = {
+    [PA_RESAMPLER_POLYPHASE_LQ - PA_RESAMPLER_POLYPHASE_LQ] = { 16, 6.0, 0.85 },
+    [PA_RESAMPLER_POLYPHASE_MQ - PA_RESAMPLER_POLYPHASE_LQ] = { 32, 8.5, 0.91 },
+    [PA_RESAMPLER_POLYPHASE_HQ - PA_RESAMPLER_POLYPHASE_LQ] = { 64, 10.5, 0.95 },
+};
+
+typedef struct polyphase_table polyphase_table;
+
+struct polyphase_table {
+    unsigned ref;
+
+    /* The key */
+    pa_resample_method_t method;
+    unsigned in_step, out_step;
+
+    bool interpolate;
+    unsigned n_phases;
+    unsigned n_taps;
+
+    /* n_phases rows of n_taps coefficients, plus one extra row when
+     * interpolating */
+    float *coefs;
+
+    PA_LLIST_FIELDS(polyphase_table);
+};
+
+struct polyphase_data {
+    polyphase_table *table;
+
+    /* The input, one buffer per channel. Starts with the history needed
+     * for the next output sample. */
+    float *buf;
+    unsigned buf_frames, n_frames;
+
+    /* Position of the next output sample: its first input sample in buf,
+     * and the phase in units of 1/out_step input samples */
+    unsigned start;
+    unsigned phase;
+};
+
+static pa_static_mutex tables_mutex = PA_STATIC_MUTEX_INIT;
+static PA_LLIST_HEAD(polyphase_table, tables) = NULL;
+
+static float dot_c(const float *a, const float *b, unsigned n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    unsigned i;
+
+    for (i = 0; i < n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+static pa_polyphase_dot_func_t dot_func = dot_c;
+
+pa_polyphase_dot_func_t pa_get_polyphase_dot_func(void) {
+    return dot_func;
+}
+
+void pa_set_polyphase_dot_func(pa_polyphase_dot_func_t func) {
+    pa_assert(func);
+
+    dot_func = func;
+}
+
+static unsigned gcd(unsigned a, unsigned b) {
+    while (b > 0) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* Modified Bessel function of the first kind, order 0 */
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    unsigned k;
+
+    for (k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+
+        if (term < sum * 1e-12)
+            break;
+    }
+
+    return sum;
+}
+
+static void compute_row(float *row, unsigned n_taps, double frac, double fc, double beta) {
+    double sum = 0, i0_beta = bessel_i0(beta);
+    double half = n_taps / 2;
+    unsigned k;
+
+    /* Tap k is applied to the input sample at distance d from the output
+     * position. */
+    for (k = 0; k < n_taps; k++) {
+        double d = (double) k - (half - 1) - frac;
+        double u = d / half, h;
+
+        if (fabs(u) >= 1)
+            h = 0;
+        else {
+            double x = M_PI * fc * d;
+
+            h = fc * (fabs(x) < 1e-9 ? 1 : sin(x) / x);
+            h *= bessel_i0(beta * sqrt(1 - u * u)) / i0_beta;
+        }
+
+        row[k] = (float) h;
+        sum += h;
+    }
+
+    /* Normalize every phase to unity gain at DC */
+    for (k = 0; k < n_taps; k++)
+        row[k] = (float) (row[k] / sum);
+}
+
+static polyphase_table *table_new(pa_resample_method_t method, unsigned in_step, unsigned out_step) {
+    const struct quality *q = &qualities[method - PA_RESAMPLER_POLYPHASE_LQ];
+    polyphase_table *t;
+    double ratio;
+    unsigned n_rows, i;
+
+    t = pa_xnew0(polyphase_table, 1);
+    t->ref = 1;
+    t->method = method;
+    t->in_step = in_step;
+    t->out_step = out_step;
+
+    t->interpolate = out_step > MAX_PHASES;
+    t->n_phases = t->interpolate ? INTERP_PHASES : out_step;
+
+    /* When downsampling, the cutoff moves down to the output Nyquist
+     * frequency, and the filter has to get longer by the same factor
+     * to keep the transition band as steep */
+    ratio = PA_MIN(1.0, (double) out_step / in_step);
+    t->n_taps = (unsigned) ceil(q->taps / ratio);
+    t->n_taps = PA_ROUND_UP(t->n_taps, TAPS_ALIGN);
+    t->n_taps = PA_MIN(t->n_taps, (unsigned) MAX_TAPS);
+
+    n_rows = t->interpolate ? t->n_phases + 1 : t->n_phases;
+    t->coefs = pa_xnew(float, n_rows * t->n_taps);
+
+    for (i = 0; i < n_rows; i++)
+        compute_row(t->coefs + i * t->n_taps, t->n_taps, (double) i / t->n_phases, q->cutoff * ratio, q->beta);
+
+    pa_log_debug("Created polyphase filter table for %u/%u: %u phases%s, %u taps, %lu bytes.",
+                 out_step, in_step, t->n_phases, t->interpolate ? " (interpolated)" : "", t->n_taps,
+                 (unsigned long) (n_rows * t->n_taps * sizeof(float)));
+
+    return t;
+}
+
+/* Return a reference to the table for the given rates and quality,
+ * creating it if nobody uses it yet */
+static polyphase_table *table_get(pa_resample_method_t method, uint32_t in_rate, uint32_t out_rate) {
+    polyphase_table *t;
+    unsigned g, in_step, out_step;
+    pa_mutex *mutex;
+
+    g = gcd(in_rate, out_rate);
+    in_step = in_rate / g;
+    out_step = out_rate / g;
+
+    mutex = pa_static_mutex_get(&tables_mutex, false, false);
+    pa_mutex_lock(mutex);
+
+    PA_LLIST_FOREACH(t, tables)
+        if (t->method == method && t->in_step == in_step && t->out_step == out_step)
+            break;
+
+    if (t)
+        t->ref++;
+    else {
+        t = table_new(method, in_step, out_step);
+        PA_LLIST_PREPEND(polyphase_table, tables, t);
+    }
+
+    pa_mutex_unlock(mutex);
+
+    return t;
+}
+
+static void table_unref(polyphase_table *t) {
+    pa_mutex *mutex;
+
+    mutex = pa_static_mutex_get(&tables_mutex, false, false);
+    pa_mutex_lock(mutex);
+
+    pa_assert(t->ref >= 1);
+
+    if (--t->ref <= 0)
+        PA_LLIST_REMOVE(polyphase_table, tables, t);
+    else
+        t = NULL;
+
+    pa_mutex_unlock(mutex);
+
+    if (t) {
+        pa_xfree(t->coefs);
+        pa_xfree(t);
+    }
+}
+
+/* Throw away the input that is no longer needed */
+static void drop_consumed(struct polyphase_data *d, unsigned channels) {
+    unsigned n, c;
+
+    if ((n = PA_MIN(d->start, d->n_frames)) <= 0)
+        return;
+
+    for (c = 0; c < channels; c++) {
+        float *b = d->buf + c * d->buf_frames;
+        memmove(b, b + n, (d->n_frames - n) * sizeof(float));
+    }
+
+    d->n_frames -= n;
+    d->start -= n;
+}
+
+static void ensure_space(struct polyphase_data *d, unsigned channels, unsigned frames) {
+    float *buf;
+    unsigned buf_frames, c;
+
+    if (d->n_frames + frames <= d->buf_frames)
+        return;
+
+    buf_frames = PA_MAX(d->n_frames + frames, d->buf_frames * 2);
+    buf = pa_xnew(float, buf_frames * channels);
+
+    if (d->n_frames)
+        for (c = 0; c < channels; c++)
+            memcpy(buf + c * buf_frames, d->buf + c * d->buf_frames, d->n_frames * sizeof(float));
+
+    pa_xfree(d->buf);
+    d->buf = buf;
+    d->buf_frames = buf_frames;
+}
+
+static unsigned polyphase_resample(pa_resampler *r, const pa_memchunk *input, unsigned in_n_frames, pa_memchunk *output, unsigned *out_n_frames) {
+    struct polyphase_data *d;
+    polyphase_table *t;
+    const float *src;
+    float *dst;
+    unsigned channels, n_out = 0, i, c;
+
+    pa_assert(r);
+    pa_assert(input);
+    pa_assert(output);
+    pa_assert(out_n_frames);
+
+    d = r->impl.data;
+    t = d->table;
+    channels = r->work_channels;
+
+    /* Append the input to the per-channel buffers */
+    ensure_space(d, channels, in_n_frames);
+
+    src = pa_memblock_acquire_chunk(input);
+    for (c = 0; c < channels; c++) {
+        float *b = d->buf + c * d->buf_frames + d->n_frames;
+
+        for (i = 0; i < in_n_frames; i++)
+            b[i] = src[i * channels + c];
+    }
+    pa_memblock_release(input->memblock);
+
+    d->n_frames += in_n_frames;
+
+    dst = pa_memblock_acquire_chunk(output);
+
+    while (n_out < *out_n_frames && d->start + t->n_taps <= d->n_frames) {
+        const float *in = d->buf + d->start;
+
+        if (!t->interpolate) {
+            const float *row = t->coefs + d->phase * t->n_taps;
+
+            for (c = 0; c < channels; c++)
+                *(dst++) = dot_func(row, in + c * d->buf_frames, t->n_taps);
+        } else {
+            double pos = (double) d->phase * t->n_phases / t->out_step;
+            unsigned j = (unsigned) pos;
+            float a = (float) (pos - j);
+            const float *row = t->coefs + j * t->n_taps;
+
+            for (c = 0; c < channels; c++) {
+                float y0 = dot_func(row, in + c * d->buf_frames, t->n_taps);
+                float y1 = dot_func(row + t->n_taps, in + c * d->buf_frames, t->n_taps);
+
+                *(dst++) = y0 + a * (y1 - y0);
+            }
+        }
+
+        n_out++;
+
+        d->phase += t->in_step;
+        d->start += d->phase / t->out_step;
+        d->phase %= t->out_step;
+    }
+
+    pa_memblock_release(output->memblock);
+
+    drop_consumed(d, channels);
+
+    *out_n_frames = n_out;
+
+    /* All input is kept in our own buffers */
+    return 0;
+}
+
+static void polyphase_reset(pa_resampler *r) {
+    struct polyphase_data *d;
+    unsigned c;
+
+    pa_assert(r);
+
+    d = r->impl.data;
+
+    /* Start with silence as history, so that the first input sample is
+     * where the first output sample is */
+    d->n_frames = 0;
+    ensure_space(d, r->work_channels, d->table->n_taps / 2 - 1);
+    d->n_frames = d->table->n_taps / 2 - 1;
+
+    for (c = 0; c < r->work_channels; c++)
+        memset(d->buf + c * d->buf_frames, 0, d->n_frames * sizeof(float));
+
+    d->start = 0;
+    d->phase = 0;
+}
+
+static void polyphase_update_rates(pa_resampler *r) {
+    struct polyphase_data *d;
+
+    pa_assert(r);
+
+    d = r->impl.data;
+
+    table_unref(d->table);
+    d->table = table_get(r->method, r->i_ss.rate, r->o_ss.rate);
+
+    polyphase_reset(r);
+}
+
+static void polyphase_free(pa_resampler *r) {
+    struct polyphase_data *d;
+
+    pa_assert(r);
+
+    if (!(d = r->impl.data))
+        return;
+
+    table_unref(d->table);
+    pa_xfree(d->buf);
+    pa_xfree(d);
+}
+
+int pa_resampler_polyphase_init(pa_resampler *r) {
+    struct polyphase_data *d;
+
+    pa_assert(r);
+    pa_assert(r->method >= PA_RESAMPLER_POLYPHASE_LQ && r->method <= PA_RESAMPLER_POLYPHASE_HQ);
+    pa_assert(r->work_format == PA_SAMPLE_FLOAT32NE);
+
+    d = pa_xnew0(struct polyphase_data, 1);
+    d->table = table_get(r->method, r->i_ss.rate, r->o_ss.rate);
+
+    r->impl.free = polyphase_free;
+    r->impl.update_rates = polyphase_update_rates;
+    r->impl.reset = polyphase_reset;
+    r->impl.resample = polyphase_resample;
+    r->impl.data = d;
+
+    polyphase_reset(r);
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/resampler.h>
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <emmintrin.h>
+
+static float dot_sse2(const float *a, const float *b, unsigned n) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    float r[4];
+    unsigned i;
+
+    for (i = 0; i < n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+
+    _mm_storeu_ps(r, _mm_add_ps(s0, s1));
+
+    return (r[0] + r[1]) + (r[2] + r[3]);
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_polyphase_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized polyphase resampler functions.");
+        pa_set_polyphase_dot_func(dot_sse2);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -0,0 +1,237 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <limits.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+
+#include "ringq.h"
+
+struct pa_ringq {
+    char *name;
+    pa_mempool *pool;
+    pa_sample_spec sample_spec;
+
+    pa_memblock *memblock;
+    uint8_t *data;
+    size_t capacity;
+
+    /* The number of queued bytes is the only thing shared between the
+     * two sides. The writer only ever increases it and the reader only
+     * ever decreases it, which makes the indexes below safe to use
+     * without locking. */
+    pa_atomic_t length;
+
+    /* Only touched by the reading side */
+    size_t read_index;
+
+    /* Only touched by the writing side */
+    size_t write_index;
+};
+
+pa_ringq* pa_ringq_new(const char *name, pa_mempool *pool, const pa_sample_spec *ss, size_t capacity) {
+    pa_ringq *q;
+
+    pa_assert(pool);
+    pa_assert(ss);
+    pa_assert(pa_sample_spec_valid(ss));
+
+    capacity = pa_frame_align(capacity, ss);
+    pa_assert(capacity > 0);
+    pa_assert(capacity <= INT_MAX);
+
+    q = pa_xnew0(pa_ringq, 1);
+    q->name = pa_xstrdup(name ? name : "(no name)");
+    q->pool = pa_mempool_ref(pool);
+    q->sample_spec = *ss;
+    q->capacity = capacity;
+
+    /* The memblock stays acquired for the lifetime of the queue */
+    q->memblock = pa_memblock_new(pool, capacity);
+    q->data = pa_memblock_acquire(q->memblock);
+
+    pa_atomic_store(&q->length, 0);
+
+    pa_log_debug("ringq created [%s]: capacity=%lu", q->name, (unsigned long) capacity);
+
+    return q;
+}
+
+void pa_ringq_free(pa_ringq *q) {
+    pa_assert(q);
+
+    pa_memblock_release(q->memblock);
+    pa_memblock_unref(q->memblock);
+    pa_mempool_unref(q->pool);
+
+    pa_xfree(q->name);
+    pa_xfree(q);
+}
+
+size_t pa_ringq_get_capacity(pa_ringq *q) {
+    pa_assert(q);
+
+    return q->capacity;
+}
+
+size_t pa_ringq_get_length(pa_ringq *q) {
+    pa_assert(q);
+
+    return (size_t) pa_atomic_load(&q->length);
+}
+
+void* pa_ringq_begin_write(pa_ringq *q, size_t *length) {
+    size_t free_space;
+
+    pa_assert(q);
+    pa_assert(length);
+
+    free_space = q->capacity - (size_t) pa_atomic_load(&q->length);
+    *length = PA_MIN(free_space, q->capacity - q->write_index);
+
+    return q->data + q->write_index;
+}
+
+void pa_ringq_end_write(pa_ringq *q, size_t length) {
+    pa_assert(q);
+    pa_assert(pa_frame_aligned(length, &q->sample_spec));
+    pa_assert(length <= q->capacity - (size_t) pa_atomic_load(&q->length));
+
+    if (length <= 0)
+        return;
+
+    q->write_index += length;
+    if (q->write_index >= q->capacity)
+        q->write_index -= q->capacity;
+
+    /* This also acts as a barrier, so the reader never sees the new
+     * length before the data */
+    pa_atomic_add(&q->length, (int) length);
+}
+
+size_t pa_ringq_push(pa_ringq *q, const pa_memchunk *chunk) {
+    const uint8_t *src;
+    size_t done = 0;
+
+    pa_assert(q);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+    pa_assert(pa_frame_aligned(chunk->length, &q->sample_spec));
+
+    src = (const uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+
+    /* At most two rounds, one up to the end of the buffer and one from
+     * its start */
+    while (done < chunk->length) {
+        size_t l;
+        void *dst = pa_ringq_begin_write(q, &l);
+
+        if (l <= 0)
+            break;
+
+        l = PA_MIN(l, chunk->length - done);
+        memcpy(dst, src + done, l);
+        pa_ringq_end_write(q, l);
+
+        done += l;
+    }
+
+    pa_memblock_release(chunk->memblock);
+
+    return done;
+}
+
+int pa_ringq_peek(pa_ringq *q, pa_memchunk *chunk) {
+    size_t length;
+
+    pa_assert(q);
+    pa_assert(chunk);
+
+    if ((length = (size_t) pa_atomic_load(&q->length)) <= 0)
+        return -1;
+
+    chunk->memblock = pa_memblock_ref(q->memblock);
+    chunk->index = q->read_index;
+    chunk->length = PA_MIN(length, q->capacity - q->read_index);
+
+    return 0;
+}
+
+int pa_ringq_peek_fixed_size(pa_ringq *q, size_t length, pa_memchunk *chunk) {
+    size_t first;
+    uint8_t *dst;
+
+    pa_assert(q);
+    pa_assert(chunk);
+    pa_assert(length > 0);
+    pa_assert(pa_frame_aligned(length, &q->sample_spec));
+
+    if ((size_t) pa_atomic_load(&q->length) < length)
+        return -1;
+
+    if (length <= q->capacity - q->read_index) {
+        chunk->memblock = pa_memblock_ref(q->memblock);
+        chunk->index = q->read_index;
+        chunk->length = length;
+        return 0;
+    }
+
+    /* The data wraps around, so we need to copy it */
+    first = q->capacity - q->read_index;
+
+    chunk->memblock = pa_memblock_new(q->pool, length);
+    chunk->index = 0;
+    chunk->length = length;
+
+    dst = pa_memblock_acquire(chunk->memblock);
+    memcpy(dst, q->data + q->read_index, first);
+    memcpy(dst + first, q->data, length - first);
+    pa_memblock_release(chunk->memblock);
+
+    return 0;
+}
+
+void pa_ringq_drop(pa_ringq *q, size_t length) {
+    pa_assert(q);
+    pa_assert(pa_frame_aligned(length, &q->sample_spec));
+    pa_assert(length <= (size_t) pa_atomic_load(&q->length));
+
+    if (length <= 0)
+        return;
+
+    q->read_index += length;
+    if (q->read_index >= q->capacity)
+        q->read_index -= q->capacity;
+
+    pa_atomic_sub(&q->length, (int) length);
+}
+
+void pa_ringq_flush(pa_ringq *q) {
+    pa_assert(q);
+
+    pa_ringq_drop(q, (size_t) pa_atomic_load(&q->length));
+}
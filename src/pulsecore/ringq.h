@@ -0,0 +1,84 @@
+#ifndef foopulseringqhfoo
+#define foopulseringqhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/types.h>
+
+#include <pulse/sample.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/memchunk.h>
+
+/* A ring buffer of audio data in a single memblock, for handing data
+ * from one thread to another. In contrast to pa_memblockq, data is
+ * copied in when writing, but no memory is allocated per chunk, and
+ * the data in the queue is always contiguous except where it wraps
+ * around.
+ *
+ * One thread may write and one other thread may read without any
+ * locking. Functions marked for the writing side must only be called
+ * from the writing thread, functions for the reading side only from
+ * the reading thread. There is no way to wait for data or space,
+ * both sides are expected to run at their own pace, e.g. driven by
+ * their IO threads.
+ *
+ * Only whole frames of the sample spec can be written and read. */
+
+typedef struct pa_ringq pa_ringq;
+
+/* The capacity is rounded down to whole frames */
+pa_ringq* pa_ringq_new(const char *name, pa_mempool *pool, const pa_sample_spec *ss, size_t capacity);
+void pa_ringq_free(pa_ringq *q);
+
+size_t pa_ringq_get_capacity(pa_ringq *q);
+
+/* Return how many bytes are currently queued. May be called from
+ * either side, the value is only a snapshot for the other side. */
+size_t pa_ringq_get_length(pa_ringq *q);
+
+/* For the writing side: return a pointer to where the next data is
+ * to be written, and the number of bytes that may be written there
+ * in *length. This is 0 if the queue is full. */
+void* pa_ringq_begin_write(pa_ringq *q, size_t *length);
+
+/* For the writing side: make length bytes written after
+ * pa_ringq_begin_write() visible to the reading side. */
+void pa_ringq_end_write(pa_ringq *q, size_t length);
+
+/* For the writing side: copy the chunk into the queue. Returns how
+ * many bytes fit, the rest is not queued. */
+size_t pa_ringq_push(pa_ringq *q, const pa_memchunk *chunk);
+
+/* For the reading side: return a reference to the queued data up to
+ * the point where it wraps around, without copying. The chunk is only
+ * valid until the data is dropped, don't keep references to it after
+ * that. Returns negative if the queue is empty. */
+int pa_ringq_peek(pa_ringq *q, pa_memchunk *chunk);
+
+/* For the reading side: like pa_ringq_peek(), but return exactly
+ * length bytes. If the data wraps around it is copied into a new
+ * memblock. Returns negative if not enough data is queued. */
+int pa_ringq_peek_fixed_size(pa_ringq *q, size_t length, pa_memchunk *chunk);
+
+/* For the reading side: remove length bytes from the queue */
+void pa_ringq_drop(pa_ringq *q, size_t length);
+
+/* For the reading side: drop everything that is currently queued */
+void pa_ringq_flush(pa_ringq *q);
+
+#endif
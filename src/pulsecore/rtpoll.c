@@ -27,6 +27,12 @@
 #include <string.h>
 #include <errno.h>
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#define USE_EPOLL
+#endif
+
 #include <pulse/xmalloc.h>
 #include <pulse/timeval.h>
 
@@ -38,6 +44,7 @@
 #include <pulsecore/flist.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/ratelimit.h>
+#include <pulsecore/io-stats.h>
 #include <pulse/rtclock.h>
 
 #include "rtpoll.h"
@@ -57,11 +64,34 @@ struct pa_rtpoll {
     bool quit:1;
     bool timer_elapsed:1;
 
+#ifdef USE_EPOLL
+    /* While epoll_fd is valid the pollfds of all items are registered
+     * with it, and the timer is implemented with timer_fd. Only the
+     * items whose fds became ready get their work and after callbacks
+     * called. If something can't be handled by epoll, we fall back to
+     * ppoll() over the pollfd array for good. */
+    int epoll_fd;
+    int timer_fd;
+    bool timer_fd_armed:1;
+    struct epoll_event *epoll_events;
+    unsigned n_epoll_events_alloc;
+
+    /* The pollfd registered with epoll for each fd. epoll only knows the
+     * fd, which may have been closed and reused by another item by the
+     * time the old one is changed or freed. */
+    struct rtpoll_epoll_fd **epoll_registered;
+    unsigned n_epoll_registered_alloc;
+#endif
+
 #ifdef DEBUG_TIMING
     pa_usec_t timestamp;
     pa_usec_t slept, awake;
 #endif
 
+    /* Always kept, see pa_rtpoll_get_io_stats() */
+    pa_io_histogram lateness;
+    pa_usec_t poll_time;
+
     PA_LLIST_HEAD(pa_rtpoll_item, items);
 };
 
@@ -79,11 +109,292 @@ struct pa_rtpoll_item {
     void (*after_cb)(pa_rtpoll_item *i);
     void *userdata;
 
+#ifdef USE_EPOLL
+    /* What is currently registered with epoll for each pollfd */
+    struct rtpoll_epoll_fd *epoll_fds;
+    bool epoll_dirty:1;
+    bool ready:1;
+#endif
+
     PA_LLIST_FIELDS(pa_rtpoll_item);
 };
 
+#ifdef USE_EPOLL
+struct rtpoll_epoll_fd {
+    pa_rtpoll_item *item;
+    unsigned index;
+    int fd;
+    short events;
+};
+#endif
+
 PA_STATIC_FLIST_DECLARE(items, 0, pa_xfree);
 
+#ifdef USE_EPOLL
+static uint32_t map_events_to_epoll(short events) {
+    return
+        (events & POLLIN ? EPOLLIN : 0) |
+        (events & POLLOUT ? EPOLLOUT : 0) |
+        (events & POLLPRI ? EPOLLPRI : 0);
+}
+
+static short map_events_from_epoll(uint32_t events) {
+    return (short)
+        ((events & EPOLLIN ? POLLIN : 0) |
+         (events & EPOLLOUT ? POLLOUT : 0) |
+         (events & EPOLLPRI ? POLLPRI : 0) |
+         (events & EPOLLERR ? POLLERR : 0) |
+         (events & EPOLLHUP ? POLLHUP : 0));
+}
+
+static void disable_epoll(pa_rtpoll *p) {
+    if (p->epoll_fd >= 0) {
+        pa_close(p->epoll_fd);
+        p->epoll_fd = -1;
+    }
+
+    if (p->timer_fd >= 0) {
+        pa_close(p->timer_fd);
+        p->timer_fd = -1;
+    }
+}
+
+static void init_epoll(pa_rtpoll *p) {
+    struct epoll_event ev;
+
+    p->timer_fd = -1;
+
+    if ((p->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        pa_log_debug("epoll_create1() failed, using ppoll(): %s", pa_cstrerror(errno));
+        return;
+    }
+
+    if ((p->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0) {
+        pa_log_debug("timerfd_create() failed, using ppoll(): %s", pa_cstrerror(errno));
+        disable_epoll(p);
+        return;
+    }
+
+    pa_zero(ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->timer_fd, &ev) < 0) {
+        pa_log_debug("epoll_ctl() failed, using ppoll(): %s", pa_cstrerror(errno));
+        disable_epoll(p);
+    }
+}
+
+static void set_registered(pa_rtpoll *p, int fd, struct rtpoll_epoll_fd *e) {
+    unsigned k = (unsigned) fd;
+
+    if (k >= p->n_epoll_registered_alloc) {
+        unsigned l = PA_MAX(k + 1, 2 * p->n_epoll_registered_alloc);
+
+        p->epoll_registered = pa_xrealloc(p->epoll_registered, sizeof(struct rtpoll_epoll_fd *) * l);
+        memset(p->epoll_registered + p->n_epoll_registered_alloc, 0,
+               sizeof(struct rtpoll_epoll_fd *) * (l - p->n_epoll_registered_alloc));
+        p->n_epoll_registered_alloc = l;
+    }
+
+    p->epoll_registered[k] = e;
+}
+
+/* Whether the fd of e is still the one that e registered with epoll */
+static bool owns_fd(pa_rtpoll *p, struct rtpoll_epoll_fd *e) {
+    return (unsigned) e->fd < p->n_epoll_registered_alloc && p->epoll_registered[e->fd] == e;
+}
+
+/* Removes the fd of e from the epoll set. Returns negative if the fd was
+ * closed while registered: removing it could hit another item that now
+ * uses the fd, and if the old file is still open through a dup() epoll
+ * might report it for an item that is about to be freed. */
+static int unregister_fd(pa_rtpoll *p, struct rtpoll_epoll_fd *e) {
+    if (!owns_fd(p, e) || epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, e->fd, NULL) < 0) {
+        pa_log_debug("fd %i was closed before its rtpoll item was done with it, falling back to ppoll()", e->fd);
+        return -1;
+    }
+
+    p->epoll_registered[e->fd] = NULL;
+    e->fd = -1;
+
+    return 0;
+}
+
+static void unregister_item(pa_rtpoll_item *i) {
+    unsigned k;
+
+    if (!i->epoll_fds)
+        return;
+
+    if (i->rtpoll->epoll_fd >= 0)
+        for (k = 0; k < i->n_pollfd; k++)
+            if (i->epoll_fds[k].fd >= 0 && unregister_fd(i->rtpoll, &i->epoll_fds[k]) < 0) {
+                disable_epoll(i->rtpoll);
+                break;
+            }
+
+    pa_xfree(i->epoll_fds);
+    i->epoll_fds = NULL;
+}
+
+/* Bring the epoll registrations of the item in line with its pollfds.
+ * Returns negative if epoll can't handle them. */
+static int sync_item(pa_rtpoll_item *i) {
+    pa_rtpoll *p = i->rtpoll;
+    unsigned k;
+
+    i->epoll_dirty = false;
+
+    if (!i->epoll_fds) {
+        i->epoll_fds = pa_xnew(struct rtpoll_epoll_fd, i->n_pollfd);
+
+        for (k = 0; k < i->n_pollfd; k++) {
+            i->epoll_fds[k].item = i;
+            i->epoll_fds[k].index = k;
+            i->epoll_fds[k].fd = -1;
+            i->epoll_fds[k].events = 0;
+        }
+    }
+
+    for (k = 0; k < i->n_pollfd; k++) {
+        struct rtpoll_epoll_fd *e = &i->epoll_fds[k];
+        struct pollfd *f = &i->pollfd[k];
+        struct epoll_event ev;
+        int op;
+
+        if (e->fd == f->fd && e->events == f->events)
+            continue;
+
+        if (e->fd >= 0 && e->fd != f->fd && unregister_fd(p, e) < 0)
+            return -1;
+
+        /* Like poll(), ignore negative fds */
+        if (f->fd < 0)
+            continue;
+
+        if (e->fd >= 0 && !owns_fd(p, e)) {
+            pa_log_debug("fd %i was closed before its rtpoll item was done with it, falling back to ppoll()", e->fd);
+            return -1;
+        }
+
+        op = e->fd >= 0 ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+        pa_zero(ev);
+        ev.events = map_events_to_epoll(f->events);
+        ev.data.ptr = e;
+
+        /* epoll can't watch the same fd for two pollfds, or fds like
+         * regular files, let ppoll() handle those */
+        if (epoll_ctl(p->epoll_fd, op, f->fd, &ev) < 0) {
+            pa_log_debug("epoll_ctl() failed for fd %i, falling back to ppoll(): %s", f->fd, pa_cstrerror(errno));
+            return -1;
+        }
+
+        e->fd = f->fd;
+        e->events = f->events;
+        set_registered(p, e->fd, e);
+    }
+
+    return 0;
+}
+
+/* Called right before going to sleep. Updates the epoll set and clears
+ * the results of the last sleep. */
+static void sync_epoll(pa_rtpoll *p) {
+    pa_rtpoll_item *i;
+
+    for (i = p->items; i; i = i->next) {
+        unsigned k;
+
+        if (i->n_pollfd <= 0 || i->dead)
+            continue;
+
+        if (i->epoll_dirty && sync_item(i) < 0) {
+            disable_epoll(p);
+            return;
+        }
+
+        if (i->ready) {
+            for (k = 0; k < i->n_pollfd; k++)
+                i->pollfd[k].revents = 0;
+
+            i->ready = false;
+        }
+    }
+
+    if (p->n_epoll_events_alloc < p->n_pollfd_used + 1) {
+        p->n_epoll_events_alloc = (p->n_pollfd_used + 1) * 2;
+        p->epoll_events = pa_xrealloc(p->epoll_events, p->n_epoll_events_alloc * sizeof(struct epoll_event));
+    }
+}
+
+static int set_timer_fd(pa_rtpoll *p, const struct timeval *timeout) {
+    struct itimerspec its;
+
+    if (!timeout && !p->timer_fd_armed)
+        return 0;
+
+    pa_zero(its);
+
+    if (timeout) {
+        its.it_value.tv_sec = timeout->tv_sec;
+        its.it_value.tv_nsec = timeout->tv_usec * 1000;
+    }
+
+    if (timerfd_settime(p->timer_fd, 0, &its, NULL) < 0) {
+        pa_log_error("timerfd_settime(): %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    p->timer_fd_armed = !!timeout;
+    return 0;
+}
+
+/* Sleep on the epoll set, fills in the revents of the ready items.
+ * Returns the number of ready fds like poll(), not counting the timer. */
+static int epoll_sleep(pa_rtpoll *p, const struct timeval *timeout) {
+    int n, k, r = 0;
+
+    if (!timeout || timeout->tv_sec > 0 || timeout->tv_usec > 0) {
+        if (set_timer_fd(p, timeout) < 0)
+            return -1;
+
+        n = epoll_wait(p->epoll_fd, p->epoll_events, (int) p->n_epoll_events_alloc, -1);
+    } else
+        n = epoll_wait(p->epoll_fd, p->epoll_events, (int) p->n_epoll_events_alloc, 0);
+
+    if (n < 0)
+        return n;
+
+    for (k = 0; k < n; k++) {
+        struct rtpoll_epoll_fd *e = p->epoll_events[k].data.ptr;
+
+        if (!e) {
+            uint64_t expirations;
+
+            (void) pa_read(p->timer_fd, &expirations, sizeof(expirations), NULL);
+            p->timer_fd_armed = false;
+            continue;
+        }
+
+        if (e->item->dead)
+            continue;
+
+        e->item->pollfd[e->index].revents = map_events_from_epoll(p->epoll_events[k].events);
+        e->item->ready = true;
+        r++;
+    }
+
+    return r;
+}
+
+/* Whether the work and after callbacks of the item need to be called */
+static bool item_is_ready(pa_rtpoll_item *i) {
+    return i->rtpoll->epoll_fd < 0 || i->n_pollfd <= 0 || i->ready;
+}
+#endif
+
 pa_rtpoll *pa_rtpoll_new(void) {
     pa_rtpoll *p;
 
@@ -93,6 +404,10 @@ pa_rtpoll *pa_rtpoll_new(void) {
     p->pollfd = pa_xnew(struct pollfd, p->n_pollfd_alloc);
     p->pollfd2 = pa_xnew(struct pollfd, p->n_pollfd_alloc);
 
+#ifdef USE_EPOLL
+    init_epoll(p);
+#endif
+
 #ifdef DEBUG_TIMING
     p->timestamp = pa_rtclock_now();
 #endif
@@ -156,6 +471,10 @@ static void rtpoll_item_destroy(pa_rtpoll_item *i) {
 
     p->n_pollfd_used -= i->n_pollfd;
 
+#ifdef USE_EPOLL
+    unregister_item(i);
+#endif
+
     if (pa_flist_push(PA_STATIC_FLIST_GET(items), i) < 0)
         pa_xfree(i);
 
@@ -165,12 +484,24 @@ static void rtpoll_item_destroy(pa_rtpoll_item *i) {
 void pa_rtpoll_free(pa_rtpoll *p) {
     pa_assert(p);
 
+#ifdef USE_EPOLL
+    /* The fds of the remaining items are often closed already, e.g. by
+     * pa_thread_mq_done(), so drop the whole epoll set instead of
+     * removing them one by one */
+    disable_epoll(p);
+#endif
+
     while (p->items)
         rtpoll_item_destroy(p->items);
 
     pa_xfree(p->pollfd);
     pa_xfree(p->pollfd2);
 
+#ifdef USE_EPOLL
+    pa_xfree(p->epoll_events);
+    pa_xfree(p->epoll_registered);
+#endif
+
     pa_xfree(p);
 }
 
@@ -205,6 +536,7 @@ int pa_rtpoll_run(pa_rtpoll *p) {
     pa_rtpoll_item *i;
     int r = 0;
     struct timeval timeout;
+    pa_usec_t sleep_start, sleep_end;
 
     pa_assert(p);
     pa_assert(!p->running);
@@ -226,6 +558,11 @@ int pa_rtpoll_run(pa_rtpoll *p) {
         if (!i->work_cb)
             continue;
 
+#ifdef USE_EPOLL
+        if (!item_is_ready(i))
+            continue;
+#endif
+
         if (p->quit) {
 #ifdef DEBUG_TIMING
             pa_log("rtpoll finish");
@@ -255,6 +592,12 @@ int pa_rtpoll_run(pa_rtpoll *p) {
 
         if (p->quit || (k = i->before_cb(i)) != 0) {
 
+#ifdef USE_EPOLL
+            /* It has something to do without any of its fds being
+             * ready, so make sure its work callback gets called */
+            i->ready = true;
+#endif
+
             /* Hmm, this one doesn't let us enter the poll, so rewind everything */
 
             for (i = i->prev; i; i = i->prev) {
@@ -280,6 +623,11 @@ int pa_rtpoll_run(pa_rtpoll *p) {
     if (p->rebuild_needed)
         rtpoll_rebuild(p);
 
+#ifdef USE_EPOLL
+    if (p->epoll_fd >= 0)
+        sync_epoll(p);
+#endif
+
     pa_zero(timeout);
 
     /* Calculate timeout */
@@ -306,6 +654,13 @@ int pa_rtpoll_run(pa_rtpoll *p) {
 #endif
 
     /* OK, now let's sleep */
+    sleep_start = pa_rtclock_now();
+
+#ifdef USE_EPOLL
+    if (p->epoll_fd >= 0)
+        r = epoll_sleep(p, (p->quit || p->timer_enabled) ? &timeout : NULL);
+    else
+#endif
 #ifdef HAVE_PPOLL
     {
         struct timespec ts;
@@ -319,6 +674,15 @@ int pa_rtpoll_run(pa_rtpoll *p) {
 
     p->timer_elapsed = r == 0;
 
+    sleep_end = pa_rtclock_now();
+    p->poll_time += sleep_end - sleep_start;
+
+    if (p->timer_elapsed && p->timer_enabled) {
+        pa_usec_t elapse = pa_timeval_load(&p->next_elapse);
+
+        pa_io_histogram_add(&p->lateness, sleep_end > elapse ? sleep_end - elapse : 0);
+    }
+
 #ifdef DEBUG_TIMING
     {
         pa_usec_t now = pa_rtclock_now();
@@ -349,6 +713,13 @@ int pa_rtpoll_run(pa_rtpoll *p) {
         if (!i->after_cb)
             continue;
 
+#ifdef USE_EPOLL
+        /* An after callback that is paired with a before callback
+         * always has to be called, e.g. for pa_fdsem */
+        if (!i->before_cb && !item_is_ready(i))
+            continue;
+#endif
+
         i->after_cb(i);
     }
 
@@ -416,6 +787,12 @@ pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsi
     i->after_cb = NULL;
     i->work_cb = NULL;
 
+#ifdef USE_EPOLL
+    i->epoll_fds = NULL;
+    i->epoll_dirty = n_fds > 0;
+    i->ready = true;
+#endif
+
     for (j = p->items; j; j = j->next) {
         if (prio <= j->priority)
             break;
@@ -448,10 +825,16 @@ void pa_rtpoll_item_free(pa_rtpoll_item *i) {
 struct pollfd *pa_rtpoll_item_get_pollfd(pa_rtpoll_item *i, unsigned *n_fds) {
     pa_assert(i);
 
-    if (i->n_pollfd > 0)
+    if (i->n_pollfd > 0) {
         if (i->rtpoll->rebuild_needed)
             rtpoll_rebuild(i->rtpoll);
 
+#ifdef USE_EPOLL
+        /* The caller may change the fds or events */
+        i->epoll_dirty = true;
+#endif
+    }
+
     if (n_fds)
         *n_fds = i->n_pollfd;
 
@@ -627,6 +1010,15 @@ pa_rtpoll_item *pa_rtpoll_item_new_asyncmsgq_write(pa_rtpoll *p, pa_rtpoll_prior
     return i;
 }
 
+void pa_rtpoll_get_io_stats(pa_rtpoll *p, pa_io_histogram *lateness, pa_usec_t *poll_time) {
+    pa_assert(p);
+    pa_assert(lateness);
+    pa_assert(poll_time);
+
+    *lateness = p->lateness;
+    *poll_time = p->poll_time;
+}
+
 bool pa_rtpoll_timer_elapsed(pa_rtpoll *p) {
     pa_assert(p);
 
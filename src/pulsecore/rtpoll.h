@@ -23,6 +23,7 @@
 #include <sys/types.h>
 #include <limits.h>
 
+#include <pulse/def.h>
 #include <pulse/sample.h>
 #include <pulsecore/asyncmsgq.h>
 #include <pulsecore/fdsem.h>
@@ -68,6 +69,11 @@ void pa_rtpoll_set_timer_disabled(pa_rtpoll *p);
  * the last pa_rtpoll_run() invocation to finish */
 bool pa_rtpoll_timer_elapsed(pa_rtpoll *p);
 
+/* Get how much later than asked for by the timer the loop woke up,
+ * and how much time it spent waiting in total. Must be called from
+ * the thread that runs the loop. */
+void pa_rtpoll_get_io_stats(pa_rtpoll *p, pa_io_histogram *lateness, pa_usec_t *poll_time);
+
 /* A new fd wakeup item for pa_rtpoll */
 pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsigned n_fds);
 void pa_rtpoll_item_free(pa_rtpoll_item *i);
@@ -79,7 +85,9 @@ struct pollfd *pa_rtpoll_item_get_pollfd(pa_rtpoll_item *i, unsigned *n_fds);
 
 /* Set the callback that shall be called when there's time to do some work: If the
  * callback returns a value > 0, the poll is skipped and the next
- * iteration of the loop will start immediately. */
+ * iteration of the loop will start immediately. For items with fds
+ * it may only be called when one of them was ready in the last poll,
+ * or when the before callback of the item skipped the poll. */
 void pa_rtpoll_item_set_work_callback(pa_rtpoll_item *i, int (*work_cb)(pa_rtpoll_item *i));
 
 /* Set the callback that shall be called immediately before entering
@@ -88,7 +96,8 @@ void pa_rtpoll_item_set_work_callback(pa_rtpoll_item *i, int (*work_cb)(pa_rtpol
 void pa_rtpoll_item_set_before_callback(pa_rtpoll_item *i, int (*before_cb)(pa_rtpoll_item *i));
 
 /* Set the callback that shall be called immediately after having
- * entered the sleeping poll */
+ * entered the sleeping poll. Unless the item also has a before
+ * callback, this may be skipped when none of its fds are ready. */
 void pa_rtpoll_item_set_after_callback(pa_rtpoll_item *i, void (*after_cb)(pa_rtpoll_item *i));
 
 void pa_rtpoll_item_set_userdata(pa_rtpoll_item *i, void *userdata);
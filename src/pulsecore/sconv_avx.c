@@ -0,0 +1,126 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "cpu-x86.h"
+#include "sconv.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <immintrin.h>
+
+/* x86 is little endian, so these are the *ne conversions. The results are
+ * the same as the C versions in sconv-s16le.c: the float to integer
+ * conversion rounds to nearest like lrintf(), and the clamping is done before
+ * converting so nothing can overflow. */
+
+static void pa_sconv_s16le_to_f32ne_avx2(unsigned n, const int16_t *a, float *b) {
+    const __m256 scale = _mm256_set1_ps(1.0f / (1 << 15));
+
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) a));
+
+        _mm256_storeu_ps(b, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    for (; n > 0; n--)
+        *(b++) = *(a++) * (1.0f / (1 << 15));
+}
+
+static void pa_sconv_s16le_from_f32ne_avx2(unsigned n, const float *a, int16_t *b) {
+    const __m256 scale = _mm256_set1_ps(1 << 15);
+    const __m256 min = _mm256_set1_ps(-0x8000);
+    const __m256 max = _mm256_set1_ps(0x7FFF);
+
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(a), scale);
+        __m256i i;
+
+        i = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, min), max));
+        _mm_storeu_si128((__m128i *) b, _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1)));
+    }
+
+    for (; n > 0; n--) {
+        float v = *(a++) * (1 << 15);
+
+        *(b++) = (int16_t) PA_CLAMP_UNLIKELY(lrintf(v), -0x8000, 0x7FFF);
+    }
+}
+
+static void pa_sconv_s32le_to_f32ne_avx2(unsigned n, const int32_t *a, float *b) {
+    const __m256 scale = _mm256_set1_ps(1.0f / (1U << 31));
+
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) a);
+
+        _mm256_storeu_ps(b, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    for (; n > 0; n--)
+        *(b++) = *(a++) * (1.0f / (1U << 31));
+}
+
+/* 0x7FFFFFFF is not representable as a float, so rather than clamping we let
+ * cvtps2dq saturate: it returns 0x80000000 for anything out of range, which
+ * is already right for the negative side and is fixed up for the positive
+ * side with a compare. */
+static void pa_sconv_s32le_from_f32ne_avx2(unsigned n, const float *a, int32_t *b) {
+    const __m256 scale = _mm256_set1_ps(1U << 31);
+    const __m256 limit = _mm256_set1_ps(1U << 31);
+    const __m256i max = _mm256_set1_epi32(0x7FFFFFFF);
+
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(a), scale);
+        __m256i i, over;
+
+        i = _mm256_cvtps_epi32(v);
+        over = _mm256_castps_si256(_mm256_cmp_ps(v, limit, _CMP_GE_OQ));
+        _mm256_storeu_si256((__m256i *) b, _mm256_blendv_epi8(i, max, over));
+    }
+
+    for (; n > 0; n--) {
+        float v = *(a++) * (1U << 31);
+
+        *(b++) = (int32_t) PA_CLAMP_UNLIKELY(llrintf(v), -0x80000000LL, 0x7FFFFFFFLL);
+    }
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_convert_func_init_avx(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized conversions.");
+
+        pa_set_convert_to_float32ne_function(PA_SAMPLE_S16LE, (pa_convert_func_t) pa_sconv_s16le_to_f32ne_avx2);
+        pa_set_convert_from_float32ne_function(PA_SAMPLE_S16LE, (pa_convert_func_t) pa_sconv_s16le_from_f32ne_avx2);
+        pa_set_convert_to_float32ne_function(PA_SAMPLE_S32LE, (pa_convert_func_t) pa_sconv_s32le_to_f32ne_avx2);
+        pa_set_convert_from_float32ne_function(PA_SAMPLE_S32LE, (pa_convert_func_t) pa_sconv_s32le_from_f32ne_avx2);
+
+        pa_set_convert_to_s16ne_function(PA_SAMPLE_FLOAT32LE, (pa_convert_func_t) pa_sconv_s16le_from_f32ne_avx2);
+        pa_set_convert_from_s16ne_function(PA_SAMPLE_FLOAT32LE, (pa_convert_func_t) pa_sconv_s16le_to_f32ne_avx2);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
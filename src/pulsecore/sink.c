@@ -49,7 +49,7 @@
 
 #include "sink.h"
 
-#define MAX_MIX_CHANNELS 32
+#define MIX_INFO_STACK_SIZE 32
 #define MIX_BUFFER_LENGTH (pa_page_size())
 #define ABSOLUTE_MIN_LATENCY (500)
 #define ABSOLUTE_MAX_LATENCY (10*PA_USEC_PER_SEC)
@@ -346,6 +346,8 @@ pa_sink* pa_sink_new(
     s->thread_info.volume_change_safety_margin = core->deferred_volume_safety_margin_usec;
     s->thread_info.volume_change_extra_delay = core->deferred_volume_extra_delay_usec;
     s->thread_info.port_latency_offset = s->port_latency_offset;
+    s->thread_info.mix_info = NULL;
+    s->thread_info.n_mix_info = 0;
 
     /* FIXME: This should probably be moved to pa_sink_put() */
     pa_assert_se(pa_idxset_put(core->sinks, s, &s->index) >= 0);
@@ -735,6 +737,7 @@ static void sink_free(pa_object *o) {
 
     pa_idxset_free(s->inputs, NULL);
     pa_hashmap_free(s->thread_info.inputs);
+    pa_xfree(s->thread_info.mix_info);
 
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
@@ -1009,6 +1012,8 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
 
     if (nbytes > 0) {
         pa_log_debug("Processing rewind...");
+        s->thread_info.io_stats.rewinds++;
+
         if (s->flags & PA_SINK_DEFERRED_VOLUME)
             pa_sink_volume_change_rewind(s, nbytes);
     }
@@ -1024,6 +1029,32 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     }
 }
 
+/* Called from IO thread context. The array on the stack of the caller is
+ * used for the common case, sinks with more inputs than that get an
+ * array that grows with the number of inputs. */
+static pa_mix_info* get_mix_info(pa_sink *s, pa_mix_info *stack_info, unsigned *maxinfo) {
+    unsigned n;
+
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    n = pa_hashmap_size(s->thread_info.inputs);
+
+    if (n <= MIX_INFO_STACK_SIZE) {
+        *maxinfo = MIX_INFO_STACK_SIZE;
+        return stack_info;
+    }
+
+    if (n > s->thread_info.n_mix_info) {
+        pa_xfree(s->thread_info.mix_info);
+        s->thread_info.n_mix_info = n * 2;
+        s->thread_info.mix_info = pa_xnew(pa_mix_info, s->thread_info.n_mix_info);
+    }
+
+    *maxinfo = s->thread_info.n_mix_info;
+    return s->thread_info.mix_info;
+}
+
 /* Called from IO thread context */
 static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, unsigned maxinfo) {
     pa_sink_input *i;
@@ -1162,11 +1193,18 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
         pa_source_post(s->monitor_source, result);
 }
 
+/* Called from IO thread context */
+static void update_io_stats(pa_sink *s, pa_usec_t start, size_t length) {
+    pa_io_histogram_add(&s->thread_info.io_stats.render, pa_rtclock_now() - start);
+    s->thread_info.io_stats.bytes += length;
+}
+
 /* Called from IO thread context */
 void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
-    unsigned n;
+    pa_mix_info stack_info[MIX_INFO_STACK_SIZE], *info;
+    unsigned n, maxinfo;
     size_t block_size_max;
+    pa_usec_t start;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1185,6 +1223,7 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     }
 
     pa_sink_ref(s);
+    start = pa_rtclock_now();
 
     if (length <= 0)
         length = pa_frame_align(MIX_BUFFER_LENGTH, &s->sample_spec);
@@ -1195,7 +1234,8 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    info = get_mix_info(s, stack_info, &maxinfo);
+    n = fill_mix_info(s, &length, info, maxinfo);
 
     if (n == 0) {
 
@@ -1244,14 +1284,17 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     inputs_drop(s, info, n, result);
 
+    update_io_stats(s, start, result->length);
+
     pa_sink_unref(s);
 }
 
 /* Called from IO thread context */
 void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
-    unsigned n;
+    pa_mix_info stack_info[MIX_INFO_STACK_SIZE], *info;
+    unsigned n, maxinfo;
     size_t length, block_size_max;
+    pa_usec_t start;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1270,6 +1313,7 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
     }
 
     pa_sink_ref(s);
+    start = pa_rtclock_now();
 
     length = target->length;
     block_size_max = pa_mempool_block_size_max(s->core->mempool);
@@ -1278,7 +1322,8 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    info = get_mix_info(s, stack_info, &maxinfo);
+    n = fill_mix_info(s, &length, info, maxinfo);
 
     if (n == 0) {
         if (target->length > length)
@@ -1329,6 +1374,8 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     inputs_drop(s, info, n, target);
 
+    update_io_stats(s, start, target->length);
+
     pa_sink_unref(s);
 }
 
@@ -1514,6 +1561,16 @@ pa_usec_t pa_sink_get_latency(pa_sink *s) {
     return usec;
 }
 
+/* Called from main thread */
+void pa_sink_get_io_stats(pa_sink *s, pa_io_stats *stats) {
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_IS_LINKED(s->state));
+    pa_assert(stats);
+
+    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_IO_STATS, stats, 0, NULL) == 0);
+}
+
 /* Called from IO thread */
 pa_usec_t pa_sink_get_latency_within_thread(pa_sink *s) {
     pa_usec_t usec = 0;
@@ -2891,6 +2948,17 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             s->thread_info.port_latency_offset = offset;
             return 0;
 
+        case PA_SINK_MESSAGE_GET_IO_STATS: {
+            pa_io_stats *stats = userdata;
+
+            *stats = s->thread_info.io_stats;
+
+            if (s->thread_info.rtpoll)
+                pa_rtpoll_get_io_stats(s->thread_info.rtpoll, &stats->lateness, &stats->poll_time);
+
+            return 0;
+        }
+
         case PA_SINK_MESSAGE_GET_LATENCY:
         case PA_SINK_MESSAGE_MAX:
             ;
@@ -39,6 +39,7 @@
 #include <pulsecore/msgobject.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/device-port.h>
+#include <pulsecore/io-stats.h>
 #include <pulsecore/card.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/thread-mq.h>
@@ -304,6 +305,15 @@ struct pa_sink {
         uint32_t volume_change_safety_margin;
         /* Usec delay added to all volume change events, may be negative. */
         int32_t volume_change_extra_delay;
+
+        /* Used by pa_sink_render() instead of its array on the stack
+         * when there are many inputs */
+        struct pa_mix_info *mix_info;
+        unsigned n_mix_info;
+
+        /* Timing and counters of the IO thread, see
+         * pa_sink_get_io_stats() */
+        pa_io_stats io_stats;
     } thread_info;
 
     void *userdata;
@@ -338,6 +348,7 @@ typedef enum pa_sink_message {
     PA_SINK_MESSAGE_SET_PORT,
     PA_SINK_MESSAGE_UPDATE_VOLUME_AND_MUTE,
     PA_SINK_MESSAGE_SET_PORT_LATENCY_OFFSET,
+    PA_SINK_MESSAGE_GET_IO_STATS,
     PA_SINK_MESSAGE_MAX
 } pa_sink_message_t;
 
@@ -427,6 +438,7 @@ void pa_sink_set_port_latency_offset(pa_sink *s, int64_t offset);
 
 /* The returned value is supposed to be in the time domain of the sound card! */
 pa_usec_t pa_sink_get_latency(pa_sink *s);
+void pa_sink_get_io_stats(pa_sink *s, pa_io_stats *stats);
 pa_usec_t pa_sink_get_requested_latency(pa_sink *s);
 void pa_sink_get_latency_range(pa_sink *s, pa_usec_t *min_latency, pa_usec_t *max_latency);
 pa_usec_t pa_sink_get_fixed_latency(pa_sink *s);
@@ -459,6 +459,7 @@ int pa_source_output_new(
     o->thread_info.attached = false;
     o->thread_info.sample_spec = o->sample_spec;
     o->thread_info.resampler = resampler;
+    o->thread_info.resampler_used = false;
     o->thread_info.soft_volume = o->soft_volume;
     o->thread_info.muted = o->muted;
     o->thread_info.requested_source_latency = (pa_usec_t) -1;
@@ -708,10 +709,50 @@ pa_usec_t pa_source_output_get_latency(pa_source_output *o, pa_usec_t *source_la
     return r[0];
 }
 
+/* Called from thread context. Outputs that feed their resampler the plain
+ * source data may share the conversion with other outputs of the source.
+ * This doesn't change while the output stays with its resampler. */
+bool pa_source_output_may_share_conversion(pa_source_output *o) {
+    pa_source_output_assert_ref(o);
+
+    return
+        o->thread_info.resampler &&
+        !o->process_rewind &&
+        !o->thread_info.direct_on_input &&
+        !(o->thread_info.resampler->flags & PA_RESAMPLER_VARIABLE_RATE);
+}
+
+/* Called from thread context. The data of outputs that share conversions
+ * is adjusted after resampling, in the output's own format, see
+ * pa_source_output_push() */
+static void volume_converted_chunk(pa_source_output *o, pa_memchunk *chunk, bool need_volume_factor_source) {
+    pa_cvolume v;
+
+    /* The chunk may be shared with other outputs */
+    pa_memchunk_make_writable(chunk, 0);
+
+    if (o->thread_info.muted) {
+        pa_silence_memchunk(chunk, &o->sample_spec);
+        return;
+    }
+
+    v = o->thread_info.soft_volume;
+
+    if (need_volume_factor_source) {
+        pa_cvolume f = o->volume_factor_source;
+
+        pa_cvolume_remap(&f, &o->source->channel_map, &o->channel_map);
+        pa_sw_cvolume_multiply(&v, &v, &f);
+    }
+
+    pa_volume_memchunk(chunk, &o->sample_spec, &v);
+}
+
 /* Called from thread context */
 void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
     bool need_volume_factor_source;
     bool volume_is_norm;
+    bool share_conversion;
     size_t length;
     size_t limit, mbs = 0;
 
@@ -736,6 +777,11 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
     volume_is_norm = pa_cvolume_is_norm(&o->thread_info.soft_volume) && !o->thread_info.muted;
     need_volume_factor_source = !pa_cvolume_is_norm(&o->volume_factor_source);
 
+    share_conversion = pa_source_output_may_share_conversion(o);
+
+    if (!share_conversion && o->thread_info.conversion)
+        pa_source_leave_conversion(o->source, o);
+
     if (limit > 0 && o->source->monitor_of) {
         pa_usec_t latency;
         size_t n;
@@ -747,7 +793,7 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
          * of the queued data is actually still changeable. Hence
          * FIXME! */
 
-        latency = pa_sink_get_latency_within_thread(o->source->monitor_of);
+        latency = pa_source_get_monitor_latency_within_thread(o->source);
 
         n = pa_usec_to_bytes(latency, &o->source->sample_spec);
 
@@ -769,8 +815,9 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
 
         pa_assert(qchunk.length > 0);
 
-        /* It might be necessary to adjust the volume here */
-        if (!volume_is_norm) {
+        /* It might be necessary to adjust the volume here, unless the
+         * resampler may be shared, then it is done after resampling */
+        if (!volume_is_norm && !share_conversion) {
             pa_memchunk_make_writable(&qchunk, 0);
 
             if (o->thread_info.muted) {
@@ -791,7 +838,7 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
                 pa_volume_memchunk(&qchunk, &o->source->sample_spec, &o->thread_info.soft_volume);
         }
 
-        if (nvfs) {
+        if (nvfs && !share_conversion) {
             pa_memchunk_make_writable(&qchunk, 0);
             pa_volume_memchunk(&qchunk, &o->source->sample_spec, &o->volume_factor_source);
         }
@@ -807,7 +854,15 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
             if (qchunk.length > mbs)
                 qchunk.length = mbs;
 
-            pa_resampler_run(o->thread_info.resampler, &qchunk, &rchunk);
+            if (share_conversion) {
+                pa_source_run_conversion(o->source, o, &qchunk, &rchunk);
+
+                if (rchunk.memblock && (!volume_is_norm || need_volume_factor_source))
+                    volume_converted_chunk(o, &rchunk, need_volume_factor_source);
+            } else {
+                pa_resampler_run(o->thread_info.resampler, &qchunk, &rchunk);
+                o->thread_info.resampler_used = true;
+            }
 
             if (rchunk.length > 0)
                 o->push(o, &rchunk);
@@ -1730,6 +1785,7 @@ int pa_source_output_update_rate(pa_source_output *o) {
         pa_resampler_free(o->thread_info.resampler);
 
     o->thread_info.resampler = new_resampler;
+    o->thread_info.resampler_used = false;
 
     pa_memblockq_free(o->thread_info.delay_memblockq);
 
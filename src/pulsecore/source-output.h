@@ -199,6 +199,16 @@ struct pa_source_output {
 
         pa_resampler* resampler;              /* may be NULL */
 
+        /* Set while the output uses the resampler shared with other
+         * outputs instead of its own one */
+        pa_source_conversion *conversion;
+        unsigned conversion_serial;
+
+        /* Set once the output's own resampler has been run. From then on
+         * its state belongs to the output's stream, and the output can't
+         * switch to a shared resampler without a jump in its data. */
+        bool resampler_used;
+
         /* We maintain a delay memblockq here for source outputs that
          * don't implement rewind() */
         pa_memblockq *delay_memblockq;
@@ -342,6 +352,7 @@ pa_usec_t pa_source_output_get_requested_latency(pa_source_output *o);
 void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk);
 void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes);
 void pa_source_output_update_max_rewind(pa_source_output *o, size_t nbytes);
+bool pa_source_output_may_share_conversion(pa_source_output *o);
 
 void pa_source_output_set_state_within_thread(pa_source_output *o, pa_source_output_state_t state);
 
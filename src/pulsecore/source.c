@@ -56,12 +56,45 @@ struct pa_source_volume_change {
     PA_LLIST_FIELDS(pa_source_volume_change);
 };
 
+/* The result of running a shared resampler once */
+struct conversion_run {
+    pa_memchunk in, out;
+};
+
+/* A resampler that is used instead of their own by all outputs that
+ * convert the source data to the same format in the same way. Outputs
+ * stay in sync as long as they feed in the same chunks: the first one
+ * in each pa_source_post() call runs the resampler, the others pick up
+ * the results. The serials count the chunks run so far, each output
+ * remembers how many of them it has consumed.
+ *
+ * A resampler keeps some of the past data, so an output never switches
+ * between its own resampler and the shared one while its data continues:
+ * the conversion starts out with the resampler of an output that is
+ * already running, other outputs only join before they have run their
+ * own, and outputs only leave when their data jumps anyway. */
+struct pa_source_conversion {
+    pa_resampler *resampler;
+    unsigned n_outputs;
+
+    unsigned serial;
+
+    /* The chunks run in the current pa_source_post() call, the first
+     * one has the serial first_serial + 1 */
+    struct conversion_run *runs;
+    unsigned n_runs, n_runs_allocated;
+    unsigned first_serial;
+
+    PA_LLIST_FIELDS(pa_source_conversion);
+};
+
 struct source_message_set_port {
     pa_device_port *port;
     int ret;
 };
 
 static void source_free(pa_object *o);
+static void conversion_free(pa_source *s, pa_source_conversion *c);
 
 static void pa_source_volume_change_push(pa_source *s);
 static void pa_source_volume_change_flush(pa_source *s);
@@ -327,6 +360,9 @@ pa_source* pa_source_new(
 
     PA_LLIST_HEAD_INIT(pa_source_volume_change, s->thread_info.volume_changes);
     s->thread_info.volume_changes_tail = NULL;
+    PA_LLIST_HEAD_INIT(pa_source_conversion, s->thread_info.conversions);
+    s->thread_info.monitor_latency = 0;
+    s->thread_info.monitor_latency_valid = false;
     pa_sw_cvolume_multiply(&s->thread_info.current_hw_volume, &s->soft_volume, &s->real_volume);
     s->thread_info.volume_change_safety_margin = core->deferred_volume_safety_margin_usec;
     s->thread_info.volume_change_extra_delay = core->deferred_volume_extra_delay_usec;
@@ -667,6 +703,9 @@ static void source_free(pa_object *o) {
 
     pa_source_volume_change_flush(s);
 
+    while (s->thread_info.conversions)
+        conversion_free(s, s->thread_info.conversions);
+
     pa_idxset_free(s->outputs, NULL);
     pa_hashmap_free(s->thread_info.outputs);
 
@@ -894,6 +933,7 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
         return;
 
     pa_log_debug("Processing rewind...");
+    s->thread_info.io_stats.rewinds++;
 
     PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
         pa_source_output_assert_ref(o);
@@ -901,10 +941,262 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
     }
 }
 
+static bool resamplers_match(pa_resampler *a, pa_resampler *b) {
+    return
+        a->method == b->method &&
+        a->flags == b->flags &&
+        pa_sample_spec_equal(&a->i_ss, &b->i_ss) &&
+        pa_sample_spec_equal(&a->o_ss, &b->o_ss) &&
+        pa_channel_map_equal(&a->i_cm, &b->i_cm) &&
+        pa_channel_map_equal(&a->o_cm, &b->o_cm);
+}
+
+static bool conversion_matches(pa_source_conversion *c, pa_resampler *r) {
+    return resamplers_match(c->resampler, r);
+}
+
+static bool conversion_run_matches(struct conversion_run *run, const pa_memchunk *in) {
+    return
+        run->in.memblock == in->memblock &&
+        run->in.index == in->index &&
+        run->in.length == in->length;
+}
+
+/* Called from IO thread context */
+static void conversion_flush_runs(pa_source_conversion *c) {
+    unsigned i;
+
+    for (i = 0; i < c->n_runs; i++) {
+        pa_memblock_unref(c->runs[i].in.memblock);
+
+        if (c->runs[i].out.memblock)
+            pa_memblock_unref(c->runs[i].out.memblock);
+    }
+
+    c->n_runs = 0;
+    c->first_serial = c->serial;
+}
+
+/* Called from main or IO thread context */
+static void conversion_free(pa_source *s, pa_source_conversion *c) {
+    conversion_flush_runs(c);
+
+    PA_LLIST_REMOVE(pa_source_conversion, s->thread_info.conversions, c);
+
+    pa_resampler_free(c->resampler);
+    pa_xfree(c->runs);
+    pa_xfree(c);
+}
+
+static void conversion_join(pa_source_conversion *c, pa_source_output *o, unsigned serial) {
+    o->thread_info.conversion = c;
+    o->thread_info.conversion_serial = serial;
+    c->n_outputs++;
+}
+
+/* Called from IO thread context. The running output hands its resampler
+ * over to the conversion, so that its data continues seamlessly, and
+ * gets an unused one of its own in return. */
+static pa_source_conversion *conversion_new(pa_source *s, pa_source_output *o) {
+    pa_source_conversion *c;
+    pa_resampler *r, *own;
+
+    r = o->thread_info.resampler;
+
+    if (!(own = pa_resampler_new(s->core->mempool,
+                                 &r->i_ss, &r->i_cm,
+                                 &r->o_ss, &r->o_cm,
+                                 s->core->lfe_crossover_freq,
+                                 r->method, r->flags)))
+        return NULL;
+
+    c = pa_xnew0(pa_source_conversion, 1);
+    c->resampler = r;
+    o->thread_info.resampler = own;
+
+    PA_LLIST_PREPEND(pa_source_conversion, s->thread_info.conversions, c);
+
+    conversion_join(c, o, c->serial);
+
+    pa_log_debug("Sharing resampler on source %s for conversion to %uch %uHz.", s->name, r->o_ss.channels, r->o_ss.rate);
+
+    return c;
+}
+
+/* Called from IO thread context, when an output is attached. A conversion
+ * is only set up once a second output converts to the same format. The
+ * new output joins with the first chunk it converts, if that is the same
+ * as the others', see pa_source_run_conversion() */
+static void conversion_prepare(pa_source *s, pa_source_output *o) {
+    pa_source_conversion *c;
+    pa_source_output *other;
+    void *state;
+
+    if (!pa_source_output_may_share_conversion(o) || o->thread_info.resampler_used)
+        return;
+
+    PA_LLIST_FOREACH(c, s->thread_info.conversions)
+        if (conversion_matches(c, o->thread_info.resampler))
+            return;
+
+    PA_HASHMAP_FOREACH(other, s->thread_info.outputs, state) {
+        if (other == o || other->thread_info.conversion || !pa_source_output_may_share_conversion(other))
+            continue;
+
+        if (resamplers_match(other->thread_info.resampler, o->thread_info.resampler)) {
+            conversion_new(s, other);
+            return;
+        }
+    }
+}
+
+/* Called from IO thread context */
+static void conversion_run(pa_source_conversion *c, const pa_memchunk *in, pa_memchunk *out) {
+    struct conversion_run *run;
+
+    pa_resampler_run(c->resampler, in, out);
+
+    if (c->n_runs >= c->n_runs_allocated) {
+        c->n_runs_allocated = PA_MAX(4U, c->n_runs_allocated * 2);
+        c->runs = pa_xrenew(struct conversion_run, c->runs, c->n_runs_allocated);
+    }
+
+    /* Keep a reference to the input, so that its memblock can't be
+     * reused for different data while we compare against it */
+    run = &c->runs[c->n_runs++];
+    run->in = *in;
+    pa_memblock_ref(run->in.memblock);
+    run->out = *out;
+    if (run->out.memblock)
+        pa_memblock_ref(run->out.memblock);
+
+    c->serial++;
+}
+
+/* Called from IO thread context */
+void pa_source_leave_conversion(pa_source *s, pa_source_output *o) {
+    pa_source_conversion *c;
+
+    pa_source_assert_ref(s);
+    pa_source_output_assert_ref(o);
+
+    if (!(c = o->thread_info.conversion))
+        return;
+
+    o->thread_info.conversion = NULL;
+    o->thread_info.resampler_used = true;
+
+    /* Outputs leave when their data jumps anyway, after being corked,
+     * moved, removed or getting a different resampler, so their own
+     * resampler can just start over */
+    if (o->thread_info.resampler)
+        pa_resampler_reset(o->thread_info.resampler);
+
+    pa_assert(c->n_outputs > 0);
+    if (--c->n_outputs <= 0)
+        conversion_free(s, c);
+}
+
+/* Called from IO thread context */
+void pa_source_run_conversion(pa_source *s, pa_source_output *o, const pa_memchunk *in, pa_memchunk *out) {
+    pa_resampler *r;
+    pa_source_conversion *c;
+    unsigned i;
+
+    pa_source_assert_ref(s);
+    pa_source_assert_io_context(s);
+    pa_source_output_assert_ref(o);
+    pa_assert(in);
+    pa_assert(out);
+
+    r = o->thread_info.resampler;
+    pa_assert(r);
+
+    if ((c = o->thread_info.conversion)) {
+
+        if (conversion_matches(c, r)) {
+
+            /* We are the first one to get here, do the work */
+            if (o->thread_info.conversion_serial == c->serial) {
+                conversion_run(c, in, out);
+                o->thread_info.conversion_serial = c->serial;
+                return;
+            }
+
+            /* Somebody else already did */
+            i = o->thread_info.conversion_serial - c->first_serial;
+            if (i < c->n_runs && conversion_run_matches(&c->runs[i], in)) {
+                *out = c->runs[i].out;
+                if (out->memblock)
+                    pa_memblock_ref(out->memblock);
+
+                o->thread_info.conversion_serial++;
+                return;
+            }
+        }
+
+        /* We got out of sync with the others, e.g. after being corked */
+        pa_source_leave_conversion(s, o);
+        pa_resampler_run(o->thread_info.resampler, in, out);
+        return;
+    }
+
+    /* Join if we haven't converted anything on our own yet and the others
+     * have already converted the same data */
+    if (!o->thread_info.resampler_used) {
+        PA_LLIST_FOREACH(c, s->thread_info.conversions) {
+            if (!conversion_matches(c, r))
+                continue;
+
+            for (i = 0; i < c->n_runs; i++)
+                if (conversion_run_matches(&c->runs[i], in)) {
+                    conversion_join(c, o, c->first_serial + i + 1);
+
+                    *out = c->runs[i].out;
+                    if (out->memblock)
+                        pa_memblock_ref(out->memblock);
+                    return;
+                }
+        }
+    }
+
+    pa_resampler_run(r, in, out);
+    o->thread_info.resampler_used = true;
+}
+
+/* Called from IO thread context */
+pa_usec_t pa_source_get_monitor_latency_within_thread(pa_source *s) {
+    pa_source_assert_ref(s);
+    pa_source_assert_io_context(s);
+    pa_assert(s->monitor_of);
+
+    if (!s->thread_info.monitor_latency_valid) {
+        s->thread_info.monitor_latency = pa_sink_get_latency_within_thread(s->monitor_of);
+        s->thread_info.monitor_latency_valid = true;
+    }
+
+    return s->thread_info.monitor_latency;
+}
+
+/* Called from IO thread context */
+static void flush_conversions(pa_source *s) {
+    pa_source_conversion *c;
+
+    PA_LLIST_FOREACH(c, s->thread_info.conversions)
+        conversion_flush_runs(c);
+}
+
+/* Called from IO thread context */
+static void update_io_stats(pa_source *s, pa_usec_t start, size_t length) {
+    pa_io_histogram_add(&s->thread_info.io_stats.render, pa_rtclock_now() - start);
+    s->thread_info.io_stats.bytes += length;
+}
+
 /* Called from IO thread context */
 void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
     pa_source_output *o;
     void *state = NULL;
+    pa_usec_t start;
 
     pa_source_assert_ref(s);
     pa_source_assert_io_context(s);
@@ -914,6 +1206,9 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
     if (s->thread_info.state == PA_SOURCE_SUSPENDED)
         return;
 
+    start = pa_rtclock_now();
+    s->thread_info.monitor_latency_valid = false;
+
     if (s->thread_info.soft_muted || !pa_cvolume_is_norm(&s->thread_info.soft_volume)) {
         pa_memchunk vchunk = *chunk;
 
@@ -942,6 +1237,11 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
                 pa_source_output_push(o, chunk);
         }
     }
+
+    /* Results of shared conversions are only reused within one call */
+    flush_conversions(s);
+
+    update_io_stats(s, start, chunk->length);
 }
 
 /* Called from IO thread context */
@@ -956,6 +1256,8 @@ void pa_source_post_direct(pa_source*s, pa_source_output *o, const pa_memchunk *
     if (s->thread_info.state == PA_SOURCE_SUSPENDED)
         return;
 
+    s->thread_info.monitor_latency_valid = false;
+
     if (s->thread_info.soft_muted || !pa_cvolume_is_norm(&s->thread_info.soft_volume)) {
         pa_memchunk vchunk = *chunk;
 
@@ -1109,6 +1411,16 @@ pa_usec_t pa_source_get_latency(pa_source *s) {
     return usec;
 }
 
+/* Called from main thread */
+void pa_source_get_io_stats(pa_source *s, pa_io_stats *stats) {
+    pa_source_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(PA_SOURCE_IS_LINKED(s->state));
+    pa_assert(stats);
+
+    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_GET_IO_STATS, stats, 0, NULL) == 0);
+}
+
 /* Called from IO thread */
 pa_usec_t pa_source_get_latency_within_thread(pa_source *s) {
     pa_usec_t usec = 0;
@@ -2044,6 +2356,8 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
 
             pa_source_output_update_max_rewind(o, s->thread_info.max_rewind);
 
+            conversion_prepare(s, o);
+
             /* We don't just invalidate the requested latency here,
              * because if we are in a move we might need to fix up the
              * requested latency. */
@@ -2070,6 +2384,8 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
                 o->thread_info.direct_on_input = NULL;
             }
 
+            pa_source_leave_conversion(s, o);
+
             pa_hashmap_remove_and_free(s->thread_info.outputs, PA_UINT32_TO_PTR(o->index));
             pa_source_invalidate_requested_latency(s, true);
 
@@ -2246,6 +2562,17 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
             s->thread_info.port_latency_offset = offset;
             return 0;
 
+        case PA_SOURCE_MESSAGE_GET_IO_STATS: {
+            pa_io_stats *stats = userdata;
+
+            *stats = s->thread_info.io_stats;
+
+            if (s->thread_info.rtpoll)
+                pa_rtpoll_get_io_stats(s->thread_info.rtpoll, &stats->lateness, &stats->poll_time);
+
+            return 0;
+        }
+
         case PA_SOURCE_MESSAGE_MAX:
             ;
     }
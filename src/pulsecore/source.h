@@ -41,6 +41,7 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/card.h>
 #include <pulsecore/device-port.h>
+#include <pulsecore/io-stats.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/source-output.h>
@@ -246,6 +247,19 @@ struct pa_source {
         uint32_t volume_change_safety_margin;
         /* Usec delay added to all volume change events, may be negative. */
         int32_t volume_change_extra_delay;
+
+        /* Resamplers shared by outputs that convert to the same format,
+         * see pa_source_run_conversion() */
+        PA_LLIST_HEAD(pa_source_conversion, conversions);
+
+        /* Latency of the monitored sink, queried once per
+         * pa_source_post() call */
+        pa_usec_t monitor_latency;
+        bool monitor_latency_valid;
+
+        /* Timing and counters of the IO thread, see
+         * pa_source_get_io_stats() */
+        pa_io_stats io_stats;
     } thread_info;
 
     void *userdata;
@@ -276,6 +290,7 @@ typedef enum pa_source_message {
     PA_SOURCE_MESSAGE_SET_PORT,
     PA_SOURCE_MESSAGE_UPDATE_VOLUME_AND_MUTE,
     PA_SOURCE_MESSAGE_SET_PORT_LATENCY_OFFSET,
+    PA_SOURCE_MESSAGE_GET_IO_STATS,
     PA_SOURCE_MESSAGE_MAX
 } pa_source_message_t;
 
@@ -360,6 +375,7 @@ void pa_source_set_port_latency_offset(pa_source *s, int64_t offset);
 
 /* The returned value is supposed to be in the time domain of the sound card! */
 pa_usec_t pa_source_get_latency(pa_source *s);
+void pa_source_get_io_stats(pa_source *s, pa_io_stats *stats);
 pa_usec_t pa_source_get_requested_latency(pa_source *s);
 void pa_source_get_latency_range(pa_source *s, pa_usec_t *min_latency, pa_usec_t *max_latency);
 pa_usec_t pa_source_get_fixed_latency(pa_source *s);
@@ -445,6 +461,22 @@ bool pa_source_volume_change_apply(pa_source *s, pa_usec_t *usec_to_next);
 void pa_source_invalidate_requested_latency(pa_source *s, bool dynamic);
 pa_usec_t pa_source_get_latency_within_thread(pa_source *s);
 
+/* Called from IO context, from source-output.c only. Run the resampler
+ * of the output on the chunk, or reuse the result of another output that
+ * converts the same data to the same format in the same pa_source_post()
+ * call. out->memblock may be NULL if nothing came out of the resampler. */
+void pa_source_run_conversion(pa_source *s, pa_source_output *o, const pa_memchunk *in, pa_memchunk *out);
+
+/* Called from IO context. Stop sharing the resampler of the output with
+ * others, e.g. because it is about to be removed from the source. */
+void pa_source_leave_conversion(pa_source *s, pa_source_output *o);
+
+/* Called from IO context, from source-output.c only. The latency of the
+ * sink this source monitors. It is the same for all outputs within one
+ * pa_source_post() call, so that their delay queues release the same
+ * chunks and they can share conversions. */
+pa_usec_t pa_source_get_monitor_latency_within_thread(pa_source *s);
+
 /* Called from the main thread, from source-output.c only. The normal way to
  * set the source reference volume is to call pa_source_set_volume(), but the
  * flat volume logic in source-output.c needs also a function that doesn't do
@@ -0,0 +1,200 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/endianmacros.h>
+
+#include "cpu-x86.h"
+
+#include "sample-util.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <immintrin.h>
+
+#define LANES 8
+
+/* The volume table is padded (see VOLUME_PADDING in mix.c), so we can load
+ * LANES volumes starting at any channel and get the right pattern. */
+static inline __m256i volume_32x16(__m256i v, __m256i cv) {
+    __m256i hi = _mm256_srai_epi32(cv, 16);
+    __m256i lo = _mm256_and_si256(cv, _mm256_set1_epi32(0xFFFF));
+
+    /* same split as pa_mult_s16_volume(), both products fit in 32 bits */
+    return _mm256_add_epi32(_mm256_mullo_epi32(v, hi),
+                            _mm256_srai_epi32(_mm256_mullo_epi32(v, lo), 16));
+}
+
+static void pa_volume_s16ne_avx2(int16_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned channel = 0, step;
+
+    length /= sizeof(int16_t);
+    step = LANES % channels;
+
+    for (; length >= LANES; length -= LANES, samples += LANES) {
+        __m256i v, cv;
+
+        v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) samples));
+        cv = _mm256_loadu_si256((const __m256i *) (volumes + channel));
+        v = volume_32x16(v, cv);
+
+        _mm_storeu_si128((__m128i *) samples,
+                         _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+
+        channel += step;
+        if (channel >= channels)
+            channel -= channels;
+    }
+
+    for (; length; length--) {
+        int32_t t = pa_mult_s16_volume(*samples, volumes[channel]);
+
+        t = PA_CLAMP_UNLIKELY(t, -0x8000, 0x7FFF);
+        *samples++ = (int16_t) t;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void pa_volume_s16re_avx2(int16_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    unsigned channel = 0, step;
+
+    length /= sizeof(int16_t);
+    step = LANES % channels;
+
+    for (; length >= LANES; length -= LANES, samples += LANES) {
+        __m256i v, cv;
+
+        v = _mm256_cvtepi16_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) samples), swap));
+        cv = _mm256_loadu_si256((const __m256i *) (volumes + channel));
+        v = volume_32x16(v, cv);
+
+        _mm_storeu_si128((__m128i *) samples,
+                         _mm_shuffle_epi8(_mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)), swap));
+
+        channel += step;
+        if (channel >= channels)
+            channel -= channels;
+    }
+
+    for (; length; length--) {
+        int32_t t = pa_mult_s16_volume(PA_INT16_SWAP(*samples), volumes[channel]);
+
+        t = PA_CLAMP_UNLIKELY(t, -0x8000, 0x7FFF);
+        *samples++ = PA_INT16_SWAP((int16_t) t);
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+/* Works on the even and odd samples separately to get full 64 bit products.
+ * These are offset by 2^63 before shifting, which turns the arithmetic shift
+ * that AVX2 lacks into a logical one and leaves (v * cv >> 16) + 2^47, a
+ * positive number that can be clamped with signed compares. The low 32 bits
+ * are then the result, since 2^47 has none set. */
+static void pa_volume_s32ne_avx2(int32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i min = _mm256_set1_epi64x((1LL << 47) - 0x80000000LL);
+    const __m256i max = _mm256_set1_epi64x((1LL << 47) + 0x7FFFFFFFLL);
+    unsigned channel = 0, step;
+
+    length /= sizeof(int32_t);
+    step = LANES % channels;
+
+    for (; length >= LANES; length -= LANES, samples += LANES) {
+        __m256i v, cv, even, odd;
+
+        v = _mm256_loadu_si256((const __m256i *) samples);
+        cv = _mm256_loadu_si256((const __m256i *) (volumes + channel));
+
+        even = _mm256_mul_epi32(v, cv);
+        odd = _mm256_mul_epi32(_mm256_srli_epi64(v, 32), _mm256_srli_epi64(cv, 32));
+
+        even = _mm256_srli_epi64(_mm256_xor_si256(even, sign), 16);
+        odd = _mm256_srli_epi64(_mm256_xor_si256(odd, sign), 16);
+
+        even = _mm256_blendv_epi8(even, max, _mm256_cmpgt_epi64(even, max));
+        even = _mm256_blendv_epi8(even, min, _mm256_cmpgt_epi64(min, even));
+        odd = _mm256_blendv_epi8(odd, max, _mm256_cmpgt_epi64(odd, max));
+        odd = _mm256_blendv_epi8(odd, min, _mm256_cmpgt_epi64(min, odd));
+
+        _mm256_storeu_si256((__m256i *) samples, _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA));
+
+        channel += step;
+        if (channel >= channels)
+            channel -= channels;
+    }
+
+    for (; length; length--) {
+        int64_t t;
+
+        t = (int64_t)(*samples);
+        t = (t * volumes[channel]) >> 16;
+        t = PA_CLAMP_UNLIKELY(t, -0x80000000LL, 0x7FFFFFFFLL);
+        *samples++ = (int32_t) t;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void pa_volume_float32ne_avx2(float *samples, const float *volumes, unsigned channels, unsigned length) {
+    unsigned channel = 0, step;
+
+    length /= sizeof(float);
+    step = LANES % channels;
+
+    for (; length >= LANES; length -= LANES, samples += LANES) {
+        __m256 v = _mm256_loadu_ps(samples);
+
+        _mm256_storeu_ps(samples, _mm256_mul_ps(v, _mm256_loadu_ps(volumes + channel)));
+
+        channel += step;
+        if (channel >= channels)
+            channel -= channels;
+    }
+
+    for (; length; length--) {
+        *samples++ *= volumes[channel];
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_volume_func_init_avx(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized volume functions.");
+
+        pa_set_volume_func(PA_SAMPLE_S16NE, (pa_do_volume_func_t) pa_volume_s16ne_avx2);
+        pa_set_volume_func(PA_SAMPLE_S16RE, (pa_do_volume_func_t) pa_volume_s16re_avx2);
+        pa_set_volume_func(PA_SAMPLE_S32NE, (pa_do_volume_func_t) pa_volume_s32ne_avx2);
+        pa_set_volume_func(PA_SAMPLE_FLOAT32NE, (pa_do_volume_func_t) pa_volume_float32ne_avx2);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -31,6 +31,7 @@ typedef struct pa_sink_volume_change pa_sink_volume_change;
 typedef struct pa_sink_input pa_sink_input;
 typedef struct pa_source pa_source;
 typedef struct pa_source_volume_change pa_source_volume_change;
+typedef struct pa_source_conversion pa_source_conversion;
 typedef struct pa_source_output pa_source_output;
 
 
@@ -0,0 +1,249 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <pulsecore/cpu.h>
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/echo-cancel/adrian-aec.h>
+
+#include "runtime-test-util.h"
+
+#define RATE 16000
+#define SAMPLES (RATE / 2)
+#define TIMES 1000
+#define TIMES2 100
+#define AEC_TIMES 1
+#define AEC_TIMES2 5
+
+/* Allowed deviation of a kernel from the generic code, relative to the
+ * magnitude of its inputs, as the order of summation differs */
+#define EPSILON 1e-4f
+
+static void fill_random(float *f, unsigned n, float scale) {
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        f[i] = scale * (rand() / (float) RAND_MAX - 0.5f);
+}
+
+static void run_kernel_test(AEC *a, AEC *ref, bool correct, bool perf) {
+    PA_DECLARE_ALIGNED(32, float, w[NLMS_LEN]);
+    PA_DECLARE_ALIGNED(32, float, w_ref[NLMS_LEN]);
+    PA_DECLARE_ALIGNED(32, float, x_arr[NLMS_LEN + 8]);
+    float *x;
+    float sum, sum_ref, mag;
+    unsigned i;
+
+    /* The filter slides over x, so it is not aligned in general */
+    x = x_arr + 3;
+
+    fill_random(w, NLMS_LEN, 2.0f);
+    fill_random(x, NLMS_LEN, 2.0f * MAXPCM);
+    memcpy(w_ref, w, sizeof(w));
+
+    if (correct) {
+        mag = 0.0f;
+        for (i = 0; i < NLMS_LEN; i++)
+            mag += fabsf(w[i] * x[i]);
+
+        sum = a->dotp(w, x, NLMS_LEN);
+        sum_ref = ref->dotp(w_ref, x, NLMS_LEN);
+
+        if (fabsf(sum - sum_ref) > EPSILON * mag) {
+            pa_log_debug("Correctness test failed: dotp %f != %f", sum, sum_ref);
+            ck_abort();
+        }
+
+        a->update(w, x, 1e-6f, NLMS_LEN);
+        ref->update(w_ref, x, 1e-6f, NLMS_LEN);
+
+        for (i = 0; i < NLMS_LEN; i++) {
+            if (fabsf(w[i] - w_ref[i]) > EPSILON * (fabsf(w_ref[i]) + 1.0f)) {
+                pa_log_debug("Correctness test failed: update");
+                pa_log_debug("%u: %f != %f", i, w[i], w_ref[i]);
+                ck_abort();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing NLMS filter performance with %d taps", NLMS_LEN);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            sum = a->dotp(w, x, NLMS_LEN);
+            a->update(w, x, 1e-12f * sum, NLMS_LEN);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            sum = ref->dotp(w_ref, x, NLMS_LEN);
+            ref->update(w_ref, x, 1e-12f * sum, NLMS_LEN);
+        } PA_RUNTIME_TEST_RUN_STOP
+    }
+}
+
+/* Runs the whole canceller on an echoed signal, which is what bounds how many
+ * echo-cancelled sources can run concurrently */
+static void run_aec_test(const pa_cpu_info *cpu_info, bool correct, bool perf) {
+    static int16_t mic[SAMPLES], spk[SAMPLES];
+    AEC *a, *ref;
+    pa_cpu_info generic = { PA_CPU_UNDEFINED, {}, true };
+    int out, out_ref;
+    unsigned i;
+
+    /* The speaker signal, and the microphone picking up an attenuated and
+     * delayed copy of it over some noise */
+    for (i = 0; i < SAMPLES; i++) {
+        spk[i] = (int16_t) (8000.0 * sin(i * 0.05) + (rand() % 4000) - 2000);
+        mic[i] = (int16_t) ((rand() % 200) - 100);
+        if (i >= 40)
+            mic[i] += spk[i - 40] / 2;
+    }
+
+    if (correct) {
+        a = AEC_init(RATE, cpu_info);
+        ref = AEC_init(RATE, &generic);
+
+        for (i = 0; i < SAMPLES; i++) {
+            out = AEC_doAEC(a, mic[i], spk[i]);
+            out_ref = AEC_doAEC(ref, mic[i], spk[i]);
+
+            /* Rounding differences feed back through the adaptation, so
+             * only require the outputs to stay close */
+            if (abs(out - out_ref) > 16) {
+                pa_log_debug("Correctness test failed: AEC output");
+                pa_log_debug("%u: %d != %d", i, out, out_ref);
+                ck_abort();
+            }
+        }
+
+        AEC_done(a);
+        AEC_done(ref);
+    }
+
+    if (perf) {
+        pa_log_debug("Testing AEC performance with %d samples", SAMPLES);
+
+        a = AEC_init(RATE, cpu_info);
+        PA_RUNTIME_TEST_RUN_START("func", AEC_TIMES, AEC_TIMES2) {
+            for (i = 0; i < SAMPLES; i++)
+                AEC_doAEC(a, mic[i], spk[i]);
+        } PA_RUNTIME_TEST_RUN_STOP
+        AEC_done(a);
+
+        ref = AEC_init(RATE, &generic);
+        PA_RUNTIME_TEST_RUN_START("orig", AEC_TIMES, AEC_TIMES2) {
+            for (i = 0; i < SAMPLES; i++)
+                AEC_doAEC(ref, mic[i], spk[i]);
+        } PA_RUNTIME_TEST_RUN_STOP
+        AEC_done(ref);
+    }
+}
+
+static void run_tests(const pa_cpu_info *cpu_info) {
+    pa_cpu_info generic = { PA_CPU_UNDEFINED, {}, true };
+    AEC *a, *ref;
+
+    a = AEC_init(RATE, cpu_info);
+    ref = AEC_init(RATE, &generic);
+
+    run_kernel_test(a, ref, true, true);
+
+    AEC_done(a);
+    AEC_done(ref);
+
+    run_aec_test(cpu_info, true, true);
+}
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (nlms_sse_test) {
+    pa_cpu_info cpu_info = { PA_CPU_X86, {}, false };
+
+    pa_cpu_get_x86_flags(&cpu_info.flags.x86);
+
+    if (!(cpu_info.flags.x86 & PA_CPU_X86_SSE)) {
+        pa_log_info("SSE not supported. Skipping");
+        return;
+    }
+
+    /* Keep the AVX2 variant from being picked */
+    cpu_info.flags.x86 &= ~PA_CPU_X86_AVX2;
+
+    pa_log_debug("Checking SSE NLMS filter");
+    run_tests(&cpu_info);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+START_TEST (nlms_avx2_test) {
+    pa_cpu_info cpu_info = { PA_CPU_X86, {}, false };
+
+    pa_cpu_get_x86_flags(&cpu_info.flags.x86);
+
+    if (!(cpu_info.flags.x86 & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    pa_log_debug("Checking AVX2 NLMS filter");
+    run_tests(&cpu_info);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Adrian AEC");
+
+    tc = tcase_create("nlms");
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, nlms_sse_test);
+#endif
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, nlms_avx2_test);
+#endif
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,157 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <pulsecore/filter/convolver.h>
+
+#define N_INPUTS 3
+#define N_OUTPUTS 2
+#define FRAMES 4000
+
+static float random_sample(void) {
+    return 2.0f * (rand() / (float) RAND_MAX - 0.5f);
+}
+
+/* Straightforward time domain version of what the convolver computes */
+static void convolve_reference(const float *src, float *dst, float *ir[N_OUTPUTS][N_INPUTS], unsigned ir_length, unsigned n) {
+    unsigned t, j, i, o;
+
+    for (t = 0; t < n; t++) {
+        for (o = 0; o < N_OUTPUTS; o++) {
+            double sum = 0;
+
+            for (i = 0; i < N_INPUTS; i++)
+                for (j = 0; j < ir_length && j <= t; j++)
+                    sum += ir[o][i][j] * src[(t - j) * N_INPUTS + i];
+
+            dst[t * N_OUTPUTS + o] = (float) sum;
+        }
+    }
+}
+
+static void run_convolver_test(unsigned block_size, unsigned ir_length) {
+    pa_convolver *c;
+    float *ir[N_OUTPUTS][N_INPUTS];
+    float *src, *dst, *ref;
+    unsigned i, o, j, done, latency;
+
+    pa_log_debug("Checking convolver with block size %u and %u taps", block_size, ir_length);
+
+    c = pa_convolver_new(block_size, N_INPUTS, N_OUTPUTS, ir_length);
+    latency = pa_convolver_get_latency(c);
+
+    for (o = 0; o < N_OUTPUTS; o++) {
+        for (i = 0; i < N_INPUTS; i++) {
+            ir[o][i] = pa_xnew(float, ir_length);
+
+            for (j = 0; j < ir_length; j++)
+                ir[o][i][j] = random_sample() * expf(-(float) j / ir_length);
+
+            /* leave one of the filters unset, it has to be silent */
+            if (o != 1 || i != 2)
+                pa_convolver_set_filter(c, i, o, ir[o][i], ir_length);
+            else
+                memset(ir[o][i], 0, ir_length * sizeof(float));
+        }
+    }
+
+    src = pa_xnew(float, FRAMES * N_INPUTS);
+    dst = pa_xnew(float, FRAMES * N_OUTPUTS);
+    ref = pa_xnew(float, FRAMES * N_OUTPUTS);
+
+    for (j = 0; j < FRAMES * N_INPUTS; j++)
+        src[j] = random_sample();
+
+    convolve_reference(src, ref, ir, ir_length, FRAMES);
+
+    /* feed the data in odd sized pieces to exercise the block handling */
+    for (done = 0, j = 1; done < FRAMES; j = j * 7 % 331 + 1) {
+        unsigned n = PA_MIN(j, FRAMES - done);
+
+        pa_convolver_process(c, src + done * N_INPUTS, dst + done * N_OUTPUTS, n);
+        done += n;
+    }
+
+    for (j = 0; j < FRAMES * N_OUTPUTS; j++) {
+        float expected = j < latency * N_OUTPUTS ? 0.0f : ref[j - latency * N_OUTPUTS];
+
+        if (fabsf(dst[j] - expected) > 1e-3f) {
+            pa_log_debug("Correctness test failed: block_size=%u, taps=%u", block_size, ir_length);
+            pa_log_debug("%u: %.9f != %.9f", j, dst[j], expected);
+            ck_abort();
+        }
+    }
+
+    /* after a reset we need to get the same result again */
+    pa_convolver_reset(c);
+    pa_convolver_process(c, src, dst, FRAMES);
+    for (j = latency * N_OUTPUTS; j < FRAMES * N_OUTPUTS; j++)
+        fail_unless(fabsf(dst[j] - ref[j - latency * N_OUTPUTS]) <= 1e-3f);
+
+    for (o = 0; o < N_OUTPUTS; o++)
+        for (i = 0; i < N_INPUTS; i++)
+            pa_xfree(ir[o][i]);
+
+    pa_xfree(src);
+    pa_xfree(dst);
+    pa_xfree(ref);
+
+    pa_convolver_free(c);
+}
+
+START_TEST (convolver_test) {
+    run_convolver_test(4, 1);
+    run_convolver_test(16, 16);
+    run_convolver_test(64, 100);
+    run_convolver_test(128, 1000);
+    run_convolver_test(256, 2049);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Convolver");
+    tc = tcase_create("convolver");
+    tcase_add_test(tc, convolver_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
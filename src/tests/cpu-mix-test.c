@@ -20,18 +20,28 @@
 #endif
 
 #include <check.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/cpu.h>
 #include <pulsecore/cpu-arm.h>
+#include <pulsecore/cpu-x86.h>
 #include <pulsecore/random.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/mix.h>
+#include <pulsecore/sample-util.h>
 
 #include "runtime-test-util.h"
 
 #define SAMPLES 1028
 #define TIMES 1000
 #define TIMES2 100
+#define NSTREAMS 24
+/* More inputs than pa_sink_render() collects on its stack */
+#define NSTREAMS_WIDE 40
 
 static void acquire_mix_streams(pa_mix_info streams[], unsigned nstreams) {
     unsigned i;
@@ -145,6 +155,195 @@ static void run_mix_test(
     pa_mempool_unref(pool);
 }
 
+/* Mixes NSTREAMS streams of the given format with per-channel volumes, as
+ * seen on busy sinks, and compares against the generic implementation */
+static void run_mix_format_test(
+        pa_do_mix_func_t func,
+        pa_do_mix_func_t orig_func,
+        pa_sample_format_t format,
+        unsigned nstreams,
+        int align,
+        int channels,
+        bool correct,
+        bool perf) {
+
+    pa_sample_spec ss;
+    pa_mempool *pool;
+    pa_mix_info m[NSTREAMS_WIDE];
+    void *in[NSTREAMS_WIDE];
+    uint8_t *out, *out_ref;
+    size_t sample_size, length;
+    unsigned i, j;
+
+    pa_assert(nstreams <= NSTREAMS_WIDE);
+
+    ss.format = format;
+    ss.channels = channels;
+    ss.rate = 44100;
+    sample_size = pa_sample_size(&ss);
+    /* frame counts that are not a multiple of the vector size, so that the
+     * leftover samples are mixed too */
+    length = pa_frame_size(&ss) * (SAMPLES - align);
+
+    fail_unless((pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true)) != NULL, NULL);
+
+    for (i = 0; i < nstreams; i++) {
+        in[i] = pa_xmalloc(length + sample_size * align);
+
+        if (format == PA_SAMPLE_FLOAT32NE) {
+            float *f = (float *) ((uint8_t *) in[i] + sample_size * align);
+
+            for (j = 0; j < length / sample_size; j++)
+                f[j] = (float) (rand() / (double) RAND_MAX * 2.0 - 1.0);
+        } else
+            pa_random((uint8_t *) in[i] + sample_size * align, length);
+
+        m[i].chunk.memblock = pa_memblock_new_fixed(pool, (uint8_t *) in[i] + sample_size * align, length, false);
+        m[i].chunk.length = length;
+        m[i].chunk.index = 0;
+        m[i].volume.channels = channels;
+
+        for (j = 0; j < (unsigned) channels; j++) {
+            m[i].volume.values[j] = PA_VOLUME_NORM;
+            if (format == PA_SAMPLE_FLOAT32NE)
+                m[i].linear[j].f = (i + j) % 7 ? 1.0f / (i + j + 1) : 0.0f;
+            else
+                m[i].linear[j].i = (i + j) % 7 ? 0x5555 + 0x1234 * (int32_t) (i + j) : 0;
+        }
+    }
+
+    out = pa_xmalloc(length);
+    out_ref = pa_xmalloc(length);
+
+    if (correct) {
+        acquire_mix_streams(m, nstreams);
+        orig_func(m, nstreams, channels, out_ref, length);
+        release_mix_streams(m, nstreams);
+
+        acquire_mix_streams(m, nstreams);
+        func(m, nstreams, channels, out, length);
+        release_mix_streams(m, nstreams);
+
+        for (j = 0; j < length / sample_size; j++) {
+            bool equal;
+
+            if (format == PA_SAMPLE_FLOAT32NE)
+                equal = fabsf(((float *) out)[j] - ((float *) out_ref)[j]) <= 0.00001f;
+            else
+                equal = memcmp(out + j * sample_size, out_ref + j * sample_size, sample_size) == 0;
+
+            if (!equal) {
+                pa_log_debug("Correctness test failed: format=%s, streams=%u, align=%d, channels=%d, sample %u",
+                             pa_sample_format_to_string(format), nstreams, align, channels, j);
+                ck_abort();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %d-channel %s mixing performance of %u streams", channels, pa_sample_format_to_string(format), nstreams);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES2, TIMES2) {
+            acquire_mix_streams(m, nstreams);
+            func(m, nstreams, channels, out, length);
+            release_mix_streams(m, nstreams);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES2, TIMES2) {
+            acquire_mix_streams(m, nstreams);
+            orig_func(m, nstreams, channels, out_ref, length);
+            release_mix_streams(m, nstreams);
+        } PA_RUNTIME_TEST_RUN_STOP
+    }
+
+    for (i = 0; i < nstreams; i++) {
+        pa_memblock_unref(m[i].chunk.memblock);
+        pa_xfree(in[i]);
+    }
+
+    pa_xfree(out);
+    pa_xfree(out_ref);
+
+    pa_mempool_unref(pool);
+}
+
+static void run_mix_format_tests(pa_do_mix_func_t funcs[3], pa_do_mix_func_t orig_funcs[3]) {
+    static const pa_sample_format_t formats[3] = { PA_SAMPLE_S16NE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    static const int channels[] = { 1, 2, 3, 6, 8 };
+    unsigned i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < PA_ELEMENTSOF(channels); j++) {
+            run_mix_format_test(funcs[i], orig_funcs[i], formats[i], 3, 7, channels[j], true, false);
+            run_mix_format_test(funcs[i], orig_funcs[i], formats[i], NSTREAMS, 5, channels[j], true, false);
+            run_mix_format_test(funcs[i], orig_funcs[i], formats[i], NSTREAMS_WIDE, 3, channels[j], true, false);
+        }
+
+        run_mix_format_test(funcs[i], orig_funcs[i], formats[i], NSTREAMS, 0, 2, true, true);
+    }
+}
+
+/* Sample by sample, as the generic code did before it mixed in tiles */
+static void mix_ref_s16ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, unsigned length) {
+    int16_t *d = data;
+    unsigned i, k;
+
+    for (k = 0; k < length / sizeof(int16_t); k++) {
+        int32_t sum = 0;
+
+        for (i = 0; i < nstreams; i++)
+            sum += pa_mult_s16_volume(((int16_t *) streams[i].ptr)[k], streams[i].linear[k % channels].i);
+
+        d[k] = (int16_t) PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
+    }
+}
+
+static void mix_ref_s32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, unsigned length) {
+    int32_t *d = data;
+    unsigned i, k;
+
+    for (k = 0; k < length / sizeof(int32_t); k++) {
+        int64_t sum = 0;
+
+        for (i = 0; i < nstreams; i++)
+            sum += ((int64_t) ((int32_t *) streams[i].ptr)[k] * streams[i].linear[k % channels].i) >> 16;
+
+        d[k] = (int32_t) PA_CLAMP_UNLIKELY(sum, -0x80000000LL, 0x7FFFFFFFLL);
+    }
+}
+
+static void mix_ref_float32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, unsigned length) {
+    float *d = data;
+    unsigned i, k;
+
+    for (k = 0; k < length / sizeof(float); k++) {
+        float sum = 0.0f;
+
+        for (i = 0; i < nstreams; i++)
+            sum += ((float *) streams[i].ptr)[k] * streams[i].linear[k % channels].f;
+
+        d[k] = sum;
+    }
+}
+
+/* The generic code mixes many streams in tiles, check it against mixing
+ * sample by sample, also with more streams than a sink mixes from its
+ * stack */
+START_TEST (mix_wide_test) {
+    pa_cpu_info cpu_info = { PA_CPU_UNDEFINED, {}, true };
+    pa_do_mix_func_t funcs[3];
+    pa_do_mix_func_t ref_funcs[3] = { mix_ref_s16ne, mix_ref_s32ne, mix_ref_float32ne };
+
+    pa_mix_func_init(&cpu_info);
+    funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking generic mix of %u streams (s16, s32, float)", NSTREAMS_WIDE);
+    run_mix_format_tests(funcs, ref_funcs);
+}
+END_TEST
+
 START_TEST (mix_special_test) {
     pa_cpu_info cpu_info = { PA_CPU_UNDEFINED, {}, false };
     pa_do_mix_func_t orig_func, special_func;
@@ -165,6 +364,12 @@ START_TEST (mix_special_test) {
 
     pa_log_debug("Checking special mix (s16, mono)");
     run_mix_test(special_func, orig_func, 7, 1, true, true);
+
+    /* Many streams are mixed in tiles */
+    pa_log_debug("Checking tiled mix (s16)");
+    run_mix_format_test(special_func, orig_func, PA_SAMPLE_S16NE, NSTREAMS, 5, 1, true, false);
+    run_mix_format_test(special_func, orig_func, PA_SAMPLE_S16NE, NSTREAMS, 5, 3, true, false);
+    run_mix_format_test(special_func, orig_func, PA_SAMPLE_S16NE, NSTREAMS, 0, 2, true, true);
 }
 END_TEST
 
@@ -196,6 +401,83 @@ START_TEST (mix_neon_test) {
 END_TEST
 #endif /* defined (__arm__) && defined (__linux__) && defined (HAVE_NEON) */
 
+#if defined (__i386__) || defined (__amd64__)
+static void get_generic_mix_funcs(pa_do_mix_func_t funcs[3]) {
+    pa_cpu_info cpu_info = { PA_CPU_UNDEFINED, {}, true };
+
+    pa_mix_func_init(&cpu_info);
+    funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+}
+
+#ifdef HAVE_SSE2
+START_TEST (mix_sse2_test) {
+    pa_do_mix_func_t orig_funcs[3], sse2_funcs[3];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    get_generic_mix_funcs(orig_funcs);
+    pa_mix_func_init_sse(flags);
+    sse2_funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    sse2_funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    sse2_funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking SSE2 mix (s16, stereo)");
+    run_mix_test(sse2_funcs[0], orig_funcs[0], 7, 2, true, true);
+
+    pa_log_debug("Checking SSE2 mix (s16, 4-channel)");
+    run_mix_test(sse2_funcs[0], orig_funcs[0], 7, 4, true, true);
+
+    pa_log_debug("Checking SSE2 mix (s16, mono)");
+    run_mix_test(sse2_funcs[0], orig_funcs[0], 7, 1, true, true);
+
+    pa_log_debug("Checking SSE2 mix (s16, s32, float)");
+    run_mix_format_tests(sse2_funcs, orig_funcs);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+START_TEST (mix_avx2_test) {
+    pa_do_mix_func_t orig_funcs[3], avx2_funcs[3];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    get_generic_mix_funcs(orig_funcs);
+    pa_mix_func_init_avx(flags);
+    avx2_funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    avx2_funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    avx2_funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking AVX2 mix (s16, stereo)");
+    run_mix_test(avx2_funcs[0], orig_funcs[0], 7, 2, true, true);
+
+    pa_log_debug("Checking AVX2 mix (s16, 4-channel)");
+    run_mix_test(avx2_funcs[0], orig_funcs[0], 7, 4, true, true);
+
+    pa_log_debug("Checking AVX2 mix (s16, mono)");
+    run_mix_test(avx2_funcs[0], orig_funcs[0], 7, 1, true, true);
+
+    pa_log_debug("Checking AVX2 mix (s16, s32, float)");
+    run_mix_format_tests(avx2_funcs, orig_funcs);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -209,6 +491,15 @@ int main(int argc, char *argv[]) {
 
     tc = tcase_create("mix");
     tcase_add_test(tc, mix_special_test);
+    tcase_add_test(tc, mix_wide_test);
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, mix_sse2_test);
+#endif
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, mix_avx2_test);
+#endif
+#endif
 #if defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)
     tcase_add_test(tc, mix_neon_test);
 #endif
@@ -20,12 +20,16 @@
 #endif
 
 #include <check.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/cpu-x86.h>
 #include <pulsecore/cpu.h>
 #include <pulsecore/random.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/remap.h>
+#include <pulsecore/resampler.h>
 
 #include "runtime-test-util.h"
 
@@ -33,6 +37,9 @@
 #define TIMES 1000
 #define TIMES2 100
 
+/* Written after the end of the output, must still be there afterwards */
+#define CANARY 0x5a5a
+
 static void run_remap_test_float(
         pa_remap_t *remap_func,
         pa_remap_t *remap_orig,
@@ -40,14 +47,15 @@ static void run_remap_test_float(
         bool correct,
         bool perf) {
 
-    PA_DECLARE_ALIGNED(8, float, out_buf_ref[SAMPLES*8]) = { 0.0f, };
-    PA_DECLARE_ALIGNED(8, float, out_buf[SAMPLES*8]) = { 0.0f, };
+    PA_DECLARE_ALIGNED(8, float, out_buf_ref[SAMPLES*8 + 8]) = { 0.0f, };
+    PA_DECLARE_ALIGNED(8, float, out_buf[SAMPLES*8 + 8]) = { 0.0f, };
     PA_DECLARE_ALIGNED(8, float, in_buf[SAMPLES*8]);
     float *out, *out_ref;
     float *in;
     unsigned n_ic = remap_func->i_ss.channels;
     unsigned n_oc = remap_func->o_ss.channels;
     unsigned i, nsamples;
+    const float canary = CANARY;
 
     pa_assert(n_ic >= 1 && n_ic <= 8);
     pa_assert(n_oc >= 1 && n_oc <= 8);
@@ -61,6 +69,9 @@ static void run_remap_test_float(
     for (i = 0; i < nsamples * n_ic; i++)
         in[i] = 2.1f * (rand()/(float) RAND_MAX - 0.5f);
 
+    for (i = nsamples * n_oc; i < nsamples * n_oc + 8; i++)
+        out[i] = CANARY;
+
     if (correct) {
         remap_orig->do_remap(remap_orig, out_ref, in, nsamples);
         remap_func->do_remap(remap_func, out, in, nsamples);
@@ -73,6 +84,14 @@ static void run_remap_test_float(
                 ck_abort();
             }
         }
+
+        /* Nothing may be written past the end of the output */
+        for (i = nsamples * n_oc; i < nsamples * n_oc + 8; i++) {
+            if (memcmp(&out[i], &canary, sizeof(float)) != 0) {
+                pa_log_debug("Correctness test failed: align=%d, overrun at %d", align, i);
+                ck_abort();
+            }
+        }
     }
 
     if (perf) {
@@ -95,8 +114,8 @@ static void run_remap_test_s16(
         bool correct,
         bool perf) {
 
-    PA_DECLARE_ALIGNED(8, int16_t, out_buf_ref[SAMPLES*8]) = { 0 };
-    PA_DECLARE_ALIGNED(8, int16_t, out_buf[SAMPLES*8]) = { 0 };
+    PA_DECLARE_ALIGNED(8, int16_t, out_buf_ref[SAMPLES*8 + 8]) = { 0 };
+    PA_DECLARE_ALIGNED(8, int16_t, out_buf[SAMPLES*8 + 8]) = { 0 };
     PA_DECLARE_ALIGNED(8, int16_t, in_buf[SAMPLES*8]);
     int16_t *out, *out_ref;
     int16_t *in;
@@ -115,6 +134,9 @@ static void run_remap_test_s16(
 
     pa_random(in, nsamples * n_ic * sizeof(int16_t));
 
+    for (i = nsamples * n_oc; i < nsamples * n_oc + 8; i++)
+        out[i] = CANARY;
+
     if (correct) {
         remap_orig->do_remap(remap_orig, out_ref, in, nsamples);
         remap_func->do_remap(remap_func, out, in, nsamples);
@@ -126,6 +148,14 @@ static void run_remap_test_s16(
                 ck_abort();
             }
         }
+
+        /* Nothing may be written past the end of the output */
+        for (i = nsamples * n_oc; i < nsamples * n_oc + 8; i++) {
+            if (out[i] != CANARY) {
+                pa_log_debug("Correctness test failed: align=%d, overrun at %d", align, i);
+                ck_abort();
+            }
+        }
     }
 
     if (perf) {
@@ -223,6 +253,39 @@ static void remap_init_test_channels(
     remap_test_channels(&remap_func, &remap_orig);
 }
 
+/* Installed while setting up the reference, so that pa_init_remap_func()
+ * falls back to the generic C code */
+static void init_remap_none(pa_remap_t *m) {
+}
+
+/* Compares init_func against the generic C code, which handles any layout */
+static void remap_init_generic_test_channels(
+        pa_init_remap_func_t init_func,
+        pa_sample_format_t f,
+        unsigned in_channels,
+        unsigned out_channels,
+        bool rearrange) {
+
+    pa_cpu_info cpu_info = { PA_CPU_UNDEFINED, {}, true };
+    pa_init_remap_func_t installed;
+    pa_remap_t remap_orig, remap_func;
+
+    installed = pa_get_init_remap_func();
+    pa_set_init_remap_func(init_remap_none);
+    pa_remap_func_init(&cpu_info);
+    setup_remap_channels(&remap_orig, f, in_channels, out_channels, rearrange);
+    pa_init_remap_func(&remap_orig);
+
+    cpu_info.force_generic_code = false;
+    pa_remap_func_init(&cpu_info);
+    pa_set_init_remap_func(installed);
+
+    setup_remap_channels(&remap_func, f, in_channels, out_channels, rearrange);
+    init_func(&remap_func);
+
+    remap_test_channels(&remap_func, &remap_orig);
+}
+
 static void remap_init2_test_channels(
         pa_sample_format_t f,
         unsigned in_channels,
@@ -323,6 +386,48 @@ START_TEST (remap_sse2_test) {
     remap_init_test_channels(init_func, orig_init_func, PA_SAMPLE_S16NE, 1, 2, false);
 }
 END_TEST
+
+#ifdef HAVE_AVX2
+START_TEST (remap_avx2_test) {
+    pa_cpu_x86_flag_t flags = 0;
+    pa_init_remap_func_t init_func;
+
+    pa_cpu_get_x86_flags(&flags);
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    pa_remap_func_init_avx(flags);
+    init_func = pa_get_init_remap_func();
+
+    pa_log_debug("Checking AVX2 remap (float, mono->stereo)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 1, 2, false);
+    pa_log_debug("Checking AVX2 remap (s16, mono->stereo)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_S16NE, 1, 2, false);
+
+    pa_log_debug("Checking AVX2 remap (float, stereo->6-channel)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 2, 6, false);
+    pa_log_debug("Checking AVX2 remap (s16, stereo->6-channel)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_S16NE, 2, 6, false);
+
+    pa_log_debug("Checking AVX2 remap (float, 6-channel->stereo)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 6, 2, false);
+    pa_log_debug("Checking AVX2 remap (s16, 6-channel->stereo)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_S16NE, 6, 2, false);
+
+    pa_log_debug("Checking AVX2 remap (float, 6-channel->3-channel)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 6, 3, false);
+    pa_log_debug("Checking AVX2 remap (s16, 6-channel->3-channel)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_S16NE, 6, 3, false);
+
+    pa_log_debug("Checking AVX2 remap (float, 8-channel->8-channel)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 8, 8, false);
+    pa_log_debug("Checking AVX2 remap (s16, 8-channel->8-channel)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_S16NE, 8, 8, false);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
 #endif /* defined (__i386__) || defined (__amd64__) */
 
 #if defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)
@@ -394,6 +499,126 @@ START_TEST (rearrange_neon_test) {
 END_TEST
 #endif
 
+/* Runs the conversions and the remapping of a resampler one after the other
+ * over the whole chunk, the way pa_resampler_run() did before doing them in
+ * one pass */
+static void run_steps_separately(pa_resampler *r, const void *src, void *dst, unsigned n_frames) {
+    void *work, *remapped;
+
+    work = pa_xmalloc(r->w_sz * r->i_ss.channels * n_frames);
+    remapped = pa_xmalloc(r->w_sz * r->o_ss.channels * n_frames);
+
+    if (r->to_work_format_func)
+        r->to_work_format_func(n_frames * r->i_ss.channels, src, work);
+    else
+        memcpy(work, src, r->i_fz * n_frames);
+
+    if (r->map_required)
+        r->remap.do_remap(&r->remap, remapped, work, n_frames);
+    else
+        memcpy(remapped, work, r->w_sz * r->o_ss.channels * n_frames);
+
+    if (r->from_work_format_func)
+        r->from_work_format_func(n_frames * r->o_ss.channels, remapped, dst);
+    else
+        memcpy(dst, remapped, r->o_fz * n_frames);
+
+    pa_xfree(work);
+    pa_xfree(remapped);
+}
+
+static void fused_test_channels(
+        pa_mempool *pool,
+        pa_sample_format_t i_format,
+        unsigned in_channels,
+        pa_sample_format_t o_format,
+        unsigned out_channels) {
+
+    pa_sample_spec i_ss, o_ss;
+    pa_channel_map i_cm, o_cm;
+    pa_resampler *r;
+    pa_memchunk in, out;
+    unsigned n_frames, i;
+    void *d, *ref;
+    uint8_t *o;
+
+    i_ss.format = i_format;
+    i_ss.rate = 48000;
+    i_ss.channels = in_channels;
+    o_ss.format = o_format;
+    o_ss.rate = 48000;
+    o_ss.channels = out_channels;
+
+    /* Also for channel counts that have no well known layout */
+    pa_channel_map_init_extend(&i_cm, in_channels, PA_CHANNEL_MAP_DEFAULT);
+    pa_channel_map_init_extend(&o_cm, out_channels, PA_CHANNEL_MAP_DEFAULT);
+
+    pa_log_debug("Checking fused conversion and remap (%s, %u channels -> %s, %u channels)",
+                 pa_sample_format_to_string(i_format), in_channels,
+                 pa_sample_format_to_string(o_format), out_channels);
+
+    pa_assert_se(r = pa_resampler_new(pool, &i_ss, &i_cm, &o_ss, &o_cm, 0, PA_RESAMPLER_COPY, 0));
+    fail_unless(r->fused_buf != NULL);
+
+    /* Several blocks and a partial one at the end */
+    n_frames = 3 * r->fused_block_frames + 17;
+
+    in.memblock = pa_memblock_new(pool, n_frames * r->i_fz);
+    in.index = 0;
+    in.length = n_frames * r->i_fz;
+
+    d = pa_memblock_acquire(in.memblock);
+    if (i_format == PA_SAMPLE_FLOAT32NE) {
+        for (i = 0; i < n_frames * in_channels; i++)
+            ((float *) d)[i] = rand() / (float) RAND_MAX * 2.0f - 1.0f;
+    } else
+        pa_random(d, in.length);
+
+    ref = pa_xmalloc(n_frames * r->o_fz);
+    run_steps_separately(r, d, ref, n_frames);
+    pa_memblock_release(in.memblock);
+
+    pa_resampler_run(r, &in, &out);
+    fail_unless(out.length == n_frames * r->o_fz);
+
+    o = pa_memblock_acquire_chunk(&out);
+    for (i = 0; i < out.length; i++) {
+        if (o[i] != ((uint8_t *) ref)[i]) {
+            pa_log_debug("Correctness test failed: byte %u of %u, %02x != %02x",
+                         i, (unsigned) out.length, o[i], ((uint8_t *) ref)[i]);
+            ck_abort();
+        }
+    }
+    pa_memblock_release(out.memblock);
+
+    pa_memblock_unref(out.memblock);
+    pa_memblock_unref(in.memblock);
+    pa_xfree(ref);
+    pa_resampler_free(r);
+}
+
+START_TEST (fused_test) {
+    static const unsigned channels[][2] = {
+        { 1, 2 }, { 2, 1 }, { 2, 6 }, { 6, 2 }, { 2, 3 }, { 5, 7 }, { 2, 8 }, { 8, 2 }
+    };
+    pa_mempool *pool;
+    unsigned i;
+
+    pa_assert_se(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true));
+
+    for (i = 0; i < PA_ELEMENTSOF(channels); i++) {
+        fused_test_channels(pool, PA_SAMPLE_S16LE, channels[i][0], PA_SAMPLE_FLOAT32NE, channels[i][1]);
+        fused_test_channels(pool, PA_SAMPLE_S16BE, channels[i][0], PA_SAMPLE_FLOAT32NE, channels[i][1]);
+        fused_test_channels(pool, PA_SAMPLE_FLOAT32NE, channels[i][0], PA_SAMPLE_S16LE, channels[i][1]);
+        fused_test_channels(pool, PA_SAMPLE_S16LE, channels[i][0], PA_SAMPLE_S32LE, channels[i][1]);
+        fused_test_channels(pool, PA_SAMPLE_U8, channels[i][0], PA_SAMPLE_S24LE, channels[i][1]);
+        fused_test_channels(pool, PA_SAMPLE_S16NE, channels[i][0], PA_SAMPLE_S16NE, channels[i][1]);
+    }
+
+    pa_mempool_unref(pool);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -410,6 +635,9 @@ int main(int argc, char *argv[]) {
 #if defined (__i386__) || defined (__amd64__)
     tcase_add_test(tc, remap_mmx_test);
     tcase_add_test(tc, remap_sse2_test);
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, remap_avx2_test);
+#endif
 #endif
 #if defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)
     tcase_add_test(tc, remap_neon_test);
@@ -425,6 +653,11 @@ int main(int argc, char *argv[]) {
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
+    tc = tcase_create("fused");
+    tcase_add_test(tc, fused_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
     sr = srunner_create(s);
     srunner_run_all(sr, CK_NORMAL);
     failed = srunner_ntests_failed(sr);
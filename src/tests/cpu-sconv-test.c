@@ -20,6 +20,7 @@
 #endif
 
 #include <check.h>
+#include <string.h>
 
 #include <pulsecore/cpu-arm.h>
 #include <pulsecore/cpu-x86.h>
@@ -83,8 +84,9 @@ static void run_conv_test_float_to_s16(
     }
 }
 
-/* This test is currently only run under NEON */
-#if defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)
+/* This test is currently only run under NEON and AVX2 */
+#if (defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)) || \
+    ((defined (__i386__) || defined (__amd64__)) && defined (HAVE_AVX2))
 static void run_conv_test_s16_to_float(
         pa_convert_func_t func,
         pa_convert_func_t orig_func,
@@ -132,7 +134,61 @@ static void run_conv_test_s16_to_float(
         } PA_RUNTIME_TEST_RUN_STOP
     }
 }
-#endif /* defined (__arm__) && defined (__linux__) && defined (HAVE_NEON) */
+#endif /* (defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)) || ... */
+
+#if (defined (__i386__) || defined (__amd64__)) && defined (HAVE_AVX2)
+/* The s32 conversions are expected to match the C code exactly, in both
+ * directions, including clipping of out of range floats */
+static void run_conv_test_s32(
+        pa_convert_func_t from_func,
+        pa_convert_func_t orig_from_func,
+        pa_convert_func_t to_func,
+        pa_convert_func_t orig_to_func,
+        int align) {
+
+    PA_DECLARE_ALIGNED(8, int32_t, s[SAMPLES]) = { 0 };
+    PA_DECLARE_ALIGNED(8, int32_t, s_ref[SAMPLES]) = { 0 };
+    PA_DECLARE_ALIGNED(8, float, f[SAMPLES]) = { 0.0f };
+    PA_DECLARE_ALIGNED(8, float, f_ref[SAMPLES]) = { 0.0f };
+    int32_t *samples, *samples_ref;
+    float *floats, *floats_ref;
+    int i, nsamples;
+
+    /* Force sample alignment as requested */
+    samples = s + (8 - align);
+    samples_ref = s_ref + (8 - align);
+    floats = f + (8 - align);
+    floats_ref = f_ref + (8 - align);
+    nsamples = SAMPLES - (8 - align);
+
+    for (i = 0; i < nsamples; i++)
+        floats[i] = 2.1f * (rand()/(float) RAND_MAX - 0.5f);
+
+    orig_from_func(nsamples, floats, samples_ref);
+    from_func(nsamples, floats, samples);
+
+    for (i = 0; i < nsamples; i++) {
+        if (samples[i] != samples_ref[i]) {
+            pa_log_debug("Correctness test failed: align=%d", align);
+            pa_log_debug("%d: %08x != %08x (%.24f)\n", i, samples[i], samples_ref[i], floats[i]);
+            ck_abort();
+        }
+    }
+
+    pa_random(samples, nsamples * sizeof(int32_t));
+
+    orig_to_func(nsamples, samples, floats_ref);
+    to_func(nsamples, samples, floats);
+
+    for (i = 0; i < nsamples; i++) {
+        if (memcmp(&floats[i], &floats_ref[i], sizeof(float)) != 0) {
+            pa_log_debug("Correctness test failed: align=%d", align);
+            pa_log_debug("%d: %.24f != %.24f (%d)\n", i, floats[i], floats_ref[i], samples[i]);
+            ck_abort();
+        }
+    }
+}
+#endif /* (defined (__i386__) || defined (__amd64__)) && defined (HAVE_AVX2) */
 
 #if defined (__i386__) || defined (__amd64__)
 START_TEST (sconv_sse2_test) {
@@ -188,6 +244,47 @@ START_TEST (sconv_sse_test) {
     run_conv_test_float_to_s16(sse_func, orig_func, 7, true, true);
 }
 END_TEST
+
+#ifdef HAVE_AVX2
+START_TEST (sconv_avx2_test) {
+    pa_cpu_x86_flag_t flags = 0;
+    pa_convert_func_t orig_from_func, avx2_from_func;
+    pa_convert_func_t orig_to_func, avx2_to_func;
+    pa_convert_func_t orig_from_s32_func, orig_to_s32_func;
+    int i;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    orig_from_func = pa_get_convert_from_float32ne_function(PA_SAMPLE_S16LE);
+    orig_to_func = pa_get_convert_to_float32ne_function(PA_SAMPLE_S16LE);
+    orig_from_s32_func = pa_get_convert_from_float32ne_function(PA_SAMPLE_S32LE);
+    orig_to_s32_func = pa_get_convert_to_float32ne_function(PA_SAMPLE_S32LE);
+    pa_convert_func_init_avx(flags);
+    avx2_from_func = pa_get_convert_from_float32ne_function(PA_SAMPLE_S16LE);
+    avx2_to_func = pa_get_convert_to_float32ne_function(PA_SAMPLE_S16LE);
+
+    pa_log_debug("Checking AVX2 sconv (float -> s16)");
+    for (i = 0; i < 7; i++)
+        run_conv_test_float_to_s16(avx2_from_func, orig_from_func, i, true, false);
+    run_conv_test_float_to_s16(avx2_from_func, orig_from_func, 7, true, true);
+
+    pa_log_debug("Checking AVX2 sconv (s16 -> float)");
+    for (i = 0; i < 7; i++)
+        run_conv_test_s16_to_float(avx2_to_func, orig_to_func, i, true, false);
+    run_conv_test_s16_to_float(avx2_to_func, orig_to_func, 7, true, true);
+
+    pa_log_debug("Checking AVX2 sconv (float <-> s32)");
+    for (i = 0; i < 8; i++)
+        run_conv_test_s32(pa_get_convert_from_float32ne_function(PA_SAMPLE_S32LE), orig_from_s32_func,
+                          pa_get_convert_to_float32ne_function(PA_SAMPLE_S32LE), orig_to_s32_func, i);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
 #endif /* defined (__i386__) || defined (__amd64__) */
 
 #if defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)
@@ -247,6 +344,9 @@ int main(int argc, char *argv[]) {
 #if defined (__i386__) || defined (__amd64__)
     tcase_add_test(tc, sconv_sse2_test);
     tcase_add_test(tc, sconv_sse_test);
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, sconv_avx2_test);
+#endif
 #endif
 #if defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)
     tcase_add_test(tc, sconv_neon_test);
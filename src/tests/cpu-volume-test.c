@@ -100,6 +100,61 @@ static void run_volume_test(
     }
 }
 
+/* Like run_volume_test(), for the other sample formats that have optimized
+ * functions. Those give the same results as the C code too. */
+static void run_volume_format_test(
+        pa_do_volume_func_t func,
+        pa_do_volume_func_t orig_func,
+        pa_sample_format_t format,
+        int align,
+        int channels) {
+
+    PA_DECLARE_ALIGNED(8, int32_t, s[SAMPLES]) = { 0 };
+    PA_DECLARE_ALIGNED(8, int32_t, s_ref[SAMPLES]) = { 0 };
+    int32_t volumes_i[channels + PADDING];
+    float volumes_f[channels + PADDING];
+    const void *volumes;
+    size_t ss;
+    uint8_t *samples, *samples_ref;
+    int i, padding, nsamples, size;
+
+    ss = pa_sample_size_of_format(format);
+
+    /* Force sample alignment as requested */
+    samples = (uint8_t *) s + (8 - align) * ss;
+    samples_ref = (uint8_t *) s_ref + (8 - align) * ss;
+    nsamples = SAMPLES - (8 - align);
+    if (nsamples % channels)
+        nsamples -= nsamples % channels;
+    size = nsamples * ss;
+
+    if (format == PA_SAMPLE_FLOAT32NE) {
+        for (i = 0; i < nsamples; i++)
+            ((float *) samples)[i] = 2.0f * (rand() / (float) RAND_MAX - 0.5f);
+    } else
+        pa_random(samples, size);
+    memcpy(samples_ref, samples, size);
+
+    for (i = 0; i < channels; i++) {
+        volumes_i[i] = PA_CLAMP_VOLUME((pa_volume_t)(rand() >> 15));
+        volumes_f[i] = 2.0f * rand() / (float) RAND_MAX;
+    }
+    for (padding = 0; padding < PADDING; padding++, i++) {
+        volumes_i[i] = volumes_i[padding];
+        volumes_f[i] = volumes_f[padding];
+    }
+    volumes = format == PA_SAMPLE_FLOAT32NE ? (const void *) volumes_f : (const void *) volumes_i;
+
+    orig_func(samples_ref, volumes, channels, size);
+    func(samples, volumes, channels, size);
+
+    if (memcmp(samples, samples_ref, size) != 0) {
+        pa_log_debug("Correctness test failed: format=%s, align=%d, channels=%d",
+                pa_sample_format_to_string(format), align, channels);
+        ck_abort();
+    }
+}
+
 #if defined (__i386__) || defined (__amd64__)
 START_TEST (svolume_mmx_test) {
     pa_do_volume_func_t orig_func, mmx_func;
@@ -154,6 +209,47 @@ START_TEST (svolume_sse_test) {
     run_volume_test(sse_func, orig_func, 7, 3, true, true);
 }
 END_TEST
+
+#ifdef HAVE_AVX2
+START_TEST (svolume_avx2_test) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16RE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    pa_do_volume_func_t orig_func, avx2_func, orig_funcs[PA_ELEMENTSOF(formats)];
+    pa_cpu_x86_flag_t flags = 0;
+    unsigned f;
+    int i, j;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    orig_func = pa_get_volume_func(PA_SAMPLE_S16NE);
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++)
+        orig_funcs[f] = pa_get_volume_func(formats[f]);
+    pa_volume_func_init_avx(flags);
+    avx2_func = pa_get_volume_func(PA_SAMPLE_S16NE);
+
+    pa_log_debug("Checking AVX2 svolume");
+    for (i = 1; i <= 8; i++) {
+        for (j = 0; j < 7; j++)
+            run_volume_test(avx2_func, orig_func, j, i, true, false);
+    }
+    run_volume_test(avx2_func, orig_func, 7, 1, true, true);
+    run_volume_test(avx2_func, orig_func, 7, 2, true, true);
+    run_volume_test(avx2_func, orig_func, 7, 3, true, true);
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        pa_log_debug("Checking AVX2 svolume (%s)", pa_sample_format_to_string(formats[f]));
+        for (i = 1; i <= 8; i++) {
+            for (j = 0; j < 7; j++)
+                run_volume_format_test(pa_get_volume_func(formats[f]), orig_funcs[f], formats[f], j, i);
+        }
+    }
+}
+END_TEST
+#endif /* HAVE_AVX2 */
 #endif /* defined (__i386__) || defined (__amd64__) */
 
 #if defined (__arm__) && defined (__linux__)
@@ -230,6 +326,9 @@ int main(int argc, char *argv[]) {
 #if defined (__i386__) || defined (__amd64__)
     tcase_add_test(tc, svolume_mmx_test);
     tcase_add_test(tc, svolume_sse_test);
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, svolume_avx2_test);
+#endif
 #endif
 #if defined (__arm__) && defined (__linux__)
     tcase_add_test(tc, svolume_arm_test);
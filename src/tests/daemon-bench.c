@@ -0,0 +1,824 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Starts a daemon with module-null-sink (or uses an already running
+ * server), connects a number of synthetic playback and record clients
+ * to it and reports how much CPU the daemon needed per stream, how
+ * many underruns and overruns the clients saw and what latencies they
+ * observed. Meant for spotting scalability regressions, not for
+ * 'make check'. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define SAMPLE_INTERVAL_USEC (20 * PA_USEC_PER_MSEC)
+#define DAEMON_STARTUP_USEC (10 * PA_USEC_PER_SEC)
+
+typedef struct bench_stream {
+    unsigned id;
+    pa_stream_direction_t direction;
+
+    pa_context *context;
+    pa_stream *stream;
+    bool ready;
+
+    uint64_t xruns;
+    uint64_t bytes;
+
+    pa_usec_t *latency;
+    unsigned n_latency, max_latency;
+} bench_stream;
+
+static pa_mainloop *mainloop = NULL;
+static pa_context *control = NULL;
+static pa_time_event *sample_event = NULL;
+
+static bench_stream *streams = NULL;
+static unsigned n_playback = 1, n_record = 0, n_ready = 0;
+
+static pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = 44100,
+    .channels = 2
+};
+
+static pa_usec_t latency_usec = 0, process_usec = 0;
+static bool adjust_latency = false;
+static unsigned seconds = 10;
+
+static char *server = NULL;
+static const char *daemon_binary = "pulseaudio";
+static const char *dl_search_path = NULL;
+static bool disable_shm = false, disable_srbchannel = false, enable_memfd = false;
+
+static pid_t daemon_pid = (pid_t) -1;
+static char *runtime_dir = NULL;
+
+static bool measuring = false;
+static pa_usec_t measure_start = 0, measure_end = 0;
+static double daemon_cpu_start = -1, daemon_cpu = -1;
+static struct rusage client_rusage_start, client_rusage;
+
+static int ret = 1;
+
+static void quit(int r) {
+    ret = r;
+    pa_mainloop_quit(mainloop, r);
+}
+
+/* Returns the user and system CPU time the daemon has used so far, in
+ * seconds, or -1 if that cannot be found out */
+static double get_daemon_cpu(void) {
+#ifdef __linux__
+    char *fn, *t;
+    char buf[1024];
+    unsigned long utime, stime;
+    FILE *f;
+
+    if (daemon_pid == (pid_t) -1)
+        return -1;
+
+    fn = pa_sprintf_malloc("/proc/%lu/stat", (unsigned long) daemon_pid);
+    f = pa_fopen_cloexec(fn, "r");
+    pa_xfree(fn);
+
+    if (!f)
+        return -1;
+
+    if (!fgets(buf, sizeof(buf), f)) {
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+
+    /* The process name may contain spaces, so start after it. utime and
+     * stime are the 14th and 15th fields, the state is the 3rd. */
+    if (!(t = strrchr(buf, ')')))
+        return -1;
+
+    if (sscanf(t + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return -1;
+
+    return (double) (utime + stime) / (double) sysconf(_SC_CLK_TCK);
+#else
+    return -1;
+#endif
+}
+
+static double timeval_to_sec(const struct timeval *tv) {
+    return (double) tv->tv_sec + (double) tv->tv_usec / PA_USEC_PER_SEC;
+}
+
+static int cmp_usec(const void *a, const void *b) {
+    const pa_usec_t *x = a, *y = b;
+
+    return *x < *y ? -1 : (*x > *y ? 1 : 0);
+}
+
+static void print_latency(const char *label, pa_stream_direction_t direction) {
+    pa_usec_t *all;
+    unsigned i, n = 0, count = 0;
+    uint64_t xruns = 0, bytes = 0;
+
+    for (i = 0; i < n_playback + n_record; i++)
+        if (streams[i].direction == direction) {
+            n += streams[i].n_latency;
+            xruns += streams[i].xruns;
+            bytes += streams[i].bytes;
+            count++;
+        }
+
+    if (count == 0)
+        return;
+
+    printf("%s streams: %u, %s: %llu, %0.1f KiB/s\n", label, count,
+           direction == PA_STREAM_PLAYBACK ? "underruns" : "overruns",
+           (unsigned long long) xruns,
+           (double) bytes / 1024.0 / ((double) (measure_end - measure_start) / PA_USEC_PER_SEC));
+
+    if (n == 0) {
+        printf("  no latency samples\n");
+        return;
+    }
+
+    all = pa_xnew(pa_usec_t, n);
+    n = 0;
+
+    for (i = 0; i < n_playback + n_record; i++)
+        if (streams[i].direction == direction) {
+            memcpy(all + n, streams[i].latency, streams[i].n_latency * sizeof(pa_usec_t));
+            n += streams[i].n_latency;
+        }
+
+    qsort(all, n, sizeof(pa_usec_t), cmp_usec);
+
+    printf("  latency (usec): p50 %llu, p90 %llu, p99 %llu, max %llu (%u samples)\n",
+           (unsigned long long) all[n / 2],
+           (unsigned long long) all[(n * 90) / 100],
+           (unsigned long long) all[(n * 99) / 100],
+           (unsigned long long) all[n - 1],
+           n);
+
+    pa_xfree(all);
+}
+
+static void print_io_stats(const pa_io_stats_info *i) {
+    printf("Sink %s: %llu bytes rendered, %llu underruns, %llu rewinds\n",
+           i->name,
+           (unsigned long long) i->bytes,
+           (unsigned long long) i->underruns,
+           (unsigned long long) i->rewinds);
+
+    if (i->render.count > 0)
+        printf("  render (usec): avg %llu, max %llu\n",
+               (unsigned long long) (i->render.total / i->render.count),
+               (unsigned long long) i->render.max);
+
+    if (i->lateness.count > 0)
+        printf("  wakeup lateness (usec): avg %llu, max %llu\n",
+               (unsigned long long) (i->lateness.total / i->lateness.count),
+               (unsigned long long) i->lateness.max);
+}
+
+static void print_results(void) {
+    double wall, client_cpu;
+    unsigned n = n_playback + n_record;
+
+    wall = (double) (measure_end - measure_start) / PA_USEC_PER_SEC;
+
+    printf("Format: %s %uch %uHz, latency %llu usec, process time %llu usec, %s%s%s\n",
+           pa_sample_format_to_string(sample_spec.format),
+           sample_spec.channels,
+           sample_spec.rate,
+           (unsigned long long) latency_usec,
+           (unsigned long long) process_usec,
+           disable_shm ? "no shm" : (enable_memfd ? "memfd" : "posix shm"),
+           disable_srbchannel ? ", no srbchannel" : "",
+           adjust_latency ? ", adjust latency" : "");
+
+    printf("Measured %0.2f s with %u streams\n", wall, n);
+
+    if (daemon_cpu >= 0 && daemon_cpu_start >= 0) {
+        double cpu = (daemon_cpu - daemon_cpu_start) / wall * 100.0;
+
+        printf("Daemon CPU: %0.2f%%, %0.3f%% per stream\n", cpu, cpu / n);
+    } else
+        printf("Daemon CPU: unknown\n");
+
+    client_cpu = timeval_to_sec(&client_rusage.ru_utime) + timeval_to_sec(&client_rusage.ru_stime) -
+        timeval_to_sec(&client_rusage_start.ru_utime) - timeval_to_sec(&client_rusage_start.ru_stime);
+    printf("Client CPU: %0.2f%%, %0.3f%% per stream\n", client_cpu / wall * 100.0, client_cpu / wall * 100.0 / n);
+
+    print_latency("Playback", PA_STREAM_PLAYBACK);
+    print_latency("Record", PA_STREAM_RECORD);
+}
+
+static void io_stats_cb(pa_context *c, const pa_io_stats_info *i, int eol, void *userdata) {
+    if (eol) {
+        quit(0);
+        return;
+    }
+
+    print_io_stats(i);
+}
+
+static void finish(void) {
+    pa_operation *o;
+
+    measure_end = pa_rtclock_now();
+    daemon_cpu = get_daemon_cpu();
+    pa_assert_se(getrusage(RUSAGE_SELF, &client_rusage) == 0);
+    measuring = false;
+
+    print_results();
+
+    /* Sink IO statistics need a server that knows about them */
+    if (pa_context_get_server_protocol_version(control) < 33 ||
+        !(o = pa_context_get_sink_io_stats_list(control, io_stats_cb, NULL))) {
+        quit(0);
+        return;
+    }
+
+    pa_operation_unref(o);
+}
+
+static void sample_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    unsigned i;
+
+    if (pa_rtclock_now() >= measure_start + seconds * PA_USEC_PER_SEC) {
+        finish();
+        return;
+    }
+
+    for (i = 0; i < n_playback + n_record; i++) {
+        bench_stream *s = &streams[i];
+        pa_usec_t usec;
+        int negative = 0;
+
+        if (pa_stream_get_latency(s->stream, &usec, &negative) < 0)
+            continue;
+
+        if (negative)
+            usec = 0;
+
+        if (s->n_latency >= s->max_latency) {
+            s->max_latency = PA_MAX(s->max_latency * 2, 1024U);
+            s->latency = pa_xrenew(pa_usec_t, s->latency, s->max_latency);
+        }
+
+        s->latency[s->n_latency++] = usec;
+    }
+
+    pa_context_rttime_restart(control, e, pa_rtclock_now() + SAMPLE_INTERVAL_USEC);
+}
+
+/* Called once all streams are running. Whatever happened while they
+ * were being set up is not counted. */
+static void start_measuring(void) {
+    unsigned i;
+
+    for (i = 0; i < n_playback + n_record; i++) {
+        streams[i].xruns = 0;
+        streams[i].bytes = 0;
+        streams[i].n_latency = 0;
+    }
+
+    daemon_cpu_start = get_daemon_cpu();
+    pa_assert_se(getrusage(RUSAGE_SELF, &client_rusage_start) == 0);
+    measure_start = pa_rtclock_now();
+    measuring = true;
+
+    pa_log_info("All %u streams running, measuring for %u s", n_playback + n_record, seconds);
+
+    sample_event = pa_context_rttime_new(control, measure_start + SAMPLE_INTERVAL_USEC, sample_cb, NULL);
+}
+
+static void stream_write_cb(pa_stream *p, size_t nbytes, void *userdata) {
+    bench_stream *s = userdata;
+
+    while (nbytes > 0) {
+        void *data;
+        size_t n = nbytes;
+
+        if (pa_stream_begin_write(p, &data, &n) < 0) {
+            pa_log("pa_stream_begin_write() failed: %s", pa_strerror(pa_context_errno(s->context)));
+            quit(1);
+            return;
+        }
+
+        memset(data, 0, n);
+
+        if (pa_stream_write(p, data, n, NULL, 0, PA_SEEK_RELATIVE) < 0) {
+            pa_log("pa_stream_write() failed: %s", pa_strerror(pa_context_errno(s->context)));
+            quit(1);
+            return;
+        }
+
+        s->bytes += n;
+        nbytes -= n;
+    }
+}
+
+static void stream_read_cb(pa_stream *p, size_t nbytes, void *userdata) {
+    bench_stream *s = userdata;
+
+    while (pa_stream_readable_size(p) > 0) {
+        const void *data;
+        size_t n;
+
+        if (pa_stream_peek(p, &data, &n) < 0) {
+            pa_log("pa_stream_peek() failed: %s", pa_strerror(pa_context_errno(s->context)));
+            quit(1);
+            return;
+        }
+
+        if (n == 0)
+            break;
+
+        s->bytes += n;
+        pa_stream_drop(p);
+    }
+}
+
+static void stream_xrun_cb(pa_stream *p, void *userdata) {
+    bench_stream *s = userdata;
+
+    if (measuring)
+        s->xruns++;
+}
+
+static void stream_state_cb(pa_stream *p, void *userdata) {
+    bench_stream *s = userdata;
+
+    switch (pa_stream_get_state(p)) {
+        case PA_STREAM_UNCONNECTED:
+        case PA_STREAM_CREATING:
+        case PA_STREAM_TERMINATED:
+            break;
+
+        case PA_STREAM_READY:
+            if (!s->ready) {
+                s->ready = true;
+
+                if (++n_ready == n_playback + n_record)
+                    start_measuring();
+            }
+            break;
+
+        case PA_STREAM_FAILED:
+        default:
+            pa_log("Stream %u failed: %s", s->id, pa_strerror(pa_context_errno(s->context)));
+            quit(1);
+    }
+}
+
+static void client_state_cb(pa_context *c, void *userdata) {
+    bench_stream *s = userdata;
+    pa_buffer_attr attr;
+    pa_stream_flags_t flags;
+    char name[64];
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_CONNECTING:
+        case PA_CONTEXT_AUTHORIZING:
+        case PA_CONTEXT_SETTING_NAME:
+        case PA_CONTEXT_TERMINATED:
+            break;
+
+        case PA_CONTEXT_READY:
+            pa_snprintf(name, sizeof(name), "bench %s #%u",
+                        s->direction == PA_STREAM_PLAYBACK ? "playback" : "record", s->id);
+            pa_assert_se(s->stream = pa_stream_new(c, name, &sample_spec, NULL));
+
+            pa_stream_set_state_callback(s->stream, stream_state_cb, s);
+
+            attr.maxlength = (uint32_t) -1;
+            attr.prebuf = (uint32_t) -1;
+            attr.tlength = latency_usec > 0 ? (uint32_t) pa_usec_to_bytes(latency_usec, &sample_spec) : (uint32_t) -1;
+            attr.fragsize = attr.tlength;
+            attr.minreq = process_usec > 0 ? (uint32_t) pa_usec_to_bytes(process_usec, &sample_spec) : (uint32_t) -1;
+
+            flags = PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE;
+            if (adjust_latency)
+                flags |= PA_STREAM_ADJUST_LATENCY;
+
+            if (s->direction == PA_STREAM_PLAYBACK) {
+                pa_stream_set_write_callback(s->stream, stream_write_cb, s);
+                pa_stream_set_underflow_callback(s->stream, stream_xrun_cb, s);
+
+                if (pa_stream_connect_playback(s->stream, NULL, &attr, flags, NULL, NULL) < 0) {
+                    pa_log("pa_stream_connect_playback() failed: %s", pa_strerror(pa_context_errno(c)));
+                    quit(1);
+                }
+            } else {
+                pa_stream_set_read_callback(s->stream, stream_read_cb, s);
+                pa_stream_set_overflow_callback(s->stream, stream_xrun_cb, s);
+
+                if (pa_stream_connect_record(s->stream, NULL, &attr, flags) < 0) {
+                    pa_log("pa_stream_connect_record() failed: %s", pa_strerror(pa_context_errno(c)));
+                    quit(1);
+                }
+            }
+            break;
+
+        case PA_CONTEXT_FAILED:
+        default:
+            pa_log("Client %u failed: %s", s->id, pa_strerror(pa_context_errno(c)));
+            quit(1);
+    }
+}
+
+/* Every stream gets its own connection, so that the daemon sees as many
+ * clients as there are streams */
+static void start_clients(void) {
+    unsigned i;
+
+    streams = pa_xnew0(bench_stream, n_playback + n_record);
+
+    for (i = 0; i < n_playback + n_record; i++) {
+        bench_stream *s = &streams[i];
+
+        s->id = i;
+        s->direction = i < n_playback ? PA_STREAM_PLAYBACK : PA_STREAM_RECORD;
+
+        pa_assert_se(s->context = pa_context_new(pa_mainloop_get_api(mainloop), "daemon-bench client"));
+        pa_context_set_state_callback(s->context, client_state_cb, s);
+
+        if (pa_context_connect(s->context, server, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
+            pa_log("pa_context_connect() failed: %s", pa_strerror(pa_context_errno(s->context)));
+            quit(1);
+            return;
+        }
+    }
+}
+
+static void control_state_cb(pa_context *c, void *userdata) {
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_CONNECTING:
+        case PA_CONTEXT_AUTHORIZING:
+        case PA_CONTEXT_SETTING_NAME:
+        case PA_CONTEXT_TERMINATED:
+            break;
+
+        case PA_CONTEXT_READY:
+            start_clients();
+            break;
+
+        case PA_CONTEXT_FAILED:
+        default:
+            pa_log("Connection failed: %s", pa_strerror(pa_context_errno(c)));
+            quit(1);
+    }
+}
+
+static int start_daemon(void) {
+    char *socket_path, *load_sink, *load_native, *shm, *memfd, *dl = NULL;
+    char template[] = "/tmp/pulse-bench-XXXXXX";
+    pa_usec_t until;
+    struct stat st;
+
+    if (!mkdtemp(template)) {
+        pa_log("mkdtemp() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    runtime_dir = pa_xstrdup(template);
+    socket_path = pa_sprintf_malloc("%s/native", runtime_dir);
+    server = pa_sprintf_malloc("unix:%s", socket_path);
+
+    load_sink = pa_sprintf_malloc("--load=module-null-sink rate=%u", sample_spec.rate);
+    load_native = pa_sprintf_malloc("--load=module-native-protocol-unix socket=%s auth-anonymous=1 srbchannel=%s",
+                                    socket_path, pa_yes_no(!disable_srbchannel));
+    shm = pa_sprintf_malloc("--disable-shm=%s", pa_yes_no(disable_shm));
+    memfd = pa_sprintf_malloc("--enable-memfd=%s", pa_yes_no(enable_memfd));
+    if (dl_search_path)
+        dl = pa_sprintf_malloc("--dl-search-path=%s", dl_search_path);
+
+    if ((daemon_pid = fork()) < 0) {
+        pa_log("fork() failed: %s", pa_cstrerror(errno));
+        daemon_pid = (pid_t) -1;
+        goto fail;
+    }
+
+    if (daemon_pid == 0) {
+        /* Child */
+        setenv("PULSE_RUNTIME_PATH", runtime_dir, 1);
+
+        execlp(daemon_binary, daemon_binary,
+               "-n",
+               "--daemonize=no",
+               "--use-pid-file=no",
+               "--exit-idle-time=-1",
+               "--log-target=stderr",
+               "--log-level=error",
+               shm, memfd, load_sink, load_native, dl,
+               NULL);
+
+        fprintf(stderr, "Failed to execute %s: %s\n", daemon_binary, pa_cstrerror(errno));
+        _exit(1);
+    }
+
+    /* Wait for the daemon to set up its socket */
+    until = pa_rtclock_now() + DAEMON_STARTUP_USEC;
+    while (stat(socket_path, &st) < 0) {
+        if (waitpid(daemon_pid, NULL, WNOHANG) == daemon_pid) {
+            pa_log("%s exited during startup", daemon_binary);
+            daemon_pid = (pid_t) -1;
+            goto fail;
+        }
+
+        if (pa_rtclock_now() >= until) {
+            pa_log("Timed out waiting for %s", socket_path);
+            goto fail;
+        }
+
+        pa_msleep(10);
+    }
+
+    pa_xfree(socket_path);
+    pa_xfree(load_sink);
+    pa_xfree(load_native);
+    pa_xfree(shm);
+    pa_xfree(memfd);
+    pa_xfree(dl);
+
+    return 0;
+
+fail:
+    pa_xfree(socket_path);
+    pa_xfree(load_sink);
+    pa_xfree(load_native);
+    pa_xfree(shm);
+    pa_xfree(memfd);
+    pa_xfree(dl);
+
+    return -1;
+}
+
+static void stop_daemon(void) {
+    if (daemon_pid != (pid_t) -1) {
+        kill(daemon_pid, SIGTERM);
+        waitpid(daemon_pid, NULL, 0);
+        daemon_pid = (pid_t) -1;
+    }
+
+    if (runtime_dir) {
+        if (rmdir(runtime_dir) < 0)
+            pa_log_debug("Failed to remove %s: %s", runtime_dir, pa_cstrerror(errno));
+
+        pa_xfree(runtime_dir);
+        runtime_dir = NULL;
+    }
+}
+
+static void help(const char *argv0) {
+    printf("%s [options]\n\n"
+           "-h, --help                            Show this help\n"
+           "-v, --verbose                         Print debug messages\n"
+           "  -p, --playback=STREAMS              Number of playback streams (defaults to 1)\n"
+           "  -r, --record=STREAMS                Number of record streams (defaults to 0)\n"
+           "      --seconds=SECONDS               How long to measure (defaults to 10)\n"
+           "      --format=SAMPLEFORMAT           Sample type of the streams (defaults to s16ne)\n"
+           "      --rate=SAMPLERATE               Sample rate in Hz (defaults to 44100)\n"
+           "      --channels=CHANNELS             Number of channels (defaults to 2)\n"
+           "      --latency-msec=MSEC             Requested latency, used for tlength and fragsize\n"
+           "      --process-msec=MSEC             Requested process time, used for minreq\n"
+           "      --adjust-latency                Use PA_STREAM_ADJUST_LATENCY\n"
+           "      --disable-shm                   Start the daemon without shared memory support\n"
+           "      --enable-memfd                  Start the daemon with memfd shared memory support\n"
+           "      --disable-srbchannel            Start the daemon without srbchannel support\n"
+           "      --daemon=BINARY                 Daemon to start (defaults to pulseaudio)\n"
+           "      --dl-search-path=PATH           Where the daemon looks for modules\n"
+           "  -s, --server=SERVER                 Use an already running server instead of\n"
+           "                                      starting one. The daemon options and the\n"
+           "                                      daemon CPU usage are then not available\n",
+           argv0);
+}
+
+enum {
+    ARG_VERSION = 256,
+    ARG_SECONDS,
+    ARG_FORMAT,
+    ARG_RATE,
+    ARG_CHANNELS,
+    ARG_LATENCY_MSEC,
+    ARG_PROCESS_MSEC,
+    ARG_ADJUST_LATENCY,
+    ARG_DISABLE_SHM,
+    ARG_ENABLE_MEMFD,
+    ARG_DISABLE_SRBCHANNEL,
+    ARG_DAEMON,
+    ARG_DL_SEARCH_PATH
+};
+
+int main(int argc, char *argv[]) {
+    int c;
+    unsigned i;
+
+    static const struct option long_options[] = {
+        {"help",                  0, NULL, 'h'},
+        {"verbose",               0, NULL, 'v'},
+        {"version",               0, NULL, ARG_VERSION},
+        {"playback",              1, NULL, 'p'},
+        {"record",                1, NULL, 'r'},
+        {"server",                1, NULL, 's'},
+        {"seconds",               1, NULL, ARG_SECONDS},
+        {"format",                1, NULL, ARG_FORMAT},
+        {"rate",                  1, NULL, ARG_RATE},
+        {"channels",              1, NULL, ARG_CHANNELS},
+        {"latency-msec",          1, NULL, ARG_LATENCY_MSEC},
+        {"process-msec",          1, NULL, ARG_PROCESS_MSEC},
+        {"adjust-latency",        0, NULL, ARG_ADJUST_LATENCY},
+        {"disable-shm",           0, NULL, ARG_DISABLE_SHM},
+        {"enable-memfd",          0, NULL, ARG_ENABLE_MEMFD},
+        {"disable-srbchannel",    0, NULL, ARG_DISABLE_SRBCHANNEL},
+        {"daemon",                1, NULL, ARG_DAEMON},
+        {"dl-search-path",        1, NULL, ARG_DL_SEARCH_PATH},
+        {NULL,                    0, NULL, 0}
+    };
+
+    pa_log_set_level(PA_LOG_INFO);
+
+    while ((c = getopt_long(argc, argv, "hvp:r:s:", long_options, NULL)) != -1) {
+
+        switch (c) {
+            case 'h':
+                help(argv[0]);
+                return 0;
+
+            case 'v':
+                pa_log_set_level(PA_LOG_DEBUG);
+                break;
+
+            case ARG_VERSION:
+                printf("%s %s\n", argv[0], PACKAGE_VERSION);
+                return 0;
+
+            case 'p':
+                n_playback = (unsigned) atoi(optarg);
+                break;
+
+            case 'r':
+                n_record = (unsigned) atoi(optarg);
+                break;
+
+            case 's':
+                pa_xfree(server);
+                server = pa_xstrdup(optarg);
+                break;
+
+            case ARG_SECONDS:
+                seconds = (unsigned) atoi(optarg);
+                break;
+
+            case ARG_FORMAT:
+                sample_spec.format = pa_parse_sample_format(optarg);
+                break;
+
+            case ARG_RATE:
+                sample_spec.rate = (uint32_t) atoi(optarg);
+                break;
+
+            case ARG_CHANNELS:
+                sample_spec.channels = (uint8_t) atoi(optarg);
+                break;
+
+            case ARG_LATENCY_MSEC:
+                latency_usec = (pa_usec_t) atoi(optarg) * PA_USEC_PER_MSEC;
+                break;
+
+            case ARG_PROCESS_MSEC:
+                process_usec = (pa_usec_t) atoi(optarg) * PA_USEC_PER_MSEC;
+                break;
+
+            case ARG_ADJUST_LATENCY:
+                adjust_latency = true;
+                break;
+
+            case ARG_DISABLE_SHM:
+                disable_shm = true;
+                break;
+
+            case ARG_ENABLE_MEMFD:
+                enable_memfd = true;
+                break;
+
+            case ARG_DISABLE_SRBCHANNEL:
+                disable_srbchannel = true;
+                break;
+
+            case ARG_DAEMON:
+                daemon_binary = optarg;
+                break;
+
+            case ARG_DL_SEARCH_PATH:
+                dl_search_path = optarg;
+                break;
+
+            default:
+                return 1;
+        }
+    }
+
+    if (!pa_sample_spec_valid(&sample_spec)) {
+        pa_log("Invalid sample specification.");
+        return 1;
+    }
+
+    if (n_playback + n_record == 0) {
+        pa_log("No streams to run.");
+        return 1;
+    }
+
+    if (seconds == 0) {
+        pa_log("Invalid measurement time.");
+        return 1;
+    }
+
+    if (!server && start_daemon() < 0)
+        goto quit;
+
+    pa_assert_se(mainloop = pa_mainloop_new());
+
+    pa_assert_se(control = pa_context_new(pa_mainloop_get_api(mainloop), "daemon-bench"));
+    pa_context_set_state_callback(control, control_state_cb, NULL);
+
+    if (pa_context_connect(control, server, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
+        pa_log("pa_context_connect() failed: %s", pa_strerror(pa_context_errno(control)));
+        goto quit;
+    }
+
+    pa_mainloop_run(mainloop, NULL);
+
+quit:
+    if (streams) {
+        for (i = 0; i < n_playback + n_record; i++) {
+            if (streams[i].stream) {
+                pa_stream_disconnect(streams[i].stream);
+                pa_stream_unref(streams[i].stream);
+            }
+
+            if (streams[i].context) {
+                pa_context_disconnect(streams[i].context);
+                pa_context_unref(streams[i].context);
+            }
+
+            pa_xfree(streams[i].latency);
+        }
+
+        pa_xfree(streams);
+    }
+
+    if (control) {
+        if (sample_event)
+            pa_mainloop_get_api(mainloop)->time_free(sample_event);
+
+        pa_context_disconnect(control);
+        pa_context_unref(control);
+    }
+
+    if (mainloop)
+        pa_mainloop_free(mainloop);
+
+    stop_daemon();
+    pa_xfree(server);
+
+    return ret;
+}
@@ -0,0 +1,270 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/database.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+static char *dir = NULL, *base = NULL, *path = NULL;
+
+static void setup(void) {
+    char template[] = "/tmp/pa-database-test-XXXXXX";
+
+    fail_unless(mkdtemp(template) != NULL);
+    dir = pa_xstrdup(template);
+    base = pa_sprintf_malloc("%s/db", dir);
+    path = pa_sprintf_malloc("%s."CANONICAL_HOST".journal", base);
+}
+
+static void teardown(void) {
+    char *tmp = pa_sprintf_malloc("%s.tmp", path);
+
+    unlink(tmp);
+    unlink(path);
+    rmdir(dir);
+
+    pa_xfree(tmp);
+    pa_xfree(path);
+    pa_xfree(base);
+    pa_xfree(dir);
+}
+
+static void set(pa_database *db, const char *k, const char *v) {
+    pa_datum key, data;
+
+    key.data = (void*) k;
+    key.size = strlen(k);
+    data.data = (void*) v;
+    data.size = strlen(v);
+
+    fail_unless(pa_database_set(db, &key, &data, true) == 0);
+}
+
+static bool has(pa_database *db, const char *k, const char *v) {
+    pa_datum key, data;
+    bool r;
+
+    key.data = (void*) k;
+    key.size = strlen(k);
+
+    if (!pa_database_get(db, &key, &data))
+        return false;
+
+    r = data.size == strlen(v) && memcmp(data.data, v, data.size) == 0;
+    pa_datum_free(&data);
+
+    return r;
+}
+
+static off_t file_size(void) {
+    struct stat st;
+
+    fail_unless(stat(path, &st) == 0);
+    return st.st_size;
+}
+
+START_TEST (journal_test) {
+    pa_database *db;
+    pa_datum key;
+
+    setup();
+
+    fail_unless((db = pa_database_open(base, true)) != NULL);
+    set(db, "a", "1");
+    set(db, "b", "2");
+    set(db, "c", "3");
+    fail_unless(pa_database_sync(db) == 0);
+
+    set(db, "a", "4");
+    key.data = (void*) "b";
+    key.size = 1;
+    fail_unless(pa_database_unset(db, &key) == 0);
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(base, false)) != NULL);
+    fail_unless(pa_database_size(db) == 2);
+    fail_unless(has(db, "a", "4"));
+    fail_unless(!has(db, "b", "2"));
+    fail_unless(has(db, "c", "3"));
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(base, true)) != NULL);
+    pa_database_clear(db);
+    set(db, "d", "5");
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(base, false)) != NULL);
+    fail_unless(pa_database_size(db) == 1);
+    fail_unless(has(db, "d", "5"));
+    pa_database_close(db);
+
+    teardown();
+}
+END_TEST
+
+START_TEST (journal_recovery_test) {
+    pa_database *db;
+    FILE *f;
+    off_t size;
+
+    setup();
+
+    fail_unless((db = pa_database_open(base, true)) != NULL);
+    set(db, "a", "1");
+    set(db, "b", "2");
+    pa_database_close(db);
+
+    size = file_size();
+
+    /* What a crash while appending a record could leave behind */
+    fail_unless((f = fopen(path, "a")) != NULL);
+    fail_unless(fwrite("\001\001\000\000\000\005\000", 7, 1, f) == 1);
+    fclose(f);
+
+    fail_unless((db = pa_database_open(base, true)) != NULL);
+    fail_unless(pa_database_size(db) == 2);
+    fail_unless(has(db, "a", "1"));
+    fail_unless(has(db, "b", "2"));
+
+    /* The damaged record must be gone, or this would be lost */
+    fail_unless(file_size() == size);
+    set(db, "c", "3");
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(base, false)) != NULL);
+    fail_unless(pa_database_size(db) == 3);
+    fail_unless(has(db, "c", "3"));
+    pa_database_close(db);
+
+    /* A flipped bit is detected too */
+    fail_unless((f = fopen(path, "r+")) != NULL);
+    fail_unless(fseek(f, -6, SEEK_END) == 0);
+    fputc('x', f);
+    fclose(f);
+
+    fail_unless((db = pa_database_open(base, false)) != NULL);
+    fail_unless(pa_database_size(db) == 2);
+    fail_unless(!has(db, "c", "3"));
+    pa_database_close(db);
+
+    teardown();
+}
+END_TEST
+
+START_TEST (journal_compact_test) {
+    pa_database *db;
+    char value[64];
+    unsigned i;
+
+    setup();
+
+    fail_unless((db = pa_database_open(base, true)) != NULL);
+
+    for (i = 0; i < 10000; i++) {
+        pa_snprintf(value, sizeof(value), "volume-%u", i);
+        set(db, "stream", value);
+        set(db, "other", "x");
+        fail_unless(pa_database_sync(db) == 0);
+    }
+
+    pa_database_close(db);
+
+    /* Without compaction this would be several hundred kB */
+    fail_unless(file_size() < 128 * 1024);
+
+    fail_unless((db = pa_database_open(base, false)) != NULL);
+    fail_unless(pa_database_size(db) == 2);
+    fail_unless(has(db, "stream", "volume-9999"));
+    fail_unless(has(db, "other", "x"));
+    pa_database_close(db);
+
+    teardown();
+}
+END_TEST
+
+/* Changes synced while a compaction is running must reach the disk too,
+ * the only change that may be missing is the one in the snapshot that
+ * is still being written */
+START_TEST (journal_sync_while_compacting_test) {
+    pa_database *db, *reader;
+    char value[256], previous[256];
+    unsigned i;
+
+    setup();
+
+    fail_unless((db = pa_database_open(base, true)) != NULL);
+    previous[0] = 0;
+
+    for (i = 0; i < 2000; i++) {
+        pa_snprintf(value, sizeof(value), "%0200u", i);
+        set(db, "stream", value);
+        fail_unless(pa_database_sync(db) == 0);
+
+        fail_unless((reader = pa_database_open(base, false)) != NULL);
+        fail_unless(has(reader, "stream", value) || (i > 0 && has(reader, "stream", previous)));
+        pa_database_close(reader);
+
+        memcpy(previous, value, sizeof(value));
+    }
+
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(base, false)) != NULL);
+    fail_unless(has(db, "stream", value));
+    pa_database_close(db);
+
+    teardown();
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Database Journal");
+    tc = tcase_create("database-journal");
+    tcase_add_test(tc, journal_test);
+    tcase_add_test(tc, journal_recovery_test);
+    tcase_add_test(tc, journal_compact_test);
+    tcase_add_test(tc, journal_sync_while_compacting_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
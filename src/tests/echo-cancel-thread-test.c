@@ -0,0 +1,362 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+#include <string.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/util.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core.h>
+#include <pulsecore/dynarray.h>
+#include <pulsecore/hook-list.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/module.h>
+#include <pulsecore/namereg.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/source.h>
+#include <pulsecore/source-output.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* The module is built into this test */
+#include "module-echo-cancel-symdef.h"
+
+/* Loads and unloads module-echo-cancel with aec_thread=yes while audio is
+ * flowing, so that the canceller thread is busy when it is shut down */
+
+#define FRAMES 480
+#define LOOPS 5
+
+#define MODULE_ARGS "source_master=test_source sink_master=test_sink " \
+                    "source_name=ec_source sink_name=ec_sink " \
+                    "aec_method=null aec_thread=yes"
+
+enum {
+    SOURCE_MESSAGE_POST = PA_SOURCE_MESSAGE_MAX
+};
+
+/* The module asks the sink for a snapshot from the source's thread and
+ * waits for it, so the two need threads of their own */
+struct io_thread {
+    pa_rtpoll *rtpoll;
+    pa_thread_mq thread_mq;
+    pa_thread *thread;
+};
+
+struct recording {
+    size_t length;
+    bool non_silent;
+};
+
+static pa_mainloop *mainloop;
+static pa_core *core;
+static struct io_thread source_thread, sink_thread;
+static pa_source *source;
+static pa_sink *sink;
+static unsigned n_posted;
+
+static const pa_sample_spec master_ss = { PA_SAMPLE_S16NE, 48000, 2 };
+
+static void thread_func(void *userdata) {
+    struct io_thread *t = userdata;
+
+    pa_thread_mq_install(&t->thread_mq);
+
+    while (pa_rtpoll_run(t->rtpoll) > 0)
+        ;
+}
+
+static void io_thread_init(struct io_thread *t) {
+    t->rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&t->thread_mq, core->mainloop, t->rtpoll);
+}
+
+static void io_thread_start(struct io_thread *t) {
+    t->thread = pa_thread_new("test-master", thread_func, t);
+    fail_unless(t->thread != NULL);
+}
+
+static void io_thread_done(struct io_thread *t) {
+    pa_asyncmsgq_send(t->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(t->thread);
+    pa_thread_mq_done(&t->thread_mq);
+    pa_rtpoll_free(t->rtpoll);
+}
+
+static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    switch (code) {
+        case SOURCE_MESSAGE_POST:
+            pa_source_post(PA_SOURCE(o), chunk);
+            return 0;
+
+        case PA_SOURCE_MESSAGE_GET_LATENCY:
+            *((pa_usec_t*) data) = 0;
+            return 0;
+    }
+
+    return pa_source_process_msg(o, code, data, offset, chunk);
+}
+
+static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    if (code == PA_SINK_MESSAGE_GET_LATENCY) {
+        *((pa_usec_t*) data) = 0;
+        return 0;
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+static void masters_init(void) {
+    pa_source_new_data source_data;
+    pa_sink_new_data sink_data;
+
+    mainloop = pa_mainloop_new();
+    fail_unless(mainloop != NULL);
+    core = pa_core_new(pa_mainloop_get_api(mainloop), false, false, 0);
+    fail_unless(core != NULL);
+
+    io_thread_init(&source_thread);
+    io_thread_init(&sink_thread);
+
+    pa_source_new_data_init(&source_data);
+    source_data.driver = __FILE__;
+    pa_source_new_data_set_name(&source_data, "test_source");
+    pa_source_new_data_set_sample_spec(&source_data, &master_ss);
+    source = pa_source_new(core, &source_data, 0);
+    pa_source_new_data_done(&source_data);
+    fail_unless(source != NULL);
+
+    source->parent.process_msg = source_process_msg;
+    pa_source_set_asyncmsgq(source, source_thread.thread_mq.inq);
+    pa_source_set_rtpoll(source, source_thread.rtpoll);
+
+    pa_sink_new_data_init(&sink_data);
+    sink_data.driver = __FILE__;
+    pa_sink_new_data_set_name(&sink_data, "test_sink");
+    pa_sink_new_data_set_sample_spec(&sink_data, &master_ss);
+    sink = pa_sink_new(core, &sink_data, 0);
+    pa_sink_new_data_done(&sink_data);
+    fail_unless(sink != NULL);
+
+    sink->parent.process_msg = sink_process_msg;
+    pa_sink_set_asyncmsgq(sink, sink_thread.thread_mq.inq);
+    pa_sink_set_rtpoll(sink, sink_thread.rtpoll);
+
+    io_thread_start(&source_thread);
+    io_thread_start(&sink_thread);
+
+    pa_source_put(source);
+    pa_sink_put(sink);
+    n_posted = 0;
+}
+
+static void masters_done(void) {
+    pa_source_unlink(source);
+    pa_sink_unlink(sink);
+
+    io_thread_done(&source_thread);
+    io_thread_done(&sink_thread);
+
+    pa_source_unref(source);
+    pa_sink_unref(sink);
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+}
+
+/* Posts a chunk of a square wave to the master source */
+static void post_chunk(void) {
+    pa_memchunk chunk;
+    int16_t *d;
+    unsigned i;
+
+    chunk.memblock = pa_memblock_new(core->mempool, FRAMES * pa_frame_size(&master_ss));
+    chunk.index = 0;
+    chunk.length = pa_memblock_get_length(chunk.memblock);
+
+    d = pa_memblock_acquire(chunk.memblock);
+    for (i = 0; i < FRAMES; i++)
+        d[2 * i] = d[2 * i + 1] = ((n_posted * FRAMES + i) / 50) % 2 ? 10000 : -10000;
+    pa_memblock_release(chunk.memblock);
+
+    pa_assert_se(pa_asyncmsgq_send(source->asyncmsgq, PA_MSGOBJECT(source), SOURCE_MESSAGE_POST, NULL, 0, &chunk) == 0);
+    pa_memblock_unref(chunk.memblock);
+
+    n_posted++;
+}
+
+static void post(void) {
+    post_chunk();
+
+    /* Let the main thread handle what the module sent to it */
+    while (pa_mainloop_iterate(mainloop, 0, NULL) > 0)
+        ;
+}
+
+/* Keeps the capture going, like a real source would, while the main
+ * thread unloads the module */
+static void feeder_func(void *userdata) {
+    pa_atomic_t *stop = userdata;
+
+    while (!pa_atomic_load(stop))
+        post_chunk();
+}
+
+static void output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
+    struct recording *r = o->userdata;
+    const int16_t *d;
+    size_t i;
+
+    d = (const int16_t *) ((uint8_t *) pa_memblock_acquire(chunk->memblock) + chunk->index);
+    for (i = 0; i < chunk->length / sizeof(int16_t); i++)
+        if (d[i] != 0)
+            r->non_silent = true;
+    pa_memblock_release(chunk->memblock);
+
+    r->length += chunk->length;
+}
+
+static void output_kill_cb(pa_source_output *o) {
+    ck_abort();
+}
+
+static pa_source_output *output_new(pa_source *s, struct recording *r) {
+    pa_source_output_new_data data;
+    pa_source_output *o = NULL;
+
+    pa_source_output_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_source_output_new_data_set_source(&data, s, false);
+    pa_source_output_new_data_set_sample_spec(&data, &s->sample_spec);
+    pa_source_output_new_data_set_channel_map(&data, &s->channel_map);
+    pa_assert_se(pa_source_output_new(&o, core, &data) == 0);
+    pa_source_output_new_data_done(&data);
+
+    o->push = output_push_cb;
+    o->kill = output_kill_cb;
+    o->userdata = r;
+    pa_source_output_put(o);
+
+    return o;
+}
+
+static void module_free(pa_module *m) {
+    pa_xfree(m->name);
+    pa_xfree(m->argument);
+    pa_proplist_free(m->proplist);
+    pa_dynarray_free(m->hooks);
+    pa_xfree(m);
+}
+
+/* What pa_module_load() would do, minus finding the module */
+static pa_module *module_load(const char *args) {
+    pa_module *m;
+
+    m = pa_xnew0(pa_module, 1);
+    m->core = core;
+    m->name = pa_xstrdup("module-echo-cancel");
+    m->argument = pa_xstrdup(args);
+    m->index = PA_IDXSET_INVALID;
+    m->proplist = pa_proplist_new();
+    m->hooks = pa_dynarray_new((pa_free_cb_t) pa_hook_slot_free);
+
+    if (pa__init(m) < 0) {
+        module_free(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+static void module_unload(pa_module *m) {
+    pa__done(m);
+    module_free(m);
+}
+
+START_TEST (echo_cancel_thread_test) {
+    unsigned i, j;
+
+    masters_init();
+
+    for (i = 0; i < LOOPS; i++) {
+        struct recording r = { 0, false };
+        pa_source_output *o;
+        pa_source *ec;
+        pa_module *m;
+        pa_thread *feeder;
+        pa_atomic_t stop;
+
+        fail_unless((m = module_load(MODULE_ARGS)) != NULL);
+        fail_unless((ec = pa_namereg_get(core, "ec_source", PA_NAMEREG_SOURCE)) != NULL);
+
+        o = output_new(ec, &r);
+
+        /* The cancelled audio has to come through the canceller thread */
+        for (j = 0; j < 1000 && !r.non_silent; j++) {
+            post();
+            pa_msleep(1);
+        }
+        fail_unless(r.non_silent);
+
+        /* Unload while the canceller thread still has work */
+        pa_atomic_store(&stop, 0);
+        fail_unless((feeder = pa_thread_new("test-feeder", feeder_func, &stop)) != NULL);
+
+        pa_source_output_unlink(o);
+        pa_source_output_unref(o);
+
+        module_unload(m);
+
+        pa_atomic_store(&stop, 1);
+        pa_thread_free(feeder);
+        fail_unless(pa_namereg_get(core, "ec_source", PA_NAMEREG_SOURCE) == NULL);
+    }
+
+    masters_done();
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Echo cancel thread");
+    tc = tcase_create("echo-cancel-thread");
+    tcase_add_test(tc, echo_cancel_thread_test);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
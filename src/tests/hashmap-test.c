@@ -0,0 +1,226 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+#include <stdio.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "runtime-test-util.h"
+
+#define N_KEYS 10000
+
+static char *keys[N_KEYS];
+
+static void make_keys(void) {
+    unsigned i;
+
+    for (i = 0; i < N_KEYS; i++)
+        keys[i] = pa_sprintf_malloc("application.process.key-%u", i);
+}
+
+static void free_keys(void) {
+    unsigned i;
+
+    for (i = 0; i < N_KEYS; i++)
+        pa_xfree(keys[i]);
+}
+
+START_TEST (hashmap_test) {
+    pa_hashmap *h;
+    void *state;
+    const void *key;
+    void *value;
+    unsigned i, n;
+
+    make_keys();
+
+    h = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    for (i = 0; i < N_KEYS; i++)
+        fail_unless(pa_hashmap_put(h, keys[i], PA_UINT_TO_PTR(i + 1)) == 0);
+
+    fail_unless(pa_hashmap_put(h, keys[7], NULL) < 0);
+    fail_unless(pa_hashmap_size(h) == N_KEYS);
+
+    for (i = 0; i < N_KEYS; i++)
+        fail_unless(pa_hashmap_get(h, keys[i]) == PA_UINT_TO_PTR(i + 1));
+
+    fail_unless(pa_hashmap_get(h, "does-not-exist") == NULL);
+
+    /* remove every third key, the rest has to stay in insertion order */
+    for (i = 0; i < N_KEYS; i += 3)
+        fail_unless(pa_hashmap_remove(h, keys[i]) == PA_UINT_TO_PTR(i + 1));
+
+    for (i = 0; i < N_KEYS; i++)
+        fail_unless(pa_hashmap_get(h, keys[i]) == (i % 3 ? PA_UINT_TO_PTR(i + 1) : NULL));
+
+    n = 0;
+    PA_HASHMAP_FOREACH_KV(key, value, h, state) {
+        unsigned v = PA_PTR_TO_UINT(value) - 1;
+
+        fail_unless(v > n || n == 0);
+        fail_unless(v % 3 != 0);
+        fail_unless(key == keys[v]);
+        n = v;
+    }
+
+    /* removing the current entry while iterating is allowed */
+    n = 0;
+    PA_HASHMAP_FOREACH_KV(key, value, h, state) {
+        if (PA_PTR_TO_UINT(value) % 2)
+            pa_hashmap_remove(h, key);
+        n++;
+    }
+
+    fail_unless(n == N_KEYS - (N_KEYS + 2) / 3);
+
+    PA_HASHMAP_FOREACH(value, h, state)
+        fail_unless(PA_PTR_TO_UINT(value) % 2 == 0);
+
+    while ((value = pa_hashmap_steal_first(h)))
+        fail_unless(pa_hashmap_get(h, keys[PA_PTR_TO_UINT(value) - 1]) == NULL);
+
+    fail_unless(pa_hashmap_isempty(h));
+
+    /* the table has to keep working after shrinking all the way */
+    for (i = 0; i < 10; i++)
+        fail_unless(pa_hashmap_put(h, keys[i], PA_UINT_TO_PTR(i + 1)) == 0);
+    for (i = 0; i < 10; i++)
+        fail_unless(pa_hashmap_get(h, keys[i]) == PA_UINT_TO_PTR(i + 1));
+
+    pa_hashmap_free(h);
+    free_keys();
+}
+END_TEST
+
+START_TEST (idxset_test) {
+    pa_idxset *s;
+    uint32_t idx, i;
+    void *data;
+
+    s = pa_idxset_new(NULL, NULL);
+
+    for (i = 0; i < N_KEYS; i++) {
+        fail_unless(pa_idxset_put(s, PA_UINT_TO_PTR(i * 16 + 16), &idx) == 0);
+        fail_unless(idx == i);
+    }
+
+    fail_unless(pa_idxset_put(s, PA_UINT_TO_PTR(32), &idx) < 0);
+    fail_unless(idx == 1);
+
+    for (i = 0; i < N_KEYS; i++) {
+        fail_unless(pa_idxset_get_by_index(s, i) == PA_UINT_TO_PTR(i * 16 + 16));
+        fail_unless(pa_idxset_get_by_data(s, PA_UINT_TO_PTR(i * 16 + 16), &idx) != NULL);
+        fail_unless(idx == i);
+    }
+
+    for (i = 0; i < N_KEYS; i += 2)
+        fail_unless(pa_idxset_remove_by_index(s, i) == PA_UINT_TO_PTR(i * 16 + 16));
+
+    fail_unless(pa_idxset_size(s) == N_KEYS / 2);
+    fail_unless(pa_idxset_get_by_data(s, PA_UINT_TO_PTR(16), NULL) == NULL);
+
+    /* pa_idxset_next() has to skip over removed entries */
+    idx = 0;
+    fail_unless(pa_idxset_next(s, &idx) == PA_UINT_TO_PTR(32));
+    fail_unless(idx == 1);
+
+    for (i = 1, data = pa_idxset_first(s, &idx); data; data = pa_idxset_next(s, &idx), i += 2) {
+        fail_unless(idx == i);
+        fail_unless(data == PA_UINT_TO_PTR(i * 16 + 16));
+    }
+
+    fail_unless(pa_idxset_remove_by_data(s, PA_UINT_TO_PTR(64), &idx) == PA_UINT_TO_PTR(64));
+    fail_unless(idx == 3);
+    fail_unless(pa_idxset_get_by_index(s, 3) == NULL);
+
+    pa_idxset_free(s, NULL);
+}
+END_TEST
+
+/* Not a test but a microbenchmark, comparing the cost of lookups in small
+ * and big tables. With fixed size hash chains the big table used to be
+ * much slower per lookup. */
+START_TEST (hashmap_benchmark) {
+    pa_hashmap *h;
+    unsigned i, size;
+
+    make_keys();
+
+    for (size = 10; size <= N_KEYS; size *= 10) {
+        char label[64];
+
+        h = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+        for (i = 0; i < size; i++)
+            pa_hashmap_put(h, keys[i], keys[i]);
+
+        pa_snprintf(label, sizeof(label), "%u string keys, %u lookups", size, N_KEYS);
+        PA_RUNTIME_TEST_RUN_START(label, 10, 20) {
+            for (i = 0; i < N_KEYS; i++)
+                fail_unless(pa_hashmap_get(h, keys[i % size]) != NULL);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        pa_snprintf(label, sizeof(label), "%u string keys, %u insert/remove", size, N_KEYS);
+        PA_RUNTIME_TEST_RUN_START(label, 10, 20) {
+            for (i = 0; i < N_KEYS; i++) {
+                pa_hashmap_remove(h, keys[i % size]);
+                pa_hashmap_put(h, keys[i % size], keys[i % size]);
+            }
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        pa_hashmap_free(h);
+    }
+
+    free_keys();
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Hashmap");
+    tc = tcase_create("hashmap");
+    tcase_add_test(tc, hashmap_test);
+    tcase_add_test(tc, idxset_test);
+    tcase_add_test(tc, hashmap_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -120,6 +120,258 @@ START_TEST (mainloop_test) {
 }
 END_TEST
 
+#ifndef GLIB_MAIN_LOOP
+/* On Linux these run against the epoll backend of pa_mainloop */
+
+#define N_PIPES 16
+
+static void count_io_cb(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
+    unsigned *count = userdata;
+    char c;
+
+    fail_unless(f & PA_IO_EVENT_INPUT);
+    pa_assert_se(read(fd, &c, sizeof(c)) == 1);
+    (*count)++;
+}
+
+static void quit_time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    a->quit(a, 0);
+}
+
+/* Runs the main loop until nothing is pending anymore */
+static void run_pending(pa_mainloop *m) {
+    while (pa_mainloop_iterate(m, 0, NULL) > 0)
+        ;
+}
+
+START_TEST (mainloop_io_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    pa_io_event *e[N_PIPES];
+    unsigned count[N_PIPES];
+    int fds[N_PIPES][2];
+    unsigned i;
+
+    m = pa_mainloop_new();
+    fail_if(!m);
+    a = pa_mainloop_get_api(m);
+
+    for (i = 0; i < N_PIPES; i++) {
+        fail_unless(pipe(fds[i]) == 0);
+        count[i] = 0;
+        e[i] = a->io_new(a, fds[i][0], PA_IO_EVENT_INPUT, count_io_cb, &count[i]);
+    }
+
+    /* Only the pipes that were written to are dispatched */
+    for (i = 0; i < N_PIPES; i += 2)
+        pa_assert_se(write(fds[i][1], "x", 1) == 1);
+
+    run_pending(m);
+
+    for (i = 0; i < N_PIPES; i++)
+        fail_unless(count[i] == (i % 2 ? 0 : 1));
+
+    /* A disabled io event isn't dispatched, until enabled again */
+    a->io_enable(e[1], PA_IO_EVENT_NULL);
+    pa_assert_se(write(fds[1][1], "x", 1) == 1);
+    run_pending(m);
+    fail_unless(count[1] == 0);
+
+    a->io_enable(e[1], PA_IO_EVENT_INPUT);
+    run_pending(m);
+    fail_unless(count[1] == 1);
+
+    /* Neither is a freed one */
+    a->io_free(e[2]);
+    pa_assert_se(write(fds[2][1], "x", 1) == 1);
+    run_pending(m);
+    fail_unless(count[2] == 1);
+
+    for (i = 0; i < N_PIPES; i++) {
+        if (i != 2)
+            a->io_free(e[i]);
+        pa_close_pipe(fds[i]);
+    }
+
+    pa_mainloop_free(m);
+}
+END_TEST
+
+START_TEST (mainloop_fd_reuse_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    pa_io_event *old, *new;
+    pa_time_event *te;
+    struct timeval tv;
+    unsigned old_count = 0, new_count = 0;
+    int fds[2], other[2], fd;
+
+    m = pa_mainloop_new();
+    fail_if(!m);
+    a = pa_mainloop_get_api(m);
+
+    fail_unless(pipe(fds) == 0);
+    fail_unless(pipe(other) == 0);
+    fd = fds[0];
+
+    old = a->io_new(a, fd, PA_IO_EVENT_INPUT, count_io_cb, &old_count);
+    run_pending(m);
+
+    /* The fd is closed and reused by a new io event before the old one is
+     * freed. Freeing the old one must not stop the new one from working. */
+    pa_assert_se(close(fd) == 0);
+    pa_assert_se(dup2(other[0], fd) == fd);
+
+    new = a->io_new(a, fd, PA_IO_EVENT_INPUT, count_io_cb, &new_count);
+    a->io_free(old);
+
+    pa_assert_se(write(other[1], "x", 1) == 1);
+
+    te = a->time_new(a, pa_timeval_rtstore(&tv, pa_rtclock_now() + PA_USEC_PER_SEC, true), quit_time_cb, NULL);
+
+    while (new_count == 0 && pa_mainloop_iterate(m, 1, NULL) >= 0)
+        ;
+
+    fail_unless(new_count == 1);
+    fail_unless(old_count == 0);
+
+    a->time_free(te);
+    a->io_free(new);
+    pa_assert_se(close(fd) == 0);
+    pa_close_pipe(other);
+    pa_assert_se(close(fds[1]) == 0);
+
+    pa_mainloop_free(m);
+}
+END_TEST
+
+#define N_TIME_EVENTS 64
+
+static pa_time_event *time_events[N_TIME_EVENTS];
+static pa_usec_t times[N_TIME_EVENTS];
+static unsigned fired[N_TIME_EVENTS * 2], n_fired;
+
+static void record_time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    fail_unless(n_fired < PA_ELEMENTSOF(fired));
+    fired[n_fired++] = PA_PTR_TO_UINT(userdata);
+}
+
+static void free_next_time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    unsigned id = PA_PTR_TO_UINT(userdata);
+
+    record_time_cb(a, e, tv, userdata);
+
+    a->time_free(time_events[id + 1]);
+    time_events[id + 1] = NULL;
+}
+
+static void restart_self_time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    unsigned id = PA_PTR_TO_UINT(userdata);
+    struct timeval next;
+
+    record_time_cb(a, e, tv, userdata);
+
+    /* Still in the past, but behind every other event of the test */
+    a->time_restart(e, pa_timeval_rtstore(&next, times[id] + 100 * PA_USEC_PER_MSEC, true));
+}
+
+static pa_time_event *new_time_event(pa_mainloop_api *a, pa_usec_t t, pa_time_event_cb_t cb, unsigned id) {
+    struct timeval tv;
+
+    return a->time_new(a, pa_timeval_rtstore(&tv, t, true), cb, PA_UINT_TO_PTR(id));
+}
+
+START_TEST (mainloop_time_order_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    pa_usec_t now;
+    unsigned i;
+
+    m = pa_mainloop_new();
+    fail_if(!m);
+    a = pa_mainloop_get_api(m);
+
+    now = pa_rtclock_now();
+    n_fired = 0;
+
+    /* All in the past, in a scrambled order with some duplicates, so that
+     * one iteration dispatches them all, earliest first */
+    for (i = 0; i < N_TIME_EVENTS; i++) {
+        times[i] = now - PA_USEC_PER_SEC + ((i * 37) % (N_TIME_EVENTS / 2)) * PA_USEC_PER_MSEC;
+        time_events[i] = new_time_event(a, times[i], record_time_cb, i);
+    }
+
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) == N_TIME_EVENTS);
+    fail_unless(n_fired == N_TIME_EVENTS);
+
+    for (i = 1; i < N_TIME_EVENTS; i++)
+        fail_unless(times[fired[i - 1]] <= times[fired[i]]);
+
+    /* They are all disabled now */
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) == 0);
+
+    for (i = 0; i < N_TIME_EVENTS; i++)
+        a->time_free(time_events[i]);
+
+    pa_mainloop_free(m);
+}
+END_TEST
+
+START_TEST (mainloop_time_restart_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    struct timeval tv;
+    pa_usec_t now;
+    unsigned i;
+
+    m = pa_mainloop_new();
+    fail_if(!m);
+    a = pa_mainloop_get_api(m);
+
+    now = pa_rtclock_now();
+    n_fired = 0;
+
+    for (i = 0; i < 8; i++) {
+        times[i] = now - PA_USEC_PER_SEC + i * PA_USEC_PER_MSEC;
+        time_events[i] = new_time_event(a, times[i],
+                                        i == 0 ? free_next_time_cb : i == 2 ? restart_self_time_cb : record_time_cb, i);
+    }
+
+    /* 3 moves to the front, 4 into the future, 5 and 6 are disabled and
+     * freed, 0 frees 1 before it is dispatched, 2 restarts itself into the
+     * past from its callback, which must wait for the next iteration. */
+    a->time_restart(time_events[3], pa_timeval_rtstore(&tv, now - 2 * PA_USEC_PER_SEC, true));
+    a->time_restart(time_events[4], pa_timeval_rtstore(&tv, now + 3600 * PA_USEC_PER_SEC, true));
+    a->time_restart(time_events[5], NULL);
+    a->time_free(time_events[6]);
+    time_events[6] = NULL;
+
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) == 4);
+    fail_unless(n_fired == 4);
+    fail_unless(fired[0] == 3);
+    fail_unless(fired[1] == 0);
+    fail_unless(fired[2] == 2);
+    fail_unless(fired[3] == 7);
+
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) == 1);
+    fail_unless(n_fired == 5);
+    fail_unless(fired[4] == 2);
+
+    /* Enabling a disabled one again */
+    a->time_restart(time_events[5], pa_timeval_rtstore(&tv, now, true));
+    a->time_restart(time_events[2], NULL);
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) == 1);
+    fail_unless(fired[5] == 5);
+
+    for (i = 0; i < 8; i++)
+        if (time_events[i])
+            a->time_free(time_events[i]);
+
+    pa_mainloop_free(m);
+}
+END_TEST
+#endif /* GLIB_MAIN_LOOP */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -129,6 +381,12 @@ int main(int argc, char *argv[]) {
     s = suite_create("MainLoop");
     tc = tcase_create("mainloop");
     tcase_add_test(tc, mainloop_test);
+#ifndef GLIB_MAIN_LOOP
+    tcase_add_test(tc, mainloop_io_test);
+    tcase_add_test(tc, mainloop_fd_reuse_test);
+    tcase_add_test(tc, mainloop_time_order_test);
+    tcase_add_test(tc, mainloop_time_restart_test);
+#endif
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
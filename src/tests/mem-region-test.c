@@ -0,0 +1,210 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/mainloop.h>
+
+/* Writes from a memory region as soon as the server confirmed its
+ * registration. The blocks go over the srbchannel while the
+ * registration went over the socket, if the server saw them first it
+ * would drop them and never release them. */
+
+#define NBLOCKS 4
+#define SINE_HZ 440
+#define SAMPLE_HZ 8000
+#define BLOCK_FRAMES (SAMPLE_HZ / 10)
+
+static pa_context *context = NULL;
+static pa_stream *stream = NULL;
+static pa_mainloop_api *mainloop_api = NULL;
+static const char *bname = NULL;
+
+static int n_freed = 0;
+static bool skipped = false;
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_FLOAT32,
+    .rate = SAMPLE_HZ,
+    .channels = 1
+};
+
+static void block_free_cb(void *userdata) {
+    fprintf(stderr, "Block %i released\n", (int) (long) userdata);
+
+    if (++n_freed >= NBLOCKS) {
+        fprintf(stderr, "We're done\n");
+        pa_context_disconnect(context);
+    }
+}
+
+static void region_cb(pa_context *c, pa_mem_region *r, void *userdata) {
+    float *data;
+    size_t size;
+    int i;
+
+    fail_unless(r != NULL);
+
+    data = pa_mem_region_get_data(r, &size);
+    fail_unless(data != NULL);
+    fail_unless(size >= NBLOCKS * BLOCK_FRAMES * sizeof(float));
+
+    for (i = 0; i < NBLOCKS * BLOCK_FRAMES; i++)
+        data[i] = (float) sin(((double) i/SAMPLE_HZ)*2*M_PI*SINE_HZ)/2;
+
+    /* Straight away, nothing else happened on the connection since the
+     * reply */
+    for (i = 0; i < NBLOCKS; i++) {
+        fprintf(stderr, "Writing block %i\n", i);
+        fail_unless(pa_stream_write_mem_region(stream, r, i * BLOCK_FRAMES * sizeof(float), BLOCK_FRAMES * sizeof(float),
+                                               block_free_cb, (void*) (long) i, 0, PA_SEEK_RELATIVE) == 0);
+    }
+}
+
+/* This routine is called whenever the stream state changes */
+static void stream_state_callback(pa_stream *s, void *userdata) {
+    fail_unless(s != NULL);
+
+    switch (pa_stream_get_state(s)) {
+        case PA_STREAM_UNCONNECTED:
+        case PA_STREAM_CREATING:
+        case PA_STREAM_TERMINATED:
+            break;
+
+        case PA_STREAM_READY: {
+            pa_operation *o;
+
+            fprintf(stderr, "Registering region\n");
+
+            if (!(o = pa_context_register_mem_region(context, NBLOCKS * BLOCK_FRAMES * sizeof(float), region_cb, NULL))) {
+                fail_unless(pa_context_errno(context) == PA_ERR_NOTSUPPORTED);
+
+                fprintf(stderr, "Memory regions not supported, skipping\n");
+                skipped = true;
+                pa_context_disconnect(context);
+                break;
+            }
+
+            pa_operation_unref(o);
+            break;
+        }
+
+        default:
+        case PA_STREAM_FAILED:
+            fprintf(stderr, "Stream error: %s\n", pa_strerror(pa_context_errno(pa_stream_get_context(s))));
+            ck_abort();
+    }
+}
+
+/* This is called whenever the context status changes */
+static void context_state_callback(pa_context *c, void *userdata) {
+    fail_unless(c != NULL);
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_CONNECTING:
+        case PA_CONTEXT_AUTHORIZING:
+        case PA_CONTEXT_SETTING_NAME:
+            break;
+
+        case PA_CONTEXT_READY:
+            fprintf(stderr, "Connection established.\n");
+
+            stream = pa_stream_new(c, "mem-region-test", &sample_spec, NULL);
+            fail_unless(stream != NULL);
+            pa_stream_set_state_callback(stream, stream_state_callback, NULL);
+            pa_stream_connect_playback(stream, NULL, NULL, 0, NULL, NULL);
+            break;
+
+        case PA_CONTEXT_TERMINATED:
+            mainloop_api->quit(mainloop_api, 0);
+            break;
+
+        case PA_CONTEXT_FAILED:
+        default:
+            fprintf(stderr, "Context error: %s\n", pa_strerror(pa_context_errno(c)));
+            ck_abort();
+    }
+}
+
+START_TEST (mem_region_test) {
+    pa_mainloop* m = NULL;
+    int ret = 0;
+
+    /* Set up a new main loop */
+    m = pa_mainloop_new();
+    fail_unless(m != NULL);
+
+    mainloop_api = pa_mainloop_get_api(m);
+
+    context = pa_context_new(mainloop_api, bname);
+    fail_unless(context != NULL);
+
+    pa_context_set_state_callback(context, context_state_callback, NULL);
+
+    /* Connect the context */
+    if (pa_context_connect(context, NULL, 0, NULL) < 0) {
+        fprintf(stderr, "pa_context_connect() failed.\n");
+        goto quit;
+    }
+
+    if (pa_mainloop_run(m, &ret) < 0)
+        fprintf(stderr, "pa_mainloop_run() failed.\n");
+
+    fail_unless(skipped || n_freed == NBLOCKS);
+
+quit:
+    if (stream)
+        pa_stream_unref(stream);
+
+    pa_context_unref(context);
+    pa_mainloop_free(m);
+
+    fail_unless(ret == 0);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    bname = argv[0];
+
+    s = suite_create("Memory Region");
+    tc = tcase_create("memregion");
+    tcase_add_test(tc, mem_region_test);
+    /* 0.4s of audio, plenty of grace time */
+    tcase_set_timeout(tc, 5);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -20,6 +20,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <check.h>
@@ -176,6 +177,72 @@ START_TEST (memblock_test) {
 }
 END_TEST
 
+static void pool_user_free_cb(void *userdata) {
+    (*(unsigned*) userdata)++;
+}
+
+START_TEST (memblock_pool_user_test) {
+    pa_mempool *pool_a, *pool_b;
+    unsigned id_a;
+    pa_memexport *export_a;
+    pa_memimport *import_b;
+    pa_memblock *mb_a, *mb_b;
+    pa_mem_type_t mem_type;
+    uint32_t id, shm_id;
+    size_t offset, size, region_size;
+    unsigned n_freed = 0;
+    char *region, *x;
+
+    const char txt[] = "This is a test!";
+
+    pool_a = pa_mempool_new_user(PA_MEM_TYPE_SHARED_POSIX, 100);
+    fail_unless(pool_a != NULL);
+    pool_b = pa_mempool_new(PA_MEM_TYPE_SHARED_POSIX, 0, true);
+    fail_unless(pool_b != NULL);
+
+    pa_mempool_get_shm_id(pool_a, &id_a);
+
+    /* The memory belongs to the user, nothing is allocated from it */
+    fail_unless(pa_memblock_new_pool(pool_a, sizeof(txt)) == NULL);
+
+    region = pa_mempool_get_user_memory(pool_a, &region_size);
+    fail_unless(region_size >= 8192);
+    memcpy(region + 4096, txt, sizeof(txt));
+
+    mb_a = pa_memblock_new_pool_user(pool_a, 4096, sizeof(txt), pool_user_free_cb, &n_freed);
+
+    export_a = pa_memexport_new(pool_a, revoke_cb, (void*) "A");
+    fail_unless(export_a != NULL);
+    import_b = pa_memimport_new(pool_b, release_cb, (void*) "B");
+    fail_unless(import_b != NULL);
+
+    fail_unless(pa_memexport_put(export_a, mb_a, &mem_type, &id, &shm_id, &offset, &size) >= 0);
+    fail_unless(shm_id == id_a);
+    fail_unless(offset == 4096);
+    fail_unless(size == sizeof(txt));
+
+    /* Until the other side releases it the export keeps it */
+    pa_memblock_unref(mb_a);
+    fail_unless(n_freed == 0);
+
+    mb_b = pa_memimport_get(import_b, PA_MEM_TYPE_SHARED_POSIX, id, shm_id, offset, size, false);
+    fail_unless(mb_b != NULL);
+    x = pa_memblock_acquire(mb_b);
+    fail_unless(strcmp(x, txt) == 0);
+    pa_memblock_release(mb_b);
+    pa_memblock_unref(mb_b);
+
+    fail_unless(pa_memexport_process_release(export_a, id) == 0);
+    fail_unless(n_freed == 1);
+
+    pa_memimport_free(import_b);
+    pa_memexport_free(export_a);
+
+    pa_mempool_unref(pool_a);
+    pa_mempool_unref(pool_b);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -188,6 +255,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Memblock");
     tc = tcase_create("memblock");
     tcase_add_test(tc, memblock_test);
+    tcase_add_test(tc, memblock_pool_user_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
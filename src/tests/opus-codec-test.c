@@ -0,0 +1,289 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/opus-codec.h>
+
+/* Opus is lossy, so only require the decoded sine to be close to the
+ * original, in the same place. libopus gets around 40 dB at the default
+ * bitrates, off by the encoder's lookahead the error would be larger
+ * than the signal. */
+#define MIN_SNR 25.0
+
+/* The decoder needs a moment to settle at the start */
+#define SETTLE_MS 20
+
+struct buffer {
+    uint8_t *data;
+    size_t length;
+};
+
+static pa_mempool *pool;
+
+static void append(struct buffer *b, const pa_memchunk *chunk) {
+    void *d;
+
+    if (!chunk->memblock)
+        return;
+
+    b->data = pa_xrealloc(b->data, b->length + chunk->length);
+
+    d = pa_memblock_acquire_chunk(chunk);
+    memcpy(b->data + b->length, d, chunk->length);
+    pa_memblock_release(chunk->memblock);
+
+    b->length += chunk->length;
+}
+
+static float sine(const pa_sample_spec *ss, unsigned frame, unsigned channel) {
+    return (float) (0.5 * sin(2 * M_PI * (440.0 * (channel + 1)) * frame / ss->rate));
+}
+
+/* Encodes n_frames of a sine from start_frame on, in pieces of the given
+ * numbers of frames */
+static void encode(pa_opus_encoder *e, const pa_sample_spec *ss, unsigned start_frame, unsigned n_frames,
+                   const unsigned *pieces, unsigned n_pieces, struct buffer *encoded) {
+    unsigned i, pos = 0;
+
+    for (i = 0; pos < n_frames; i++) {
+        pa_memchunk chunk, out;
+        unsigned n, k, c;
+        float *d;
+
+        n = PA_MIN(pieces[i % n_pieces], n_frames - pos);
+
+        chunk.memblock = pa_memblock_new(pool, n * pa_frame_size(ss));
+        chunk.index = 0;
+        chunk.length = n * pa_frame_size(ss);
+
+        d = pa_memblock_acquire(chunk.memblock);
+        for (k = 0; k < n; k++)
+            for (c = 0; c < ss->channels; c++)
+                d[k * ss->channels + c] = sine(ss, start_frame + pos + k, c);
+        pa_memblock_release(chunk.memblock);
+
+        pa_opus_encoder_encode(e, &chunk, &out);
+        pa_memblock_unref(chunk.memblock);
+
+        append(encoded, &out);
+        if (out.memblock)
+            pa_memblock_unref(out.memblock);
+
+        pos += n;
+    }
+}
+
+/* Decodes the data, split into pieces of the given numbers of bytes */
+static void decode(pa_opus_decoder *d, const struct buffer *encoded, const unsigned *pieces, unsigned n_pieces,
+                   struct buffer *decoded) {
+    size_t pos = 0;
+    unsigned i;
+
+    for (i = 0; pos < encoded->length; i++) {
+        pa_memchunk chunk, out;
+        size_t n;
+        void *p;
+
+        n = PA_MIN(pieces[i % n_pieces], encoded->length - pos);
+
+        chunk.memblock = pa_memblock_new(pool, n);
+        chunk.index = 0;
+        chunk.length = n;
+
+        p = pa_memblock_acquire(chunk.memblock);
+        memcpy(p, encoded->data + pos, n);
+        pa_memblock_release(chunk.memblock);
+
+        fail_unless(pa_opus_decoder_decode(d, &chunk, &out) == 0);
+        pa_memblock_unref(chunk.memblock);
+
+        append(decoded, &out);
+        if (out.memblock)
+            pa_memblock_unref(out.memblock);
+
+        pos += n;
+    }
+}
+
+/* Compares n_frames of decoded audio with the sine from start_frame on,
+ * and returns the signal to error ratio in dB */
+static double compare(const pa_sample_spec *ss, const float *pcm, unsigned start_frame, unsigned n_frames) {
+    double sig = 0, err = 0;
+    unsigned k, c;
+
+    for (k = 0; k < n_frames; k++)
+        for (c = 0; c < ss->channels; c++) {
+            double s = sine(ss, start_frame + k, c);
+            double e = pcm[k * ss->channels + c] - s;
+
+            sig += s * s;
+            err += e * e;
+        }
+
+    return 10 * log10(sig / err);
+}
+
+static pa_format_info *format_new(pa_sample_spec *ss, unsigned rate, unsigned channels, unsigned frame_duration) {
+    ss->format = PA_SAMPLE_FLOAT32NE;
+    ss->rate = rate;
+    ss->channels = (uint8_t) channels;
+
+    return pa_opus_format_new(ss, NULL, 0, frame_duration);
+}
+
+/* Everything that goes into the encoder has to come out of the decoder
+ * once the encoder is flushed, in the same place, however the data is
+ * split up on the way */
+START_TEST (opus_roundtrip_test) {
+    static const unsigned frame_pieces[] = { 1000, 1, 441, 4800, 7 };
+    static const unsigned byte_pieces[] = { 1, 5, 333, 4096, 2 };
+    static const unsigned durations[] = { 5, 20, 60 };
+    unsigned i, channels;
+
+    for (channels = 1; channels <= 2; channels++) {
+        for (i = 0; i < PA_ELEMENTSOF(durations); i++) {
+            struct buffer encoded = { NULL, 0 }, decoded = { NULL, 0 };
+            pa_opus_encoder *e;
+            pa_opus_decoder *d;
+            pa_format_info *f;
+            pa_sample_spec ss;
+            pa_memchunk out;
+            unsigned n_frames, settle;
+            double snr;
+
+            f = format_new(&ss, 48000, channels, durations[i]);
+            fail_unless((e = pa_opus_encoder_new(pool, f)) != NULL);
+            fail_unless((d = pa_opus_decoder_new(pool, f)) != NULL);
+
+            /* Not a whole number of Opus frames */
+            n_frames = ss.rate + 123;
+            settle = ss.rate * SETTLE_MS / 1000;
+
+            encode(e, &ss, 0, n_frames, frame_pieces, PA_ELEMENTSOF(frame_pieces), &encoded);
+            pa_opus_encoder_flush(e, &out);
+            append(&encoded, &out);
+            if (out.memblock)
+                pa_memblock_unref(out.memblock);
+
+            decode(d, &encoded, byte_pieces, PA_ELEMENTSOF(byte_pieces), &decoded);
+
+            fail_unless(decoded.length == n_frames * pa_frame_size(&ss));
+
+            snr = compare(&ss, (float *) decoded.data + settle * channels, settle, n_frames - settle);
+            pa_log_debug("%u channels, %u ms frames: SNR %.1f dB", channels, durations[i], snr);
+            fail_unless(snr > MIN_SNR);
+
+            /* Also the very end, which was in the lookahead at the flush */
+            snr = compare(&ss, (float *) decoded.data + (n_frames - settle) * channels, n_frames - settle, settle);
+            fail_unless(snr > MIN_SNR);
+
+            pa_xfree(encoded.data);
+            pa_xfree(decoded.data);
+            pa_opus_encoder_free(e);
+            pa_opus_decoder_free(d);
+            pa_format_info_free(f);
+        }
+    }
+}
+END_TEST
+
+/* After a reset, what was written before doesn't come out anymore, not
+ * even the part that was in the lookahead */
+START_TEST (opus_reset_test) {
+    static const unsigned frame_pieces[] = { 333 };
+    static const unsigned byte_pieces[] = { 1000 };
+    struct buffer encoded = { NULL, 0 }, decoded = { NULL, 0 };
+    pa_opus_encoder *e;
+    pa_opus_decoder *d;
+    pa_format_info *f;
+    pa_sample_spec ss;
+    pa_memchunk out;
+    unsigned n_before, n_after, n_decoded;
+    double snr;
+
+    f = format_new(&ss, 48000, 2, 20);
+    fail_unless((e = pa_opus_encoder_new(pool, f)) != NULL);
+    fail_unless((d = pa_opus_decoder_new(pool, f)) != NULL);
+
+    n_before = ss.rate / 2 + 77;
+    n_after = ss.rate / 2;
+
+    /* The audio before the reset is out of phase with the one after */
+    encode(e, &ss, 1000, n_before, frame_pieces, PA_ELEMENTSOF(frame_pieces), &encoded);
+    pa_opus_encoder_reset(e);
+    encode(e, &ss, 0, n_after, frame_pieces, PA_ELEMENTSOF(frame_pieces), &encoded);
+    pa_opus_encoder_flush(e, &out);
+    append(&encoded, &out);
+    if (out.memblock)
+        pa_memblock_unref(out.memblock);
+
+    decode(d, &encoded, byte_pieces, PA_ELEMENTSOF(byte_pieces), &decoded);
+
+    n_decoded = (unsigned) (decoded.length / pa_frame_size(&ss));
+    fail_unless(n_decoded >= n_after);
+    fail_unless(n_decoded <= n_before + n_after);
+
+    snr = compare(&ss, (float *) decoded.data + (n_decoded - n_after) * ss.channels, 0, n_after);
+    pa_log_debug("After reset: SNR %.1f dB", snr);
+    fail_unless(snr > MIN_SNR);
+
+    pa_xfree(encoded.data);
+    pa_xfree(decoded.data);
+    pa_opus_encoder_free(e);
+    pa_opus_decoder_free(d);
+    pa_format_info_free(f);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+
+    s = suite_create("Opus codec");
+    tc = tcase_create("opus-codec");
+    tcase_add_test(tc, opus_roundtrip_test);
+    tcase_add_test(tc, opus_reset_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    pa_mempool_unref(pool);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <locale.h>
+#include <math.h>
 
 #include <pulse/pulseaudio.h>
 
@@ -37,6 +38,7 @@
 #include <pulsecore/memblock.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/cpu.h>
 
 static void dump_block(const char *label, const pa_sample_spec *ss, const pa_memchunk *chunk) {
     void *d;
@@ -251,6 +253,184 @@ static pa_memblock* generate_block(pa_mempool *pool, const pa_sample_spec *ss) {
     return r;
 }
 
+/* Runs n_frames of a sine through r, in chunks of the given sizes, and
+ * returns the output */
+static float *polyphase_run(pa_mempool *pool, pa_resampler *r, double freq, unsigned n_frames,
+                            const unsigned *chunk_frames, unsigned n_chunk_frames, unsigned *out_frames) {
+    float *out;
+    unsigned i, pos = 0, max_out;
+
+    max_out = (unsigned) ((uint64_t) n_frames * r->o_ss.rate / r->i_ss.rate) + 1;
+    out = pa_xnew(float, max_out);
+    *out_frames = 0;
+
+    for (i = 0; pos < n_frames; i++) {
+        pa_memchunk in, o;
+        unsigned n, k;
+        float *d;
+
+        n = PA_MIN(chunk_frames[i % n_chunk_frames], n_frames - pos);
+
+        in.memblock = pa_memblock_new(pool, n * sizeof(float));
+        in.index = 0;
+        in.length = n * sizeof(float);
+
+        d = pa_memblock_acquire(in.memblock);
+        for (k = 0; k < n; k++)
+            d[k] = (float) (0.5 * sin(2 * M_PI * freq * (pos + k) / r->i_ss.rate));
+        pa_memblock_release(in.memblock);
+
+        pa_resampler_run(r, &in, &o);
+        pa_memblock_unref(in.memblock);
+        pos += n;
+
+        if (!o.memblock)
+            continue;
+
+        n = (unsigned) (o.length / sizeof(float));
+        pa_assert_se(*out_frames + n <= max_out);
+
+        d = pa_memblock_acquire_chunk(&o);
+        memcpy(out + *out_frames, d, o.length);
+        pa_memblock_release(o.memblock);
+        pa_memblock_unref(o.memblock);
+
+        *out_frames += n;
+    }
+
+    return out;
+}
+
+static float polyphase_dot_ref(const float *a, const float *b, unsigned n) {
+    double s = 0;
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        s += (double) a[i] * b[i];
+
+    return (float) s;
+}
+
+/* Checks that the polyphase resamplers give the same output no matter how
+ * the input is split up, that the optimized dot product agrees with plain
+ * C, and that a sine comes out clean. The first output frame is at the
+ * time of the first input frame. Returns the number of failed checks. */
+static int polyphase_test(pa_mempool *pool) {
+    static const unsigned rates[][2] = {
+        { 44100, 48000 }, { 48000, 44100 }, { 48000, 16000 }, { 8000, 48000 }, { 44100, 48001 }
+    };
+    /* Minimum signal to error ratio, and minimum attenuation of what
+     * would alias when downsampling, in dB for lq, mq and hq */
+    static const double min_snr[] = { 60, 90, 110 };
+    static const double min_stop[] = { 50, 50, 65 };
+    static const unsigned whole[] = { UINT_MAX };
+    static const unsigned pieces[] = { 1, 7, 100, 1000, 3 };
+    pa_polyphase_dot_func_t optimized;
+    pa_cpu_info cpu_info;
+    int failed = 0;
+    unsigned i, m;
+
+    pa_cpu_init(&cpu_info);
+    optimized = pa_get_polyphase_dot_func();
+
+    for (m = PA_RESAMPLER_POLYPHASE_LQ; m <= PA_RESAMPLER_POLYPHASE_HQ; m++) {
+        for (i = 0; i < PA_ELEMENTSOF(rates); i++) {
+            pa_sample_spec a, b;
+            pa_resampler *r;
+            float *out_whole, *out_pieces, *out_ref;
+            unsigned n_whole, n_pieces, n_ref, n_frames, k, skip;
+            double freq, err = 0, sig = 0, snr, max_diff = 0, stop;
+
+            a.format = b.format = PA_SAMPLE_FLOAT32NE;
+            a.channels = b.channels = 1;
+            a.rate = rates[i][0];
+            b.rate = rates[i][1];
+            n_frames = a.rate / 2;
+
+            /* Well within the pass band of both rates */
+            freq = PA_MIN(a.rate, b.rate) / 8.0;
+
+            pa_set_polyphase_dot_func(optimized);
+
+            pa_assert_se(r = pa_resampler_new(pool, &a, NULL, &b, NULL, 0, m, 0));
+            out_whole = polyphase_run(pool, r, freq, n_frames, whole, 1, &n_whole);
+            pa_resampler_reset(r);
+            out_pieces = polyphase_run(pool, r, freq, n_frames, pieces, PA_ELEMENTSOF(pieces), &n_pieces);
+
+            pa_set_polyphase_dot_func(polyphase_dot_ref);
+            pa_resampler_reset(r);
+            out_ref = polyphase_run(pool, r, freq, n_frames, whole, 1, &n_ref);
+
+            if (n_whole != n_pieces || memcmp(out_whole, out_pieces, n_whole * sizeof(float)) != 0) {
+                pa_log_error("%s %u -> %u: output depends on how the input is split",
+                             pa_resample_method_to_string(m), a.rate, b.rate);
+                failed++;
+            }
+
+            pa_assert_se(n_ref == n_whole);
+            for (k = 0; k < n_whole; k++)
+                max_diff = PA_MAX(max_diff, fabs(out_whole[k] - out_ref[k]));
+
+            if (max_diff > 1e-5) {
+                pa_log_error("%s %u -> %u: optimized dot product is off by %g",
+                             pa_resample_method_to_string(m), a.rate, b.rate, max_diff);
+                failed++;
+            }
+
+            /* Leave out the fade in from the silence before the start */
+            skip = b.rate / 100;
+            for (k = skip; k < n_whole; k++) {
+                double e = 0.5 * sin(2 * M_PI * freq * k / b.rate);
+
+                sig += e * e;
+                err += (out_whole[k] - e) * (out_whole[k] - e);
+            }
+
+            snr = 10 * log10(sig / err);
+            pa_log_info("%s %u -> %u: %u frames, SNR %.1f dB", pa_resample_method_to_string(m),
+                        a.rate, b.rate, n_whole, snr);
+
+            /* All but the input still needed for the filter is resampled */
+            if (n_whole < n_frames / 2 * b.rate / a.rate || snr < min_snr[m - PA_RESAMPLER_POLYPHASE_LQ]) {
+                pa_log_error("%s %u -> %u: bad output, %u frames, SNR %.1f dB",
+                             pa_resample_method_to_string(m), a.rate, b.rate, n_whole, snr);
+                failed++;
+            }
+
+            /* A sine close to the Nyquist frequency of the input, far
+             * above that of the output, must not come through */
+            if (b.rate < a.rate) {
+                pa_xfree(out_ref);
+                pa_resampler_reset(r);
+                out_ref = polyphase_run(pool, r, 0.48 * a.rate, n_frames, whole, 1, &n_ref);
+
+                err = 0;
+                for (k = skip; k < n_ref; k++)
+                    err += out_ref[k] * out_ref[k];
+
+                stop = 10 * log10(sig / err);
+                pa_log_info("%s %u -> %u: stop band attenuation %.1f dB", pa_resample_method_to_string(m),
+                            a.rate, b.rate, stop);
+
+                if (stop < min_stop[m - PA_RESAMPLER_POLYPHASE_LQ]) {
+                    pa_log_error("%s %u -> %u: aliasing, stop band attenuation %.1f dB",
+                                 pa_resample_method_to_string(m), a.rate, b.rate, stop);
+                    failed++;
+                }
+            }
+
+            pa_xfree(out_whole);
+            pa_xfree(out_pieces);
+            pa_xfree(out_ref);
+            pa_resampler_free(r);
+        }
+    }
+
+    pa_set_polyphase_dot_func(optimized);
+
+    return failed;
+}
+
 static void help(const char *argv0) {
     printf("%s [options]\n\n"
            "-h, --help                            Show this help\n"
@@ -471,6 +651,9 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (polyphase_test(pool) > 0)
+        ret = 1;
+
  quit:
     if (pool)
         pa_mempool_unref(pool);
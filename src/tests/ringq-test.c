@@ -0,0 +1,214 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <pulsecore/ringq.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Mono 32 bit samples, so every frame can carry a sequence number */
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S32NE,
+    .rate = 48000,
+    .channels = 1
+};
+
+#define CAPACITY (1000 * sizeof(uint32_t))
+#define N_FRAMES 1000000
+
+static pa_memchunk make_chunk(pa_mempool *pool, uint32_t first, unsigned n) {
+    pa_memchunk c;
+    uint32_t *d;
+    unsigned i;
+
+    c.memblock = pa_memblock_new(pool, n * sizeof(uint32_t));
+    c.index = 0;
+    c.length = n * sizeof(uint32_t);
+
+    d = pa_memblock_acquire(c.memblock);
+    for (i = 0; i < n; i++)
+        d[i] = first + i;
+    pa_memblock_release(c.memblock);
+
+    return c;
+}
+
+/* Check that the chunk holds consecutive sequence numbers starting at
+ * *next, and advance *next */
+static void check_chunk(const pa_memchunk *c, uint32_t *next) {
+    const uint32_t *d;
+    unsigned i;
+
+    d = (const uint32_t*) ((uint8_t*) pa_memblock_acquire(c->memblock) + c->index);
+    for (i = 0; i < c->length / sizeof(uint32_t); i++)
+        fail_unless(d[i] == (*next)++);
+    pa_memblock_release(c->memblock);
+}
+
+START_TEST (ringq_test) {
+    pa_mempool *pool;
+    pa_ringq *q;
+    pa_memchunk c;
+    uint32_t next_in = 0, next_out = 0;
+    unsigned i;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    q = pa_ringq_new("test", pool, &ss, CAPACITY + 3);
+
+    fail_unless(pa_ringq_get_capacity(q) == CAPACITY);
+    fail_unless(pa_ringq_peek(q, &c) < 0);
+
+    /* Fill up the queue completely, the last push only fits partially */
+    for (i = 0; i < 4; i++) {
+        size_t l;
+
+        c = make_chunk(pool, next_in, 300);
+        l = pa_ringq_push(q, &c);
+        fail_unless(l == (i < 3 ? c.length : 100 * sizeof(uint32_t)));
+        next_in += l / sizeof(uint32_t);
+        pa_memblock_unref(c.memblock);
+    }
+
+    fail_unless(pa_ringq_get_length(q) == CAPACITY);
+
+    /* Reading without wrapping around gives the whole queue at once */
+    fail_unless(pa_ringq_peek(q, &c) == 0);
+    fail_unless(c.length == CAPACITY);
+    pa_memblock_unref(c.memblock);
+
+    fail_unless(pa_ringq_peek_fixed_size(q, 700 * sizeof(uint32_t), &c) == 0);
+    check_chunk(&c, &next_out);
+    pa_ringq_drop(q, c.length);
+    pa_memblock_unref(c.memblock);
+
+    /* Now make the data wrap around */
+    c = make_chunk(pool, next_in, 500);
+    fail_unless(pa_ringq_push(q, &c) == c.length);
+    next_in += 500;
+    pa_memblock_unref(c.memblock);
+
+    fail_unless(pa_ringq_get_length(q) == 800 * sizeof(uint32_t));
+
+    /* Peeking stops at the end of the buffer... */
+    fail_unless(pa_ringq_peek(q, &c) == 0);
+    fail_unless(c.length == 300 * sizeof(uint32_t));
+    pa_memblock_unref(c.memblock);
+
+    /* ...unless a fixed size is asked for */
+    fail_unless(pa_ringq_peek_fixed_size(q, 800 * sizeof(uint32_t), &c) == 0);
+    fail_unless(c.length == 800 * sizeof(uint32_t));
+    check_chunk(&c, &next_out);
+    pa_memblock_unref(c.memblock);
+
+    fail_unless(pa_ringq_peek_fixed_size(q, 801 * sizeof(uint32_t), &c) < 0);
+
+    pa_ringq_flush(q);
+    fail_unless(pa_ringq_get_length(q) == 0);
+    fail_unless(pa_ringq_peek(q, &c) < 0);
+
+    pa_ringq_free(q);
+    pa_mempool_unref(pool);
+}
+END_TEST
+
+static pa_ringq *thread_q;
+static pa_mempool *thread_pool;
+
+static void writer(void *userdata) {
+    uint32_t next = 0;
+
+    while (next < N_FRAMES) {
+        uint32_t *d;
+        size_t l, n, i;
+
+        /* Write in odd amounts to hit all positions in the buffer */
+        d = pa_ringq_begin_write(thread_q, &l);
+        n = PA_MIN(N_FRAMES - next, (size_t) 77);
+        l = PA_MIN(l / sizeof(uint32_t), n);
+
+        if (l <= 0) {
+            pa_thread_yield();
+            continue;
+        }
+
+        for (i = 0; i < l; i++)
+            d[i] = next++;
+
+        pa_ringq_end_write(thread_q, l * sizeof(uint32_t));
+    }
+}
+
+START_TEST (ringq_thread_test) {
+    pa_thread *t;
+    uint32_t next = 0;
+
+    thread_pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    thread_q = pa_ringq_new("thread-test", thread_pool, &ss, CAPACITY);
+
+    t = pa_thread_new("writer", writer, NULL);
+
+    while (next < N_FRAMES) {
+        pa_memchunk c;
+
+        if (pa_ringq_peek(thread_q, &c) < 0) {
+            pa_thread_yield();
+            continue;
+        }
+
+        check_chunk(&c, &next);
+        pa_ringq_drop(thread_q, c.length);
+        pa_memblock_unref(c.memblock);
+    }
+
+    pa_thread_free(t);
+
+    fail_unless(pa_ringq_get_length(thread_q) == 0);
+
+    pa_ringq_free(thread_q);
+    pa_mempool_unref(thread_pool);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Ring Queue");
+    tc = tcase_create("ringq");
+    tcase_add_test(tc, ringq_test);
+    tcase_add_test(tc, ringq_thread_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -21,10 +21,19 @@
 
 #include <check.h>
 #include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/util.h>
+
+#include <pulsecore/core-util.h>
 #include <pulsecore/poll.h>
 #include <pulsecore/log.h>
+#include <pulsecore/macro.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/thread.h>
 
 static int before(pa_rtpoll_item *i) {
     pa_log("before");
@@ -82,6 +91,274 @@ START_TEST (rtpoll_test) {
 }
 END_TEST
 
+START_TEST (rtpoll_io_stats_test) {
+    pa_rtpoll *p;
+    pa_io_histogram lateness;
+    pa_usec_t poll_time;
+    unsigned i;
+
+    p = pa_rtpoll_new();
+
+    /* Only the timer can wake us up, so every run counts */
+    for (i = 0; i < 10; i++) {
+        pa_rtpoll_set_timer_relative(p, 1000);
+        fail_unless(pa_rtpoll_run(p) >= 0);
+        fail_unless(pa_rtpoll_timer_elapsed(p));
+    }
+
+    pa_rtpoll_get_io_stats(p, &lateness, &poll_time);
+
+    fail_unless(lateness.count == 10);
+    fail_unless(lateness.max <= lateness.total);
+
+    pa_rtpoll_free(p);
+}
+END_TEST
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+/* On Linux these run against the epoll backend of pa_rtpoll */
+
+struct pipe_item {
+    pa_rtpoll_item *item;
+    int fds[2];
+    unsigned n_work, n_after;
+};
+
+static int pipe_work(pa_rtpoll_item *i) {
+    struct pipe_item *pi = pa_rtpoll_item_get_userdata(i);
+
+    pi->n_work++;
+    return 0;
+}
+
+static void pipe_after(pa_rtpoll_item *i) {
+    struct pipe_item *pi = pa_rtpoll_item_get_userdata(i);
+    struct pollfd *pollfd;
+    char c;
+
+    pollfd = pa_rtpoll_item_get_pollfd(i, NULL);
+    if (pollfd->revents & POLLIN)
+        pa_assert_se(read(pollfd->fd, &c, sizeof(c)) == 1);
+
+    pi->n_after++;
+}
+
+static void pipe_item_new(pa_rtpoll *p, struct pipe_item *pi) {
+    struct pollfd *pollfd;
+
+    fail_unless(pipe(pi->fds) == 0);
+    pi->n_work = pi->n_after = 0;
+
+    pi->item = pa_rtpoll_item_new(p, PA_RTPOLL_NORMAL, 1);
+    pa_rtpoll_item_set_work_callback(pi->item, pipe_work);
+    pa_rtpoll_item_set_after_callback(pi->item, pipe_after);
+    pa_rtpoll_item_set_userdata(pi->item, pi);
+
+    pollfd = pa_rtpoll_item_get_pollfd(pi->item, NULL);
+    pollfd->fd = pi->fds[0];
+    pollfd->events = POLLIN;
+}
+
+static void pipe_item_free(struct pipe_item *pi) {
+    pa_rtpoll_item_free(pi->item);
+    pa_close_pipe(pi->fds);
+}
+
+/* Runs the loop without sleeping */
+static void run_now(pa_rtpoll *p) {
+    pa_rtpoll_set_timer_relative(p, 0);
+    fail_unless(pa_rtpoll_run(p) >= 0);
+}
+
+/* Settles all items, so that only what happens next makes them ready */
+static void settle(pa_rtpoll *p, struct pipe_item *items, unsigned n) {
+    unsigned k;
+
+    run_now(p);
+    run_now(p);
+
+    for (k = 0; k < n; k++)
+        items[k].n_work = items[k].n_after = 0;
+}
+
+START_TEST (rtpoll_ready_test) {
+    pa_rtpoll *p;
+    struct pipe_item items[4];
+    unsigned k;
+
+    p = pa_rtpoll_new();
+
+    for (k = 0; k < PA_ELEMENTSOF(items); k++)
+        pipe_item_new(p, &items[k]);
+
+    settle(p, items, PA_ELEMENTSOF(items));
+
+    /* The after callback is only called for items whose fds are ready */
+    pa_assert_se(write(items[1].fds[1], "x", 1) == 1);
+    run_now(p);
+
+    for (k = 0; k < PA_ELEMENTSOF(items); k++) {
+        fail_unless(items[k].n_after == (k == 1 ? 1 : 0));
+        fail_unless(items[k].n_work == 0);
+    }
+
+    /* The work callback in the next iteration too */
+    run_now(p);
+
+    for (k = 0; k < PA_ELEMENTSOF(items); k++) {
+        fail_unless(items[k].n_after == (k == 1 ? 1 : 0));
+        fail_unless(items[k].n_work == (k == 1 ? 1 : 0));
+    }
+
+    /* And then no more */
+    run_now(p);
+    fail_unless(items[1].n_work == 1);
+
+    for (k = 0; k < PA_ELEMENTSOF(items); k++)
+        pipe_item_free(&items[k]);
+
+    pa_rtpoll_free(p);
+}
+END_TEST
+
+static void delayed_write_func(void *userdata) {
+    int *fd = userdata;
+
+    pa_msleep(100);
+    pa_assert_se(write(*fd, "x", 1) == 1);
+}
+
+START_TEST (rtpoll_timer_rearm_test) {
+    pa_rtpoll *p;
+    struct pipe_item pi;
+    pa_thread *t;
+    pa_usec_t start;
+
+    p = pa_rtpoll_new();
+    pipe_item_new(p, &pi);
+    settle(p, &pi, 1);
+
+    /* Woken up by the fd long before the timer */
+    pa_rtpoll_set_timer_relative(p, 10 * PA_USEC_PER_SEC);
+    pa_assert_se(write(pi.fds[1], "x", 1) == 1);
+    fail_unless(pa_rtpoll_run(p) > 0);
+    fail_unless(!pa_rtpoll_timer_elapsed(p));
+
+    /* A shorter timeout replaces the long one */
+    start = pa_rtclock_now();
+    pa_rtpoll_set_timer_relative(p, 10 * PA_USEC_PER_MSEC);
+    fail_unless(pa_rtpoll_run(p) > 0);
+    fail_unless(pa_rtpoll_timer_elapsed(p));
+    fail_unless(pa_rtclock_now() - start < 5 * PA_USEC_PER_SEC);
+
+    /* A disabled timer doesn't fire, even if it was armed before */
+    pa_rtpoll_set_timer_relative(p, 10 * PA_USEC_PER_MSEC);
+    pa_assert_se(write(pi.fds[1], "x", 1) == 1);
+    fail_unless(pa_rtpoll_run(p) > 0);
+    fail_unless(!pa_rtpoll_timer_elapsed(p));
+
+    pa_rtpoll_set_timer_disabled(p);
+    fail_unless((t = pa_thread_new("test-writer", delayed_write_func, &pi.fds[1])) != NULL);
+    pi.n_after = 0;
+    fail_unless(pa_rtpoll_run(p) > 0);
+    fail_unless(!pa_rtpoll_timer_elapsed(p));
+    fail_unless(pi.n_after == 1);
+    pa_thread_free(t);
+
+    pipe_item_free(&pi);
+    pa_rtpoll_free(p);
+}
+END_TEST
+
+/* Once something can't be handled by epoll, every item is run every
+ * time, also after the item that caused it is gone */
+START_TEST (rtpoll_fallback_test) {
+    pa_rtpoll *p;
+    pa_rtpoll_item *file_item;
+    struct pipe_item pi;
+    struct pollfd *pollfd;
+    FILE *f;
+
+    p = pa_rtpoll_new();
+    pipe_item_new(p, &pi);
+    settle(p, &pi, 1);
+
+    run_now(p);
+    fail_unless(pi.n_work == 0);
+    fail_unless(pi.n_after == 0);
+
+    /* epoll doesn't take regular files */
+    fail_unless((f = tmpfile()) != NULL);
+    file_item = pa_rtpoll_item_new(p, PA_RTPOLL_NORMAL, 1);
+    pollfd = pa_rtpoll_item_get_pollfd(file_item, NULL);
+    pollfd->fd = fileno(f);
+    pollfd->events = POLLIN;
+
+    run_now(p);
+    run_now(p);
+    pa_rtpoll_item_free(file_item);
+    fclose(f);
+
+    pi.n_work = pi.n_after = 0;
+    run_now(p);
+    fail_unless(pi.n_work == 1);
+    fail_unless(pi.n_after == 1);
+
+    /* The fds are still polled */
+    pa_rtpoll_set_timer_relative(p, 10 * PA_USEC_PER_SEC);
+    pa_assert_se(write(pi.fds[1], "x", 1) == 1);
+    fail_unless(pa_rtpoll_run(p) > 0);
+    fail_unless(!pa_rtpoll_timer_elapsed(p));
+    fail_unless(pi.n_after == 2);
+
+    pipe_item_free(&pi);
+    pa_rtpoll_free(p);
+}
+END_TEST
+
+/* An item that is freed after its fd was closed and reused by another
+ * item must not take the other item's registration with it */
+START_TEST (rtpoll_fd_reuse_test) {
+    pa_rtpoll *p;
+    struct pipe_item old, new;
+    struct pollfd *pollfd;
+    int fd;
+
+    p = pa_rtpoll_new();
+    pipe_item_new(p, &old);
+    settle(p, &old, 1);
+
+    fd = old.fds[0];
+    pa_close(old.fds[0]);
+    old.fds[0] = -1;
+
+    /* The new item gets the same fd number */
+    pipe_item_new(p, &new);
+    if (new.fds[0] != fd) {
+        fail_unless(dup2(new.fds[0], fd) == fd);
+        pa_close(new.fds[0]);
+        new.fds[0] = fd;
+        pollfd = pa_rtpoll_item_get_pollfd(new.item, NULL);
+        pollfd->fd = fd;
+    }
+    settle(p, &new, 1);
+
+    pa_rtpoll_item_free(old.item);
+    pa_close(old.fds[1]);
+
+    new.n_after = 0;
+    pa_rtpoll_set_timer_relative(p, 10 * PA_USEC_PER_SEC);
+    pa_assert_se(write(new.fds[1], "x", 1) == 1);
+    fail_unless(pa_rtpoll_run(p) > 0);
+    fail_unless(!pa_rtpoll_timer_elapsed(p));
+    fail_unless(new.n_after == 1);
+
+    pipe_item_free(&new);
+    pa_rtpoll_free(p);
+}
+END_TEST
+#endif
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -91,6 +368,13 @@ int main(int argc, char *argv[]) {
     s = suite_create("RT Poll");
     tc = tcase_create("rtpoll");
     tcase_add_test(tc, rtpoll_test);
+    tcase_add_test(tc, rtpoll_io_stats_test);
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+    tcase_add_test(tc, rtpoll_ready_test);
+    tcase_add_test(tc, rtpoll_timer_rearm_test);
+    tcase_add_test(tc, rtpoll_fallback_test);
+    tcase_add_test(tc, rtpoll_fd_reuse_test);
+#endif
     /* the default timeout is too small,
      * set it to a reasonable large one.
      */
@@ -0,0 +1,322 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/resampler.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/source.h>
+#include <pulsecore/source-output.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* Checks that outputs of a source that record in the same format share the
+ * resampling without any jump in their data */
+
+#define FRAMES 960
+
+enum {
+    SOURCE_MESSAGE_POST = PA_SOURCE_MESSAGE_MAX
+};
+
+struct recording {
+    uint8_t *data;
+    size_t length;
+};
+
+static pa_mainloop *mainloop;
+static pa_core *core;
+static pa_rtpoll *rtpoll;
+static pa_thread_mq thread_mq;
+static pa_thread *thread;
+static pa_source *source;
+static unsigned n_posted;
+
+static const pa_sample_spec source_ss = { PA_SAMPLE_S16NE, 48000, 2 };
+
+static void thread_func(void *userdata) {
+    pa_thread_mq_install(&thread_mq);
+
+    while (pa_rtpoll_run(rtpoll) > 0)
+        ;
+}
+
+static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    if (code == SOURCE_MESSAGE_POST) {
+        pa_source_post(PA_SOURCE(o), chunk);
+        return 0;
+    }
+
+    return pa_source_process_msg(o, code, data, offset, chunk);
+}
+
+static void output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
+    struct recording *r = o->userdata;
+    void *d;
+
+    r->data = pa_xrealloc(r->data, r->length + chunk->length);
+
+    d = pa_memblock_acquire(chunk->memblock);
+    memcpy(r->data + r->length, (uint8_t *) d + chunk->index, chunk->length);
+    pa_memblock_release(chunk->memblock);
+
+    r->length += chunk->length;
+}
+
+static void source_init(void) {
+    pa_source_new_data data;
+
+    mainloop = pa_mainloop_new();
+    fail_unless(mainloop != NULL);
+    core = pa_core_new(pa_mainloop_get_api(mainloop), false, false, 0);
+    fail_unless(core != NULL);
+
+    rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&thread_mq, core->mainloop, rtpoll);
+
+    pa_source_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_source_new_data_set_name(&data, "test_source");
+    pa_source_new_data_set_sample_spec(&data, &source_ss);
+    source = pa_source_new(core, &data, 0);
+    pa_source_new_data_done(&data);
+    fail_unless(source != NULL);
+
+    source->parent.process_msg = source_process_msg;
+    pa_source_set_asyncmsgq(source, thread_mq.inq);
+    pa_source_set_rtpoll(source, rtpoll);
+
+    thread = pa_thread_new("test-source", thread_func, NULL);
+    fail_unless(thread != NULL);
+
+    pa_source_put(source);
+    n_posted = 0;
+}
+
+static void source_done(void) {
+    pa_source_unlink(source);
+
+    pa_asyncmsgq_send(thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(thread);
+    pa_thread_mq_done(&thread_mq);
+
+    pa_source_unref(source);
+    pa_rtpoll_free(rtpoll);
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+}
+
+static void make_chunk(pa_memchunk *chunk, unsigned n) {
+    int16_t *d;
+    unsigned i;
+
+    chunk->memblock = pa_memblock_new(core->mempool, FRAMES * pa_frame_size(&source_ss));
+    chunk->index = 0;
+    chunk->length = pa_memblock_get_length(chunk->memblock);
+
+    d = pa_memblock_acquire(chunk->memblock);
+    for (i = 0; i < FRAMES; i++) {
+        double t = (double) (n * FRAMES + i) / source_ss.rate;
+
+        d[2 * i] = (int16_t) (10000.0 * sin(2.0 * M_PI * 440.0 * t));
+        d[2 * i + 1] = (int16_t) (10000.0 * sin(2.0 * M_PI * 3000.0 * t));
+    }
+    pa_memblock_release(chunk->memblock);
+}
+
+/* Posts chunks to the source and, if given, runs them through a resampler
+ * of our own for reference */
+static void post(unsigned n, pa_resampler *ref, struct recording *ref_recording) {
+    unsigned i;
+
+    for (i = 0; i < n; i++, n_posted++) {
+        pa_memchunk chunk, out;
+
+        make_chunk(&chunk, n_posted);
+
+        pa_assert_se(pa_asyncmsgq_send(source->asyncmsgq, PA_MSGOBJECT(source), SOURCE_MESSAGE_POST, NULL, 0, &chunk) == 0);
+
+        if (ref) {
+            pa_resampler_run(ref, &chunk, &out);
+
+            if (out.memblock) {
+                void *d = pa_memblock_acquire(out.memblock);
+
+                ref_recording->data = pa_xrealloc(ref_recording->data, ref_recording->length + out.length);
+                memcpy(ref_recording->data + ref_recording->length, (uint8_t *) d + out.index, out.length);
+                ref_recording->length += out.length;
+
+                pa_memblock_release(out.memblock);
+                pa_memblock_unref(out.memblock);
+            }
+        }
+
+        pa_memblock_unref(chunk.memblock);
+    }
+}
+
+static void output_kill_cb(pa_source_output *o) {
+    ck_abort();
+}
+
+static pa_source_output *output_new(const pa_sample_spec *ss, struct recording *r) {
+    pa_source_output_new_data data;
+    pa_source_output *o = NULL;
+
+    pa_source_output_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_source_output_new_data_set_source(&data, source, false);
+    pa_source_output_new_data_set_sample_spec(&data, ss);
+    data.resample_method = PA_RESAMPLER_FFMPEG;
+    pa_assert_se(pa_source_output_new(&o, core, &data) == 0);
+    pa_source_output_new_data_done(&data);
+
+    o->push = output_push_cb;
+    o->kill = output_kill_cb;
+    o->userdata = r;
+    pa_source_output_put(o);
+
+    return o;
+}
+
+static void output_free(pa_source_output *o) {
+    pa_source_output_unlink(o);
+    pa_source_output_unref(o);
+}
+
+static pa_resampler *reference_new(pa_source_output *o) {
+    pa_resampler *r = o->thread_info.resampler;
+
+    return pa_resampler_new(core->mempool, &r->i_ss, &r->i_cm, &r->o_ss, &r->o_cm,
+                            core->lfe_crossover_freq, r->method, r->flags);
+}
+
+START_TEST (source_conversion_test) {
+    static const pa_sample_spec mono16 = { PA_SAMPLE_S16NE, 16000, 1 };
+    static const pa_sample_spec stereo22 = { PA_SAMPLE_S16NE, 22050, 2 };
+    struct recording ra = { NULL, 0 }, rb = { NULL, 0 }, rc = { NULL, 0 }, rd = { NULL, 0 }, ref = { NULL, 0 };
+    pa_source_output *a, *b, *c, *d;
+    pa_resampler *ref_resampler;
+    size_t b_start, b_end, i;
+
+    source_init();
+
+    /* A single output converts on its own */
+    a = output_new(&mono16, &ra);
+    ref_resampler = reference_new(a);
+    post(10, ref_resampler, &ref);
+    fail_unless(!source->thread_info.conversions);
+
+    /* A second one with the same format sets up a conversion, which takes
+     * over the resampler of the first one, and joins it. One in another
+     * format doesn't. */
+    b = output_new(&mono16, &rb);
+    d = output_new(&stereo22, &rd);
+    fail_unless(a->thread_info.conversion != NULL);
+    fail_unless(source->thread_info.conversions == a->thread_info.conversion);
+
+    b_start = ref.length;
+    post(10, ref_resampler, &ref);
+    fail_unless(b->thread_info.conversion == a->thread_info.conversion);
+    fail_unless(d->thread_info.conversion == NULL);
+
+    /* Muting an output doesn't change the data of the others */
+    c = output_new(&mono16, &rc);
+    pa_source_output_set_mute(c, true, false);
+    post(10, ref_resampler, &ref);
+    fail_unless(c->thread_info.conversion == a->thread_info.conversion);
+
+    /* An output that skipped data leaves, the others carry on */
+    b_end = ref.length;
+    pa_source_output_cork(b, true);
+    post(3, ref_resampler, &ref);
+    pa_source_output_cork(b, false);
+    post(3, ref_resampler, &ref);
+    fail_unless(b->thread_info.conversion == NULL);
+    fail_unless(a->thread_info.conversion != NULL);
+
+    output_free(b);
+    output_free(c);
+    output_free(d);
+    fail_unless(a->thread_info.conversion != NULL);
+
+    /* When it is on its own, an output stays with the shared resampler
+     * even after skipping data */
+    pa_source_output_cork(a, true);
+    post(1, NULL, NULL);
+    pa_source_output_cork(a, false);
+    post(5, ref_resampler, &ref);
+    fail_unless(a->thread_info.conversion != NULL);
+
+    /* No jumps in the data of any output */
+    fail_unless(ra.length == ref.length);
+    fail_unless(memcmp(ra.data, ref.data, ref.length) == 0);
+
+    fail_unless(rb.length > b_end - b_start);
+    fail_unless(memcmp(rb.data, ref.data + b_start, b_end - b_start) == 0);
+
+    fail_unless(rc.length > 0);
+    for (i = 0; i < rc.length; i++)
+        fail_unless(rc.data[i] == 0);
+
+    output_free(a);
+    fail_unless(!source->thread_info.conversions);
+
+    pa_resampler_free(ref_resampler);
+    pa_xfree(ra.data);
+    pa_xfree(rb.data);
+    pa_xfree(rc.data);
+    pa_xfree(rd.data);
+    pa_xfree(ref.data);
+
+    source_done();
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Source conversion");
+    tc = tcase_create("source-conversion");
+    tcase_add_test(tc, source_conversion_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -23,6 +23,7 @@
 
 #include <unistd.h>
 #include <check.h>
+#include <sys/socket.h>
 
 #include <pulse/mainloop.h>
 #include <pulsecore/packet.h>
@@ -121,6 +122,116 @@ START_TEST (srbchannel_test) {
 }
 END_TEST
 
+#define N_ITEMS 500
+
+static unsigned items_received;
+static unsigned memblock_bytes_received;
+
+/* Packet i is i % 3000 + 1 bytes long, its bytes count up from i */
+static void ordered_packet_received(pa_pstream *p, pa_packet *packet, pa_cmsg_ancil_data *ancil_data, void *userdata) {
+    const uint8_t *pdata;
+    size_t plen;
+    unsigned i;
+
+    pdata = pa_packet_data(packet, &plen);
+    fail_unless(plen == items_received % 3000 + 1);
+
+    for (i = 0; i < plen; i++)
+        fail_unless(pdata[i] == (uint8_t) (items_received + i));
+
+    items_received++;
+}
+
+/* The bytes of all memblocks together count up from 0, however they are
+ * split up when received */
+static void memblock_received(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    const uint8_t *d;
+    size_t i;
+
+    fail_unless(channel == 7);
+
+    d = pa_memblock_acquire_chunk(chunk);
+    for (i = 0; i < chunk->length; i++)
+        fail_unless(d[i] == (uint8_t) (memblock_bytes_received + i));
+    pa_memblock_release(chunk->memblock);
+
+    memblock_bytes_received += chunk->length;
+}
+
+/* Sends many packets and memblocks over a socket with a small buffer
+ * while nobody reads from it, so that the writes of the queued items
+ * come up short or fail with EAGAIN, then checks that everything arrives
+ * in order once the other end starts reading */
+START_TEST (socketpair_test) {
+    int fds[2], size = 4096;
+    pa_mainloop *ml1 = pa_mainloop_new(), *ml2 = pa_mainloop_new();
+    pa_mempool *mp = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    pa_iochannel *io1, *io2;
+    pa_pstream *p1, *p2;
+    unsigned i, j, memblock_bytes_sent = 0;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    fail_unless(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == 0);
+    fail_unless(setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == 0);
+
+    io1 = pa_iochannel_new(pa_mainloop_get_api(ml1), fds[0], fds[0]);
+    io2 = pa_iochannel_new(pa_mainloop_get_api(ml2), fds[1], fds[1]);
+    p1 = pa_pstream_new(pa_mainloop_get_api(ml1), io1, mp);
+    p2 = pa_pstream_new(pa_mainloop_get_api(ml2), io2, mp);
+
+    items_received = 0;
+    memblock_bytes_received = 0;
+    pa_pstream_set_receive_packet_callback(p2, ordered_packet_received, NULL);
+    pa_pstream_set_receive_memblock_callback(p2, memblock_received, NULL);
+
+    for (i = 0; i < N_ITEMS; i++) {
+        pa_packet *packet;
+        pa_memchunk chunk;
+        uint8_t *d;
+        size_t l;
+
+        packet = pa_packet_new(i % 3000 + 1);
+        d = (uint8_t *) pa_packet_data(packet, &l);
+        for (j = 0; j < l; j++)
+            d[j] = (uint8_t) (i + j);
+        pa_pstream_send_packet(p1, packet, NULL);
+        pa_packet_unref(packet);
+
+        chunk.memblock = pa_memblock_new(mp, (i * 37) % 2000 + 1);
+        chunk.index = 0;
+        chunk.length = pa_memblock_get_length(chunk.memblock);
+        d = pa_memblock_acquire(chunk.memblock);
+        for (j = 0; j < chunk.length; j++)
+            d[j] = (uint8_t) (memblock_bytes_sent + j);
+        pa_memblock_release(chunk.memblock);
+        pa_pstream_send_memblock(p1, 7, 0, PA_SEEK_RELATIVE, &chunk);
+        memblock_bytes_sent += chunk.length;
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    /* Only the sending end runs, until the socket is full */
+    for (i = 0; i < 100; i++)
+        pa_mainloop_iterate(ml1, 0, NULL);
+
+    fail_unless(pa_pstream_is_pending(p1));
+
+    while (items_received < N_ITEMS || memblock_bytes_received < memblock_bytes_sent) {
+        pa_mainloop_iterate(ml1, 0, NULL);
+        pa_mainloop_iterate(ml2, 0, NULL);
+    }
+
+    fail_unless(items_received == N_ITEMS);
+    fail_unless(memblock_bytes_received == memblock_bytes_sent);
+    fail_unless(!pa_pstream_is_pending(p1));
+
+    pa_pstream_unref(p1);
+    pa_pstream_unref(p2);
+    pa_mempool_unref(mp);
+    pa_mainloop_free(ml1);
+    pa_mainloop_free(ml2);
+}
+END_TEST
+
 
 int main(int argc, char *argv[]) {
     int failed = 0;
@@ -134,6 +245,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("srbchannel");
     tc = tcase_create("srbchannel");
     tcase_add_test(tc, srbchannel_test);
+    tcase_add_test(tc, socketpair_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
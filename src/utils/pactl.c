@@ -812,6 +812,89 @@ static void get_sample_info_callback(pa_context *c, const pa_sample_info *i, int
     pa_xfree(pl);
 }
 
+static char *io_histogram_snprint(char *s, size_t l, const pa_io_histogram *h) {
+    size_t n = 0;
+    unsigned i;
+
+    s[0] = 0;
+
+    for (i = 0; i < PA_IO_HISTOGRAM_BUCKETS && n < l; i++) {
+        if (!h->buckets[i])
+            continue;
+
+        if (i == 0)
+            n += pa_snprintf(s + n, l - n, "%s<2us:%u", n ? " " : "", h->buckets[i]);
+        else if (i == PA_IO_HISTOGRAM_BUCKETS - 1)
+            n += pa_snprintf(s + n, l - n, "%s>=%uus:%u", n ? " " : "", 1U << i, h->buckets[i]);
+        else
+            n += pa_snprintf(s + n, l - n, "%s%u-%uus:%u", n ? " " : "", 1U << i, 1U << (i + 1), h->buckets[i]);
+    }
+
+    return s;
+}
+
+static void get_io_stats_callback(pa_context *c, const pa_io_stats_info *i, int is_last, void *userdata) {
+    const char *type = userdata;
+    char rh[256], lh[256];
+
+    if (is_last < 0) {
+        pa_log(_("Failed to get IO thread statistics: %s"), pa_strerror(pa_context_errno(c)));
+        quit(1);
+        return;
+    }
+
+    if (is_last) {
+        complete_action();
+        return;
+    }
+
+    pa_assert(i);
+
+    if (nl && !short_list_format)
+        printf("\n");
+    nl = true;
+
+    if (short_list_format) {
+        printf("%s\t%u\t%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+               type,
+               i->index,
+               i->name,
+               (unsigned long long) (i->render.count ? i->render.total / i->render.count : 0),
+               (unsigned long long) i->render.max,
+               (unsigned long long) (i->lateness.count ? i->lateness.total / i->lateness.count : 0),
+               (unsigned long long) i->lateness.max,
+               (unsigned long long) i->underruns,
+               (unsigned long long) i->rewinds);
+        return;
+    }
+
+    printf(_("%s #%u IO Thread\n"
+             "\tName: %s\n"
+             "\tRender: %llu times, average %llu usec, max %llu usec\n"
+             "\t        %s\n"
+             "\tWakeup Lateness: %llu times, average %llu usec, max %llu usec\n"
+             "\t                 %s\n"
+             "\tPoll Time: %0.1fs\n"
+             "\tUnderruns: %llu\n"
+             "\tRewinds: %llu\n"
+             "\tBytes: %llu\n"),
+           pa_streq(type, "sink") ? _("Sink") : _("Source"),
+           i->index,
+           i->name,
+           (unsigned long long) i->render.count,
+           (unsigned long long) (i->render.count ? i->render.total / i->render.count : 0),
+           (unsigned long long) i->render.max,
+           io_histogram_snprint(rh, sizeof(rh), &i->render),
+           (unsigned long long) i->lateness.count,
+           (unsigned long long) (i->lateness.count ? i->lateness.total / i->lateness.count : 0),
+           (unsigned long long) i->lateness.max,
+           io_histogram_snprint(lh, sizeof(lh), &i->lateness),
+           (double) i->poll_time / PA_USEC_PER_SEC,
+           (unsigned long long) i->underruns,
+           (unsigned long long) i->rewinds,
+           (unsigned long long) i->bytes);
+}
+
 static void simple_callback(pa_context *c, int success, void *userdata) {
     if (!success) {
         pa_log(_("Failure: %s"), pa_strerror(pa_context_errno(c)));
@@ -1245,7 +1328,15 @@ static void context_state_callback(pa_context *c, void *userdata) {
                             o = pa_context_get_sample_info_list(c, get_sample_info_callback, NULL);
                         else if (pa_streq(list_type, "cards"))
                             o = pa_context_get_card_info_list(c, get_card_info_callback, NULL);
-                        else
+                        else if (pa_streq(list_type, "io-stats")) {
+                            o = pa_context_get_sink_io_stats_list(c, get_io_stats_callback, (void *) "sink");
+                            if (o) {
+                                pa_operation_unref(o);
+                                actions++;
+                            }
+
+                            o = pa_context_get_source_io_stats_list(c, get_io_stats_callback, (void *) "source");
+                        } else
                             pa_assert_not_reached();
                     } else {
                         o = pa_context_get_module_info_list(c, get_module_info_callback, NULL);
@@ -1676,12 +1767,13 @@ int main(int argc, char *argv[]) {
                 if (pa_streq(argv[i], "modules") || pa_streq(argv[i], "clients") ||
                     pa_streq(argv[i], "sinks")   || pa_streq(argv[i], "sink-inputs") ||
                     pa_streq(argv[i], "sources") || pa_streq(argv[i], "source-outputs") ||
-                    pa_streq(argv[i], "samples") || pa_streq(argv[i], "cards")) {
+                    pa_streq(argv[i], "samples") || pa_streq(argv[i], "cards") ||
+                    pa_streq(argv[i], "io-stats")) {
                     list_type = pa_xstrdup(argv[i]);
                 } else if (pa_streq(argv[i], "short")) {
                     short_list_format = true;
                 } else {
-                    pa_log(_("Specify nothing, or one of: %s"), "modules, sinks, sources, sink-inputs, source-outputs, clients, samples, cards");
+                    pa_log(_("Specify nothing, or one of: %s"), "modules, sinks, sources, sink-inputs, source-outputs, clients, samples, cards, io-stats");
                     goto quit;
                 }
             }